@@ -1,3 +1,4 @@
+use crate::graph::TypeGraph;
 use crate::instances::*;
 use pdf_struct_traits::{Classify, Object, Root};
 use std::fmt::{Debug, Display};
@@ -7,6 +8,8 @@ use std::sync::{Arc, RwLock};
 pub struct Config {
     pub(crate) types: Vec<Arc<RwLock<ConcretePageType>>>,
     pub(crate) root: ConcreteRoot,
+    /// See [Config::graph].
+    pub(crate) graph: TypeGraph,
     pub(crate) offset: usize,
 }
 
@@ -18,6 +21,12 @@ impl Config {
             offset: 0,
         }
     }
+
+    /// How the configured types relate, for lookups from the classification of every page.
+    /// Nothing in [crate::Classifier] reads it yet, see [crate::Classifier::classify_chunk].
+    pub fn graph(&self) -> &TypeGraph {
+        &self.graph
+    }
 }
 
 /// Constructs a new Config
@@ -59,11 +68,15 @@ impl ConfigBuilder {
         self
     }
 
-    /// Consumes the builder into a Config.
+    /// Consumes the builder into a Config, freezing its types into a [TypeGraph].
     pub fn build(self) -> Config {
+        let root = self.root.expect("A root struct is required!");
+        let graph = TypeGraph::freeze(&self.types, &root);
+
         Config {
             types: self.types,
-            root: self.root.expect("A root struct is required!"),
+            root,
+            graph,
             offset: self.offset,
         }
     }
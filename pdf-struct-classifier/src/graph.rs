@@ -0,0 +1,143 @@
+use crate::instances::*;
+use pdf_struct_traits::{ClassifyInput, RegionOfInterest, TypeInformation};
+use std::any::TypeId;
+use std::collections::HashMap;
+use std::sync::{Arc, RwLock};
+
+/// A type of a [TypeGraph], and where it sits in the structure of the document.
+pub struct TypeNode {
+    pub obj_type: TypeInformation,
+    /// What the type was registered as, see [ConcretePageType].
+    pub kind: ConcretePageTypeIdentifiers,
+    /// See [pdf_struct_traits::Classify::INPUT].
+    pub input: ClassifyInput,
+    /// See [pdf_struct_traits::Classify::REGIONS].
+    pub regions: &'static [RegionOfInterest],
+    parent: Option<usize>,
+    children: Box<[usize]>,
+    pair: Option<usize>,
+}
+
+/// Every type of a [crate::config::Config] and how they relate, frozen once by
+/// [crate::config::ConfigBuilder::build] and indexed by [TypeId].
+///
+/// The [ConcreteObject]s sit behind locks so that the builders can wire them together, which
+/// makes walking them from every page's classification a point where threads wait on each other.
+/// Nothing here changes after it's built, so parent, child and pair lookups take no locks and
+/// allocate nothing.
+pub struct TypeGraph {
+    nodes: Box<[TypeNode]>,
+    index: HashMap<TypeId, usize>,
+    /// Types without a parent, i.e. the first-generation children of the root.
+    roots: Box<[usize]>,
+}
+
+/// Links of a node, by [TypeId] until every node has its index.
+struct Links {
+    parent: Option<TypeId>,
+    children: Vec<TypeId>,
+    pair: Option<TypeId>,
+}
+
+impl TypeGraph {
+    /// Freezes the root's children, `types` and every parent they reach. A type found more
+    /// than once keeps the first, and children and pairs that were never built are left out.
+    pub(crate) fn freeze(types: &[Arc<RwLock<ConcretePageType>>], root: &ConcreteRoot) -> Self {
+        let mut pending: Vec<Arc<RwLock<ConcretePageType>>> =
+            root.children.iter().chain(types).cloned().collect();
+        let mut nodes = Vec::new();
+        let mut links = Vec::new();
+        let mut index = HashMap::new();
+
+        // Parents are pushed as they are found, so the loop walks up every chain.
+        let mut next = 0;
+        while next < pending.len() {
+            let page = pending[next].clone();
+            next += 1;
+
+            let page = page.read().unwrap();
+            let kind = match &*page {
+                ConcretePageType::Key(_) => ConcretePageTypeIdentifiers::Key,
+                ConcretePageType::Inferred(_) => ConcretePageTypeIdentifiers::Inferred,
+                ConcretePageType::Pair(_) => ConcretePageTypeIdentifiers::Pair,
+            };
+            let inner = page.inner();
+            let obj = inner.read().unwrap();
+
+            if index.contains_key(&obj.obj_type.id) {
+                continue;
+            }
+
+            let parent = obj.parent.as_ref().map(|parent| {
+                pending.push(parent.clone());
+                parent.read().unwrap().inner().read().unwrap().obj_type.id
+            });
+
+            index.insert(obj.obj_type.id, nodes.len());
+            links.push(Links {
+                parent,
+                children: obj.expected_children.iter().map(|child| child.id).collect(),
+                pair: obj.expected_pair.as_ref().map(|pair| pair.id),
+            });
+            nodes.push(TypeNode {
+                obj_type: obj.obj_type.clone(),
+                kind,
+                input: obj.input,
+                regions: obj.regions,
+                parent: None,
+                children: Box::new([]),
+                pair: None,
+            });
+        }
+
+        for (node, links) in nodes.iter_mut().zip(links) {
+            node.parent = links.parent.and_then(|id| index.get(&id).copied());
+            node.children = links
+                .children
+                .iter()
+                .filter_map(|id| index.get(id).copied())
+                .collect();
+            node.pair = links.pair.and_then(|id| index.get(&id).copied());
+        }
+
+        let roots = (0..nodes.len())
+            .filter(|&i| nodes[i].parent.is_none())
+            .collect();
+
+        Self {
+            nodes: nodes.into_boxed_slice(),
+            index,
+            roots,
+        }
+    }
+
+    pub fn get(&self, id: TypeId) -> Option<&TypeNode> {
+        self.index.get(&id).map(|&i| &self.nodes[i])
+    }
+
+    /// Types without a parent, in the order they were registered.
+    pub fn roots(&self) -> impl Iterator<Item = &TypeNode> {
+        self.roots.iter().map(|&i| &self.nodes[i])
+    }
+
+    pub fn parent(&self, node: &TypeNode) -> Option<&TypeNode> {
+        node.parent.map(|i| &self.nodes[i])
+    }
+
+    /// The children of `node` in the order [pdf_struct_traits::Object::CHILDREN] lists them.
+    pub fn children(&self, node: &TypeNode) -> impl Iterator<Item = &TypeNode> {
+        node.children.iter().map(|&i| &self.nodes[i])
+    }
+
+    pub fn pair(&self, node: &TypeNode) -> Option<&TypeNode> {
+        node.pair.map(|i| &self.nodes[i])
+    }
+
+    /// Whether `child` is a child of `parent`, see [ConcreteObject::can_have_child].
+    pub fn can_have_child(&self, parent: TypeId, child: TypeId) -> bool {
+        match (self.index.get(&parent), self.index.get(&child)) {
+            (Some(&parent), Some(child)) => self.nodes[parent].children.contains(child),
+            _ => false,
+        }
+    }
+}
@@ -16,6 +16,7 @@ pub enum ConcretePageType {
 
 /// Doesn't require an instance of each associated-concrete type within each variant.
 /// See [ConcretePageType] for the opposite.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum ConcretePageTypeIdentifiers {
     Key,
     Inferred,
@@ -99,6 +100,17 @@ pub struct ConcreteObject {
     pub(crate) extraction_method: Box<dyn AnyClone>,
     /// Type-erased classification function that can be called without knowing specific types
     pub(crate) erased_classify_fn: Box<dyn Fn(&[u8]) -> ErasedClassificationResult + Send + Sync>,
+    /// What [ConcreteObject::classify_erased], [ConcreteObject::classify_text_erased] or
+    /// [ConcreteObject::classify_regions_erased] should be handed, see [Classify::INPUT].
+    pub(crate) input: ClassifyInput,
+    /// Type-erased text classification function, only meaningful when `input` is [ClassifyInput::Text].
+    pub(crate) erased_classify_text_fn:
+        Box<dyn Fn(&PageText) -> ErasedClassificationResult + Send + Sync>,
+    /// The parts of a page to render for [ConcreteObject::classify_regions_erased], see [Classify::REGIONS].
+    pub(crate) regions: &'static [RegionOfInterest],
+    /// Type-erased region classification function, only meaningful when `input` is [ClassifyInput::Regions].
+    pub(crate) erased_classify_regions_fn:
+        Box<dyn Fn(&[RegionImage]) -> ErasedClassificationResult + Send + Sync>,
     /// Type-erased extraction function that can be called without knowing specific types
     pub(crate) erased_extract_fn:
         Box<dyn Fn(&[u8], Box<dyn Any>) -> Result<Box<dyn Any>, String> + Send + Sync>,
@@ -107,6 +119,8 @@ pub struct ConcreteObject {
     pub(crate) obj_type: TypeInformation,
     /// The reflected type information for the children of this type.
     pub(crate) expected_children: Vec<TypeInformation>,
+    /// The reflected type information of the type this one pairs with, see [Object::Pair].
+    pub(crate) expected_pair: Option<TypeInformation>,
 }
 
 #[derive(Debug)]
@@ -117,6 +131,27 @@ pub enum ErasedClassificationResult {
     Err(String),
 }
 
+impl<T, E> From<ClassificationResult<T, E>> for ErasedClassificationResult
+where
+    T: Send + Sync + 'static,
+    E: Error + Debug + Display,
+{
+    fn from(result: ClassificationResult<T, E>) -> Self {
+        match result {
+            ClassificationResult::Confident(confidence, data) => {
+                ErasedClassificationResult::Confident(confidence, Box::new(data))
+            }
+            ClassificationResult::Probable(confidence, data) => {
+                ErasedClassificationResult::Probable(confidence, Box::new(data))
+            }
+            ClassificationResult::Uncertain(confidence, data) => {
+                ErasedClassificationResult::Uncertain(confidence, Box::new(data))
+            }
+            ClassificationResult::Err(err) => ErasedClassificationResult::Err(err.to_string()),
+        }
+    }
+}
+
 impl ConcreteObject {
     pub(crate) fn from_obj_with_cache<T, E>(
         cache: &mut ObjectCache,
@@ -152,6 +187,32 @@ impl ConcreteObject {
         (self.erased_classify_fn)(img)
     }
 
+    /// Type-erased classify method for types that classify from the text layer,
+    /// see [ConcreteObject::wants_text].
+    pub fn classify_text_erased(&self, text: &PageText) -> ErasedClassificationResult {
+        (self.erased_classify_text_fn)(text)
+    }
+
+    /// Whether this type is classified from a page's text layer instead of its image.
+    pub fn wants_text(&self) -> bool {
+        self.input == ClassifyInput::Text
+    }
+
+    /// Type-erased classify method for types that classify from renders of a few regions of
+    /// the page, see [ConcreteObject::regions].
+    pub fn classify_regions_erased(&self, regions: &[RegionImage]) -> ErasedClassificationResult {
+        (self.erased_classify_regions_fn)(regions)
+    }
+
+    /// The regions to render for this type, empty unless it's classified from regions.
+    pub fn regions(&self) -> &'static [RegionOfInterest] {
+        if self.input == ClassifyInput::Regions {
+            self.regions
+        } else {
+            &[]
+        }
+    }
+
     /// Type-erased extract method that can be called without knowing specific types
     pub fn extract_erased(
         &self,
@@ -250,6 +311,14 @@ impl ConcreteObject {
                     }
                 }
             }),
+            input: Obj::INPUT,
+            erased_classify_text_fn: Box::new(|text| {
+                ErasedClassificationResult::from(Obj::classify_text::<Err>(text))
+            }),
+            regions: Obj::REGIONS,
+            erased_classify_regions_fn: Box::new(|regions| {
+                ErasedClassificationResult::from(Obj::classify_regions::<Err>(regions))
+            }),
             erased_extract_fn: Box::new(|img, shared_data| {
                 // Extract the shared data from the type-erased box
                 let shared_data = shared_data
@@ -263,6 +332,11 @@ impl ConcreteObject {
             }),
             obj_type: Obj::TYPE,
             expected_children: Obj::CHILDREN.to_vec(),
+            expected_pair: if <Obj::Pair as Object>::TYPE.ident == "()" {
+                None
+            } else {
+                Some(<Obj::Pair as Object>::TYPE)
+            },
         }
     }
 
@@ -319,7 +393,9 @@ impl ConcreteObject {
         self.children.push(child);
     }
 
-    /// Find and add all children from cache that have this object as their parent
+    /// Find and add all children from cache that have this object as their parent.
+    /// Only meant for building, classification looks children up in the
+    /// [crate::graph::TypeGraph] of its [crate::config::Config] instead.
     pub fn collect_children_from_cache(&mut self, cache: &ObjectCache) {
         let mut existing_child_types: Vec<TypeId> = Vec::new();
         for child in &self.children {
@@ -330,14 +406,6 @@ impl ConcreteObject {
             }
         }
 
-        let expected_child_types: Vec<TypeId> = self
-            .expected_children
-            .iter()
-            .map(|type_info| type_info.id)
-            .collect();
-
-        let mut candidates: Vec<(Arc<RwLock<ConcretePageType>>, TypeId, String)> = Vec::new();
-
         for item in cache.iter() {
             let obj = item.value();
 
@@ -345,65 +413,22 @@ impl ConcreteObject {
                 continue;
             }
 
-            let type_info = {
-                let max_attempts = 3;
-                let mut attempt_count = 0;
-
-                loop {
-                    if let Ok(obj_guard) = obj.try_read() {
-                        let result = match &*obj_guard {
-                            ConcretePageType::Key(key_page) => {
-                                if let Ok(inner) = key_page.inner().try_read() {
-                                    Some((inner.obj_type.id, inner.obj_type.ident.to_string()))
-                                } else {
-                                    None
-                                }
-                            }
-                            ConcretePageType::Inferred(inferred_page) => {
-                                if let Ok(inner) = inferred_page.inner().try_read() {
-                                    Some((inner.obj_type.id, inner.obj_type.ident.to_string()))
-                                } else {
-                                    None
-                                }
-                            }
-                            ConcretePageType::Pair(pair) => {
-                                if let Ok(inner) = pair.inner.try_read() {
-                                    Some((inner.obj_type.id, inner.obj_type.ident.to_string()))
-                                } else {
-                                    None
-                                }
-                            }
-                        };
-
-                        drop(obj_guard);
-
-                        if let Some((type_id, type_name)) = result {
-                            break Some((type_id, type_name));
-                        }
-                    }
-
-                    attempt_count += 1;
-                    if attempt_count >= max_attempts {
-                        break None;
-                    }
-
-                    std::thread::sleep(std::time::Duration::from_millis(1));
-                }
+            // Nothing but the builder touches the cache, so a lock that's taken is the one the
+            // caller holds on this object's own entry, never one worth waiting for.
+            let Ok(page) = obj.try_read() else {
+                continue;
+            };
+            let inner = page.inner();
+            let Ok(inner) = inner.try_read() else {
+                continue;
             };
+            let type_id = inner.obj_type.id;
 
-            if let Some((type_id, type_name)) = type_info {
-                if !existing_child_types.contains(&type_id) {
-                    if expected_child_types.contains(&type_id) {
-                        candidates.push((obj.clone(), type_id, type_name));
-                    }
-                }
+            if !existing_child_types.contains(&type_id) && self.can_have_child(type_id) {
+                self.children.push(obj.clone());
+                existing_child_types.push(type_id);
             }
         }
-
-        for (obj, type_id, _type_name) in candidates {
-            self.children.push(obj);
-            existing_child_types.push(type_id);
-        }
     }
 
     /// Check if this object can have a specific child type
@@ -568,9 +593,18 @@ impl ConcreteObjectBuilder {
                     erased_classify_fn: Box::new(|_| {
                         ErasedClassificationResult::Err("Cloned object".to_string())
                     }),
+                    input: obj_ref.input,
+                    erased_classify_text_fn: Box::new(|_| {
+                        ErasedClassificationResult::Err("Cloned object".to_string())
+                    }),
+                    regions: obj_ref.regions,
+                    erased_classify_regions_fn: Box::new(|_| {
+                        ErasedClassificationResult::Err("Cloned object".to_string())
+                    }),
                     erased_extract_fn: Box::new(|_, _| Err("Cloned object".to_string())),
                     obj_type: obj_ref.obj_type.clone(),
                     expected_children: obj_ref.expected_children.clone(),
+                    expected_pair: obj_ref.expected_pair.clone(),
                 }
             }
         }
@@ -597,9 +631,18 @@ impl ConcreteObjectBuilder {
                     erased_classify_fn: Box::new(|_| {
                         ErasedClassificationResult::Err("Cloned object".to_string())
                     }),
+                    input: obj_ref.input,
+                    erased_classify_text_fn: Box::new(|_| {
+                        ErasedClassificationResult::Err("Cloned object".to_string())
+                    }),
+                    regions: obj_ref.regions,
+                    erased_classify_regions_fn: Box::new(|_| {
+                        ErasedClassificationResult::Err("Cloned object".to_string())
+                    }),
                     erased_extract_fn: Box::new(|_, _| Err("Cloned object".to_string())),
                     obj_type: obj_ref.obj_type.clone(),
                     expected_children: obj_ref.expected_children.clone(),
+                    expected_pair: obj_ref.expected_pair.clone(),
                 }
             }
         };
@@ -918,6 +961,14 @@ mod tests {
                     }
                 }
             }),
+            input: ClassifyInput::Image,
+            erased_classify_text_fn: Box::new(|_| {
+                ErasedClassificationResult::Err("Classified from images".to_string())
+            }),
+            regions: &[],
+            erased_classify_regions_fn: Box::new(|_| {
+                ErasedClassificationResult::Err("Classified from images".to_string())
+            }),
             erased_extract_fn: Box::new(|img, shared_data| {
                 let shared_data = shared_data
                     .downcast::<SharedData>()
@@ -933,6 +984,7 @@ mod tests {
                 ident: "Test",
             },
             expected_children: vec![],
+            expected_pair: None,
         };
 
         unsafe {
@@ -1,18 +1,22 @@
 #![allow(unused)] // TODO: remove after finishing Classifier
 
 pub mod config;
+pub mod graph;
 pub mod instances;
 
 #[cfg(test)]
 mod tests;
 
-use pdf_struct_traits::ClassificationResult;
+use pdf_struct_traits::{
+    ClassificationResult, PageInfo, RenderPriority, RenderScheduler, RenderTicket,
+};
 
 use crate::config::Config;
 use std::any::Any;
 use std::collections::HashMap;
 use std::fmt::Debug;
 use std::path::PathBuf;
+use std::sync::Arc;
 
 #[derive(thiserror::Error, Debug)]
 pub enum ClassiferError {
@@ -32,6 +36,8 @@ pub struct Classifier {
     path: PathBuf,
     context: HashMap<i32, ClassificationResult<Box<dyn Any>, ClassiferError>>,
     pages: i32,
+    page_info: Arc<[PageInfo]>,
+    scheduler: Option<Arc<dyn RenderScheduler>>,
 }
 
 impl Classifier {
@@ -41,9 +47,66 @@ impl Classifier {
             path,
             context: HashMap::new(),
             pages: 0,
+            page_info: Arc::new([]),
+            scheduler: None,
         }
     }
 
+    /// Hands the classifier the document's prescan (see `Extractor::prescan`),
+    /// so chunks can be planned from page metadata before anything is rendered.
+    pub fn with_page_info(mut self, page_info: Arc<[PageInfo]>) -> Self {
+        self.pages = page_info.len() as i32;
+        self.page_info = page_info;
+
+        self
+    }
+
+    /// Hands the classifier the extractor's render queue (see `Extractor::render_queue`), for
+    /// [Classifier::schedule_chunk] and [Classifier::drop_inferred] to use.
+    ///
+    /// Scaffolding: [Classifier::classify_chunk] isn't written yet, so nothing requests renders
+    /// through it and pages are rendered in page order.
+    pub fn with_scheduler(mut self, scheduler: Arc<dyn RenderScheduler>) -> Self {
+        self.scheduler = Some(scheduler);
+
+        self
+    }
+
+    /// Has `key_page` rendered before anything else, and the pages a pattern `inferred` after
+    /// it prefetched behind it. Returns the prefetch's tickets, for [Classifier::drop_inferred]
+    /// once the key page proves the inference wrong. Does nothing without a scheduler.
+    ///
+    /// Unused scaffolding until [Classifier::classify_chunk] is written.
+    fn schedule_chunk(&self, key_page: i32, inferred: &[i32]) -> Vec<RenderTicket> {
+        let Some(scheduler) = &self.scheduler else {
+            return Vec::new();
+        };
+
+        scheduler.request(key_page, RenderPriority::Key);
+        inferred
+            .iter()
+            .map(|&page| scheduler.request(page, RenderPriority::Speculative))
+            .collect()
+    }
+
+    /// Cancels the prefetch of [Classifier::schedule_chunk], aborting pages already rendering.
+    ///
+    /// Unused scaffolding until [Classifier::classify_chunk] is written.
+    fn drop_inferred(&self, tickets: &[RenderTicket]) {
+        if let Some(scheduler) = &self.scheduler {
+            for &ticket in tickets {
+                scheduler.cancel(ticket);
+            }
+        }
+    }
+
+    /// Prescanned metadata of `page`, if the classifier was given a prescan.
+    ///
+    /// Unused scaffolding until [Classifier::classify_chunk] is written.
+    fn page_info(&self, page: i32) -> Option<&PageInfo> {
+        usize::try_from(page).ok().and_then(|page| self.page_info.get(page))
+    }
+
     pub fn begin(&self) -> Result<(), ClassiferError> {
         todo!()
     }
@@ -56,6 +119,12 @@ impl Classifier {
     ///           |- SubChapter
     ///       |- SomeOtherKey
     ///           |- SomeOtherKeysChild
+    ///
+    /// Not written yet. The hooks it is meant to use are in place but nothing calls them:
+    /// [Classifier::page_info] to skip pages that can't hold the next key object (e.g. no text
+    /// layer to match a "CHAPTER {num}" block against), [Classifier::schedule_chunk] for the key
+    /// candidate and the pages inferred after it, [Classifier::drop_inferred] for a failed
+    /// inference, and [Config::graph] to walk the types without taking their locks.
     fn classify_chunk(&self, start_page: i32) -> Result<(), ClassiferError> {
         todo!()
     }
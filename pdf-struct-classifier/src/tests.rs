@@ -4,8 +4,10 @@
 
 #![allow(unused)]
 
+use crate::config::Config;
 use crate::instances::{
-    ConcreteInferredPage, ConcreteKeyPage, ConcreteObjectBuilder, ConcreteRoot,
+    ConcreteInferredPage, ConcreteKeyPage, ConcreteObjectBuilder, ConcretePageTypeIdentifiers,
+    ConcreteRoot, ErasedClassificationResult,
 };
 use pdf_struct_traits::*;
 use std::any::TypeId;
@@ -569,6 +571,251 @@ fn test_build_with_relationships() {
     // You might need to refactor to make relationships more explicit
 }
 
+#[test]
+fn test_type_graph() {
+    // Every with_obj builds on its own builder, so the graph has to tie the separate
+    // instances of each type back together by TypeId.
+    let config = Config::builder()
+        .with_obj::<SubChapter, TestError>()
+        .with_obj::<Diagram, TestError>()
+        .with_obj::<DataTable, TestError>()
+        .with_obj::<Heading, TestError>()
+        .with_root::<TestRoot>()
+        .build();
+    let graph = config.graph();
+
+    // Chapter was never registered, but is reached as SubChapter's parent
+    let chapter = graph.get(TypeId::of::<Chapter>()).unwrap();
+    assert!(graph.parent(chapter).is_none());
+    assert!(matches!(chapter.kind, ConcretePageTypeIdentifiers::Key));
+
+    let roots: Vec<&str> = graph.roots().map(|node| node.obj_type.ident).collect();
+    assert_eq!(roots.len(), 2);
+    assert!(roots.contains(&"Chapter"));
+    assert!(roots.contains(&"Heading"));
+
+    let children: Vec<TypeId> = graph.children(chapter).map(|c| c.obj_type.id).collect();
+    assert_eq!(children, vec![TypeId::of::<SubChapter>()]);
+
+    let subchapter = graph.get(TypeId::of::<SubChapter>()).unwrap();
+    assert_eq!(
+        graph.parent(subchapter).unwrap().obj_type.id,
+        TypeId::of::<Chapter>()
+    );
+    let children: Vec<TypeId> = graph.children(subchapter).map(|c| c.obj_type.id).collect();
+    assert_eq!(
+        children,
+        vec![TypeId::of::<Diagram>(), TypeId::of::<DataTable>()]
+    );
+
+    // Pairs point at each other
+    let diagram = graph.get(TypeId::of::<Diagram>()).unwrap();
+    let datatable = graph.pair(diagram).unwrap();
+    assert_eq!(datatable.obj_type.id, TypeId::of::<DataTable>());
+    assert_eq!(
+        graph.pair(datatable).unwrap().obj_type.id,
+        TypeId::of::<Diagram>()
+    );
+    assert!(graph.pair(subchapter).is_none());
+
+    assert!(graph.can_have_child(TypeId::of::<Chapter>(), TypeId::of::<SubChapter>()));
+    assert!(graph.can_have_child(TypeId::of::<SubChapter>(), TypeId::of::<DataTable>()));
+    assert!(!graph.can_have_child(TypeId::of::<Chapter>(), TypeId::of::<Diagram>()));
+    assert!(!graph.can_have_child(TypeId::of::<SubChapter>(), TypeId::of::<Chapter>()));
+
+    let heading = graph.get(TypeId::of::<Heading>()).unwrap();
+    assert_eq!(heading.input, ClassifyInput::Text);
+
+    // Shared by the classification of every page
+    fn assert_sync<T: Send + Sync>(_: &T) {}
+    assert_sync(graph);
+}
+
+// Heading type (key page classified from the text layer instead of an image)
+#[derive(Debug, Clone)]
+struct Heading;
+
+impl Parent for Heading {}
+
+impl Classify for Heading {
+    type SharedData = Shared;
+    const INPUT: ClassifyInput = ClassifyInput::Text;
+
+    fn classify<E>(img: &[u8]) -> ClassificationResult<Shared, E>
+    where
+        Self: Sized,
+        E: Debug + Display + Error,
+    {
+        panic!("Heading is classified from text")
+    }
+
+    fn classify_text<E>(text: &PageText) -> ClassificationResult<Shared, E>
+    where
+        E: Debug + Display + Error,
+    {
+        if text.lines().any(|line| line.text.starts_with("CHAPTER")) {
+            ClassificationResult::Confident(0.99, Shared)
+        } else {
+            ClassificationResult::Uncertain(0.0, Shared)
+        }
+    }
+}
+
+impl Extract for Heading {
+    fn extract<E>(img: &[u8], shared: Self::SharedData) -> Result<Self, E> {
+        Ok(Self {})
+    }
+}
+
+impl Object for Heading {
+    const TYPE: TypeInformation = TypeInformation {
+        id: TypeId::of::<Self>(),
+        ident: "Heading",
+    };
+    const KEY_PAGE: bool = true;
+    const INFERRED_PAGE: bool = false;
+}
+
+fn page_text(lines: &[&str]) -> PageText {
+    PageText {
+        blocks: vec![TextBlock {
+            bbox: [72.0, 72.0, 540.0, 144.0],
+            lines: lines
+                .iter()
+                .map(|line| TextLine {
+                    bbox: [72.0, 72.0, 540.0, 96.0],
+                    text: line.to_string(),
+                })
+                .collect(),
+        }],
+    }
+}
+
+#[test]
+fn test_text_classification() {
+    let mut builder = ConcreteObjectBuilder::new();
+
+    let heading = builder.build::<Heading, TestError>();
+    let chapter = builder.build::<Chapter, TestError>();
+
+    {
+        let heading_guard = heading.read().unwrap();
+        let heading_inner_arc = heading_guard.inner();
+        let heading_inner = heading_inner_arc.read().unwrap();
+        assert!(heading_inner.wants_text());
+
+        let key_page = heading_inner.classify_text_erased(&page_text(&["CHAPTER 12", "Hydraulics"]));
+        assert!(matches!(key_page, ErasedClassificationResult::Confident(_, _)));
+
+        let other_page = heading_inner.classify_text_erased(&page_text(&["Table 4"]));
+        assert!(matches!(other_page, ErasedClassificationResult::Uncertain(_, _)));
+    }
+
+    {
+        let chapter_guard = chapter.read().unwrap();
+        let chapter_inner_arc = chapter_guard.inner();
+        let chapter_inner = chapter_inner_arc.read().unwrap();
+        assert!(!chapter_inner.wants_text());
+    }
+}
+
+// Banner type (key page classified from renders of its header band only)
+#[derive(Debug, Clone)]
+struct Banner;
+
+impl Parent for Banner {}
+
+impl Classify for Banner {
+    type SharedData = Shared;
+    const INPUT: ClassifyInput = ClassifyInput::Regions;
+    const REGIONS: &'static [RegionOfInterest] =
+        &[RegionOfInterest::new([0.0, 0.0, 1.0, 0.15], 1.0)];
+
+    fn classify<E>(img: &[u8]) -> ClassificationResult<Shared, E>
+    where
+        Self: Sized,
+        E: Debug + Display + Error,
+    {
+        panic!("Banner is classified from regions")
+    }
+
+    fn classify_regions<E>(regions: &[RegionImage]) -> ClassificationResult<Shared, E>
+    where
+        E: Debug + Display + Error,
+    {
+        // Raw gray samples, a dark header band is a banner.
+        if regions.len() == 1 && regions[0].data.iter().any(|&sample| sample < 128) {
+            ClassificationResult::Confident(0.95, Shared)
+        } else {
+            ClassificationResult::Uncertain(0.0, Shared)
+        }
+    }
+}
+
+impl Extract for Banner {
+    fn extract<E>(img: &[u8], shared: Self::SharedData) -> Result<Self, E> {
+        Ok(Self {})
+    }
+}
+
+impl Object for Banner {
+    const TYPE: TypeInformation = TypeInformation {
+        id: TypeId::of::<Self>(),
+        ident: "Banner",
+    };
+    const KEY_PAGE: bool = true;
+    const INFERRED_PAGE: bool = false;
+}
+
+fn region_image(samples: &[u8]) -> RegionImage<'_> {
+    RegionImage {
+        region: Banner::REGIONS[0].on_page([0.0, 0.0, 612.0, 792.0]),
+        data: samples,
+        width: samples.len() as i32,
+        height: 1,
+        stride: samples.len(),
+    }
+}
+
+#[test]
+fn test_region_classification() {
+    let mut builder = ConcreteObjectBuilder::new();
+
+    let banner = builder.build::<Banner, TestError>();
+    let chapter = builder.build::<Chapter, TestError>();
+
+    let region = Banner::REGIONS[0].on_page([0.0, 0.0, 612.0, 792.0]);
+    assert_eq!(region.rect, [0.0, 0.0, 612.0, 792.0 * 0.15]);
+    assert_eq!(region.scale, 1.0);
+
+    {
+        let banner_guard = banner.read().unwrap();
+        let banner_inner_arc = banner_guard.inner();
+        let banner_inner = banner_inner_arc.read().unwrap();
+        assert_eq!(banner_inner.regions().len(), 1);
+        assert!(!banner_inner.wants_text());
+
+        let key_page = banner_inner.classify_regions_erased(&[region_image(&[255, 12, 255])]);
+        assert!(matches!(
+            key_page,
+            ErasedClassificationResult::Confident(_, _)
+        ));
+
+        let other_page = banner_inner.classify_regions_erased(&[region_image(&[255, 255, 255])]);
+        assert!(matches!(
+            other_page,
+            ErasedClassificationResult::Uncertain(_, _)
+        ));
+    }
+
+    {
+        let chapter_guard = chapter.read().unwrap();
+        let chapter_inner_arc = chapter_guard.inner();
+        let chapter_inner = chapter_inner_arc.read().unwrap();
+        assert!(chapter_inner.regions().is_empty());
+    }
+}
+
 #[test]
 fn test_classification_method_storage() {
     let mut builder = ConcreteObjectBuilder::new();
@@ -0,0 +1,752 @@
+//! Throughput, latency and memory of the render hot path over a synthetic corpus.
+//!
+//! `cargo bench --bench extractor -- [filter]` writes a reproducible corpus of text-heavy,
+//! scanned, vector-heavy and huge-page PDFs, then runs every case whose name contains
+//! `filter`:
+//!
+//! - `render_pages/<doc>/<dpi>/<format>` renders one page per call on a single session in
+//!   every output encoder, so latencies are wall time per page including the FFI round trip.
+//! - `render_cache/<doc>/<cold|warm>` renders like `render_pages` at 300 DPI in raw, with
+//!   [ExtractorOptions::render_cache_dir] set: emptied before every round (`cold`), or filled
+//!   by an untimed round first (`warm`), so the gap is what a re-run saves.
+//! - `iter_pages/<doc>/<format>/<workers>` drives [Extractor::iter_pages] at its full 432 DPI
+//!   on tokio's blocking pool (`pool`), on `engine-N` native workers or on native workers
+//!   with loader threads prefetching 2 pages each (`engine-N-prefetch`). Latencies are the
+//!   summed [PageStats] of each page, i.e. time spent rendering rather than queueing.
+//!
+//! - `corpus/<format>/<mode>` renders every document of the corpus, its documents repeated
+//!   [CORPUS_REPEATS] times over, either one [Extractor::iter_pages] run after another
+//!   (`sequential`) or as one [Corpus] run on a shared pool (`shared`).
+//!
+//! Peak RSS is the high-water mark of the case's rounds; on Linux it's reset between cases
+//! through `/proc/self/clear_refs`, elsewhere it's the process peak so far.
+//! `PDF_BENCH_ROUNDS` sets how many times every case runs (default 3).
+
+use pdf_struct_extractor::extractor::{
+    ControlMessage, Corpus, DocumentId, Extractor, ExtractorOptions, OutputFormat, PageImage,
+    PageNum, PageRenderError, set_png_level,
+};
+use std::{
+    env, fs,
+    hint::black_box,
+    path::{Path, PathBuf},
+    sync::{Arc, Mutex},
+    thread::available_parallelism,
+    time::{Duration, Instant},
+};
+use tokio::sync::mpsc::channel;
+
+/// Builds a PDF object by object, with a valid xref table so MuPDF doesn't have to repair it.
+struct PdfWriter {
+    objects: Vec<Vec<u8>>,
+}
+
+impl PdfWriter {
+    fn new() -> Self {
+        Self {
+            objects: Vec::new(),
+        }
+    }
+
+    /// Reserves an object number, for objects that refer to each other.
+    fn reserve(&mut self) -> usize {
+        self.objects.push(Vec::new());
+        self.objects.len()
+    }
+
+    fn set(&mut self, id: usize, body: Vec<u8>) {
+        self.objects[id - 1] = body;
+    }
+
+    fn add(&mut self, body: Vec<u8>) -> usize {
+        let id = self.reserve();
+        self.set(id, body);
+        id
+    }
+
+    fn add_stream(&mut self, dict: &str, data: &[u8]) -> usize {
+        let mut body = format!("<< {} /Length {} >>\nstream\n", dict, data.len()).into_bytes();
+        body.extend_from_slice(data);
+        body.extend_from_slice(b"\nendstream");
+        self.add(body)
+    }
+
+    fn finish(self, root: usize) -> Vec<u8> {
+        let mut out = b"%PDF-1.4\n%\xe2\xe3\xcf\xd3\n".to_vec();
+        let mut offsets = Vec::with_capacity(self.objects.len());
+
+        for (i, body) in self.objects.iter().enumerate() {
+            offsets.push(out.len());
+            out.extend_from_slice(format!("{} 0 obj\n", i + 1).as_bytes());
+            out.extend_from_slice(body);
+            out.extend_from_slice(b"\nendobj\n");
+        }
+
+        let xref = out.len();
+        out.extend_from_slice(
+            format!("xref\n0 {}\n0000000000 65535 f \n", offsets.len() + 1).as_bytes(),
+        );
+        for offset in offsets {
+            out.extend_from_slice(format!("{:010} 00000 n \n", offset).as_bytes());
+        }
+        out.extend_from_slice(
+            format!(
+                "trailer\n<< /Size {} /Root {} 0 R >>\nstartxref\n{}\n%%EOF\n",
+                self.objects.len() + 1,
+                root,
+                xref
+            )
+            .as_bytes(),
+        );
+        out
+    }
+}
+
+/// xorshift64, so the corpus is the same on every run and machine.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    fn below(&mut self, n: u64) -> u64 {
+        self.next() % n
+    }
+
+    fn coord(&mut self, max: f32) -> f32 {
+        (self.below(10_000) as f32 / 10_000.0) * max
+    }
+}
+
+struct PageContent {
+    content: Vec<u8>,
+    resources: String,
+}
+
+/// Writes a document of `pages` pages of `width` x `height` points, `page` drawing each one.
+fn write_document<P>(path: &Path, pages: usize, width: f32, height: f32, mut page: P)
+where
+    P: FnMut(&mut PdfWriter, &mut Rng) -> PageContent,
+{
+    let mut pdf = PdfWriter::new();
+    let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+    let catalog = pdf.reserve();
+    let tree = pdf.reserve();
+    let mut kids = Vec::with_capacity(pages);
+
+    for _ in 0..pages {
+        let PageContent { content, resources } = page(&mut pdf, &mut rng);
+        let contents = pdf.add_stream("", &content);
+        kids.push(pdf.add(
+            format!(
+                "<< /Type /Page /Parent {} 0 R /MediaBox [0 0 {} {}] /Resources << {} >> /Contents {} 0 R >>",
+                tree, width, height, resources, contents
+            )
+            .into_bytes(),
+        ));
+    }
+
+    let kids: Vec<String> = kids.iter().map(|id| format!("{} 0 R", id)).collect();
+    pdf.set(
+        tree,
+        format!(
+            "<< /Type /Pages /Kids [{}] /Count {} >>",
+            kids.join(" "),
+            pages
+        )
+        .into_bytes(),
+    );
+    pdf.set(
+        catalog,
+        format!("<< /Type /Catalog /Pages {} 0 R >>", tree).into_bytes(),
+    );
+
+    fs::write(path, pdf.finish(catalog)).expect("failed to write corpus document");
+}
+
+const WORDS: [&str; 16] = [
+    "the",
+    "pursuant",
+    "section",
+    "schedule",
+    "agreement",
+    "of",
+    "and",
+    "party",
+    "hereby",
+    "notwithstanding",
+    "to",
+    "clause",
+    "shall",
+    "provided",
+    "in",
+    "liability",
+];
+
+/// Letter pages of 9pt Helvetica, about 64 lines of 95 characters each.
+fn text_page(rng: &mut Rng, font: usize) -> PageContent {
+    let mut content = String::from("BT /F1 9 Tf 11 TL 36 756 Td\n");
+    for _ in 0..64 {
+        let mut line = String::new();
+        while line.len() < 95 {
+            line.push_str(WORDS[rng.below(WORDS.len() as u64) as usize]);
+            line.push(' ');
+        }
+        content.push_str(&format!("({}) Tj T*\n", line.trim_end()));
+    }
+    content.push_str("ET\n");
+
+    PageContent {
+        content: content.into_bytes(),
+        resources: format!("/Font << /F1 {} 0 R >>", font),
+    }
+}
+
+/// Letter pages holding one uncompressed 150 DPI gray scan: noisy paper with dark text rows.
+fn scanned_page(pdf: &mut PdfWriter, rng: &mut Rng) -> PageContent {
+    const WIDTH: usize = 1275;
+    const HEIGHT: usize = 1650;
+
+    let mut samples = vec![0u8; WIDTH * HEIGHT];
+    for y in 0..HEIGHT {
+        let text_row = (y % 40) >= 12 && (y % 40) < 26 && y > 100 && y < HEIGHT - 100;
+        for x in 0..WIDTH {
+            let noise = (rng.next() & 0x1f) as u8;
+            let ink = text_row
+                && x > 90
+                && x < WIDTH - 90
+                && (x / 7 + y / 40) % 9 != 0
+                && rng.below(3) != 0;
+            samples[y * WIDTH + x] = if ink { 30 + noise } else { 220 + noise };
+        }
+    }
+
+    let image = pdf.add_stream(
+        &format!(
+            "/Type /XObject /Subtype /Image /Width {} /Height {} /ColorSpace /DeviceGray /BitsPerComponent 8",
+            WIDTH, HEIGHT
+        ),
+        &samples,
+    );
+    PageContent {
+        content: b"q 612 0 0 792 0 0 cm /Im0 Do Q\n".to_vec(),
+        resources: format!("/XObject << /Im0 {} 0 R >>", image),
+    }
+}
+
+/// Letter pages of 4000 stroked curves and 500 filled rectangles, like dense CAD exports.
+fn vector_page(rng: &mut Rng) -> PageContent {
+    let mut content = String::new();
+    for _ in 0..4000 {
+        content.push_str(&format!(
+            "{:.2} G {:.2} w {:.1} {:.1} m {:.1} {:.1} {:.1} {:.1} {:.1} {:.1} c S\n",
+            rng.coord(0.8),
+            0.2 + rng.coord(1.5),
+            rng.coord(612.0),
+            rng.coord(792.0),
+            rng.coord(612.0),
+            rng.coord(792.0),
+            rng.coord(612.0),
+            rng.coord(792.0),
+            rng.coord(612.0),
+            rng.coord(792.0),
+        ));
+    }
+    for _ in 0..500 {
+        content.push_str(&format!(
+            "{:.2} g {:.1} {:.1} {:.1} {:.1} re f\n",
+            rng.coord(1.0),
+            rng.coord(612.0),
+            rng.coord(792.0),
+            rng.coord(40.0),
+            rng.coord(40.0),
+        ));
+    }
+
+    PageContent {
+        content: content.into_bytes(),
+        resources: String::new(),
+    }
+}
+
+const A1_WIDTH: f32 = 1684.0;
+const A1_HEIGHT: f32 = 2384.0;
+
+/// A1 drawing sheets: a 12pt grid and a few hundred circles. 10104 x 14304 pixels at 432 DPI.
+fn huge_page(rng: &mut Rng) -> PageContent {
+    let mut content = String::from("0.5 G 0.25 w\n");
+    let mut x = 0.0;
+    while x <= A1_WIDTH {
+        content.push_str(&format!("{:.1} 0 m {:.1} {:.1} l S\n", x, x, A1_HEIGHT));
+        x += 12.0;
+    }
+    let mut y = 0.0;
+    while y <= A1_HEIGHT {
+        content.push_str(&format!("0 {:.1} m {:.1} {:.1} l S\n", y, A1_WIDTH, y));
+        y += 12.0;
+    }
+
+    // Four Bezier quarter arcs per circle.
+    const K: f32 = 0.5523;
+    content.push_str("0 G 1 w\n");
+    for _ in 0..300 {
+        let (cx, cy, r) = (
+            rng.coord(A1_WIDTH),
+            rng.coord(A1_HEIGHT),
+            5.0 + rng.coord(120.0),
+        );
+        let k = K * r;
+        content.push_str(&format!(
+            "{:.1} {:.1} m {:.1} {:.1} {:.1} {:.1} {:.1} {:.1} c {:.1} {:.1} {:.1} {:.1} {:.1} {:.1} c \
+             {:.1} {:.1} {:.1} {:.1} {:.1} {:.1} c {:.1} {:.1} {:.1} {:.1} {:.1} {:.1} c S\n",
+            cx + r, cy,
+            cx + r, cy + k, cx + k, cy + r, cx, cy + r,
+            cx - k, cy + r, cx - r, cy + k, cx - r, cy,
+            cx - r, cy - k, cx - k, cy - r, cx, cy - r,
+            cx + k, cy - r, cx + r, cy - k, cx + r, cy,
+        ));
+    }
+
+    PageContent {
+        content: content.into_bytes(),
+        resources: String::new(),
+    }
+}
+
+/// Writes the corpus into cargo's scratch directory for benches.
+fn write_corpus() -> Vec<(&'static str, PathBuf)> {
+    let dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("corpus");
+    fs::create_dir_all(&dir).expect("failed to create corpus directory");
+
+    let text = dir.join("text.pdf");
+    let mut font = None;
+    write_document(&text, 24, 612.0, 792.0, |pdf, rng| {
+        let font = *font.get_or_insert_with(|| {
+            pdf.add(b"<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>".to_vec())
+        });
+        text_page(rng, font)
+    });
+
+    let scanned = dir.join("scanned.pdf");
+    write_document(&scanned, 6, 612.0, 792.0, scanned_page);
+
+    let vector = dir.join("vector.pdf");
+    write_document(&vector, 12, 612.0, 792.0, |_, rng| vector_page(rng));
+
+    let huge = dir.join("huge.pdf");
+    write_document(&huge, 2, A1_WIDTH, A1_HEIGHT, |_, rng| huge_page(rng));
+
+    vec![
+        ("text", text),
+        ("scanned", scanned),
+        ("vector", vector),
+        ("huge", huge),
+    ]
+}
+
+/// Resets the kernel's RSS high-water mark, so the next [peak_rss] only covers what follows.
+fn reset_peak_rss() {
+    fs::write("/proc/self/clear_refs", "5").ok();
+}
+
+/// VmHWM of the process in bytes, 0 where /proc isn't available.
+fn peak_rss() -> u64 {
+    fs::read_to_string("/proc/self/status")
+        .ok()
+        .and_then(|status| {
+            status
+                .lines()
+                .find_map(|line| line.strip_prefix("VmHWM:"))
+                .and_then(|kb| kb.trim().trim_end_matches("kB").trim().parse::<u64>().ok())
+        })
+        .map_or(0, |kb| kb * 1024)
+}
+
+struct Report {
+    pages: usize,
+    elapsed: Vec<Duration>,
+    latencies: Vec<Duration>,
+    errors: usize,
+    peak_rss: u64,
+}
+
+impl Report {
+    fn new() -> Self {
+        Self {
+            pages: 0,
+            elapsed: Vec::new(),
+            latencies: Vec::new(),
+            errors: 0,
+            peak_rss: 0,
+        }
+    }
+
+    fn percentile(sorted: &[Duration], p: f64) -> Duration {
+        if sorted.is_empty() {
+            return Duration::ZERO;
+        }
+        sorted[((sorted.len() - 1) as f64 * p).round() as usize]
+    }
+
+    fn print(&mut self, name: &str) {
+        self.latencies.sort();
+        self.elapsed.sort();
+
+        // The median round, so one cold or disturbed round doesn't skew throughput.
+        let round = Self::percentile(&self.elapsed, 0.5);
+        let pages_per_round = self.pages as f64 / self.elapsed.len().max(1) as f64;
+        let ms = |d: Duration| d.as_secs_f64() * 1000.0;
+
+        println!(
+            "{:<40} {:>9.2} {:>9.2} {:>9.2} {:>9.2} {:>9.2} {:>9.1} {:>6}",
+            name,
+            pages_per_round / round.as_secs_f64().max(f64::EPSILON),
+            ms(Self::percentile(&self.latencies, 0.5)),
+            ms(Self::percentile(&self.latencies, 0.9)),
+            ms(Self::percentile(&self.latencies, 0.99)),
+            ms(self.latencies.last().copied().unwrap_or_default()),
+            self.peak_rss as f64 / (1024.0 * 1024.0),
+            self.errors,
+        );
+    }
+}
+
+/// Every output encoder, with the [set_png_level] its PNGs are written at.
+const ENCODERS: [(&str, OutputFormat, Option<u8>); 8] = [
+    ("png", OutputFormat::Png, None),
+    ("png-store", OutputFormat::Png, Some(0)),
+    ("png-fast", OutputFormat::Png, Some(1)),
+    ("raw", OutputFormat::Raw, None),
+    ("packed", OutputFormat::Packed, None),
+    ("pbm", OutputFormat::Pbm, None),
+    ("g4", OutputFormat::CcittG4, None),
+    ("qoi", OutputFormat::Qoi, None),
+];
+
+/// Where `render_cache` cases keep their pages, and whether it's filled before timing.
+struct CacheCase<'a> {
+    dir: &'a Path,
+    warm: bool,
+}
+
+fn bench_render_pages(
+    doc: &Path,
+    dpi: u32,
+    format: OutputFormat,
+    cache: Option<CacheCase>,
+    rounds: usize,
+) -> Report {
+    let mut report = Report::new();
+    reset_peak_rss();
+
+    if let Some(cache) = &cache {
+        fs::remove_dir_all(cache.dir).ok();
+        if cache.warm {
+            let fill = CacheCase {
+                warm: false,
+                ..*cache
+            };
+            bench_render_pages(doc, dpi, format, Some(fill), 1);
+        }
+    }
+
+    for _ in 0..rounds {
+        if let Some(CacheCase { dir, warm: false }) = &cache {
+            fs::remove_dir_all(dir).ok();
+        }
+        let options = ExtractorOptions {
+            output: format,
+            render_cache_dir: cache.as_ref().map(|cache| cache.dir.to_path_buf()),
+            ..ExtractorOptions::default()
+        };
+        let extractor = Extractor::with_options(doc, options);
+        let scale = dpi as f32 / 72.0;
+        let start = Instant::now();
+
+        for page in 0..extractor.page_count {
+            let page_start = Instant::now();
+            let result = unsafe {
+                extractor.render_pages(&[page], scale, |_, image| match image {
+                    Ok(image) => {
+                        black_box(image.data.len());
+                    }
+                    Err(_) => report.errors += 1,
+                })
+            };
+            if result.is_err() {
+                report.errors += 1;
+            }
+            report.latencies.push(page_start.elapsed());
+        }
+
+        report.elapsed.push(start.elapsed());
+        report.pages += extractor.page_count as usize;
+    }
+
+    report.peak_rss = peak_rss();
+    report
+}
+
+/// Keeps the summed stage timings of every page, see [ExtractorOptions::stage_stats].
+fn collect_latency(_: PageNum, image: PageImage, latencies: Arc<Mutex<Vec<Duration>>>) {
+    black_box(image.data.len());
+
+    if let Some(stats) = image.stats {
+        latencies
+            .lock()
+            .unwrap()
+            .push(Duration::from_nanos(stats.stage_ns.iter().sum()));
+    }
+}
+
+fn bench_iter_pages(
+    runtime: &tokio::runtime::Runtime,
+    doc: &Path,
+    format: OutputFormat,
+    workers: usize,
+    prefetch_depth: usize,
+    rounds: usize,
+) -> Report {
+    let mut report = Report::new();
+    reset_peak_rss();
+
+    for _ in 0..rounds {
+        let options = ExtractorOptions {
+            output: format,
+            engine_workers: workers,
+            prefetch_depth,
+            stage_stats: true,
+            ..ExtractorOptions::default()
+        };
+        let mut extractor = Extractor::with_options(doc, options);
+        let latencies = Arc::new(Mutex::new(Vec::new()));
+
+        let (errors, elapsed) = runtime.block_on(async {
+            let (render_tx, mut render_rx) = channel::<Result<(), PageRenderError>>(1024);
+            let (_, control_rx) = channel::<ControlMessage>(1);
+            let drain = tokio::spawn(async move {
+                let mut errors = 0;
+                while let Some(result) = render_rx.recv().await {
+                    if result.is_err() {
+                        errors += 1;
+                    }
+                }
+                errors
+            });
+
+            let start = Instant::now();
+            unsafe {
+                extractor
+                    .iter_pages(collect_latency, render_tx, latencies.clone(), control_rx)
+                    .await
+            };
+            let elapsed = start.elapsed();
+
+            (drain.await.unwrap_or(0), elapsed)
+        });
+
+        report.errors += errors;
+        report.elapsed.push(elapsed);
+        report.pages += extractor.page_count as usize;
+        report.latencies.append(&mut latencies.lock().unwrap());
+    }
+
+    report.peak_rss = peak_rss();
+    report
+}
+
+/// [collect_latency] for [Corpus::iter_pages].
+fn collect_document_latency(
+    _: DocumentId,
+    page: PageNum,
+    image: PageImage,
+    latencies: Arc<Mutex<Vec<Duration>>>,
+) {
+    collect_latency(page, image, latencies);
+}
+
+/// How many times `corpus` cases go over every document, so there are enough document
+/// boundaries for idle cores between documents to show.
+const CORPUS_REPEATS: usize = 8;
+
+fn bench_corpus(
+    runtime: &tokio::runtime::Runtime,
+    paths: &[PathBuf],
+    format: OutputFormat,
+    shared: bool,
+    rounds: usize,
+) -> Report {
+    let mut report = Report::new();
+    reset_peak_rss();
+
+    let options = ExtractorOptions {
+        output: format,
+        stage_stats: true,
+        ..ExtractorOptions::default()
+    };
+
+    for _ in 0..rounds {
+        let latencies = Arc::new(Mutex::new(Vec::new()));
+
+        let (errors, elapsed) = runtime.block_on(async {
+            let start = Instant::now();
+            let mut errors = 0;
+
+            if shared {
+                let corpus = Corpus::with_options(paths, options.clone());
+                let (render_tx, mut render_rx) =
+                    channel::<(DocumentId, Result<(), PageRenderError>)>(1024);
+                let (_, control_rx) = channel::<ControlMessage>(1);
+                let drain = tokio::spawn(async move {
+                    let mut errors = 0;
+                    while let Some((_, result)) = render_rx.recv().await {
+                        if result.is_err() {
+                            errors += 1;
+                        }
+                    }
+                    errors
+                });
+
+                unsafe {
+                    corpus
+                        .iter_pages(
+                            collect_document_latency,
+                            render_tx,
+                            latencies.clone(),
+                            control_rx,
+                        )
+                        .await
+                };
+                errors += drain.await.unwrap_or(0);
+            } else {
+                for path in paths {
+                    let mut extractor = Extractor::with_options(path, options.clone());
+                    let (render_tx, mut render_rx) = channel::<Result<(), PageRenderError>>(1024);
+                    let (_, control_rx) = channel::<ControlMessage>(1);
+                    let drain = tokio::spawn(async move {
+                        let mut errors = 0;
+                        while let Some(result) = render_rx.recv().await {
+                            if result.is_err() {
+                                errors += 1;
+                            }
+                        }
+                        errors
+                    });
+
+                    unsafe {
+                        extractor
+                            .iter_pages(collect_latency, render_tx, latencies.clone(), control_rx)
+                            .await
+                    };
+                    errors += drain.await.unwrap_or(0);
+                }
+            }
+
+            (errors, start.elapsed())
+        });
+
+        report.errors += errors;
+        report.elapsed.push(elapsed);
+        // Every rendered page is timed, so this also counts them across documents.
+        report.pages += latencies.lock().unwrap().len();
+        report.latencies.append(&mut latencies.lock().unwrap());
+    }
+
+    report.peak_rss = peak_rss();
+    report
+}
+
+fn main() {
+    // cargo bench passes `--bench`, everything else is a case filter.
+    let filter: Option<String> = env::args().skip(1).find(|arg| !arg.starts_with("--"));
+    let rounds: usize = env::var("PDF_BENCH_ROUNDS")
+        .ok()
+        .and_then(|rounds| rounds.parse().ok())
+        .unwrap_or(3)
+        .max(1);
+    let selected = |name: &str| filter.as_deref().is_none_or(|filter| name.contains(filter));
+
+    let corpus = write_corpus();
+    let cores = available_parallelism().map_or(4, |p| p.get());
+    let mut engine_workers = vec![1, 2, 4, cores];
+    engine_workers.sort();
+    engine_workers.dedup();
+
+    let runtime = tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .build()
+        .expect("failed to start tokio runtime");
+
+    println!(
+        "{:<40} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9} {:>6}",
+        "case", "pages/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "rss MiB", "errors"
+    );
+
+    for (doc, path) in &corpus {
+        for dpi in [72, 150, 300] {
+            for (label, format, png_level) in ENCODERS {
+                let name = format!("render_pages/{}/{}dpi/{}", doc, dpi, label);
+                if selected(&name) {
+                    set_png_level(png_level).expect("invalid PNG level");
+                    bench_render_pages(path, dpi, format, None, rounds).print(&name);
+                }
+            }
+        }
+    }
+
+    let cache_dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("render-cache");
+    for (doc, path) in &corpus {
+        for warm in [false, true] {
+            let state = if warm { "warm" } else { "cold" };
+            let name = format!("render_cache/{}/{}", doc, state);
+            if selected(&name) {
+                let cache = CacheCase {
+                    dir: &cache_dir,
+                    warm,
+                };
+                bench_render_pages(path, 300, OutputFormat::Raw, Some(cache), rounds).print(&name);
+            }
+        }
+    }
+
+    set_png_level(None).expect("invalid PNG level");
+    for (doc, path) in &corpus {
+        for (label, format) in [("png", OutputFormat::Png), ("raw", OutputFormat::Raw)] {
+            // 0 renders on tokio's blocking pool instead of the native engine.
+            let mut pools = vec![(0, 0)];
+            for &workers in &engine_workers {
+                pools.push((workers, 0));
+                pools.push((workers, 2));
+            }
+
+            for (workers, prefetch_depth) in pools {
+                let pool = match (workers, prefetch_depth) {
+                    (0, _) => "pool".to_string(),
+                    (_, 0) => format!("engine-{}", workers),
+                    _ => format!("engine-{}-prefetch", workers),
+                };
+                let name = format!("iter_pages/{}/{}/{}", doc, label, pool);
+                if selected(&name) {
+                    bench_iter_pages(&runtime, path, format, workers, prefetch_depth, rounds)
+                        .print(&name);
+                }
+            }
+        }
+    }
+
+    let corpus_paths: Vec<PathBuf> = (0..CORPUS_REPEATS)
+        .flat_map(|_| corpus.iter().map(|(_, path)| path.clone()))
+        .collect();
+    for (label, format) in [("png", OutputFormat::Png), ("raw", OutputFormat::Raw)] {
+        for (mode, shared) in [("sequential", false), ("shared", true)] {
+            let name = format!("corpus/{}/{}", label, mode);
+            if selected(&name) {
+                bench_corpus(&runtime, &corpus_paths, format, shared, rounds).print(&name);
+            }
+        }
+    }
+}
@@ -7,6 +7,17 @@ fn main() {
 
     cxx_build::bridge("src/extractor.rs")
         .file("src_cpp/main.cpp")
+        .file("src_cpp/binarize.cpp")
+        .file("src_cpp/source.cpp")
+        .file("src_cpp/prescan.cpp")
+        .file("src_cpp/engine.cpp")
+        .file("src_cpp/governor.cpp")
+        .file("src_cpp/locks.cpp")
+        .file("src_cpp/stats.cpp")
+        .file("src_cpp/encode.cpp")
+        .file("src_cpp/cookie.cpp")
+        .file("src_cpp/cache.cpp")
+        .file("src_cpp/passthrough.cpp")
         .std("c++20")
         .include("build/vcpkg_installed/x64-windows/include")
         .cpp(true)
@@ -22,5 +33,16 @@ fn main() {
     println!("cargo:rustc-link-lib=static=libmupdf");
     println!("cargo:rustc-link-lib=static=extractor");
     println!("cargo:rerun-if-changed=src_cpp/main.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/binarize.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/source.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/prescan.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/engine.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/governor.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/locks.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/stats.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/encode.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/cookie.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/cache.cpp");
+    println!("cargo:rerun-if-changed=src_cpp/passthrough.cpp");
     println!("cargo:rerun-if-changed=CMakeLists.txt");
 }
@@ -2,17 +2,30 @@
 
 use crate::extractor::bridge::PDFHandle;
 use cxx::let_cxx_string;
-use std::sync::{Arc, Mutex};
+use pdf_struct_traits::{
+    PageInfo, PageRegion, PageText, RegionImage, RegionOfInterest, RenderPriority, RenderScheduler,
+    RenderTicket, TextBlock, TextLine,
+};
+use std::sync::{
+    Arc, Mutex,
+    atomic::{AtomicBool, Ordering},
+};
 use std::{
+    cmp::Reverse,
+    collections::BTreeMap,
     os::raw::c_void,
     path::{Path, PathBuf},
     ptr::{self, null_mut},
     slice::from_raw_parts,
-    thread::available_parallelism,
+    thread::{JoinHandle, available_parallelism},
+    time::Duration,
 };
 use tokio::{
     select,
-    sync::mpsc::{Receiver, Sender},
+    sync::{
+        OwnedSemaphorePermit, Semaphore,
+        mpsc::{Receiver, Sender},
+    },
     task::{JoinError, JoinSet},
 };
 
@@ -26,8 +39,62 @@ mod bridge {
         include!("pdf-struct-extractor/src_cpp/main.h");
         type PDFHandle;
 
+        unsafe fn set_memory_cap(cap_bytes: usize);
+
+        unsafe fn set_png_level(level: i32) -> Result<()>;
+
+        unsafe fn memory_usage(
+            live_buf: *mut usize,
+            peak_buf: *mut usize,
+            cap_buf: *mut usize,
+            context_live_buf: *mut usize,
+            context_peak_buf: *mut usize,
+            capacity: i32,
+        ) -> i32;
+
+        unsafe fn set_adaptive_locks(slot_mask: i32) -> Result<()>;
+
+        unsafe fn lock_stats(
+            acquisitions_buf: *mut u64,
+            contended_buf: *mut u64,
+            wait_ns_buf: *mut u64,
+            capacity: i32,
+        ) -> i32;
+
+        unsafe fn reset_lock_stats();
+
+        unsafe fn open_source(
+            path: &CxxString,
+            mode: i32,
+            source_handle: *mut PDFHandle,
+            size_buf: *mut usize,
+        ) -> Result<()>;
+
+        unsafe fn close_source(source_handle: *mut PDFHandle);
+
+        unsafe fn open_progressive_source(size: u64, source_handle: *mut PDFHandle) -> Result<()>;
+
+        unsafe fn feed_source(
+            offset: u64,
+            data: *const u8,
+            size: usize,
+            source_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn wait_source(
+            seen: u64,
+            timeout_ms: i32,
+            received_buf: *mut u64,
+            source_handle: *mut PDFHandle,
+        ) -> Result<bool>;
+
+        unsafe fn take_source_wanted(source_handle: *mut PDFHandle) -> Result<u64>;
+
+        unsafe fn abandon_source(source_handle: *mut PDFHandle) -> Result<()>;
+
         unsafe fn init(
             path: &CxxString,
+            source_handle: *mut PDFHandle,
             doc_handle: *mut PDFHandle,
             ctx_handle: *mut PDFHandle,
             pages_buf: *mut i32,
@@ -56,14 +123,382 @@ mod bridge {
             ctx_handle: *mut PDFHandle,
             new_doc: *mut PDFHandle,
         ) -> Result<()>;
+
+        unsafe fn prescan_document(
+            page_count: i32,
+            bounds_buf: *mut f32,
+            rotation_buf: *mut i32,
+            images_buf: *mut i32,
+            fonts_buf: *mut i32,
+            text_buf: *mut u8,
+            doc_handle: *mut PDFHandle,
+            ctx_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn clone_shared(current_ctx: *mut PDFHandle, new_ctx: *mut PDFHandle) -> Result<()>;
+
+        unsafe fn open_session(
+            path: &CxxString,
+            share_store: bool,
+            ctx_handle: *mut PDFHandle,
+            source_handle: *mut PDFHandle,
+            session_handle: *mut PDFHandle,
+            pages_buf: *mut i32,
+        ) -> Result<()>;
+
+        unsafe fn render_session_page(
+            page_num: i32,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            session_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes in PNG format to a picture of the page
+
+        unsafe fn render_session_image(
+            page_num: i32,
+            format: i32,
+            blank_ratio: f32,
+            passthrough: bool,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            stride_buf: *mut i32,
+            flags_buf: *mut i32,
+            session_handle: *mut PDFHandle,
+            cache_handle: *mut PDFHandle,
+            image_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by image_handle, in the requested format
+
+        unsafe fn free_page_image(image_handle: *mut PDFHandle);
+
+        unsafe fn render_pages(
+            pages: *const i32,
+            count: i32,
+            format: i32,
+            scale: f32,
+            session_handle: *mut PDFHandle,
+            cache_handle: *mut PDFHandle,
+            batch_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn batch_page(
+            index: i32,
+            page_buf: *mut i32,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            stride_buf: *mut i32,
+            abort_buf: *mut u64,
+            batch_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by batch_handle, in the requested format
+
+        unsafe fn free_page_batch(batch_handle: *mut PDFHandle);
+
+        unsafe fn new_render_cache(
+            budget: usize,
+            dir: &CxxString,
+            disk_budget: u64,
+            path: &CxxString,
+            cache_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn free_render_cache(cache_handle: *mut PDFHandle);
+
+        unsafe fn new_render_stats(stats_handle: *mut PDFHandle) -> Result<()>;
+
+        unsafe fn read_render_stats(
+            buckets_buf: *mut u64,
+            counts_buf: *mut u64,
+            total_ns_buf: *mut u64,
+            max_ns_buf: *mut u64,
+            totals_buf: *mut u64,
+            stats_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn free_render_stats(stats_handle: *mut PDFHandle);
+
+        unsafe fn set_session_stats(
+            stats_handle: *mut PDFHandle,
+            session_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn page_image_stats(
+            stage_ns_buf: *mut u64,
+            sample_bytes_buf: *mut usize,
+            output_bytes_buf: *mut usize,
+            image_handle: *mut PDFHandle,
+        ) -> Result<bool>;
+
+        unsafe fn new_render_control(
+            page_budget_ns: u64,
+            control_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn free_render_control(control_handle: *mut PDFHandle);
+
+        unsafe fn halt_renders(reason: i32, control_handle: *mut PDFHandle) -> Result<()>;
+
+        unsafe fn resume_renders(control_handle: *mut PDFHandle) -> Result<()>;
+
+        unsafe fn cancel_page_renders(
+            first_page: i32,
+            count: i32,
+            control_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn set_session_control(
+            control_handle: *mut PDFHandle,
+            session_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn new_render_profile(
+            mode: i32,
+            scale: f32,
+            threshold: i32,
+            profile_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn free_render_profile(profile_handle: *mut PDFHandle);
+
+        unsafe fn set_session_profile(
+            profile_handle: *mut PDFHandle,
+            session_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn last_render_abort(
+            abort_buf: *mut u64,
+            session_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn start_render_engine(
+            path: &CxxString,
+            workers: i32,
+            pin_threads: bool,
+            share_store: bool,
+            format: i32,
+            blank_ratio: f32,
+            passthrough: bool,
+            queue_depth: i32,
+            prefetch_depth: i32,
+            ctx_handle: *mut PDFHandle,
+            source_handle: *mut PDFHandle,
+            cache_handle: *mut PDFHandle,
+            profile_handle: *mut PDFHandle,
+            stats_handle: *mut PDFHandle,
+            control_handle: *mut PDFHandle,
+            engine_handle: *mut PDFHandle,
+            pages_buf: *mut i32,
+        ) -> Result<()>;
+
+        unsafe fn next_engine_page(
+            timeout_ms: i32,
+            status_buf: *mut i32,
+            page_buf: *mut i32,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            stride_buf: *mut i32,
+            flags_buf: *mut i32,
+            abort_buf: *mut u64,
+            engine_handle: *mut PDFHandle,
+            image_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by image_handle, in the requested format
+
+        unsafe fn pause_render_engine(paused: bool, engine_handle: *mut PDFHandle);
+
+        unsafe fn stop_render_engine(engine_handle: *mut PDFHandle);
+
+        unsafe fn free_render_engine(engine_handle: *mut PDFHandle);
+
+        unsafe fn load_display_list(
+            page_num: i32,
+            bounds_buf: *mut f32,
+            session_handle: *mut PDFHandle,
+            list_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn render_display_list(
+            scale: f32,
+            format: i32,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            stride_buf: *mut i32,
+            list_handle: *mut PDFHandle,
+            image_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by image_handle, in the requested format
+
+        unsafe fn render_display_list_region(
+            rect_buf: *const f32,
+            scale: f32,
+            format: i32,
+            size_buf: *mut usize,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            channels_buf: *mut i32,
+            stride_buf: *mut i32,
+            list_handle: *mut PDFHandle,
+            image_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by image_handle, in the requested format
+
+        unsafe fn free_display_list(list_handle: *mut PDFHandle);
+
+        unsafe fn open_band_renderer(
+            page_num: i32,
+            band_height: i32,
+            format: i32,
+            width_buf: *mut i32,
+            height_buf: *mut i32,
+            stride_buf: *mut i32,
+            session_handle: *mut PDFHandle,
+            band_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn render_next_band(
+            size_buf: *mut usize,
+            y_buf: *mut i32,
+            rows_buf: *mut i32,
+            band_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // bytes owned by band_handle until the next call, null once done
+
+        unsafe fn close_band_renderer(band_handle: *mut PDFHandle);
+
+        unsafe fn load_page_text(
+            page_num: i32,
+            size_buf: *mut usize,
+            block_count_buf: *mut i32,
+            line_count_buf: *mut i32,
+            session_handle: *mut PDFHandle,
+            text_handle: *mut PDFHandle,
+        ) -> Result<*mut u8>; // UTF-8 of every line back to back, owned by text_handle
+
+        unsafe fn read_page_text(
+            block_boxes_buf: *mut f32,
+            line_boxes_buf: *mut f32,
+            line_ends_buf: *mut i32,
+            line_blocks_buf: *mut i32,
+            text_handle: *mut PDFHandle,
+        ) -> Result<()>;
+
+        unsafe fn free_page_text(text_handle: *mut PDFHandle);
+
+        unsafe fn flush_session_cache(session_handle: *mut PDFHandle);
+
+        unsafe fn close_session(session_handle: *mut PDFHandle);
     }
 }
 
 pub struct Extractor {
     pub doc_path: PathBuf,
     pub page_count: i32,
+    pub options: ExtractorOptions,
     doc_handle: *mut PDFHandle,
     ctx_handle: *mut PDFHandle,
+    sessions: Arc<SessionPool>,
+    render_queue: Arc<RenderQueue>,
+    page_info: Option<Arc<[PageInfo]>>,
+}
+
+/// Tuning knobs for how an [Extractor] renders pages.
+#[derive(Clone, Debug)]
+pub struct ExtractorOptions {
+    /// Give workers `fz_clone_context` children of the base context, so every worker
+    /// shares one store, glyph cache and memory budget instead of owning a 256MB store each.
+    pub share_store: bool,
+    /// Format pages are handed to the [Extractor::iter_pages] callback in.
+    pub output: OutputFormat,
+    /// Scale, threshold and [RenderMode] of every page rendered for extraction. Thumbnails and
+    /// regions take their own scale, but the profile's threshold and mode.
+    pub render_profile: RenderProfile,
+    /// Scale of the thumbnails [Extractor::iter_pages_tiered] hands to its classify callback,
+    /// where 1.0 is 72 DPI.
+    pub classify_scale: f32,
+    /// Rows per band for [Extractor::iter_pages_banded]. Peak pixel memory per page is
+    /// roughly `width * band_height` bytes instead of the whole page.
+    pub band_height: i32,
+    /// How the base document and every worker session read the PDF.
+    pub source: SourceMode,
+    /// Report pages that draw nothing, or where at most this fraction of a low-resolution
+    /// probe is ink, as [PageImage::blank] without rendering them. `None` renders every page.
+    pub blank_ink_ratio: Option<f32>,
+    /// Hand out scanned pages, ones that only draw a single upright image covering the page
+    /// (invisible OCR text aside), at the image's own resolution instead of rendering them at
+    /// the profile's scale, see [PageImage::passthrough]. With [OutputFormat::G4], a page that already is a
+    /// Group 4 fax image is handed out as its original stream, without decoding it. Doesn't apply
+    /// to [Extractor::iter_pages_batched] and [Extractor::iter_pages_banded], which render at a
+    /// scale of their own.
+    pub image_passthrough: bool,
+    /// Pages every blocking task renders back to back in [Extractor::iter_pages_batched].
+    pub batch_size: i32,
+    /// Render [Extractor::iter_pages] on this many native worker threads instead of tokio's
+    /// blocking pool. Every worker keeps one session for the whole run, starts on its own run of
+    /// pages and steals from busier workers once it's done. 0 keeps the blocking pool.
+    pub engine_workers: usize,
+    /// Pin every native worker thread to its own core, see [ExtractorOptions::engine_workers].
+    pub pin_engine_workers: bool,
+    /// Pages every native worker has loaded and recorded ahead on a loader thread of its own,
+    /// so parsing the next page overlaps drawing this one. Only used with
+    /// [ExtractorOptions::engine_workers]; 0 loads every page on its worker.
+    pub prefetch_depth: usize,
+    /// Bytes of rendered pages kept in memory to serve repeated pages (same content and
+    /// resources, e.g. boilerplate notices) without rendering them again. The least recently
+    /// used pages make room for new ones. 0 disables the memory cache.
+    pub dedup_cache_bytes: usize,
+    /// Keep every rendered page in a directory under this one named after the document's MD5,
+    /// keyed by page, scale, threshold, render mode and output format, so later runs over the same document
+    /// read pages back instead of rendering them. Opening the [Extractor] reads the whole file
+    /// once to hash it. `None` disables the disk cache.
+    pub render_cache_dir: Option<PathBuf>,
+    /// Bytes the pages of every document under [ExtractorOptions::render_cache_dir] may take up
+    /// together. Opening the [Extractor] deletes the least recently used pages past it, and pages
+    /// aren't stored once it's full. 0 lets the directory grow without bound.
+    pub render_cache_dir_bytes: u64,
+    /// Time every stage of every rendered page, see [Extractor::render_stats] and
+    /// [PageImage::stats]. Off by default, since it reads the clock a dozen times per page.
+    pub stage_stats: bool,
+    /// Abort pages that take longer than this to render, reporting them as
+    /// [PageRenderError::Aborted] with [AbortReason::Deadline]. MuPDF checks between content
+    /// stream operators, so a pathological page gives its worker back soon after its budget is
+    /// up. Prefetched pages get the budget for loading and for drawing, banded pages per band.
+    /// `None` lets every page take as long as it needs.
+    pub page_time_budget: Option<Duration>,
+    /// Bytes of pixmaps the pages in flight may hold together, estimated from each page's
+    /// bounds and render scale before it's rendered. Small pages still run as many at once as
+    /// there are slots, big ones wait until enough of the budget is free, and a page bigger
+    /// than the whole budget runs alone. The document is prescanned for the bounds, see
+    /// [Extractor::prescan]. Doesn't apply to [ExtractorOptions::engine_workers], whose
+    /// workers render one page each anyway. `None` only limits pages by count.
+    pub inflight_bytes: Option<usize>,
+}
+
+impl Default for ExtractorOptions {
+    fn default() -> Self {
+        Self {
+            share_store: false,
+            output: OutputFormat::default(),
+            render_profile: RenderProfile::default(),
+            classify_scale: 1.0,
+            band_height: 1024,
+            source: SourceMode::default(),
+            blank_ink_ratio: None,
+            image_passthrough: false,
+            batch_size: 8,
+            engine_workers: 0,
+            pin_engine_workers: false,
+            prefetch_depth: 0,
+            dedup_cache_bytes: 0,
+            render_cache_dir: None,
+            render_cache_dir_bytes: 0,
+            stage_stats: false,
+            page_time_budget: None,
+            inflight_bytes: None,
+        }
+    }
 }
 
 #[derive(thiserror::Error, Debug)]
@@ -85,6 +520,60 @@ pub enum PageRenderError {
 
     #[error("Passed an unexpected error! {0}")]
     Unexpected(String),
+
+    /// The render was aborted through its `fz_cookie`, after `progress` of `progress_max`
+    /// (when MuPDF knew it) content stream operators or display list nodes.
+    #[error("Rendering page {page} was aborted ({reason:?}) after {progress} steps")]
+    Aborted {
+        page: PageNum,
+        reason: AbortReason,
+        progress: u64,
+        progress_max: Option<u64>,
+    },
+
+    /// Like [PageRenderError::Aborted], but part of the page had already been handed to the
+    /// callback, e.g. its first bands or its thumbnail to `classify`. Rendering it again would
+    /// hand that part out twice, so it is reported whatever the reason.
+    #[error("Rendering page {page} was aborted ({reason:?}) after part of it was handed out")]
+    AbortedAfterOutput { page: PageNum, reason: AbortReason },
+}
+
+/// Why a render was aborted, see [PageRenderError::Aborted]. Matches `AbortReason` in
+/// `src_cpp/main.h`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum AbortReason {
+    /// [ControlMessage::Stop] arrived while the page was rendering.
+    Stopped = 1,
+    /// [ControlMessage::Pause] arrived while the page was rendering. [Extractor::iter_pages]
+    /// and friends render the page again on [ControlMessage::Resume] instead of reporting it.
+    Paused = 2,
+    /// The page took longer than [ExtractorOptions::page_time_budget].
+    Deadline = 3,
+    /// Every request for the page was cancelled while it was rendering, see [RenderQueue].
+    /// The page is rendered again in page order instead of being reported.
+    Cancelled = 4,
+    /// The page needs bytes a document opened with [Extractor::open_progressive] hasn't
+    /// downloaded yet. The page is rendered again once more arrived instead of being reported.
+    Incomplete = 5,
+}
+
+impl AbortReason {
+    /// Whether [Extractor::iter_pages] and friends render a page aborted for this reason again
+    /// instead of reporting it.
+    fn retried(self) -> bool {
+        matches!(self, Self::Paused | Self::Cancelled | Self::Incomplete)
+    }
+
+    fn from_raw(raw: u64) -> Option<Self> {
+        match raw {
+            1 => Some(Self::Stopped),
+            2 => Some(Self::Paused),
+            3 => Some(Self::Deadline),
+            4 => Some(Self::Cancelled),
+            5 => Some(Self::Incomplete),
+            _ => None,
+        }
+    }
 }
 
 impl From<&str> for PageRenderError {
@@ -130,11 +619,404 @@ pub type ImageWidth = i32;
 pub type ImageHeight = i32;
 pub type ImageChannels = i32;
 
+/// Scale pages are rendered at for extraction by default, 432 DPI. Matches `RenderProfile` in
+/// `src_cpp/profile.h`.
+pub const FULL_SCALE: f32 = 6.0;
+
+/// How pages are drawn and turned into samples, see [RenderProfile].
+#[repr(i32)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum RenderMode {
+    /// Drawn without anti-aliasing, which thresholding would throw away anyway, and
+    /// thresholded to black and white in every [OutputFormat].
+    #[default]
+    Bilevel = 0,
+    /// Drawn anti-aliased. [OutputFormat::Raw], [OutputFormat::Png] and [OutputFormat::Qoi]
+    /// keep the gray samples, the 1 bit formats are still thresholded.
+    Gray = 1,
+}
+
+/// What pages are rendered with, see [ExtractorOptions::render_profile]. The mode picks which
+/// of the C++ side's drawing and encoding kernels a page goes through, once per page.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct RenderProfile {
+    pub mode: RenderMode,
+    /// 1.0 is 72 DPI.
+    pub scale: f32,
+    /// Gray samples above this become white, everything else black.
+    pub threshold: u8,
+}
+
+impl RenderProfile {
+    /// Black and white at 432 DPI, what pages are rendered with by default.
+    pub const BILEVEL: Self = Self {
+        mode: RenderMode::Bilevel,
+        scale: FULL_SCALE,
+        threshold: 128,
+    };
+
+    /// Anti-aliased gray at 432 DPI.
+    pub const GRAY: Self = Self {
+        mode: RenderMode::Gray,
+        ..Self::BILEVEL
+    };
+}
+
+impl Default for RenderProfile {
+    fn default() -> Self {
+        Self::BILEVEL
+    }
+}
+
+/// Format of the bytes handed to the [Extractor::iter_pages] callback.
+#[repr(i32)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum OutputFormat {
+    /// PNG encoded page, see [set_png_level].
+    #[default]
+    Png = 0,
+    /// Rendered 8-bit samples straight from MuPDF, `stride` bytes per row.
+    /// Skips PNG encoding on the C++ side and decoding in the callback.
+    Raw = 1,
+    /// Bilevel page packed 8 pixels per byte, most significant bit first, with set bits
+    /// being black pixels. Rows are `stride` bytes apart. 8x smaller than [OutputFormat::Raw].
+    Packed = 2,
+    /// Binary PBM (P4) file: a `P4\n<width> <height>\n` header followed by
+    /// [OutputFormat::Packed] rows, `stride` bytes apart.
+    Pbm = 3,
+    /// Bare CCITT Group 4 stream of the bilevel page, as in a PDF `/CCITTFaxDecode` stream
+    /// with `/K -1 /Columns <width> /BlackIs1 true`. Usually the smallest, and cheap to encode.
+    CcittG4 = 4,
+    /// QOI file of the page with 3 channels, bilevel unless [RenderMode::Gray]. Lossless and encoded in one pass,
+    /// for consumers that want an image file without paying for deflate.
+    Qoi = 5,
+}
+
+/// Where an [Extractor] reads the PDF from.
+#[repr(i32)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum SourceMode {
+    /// Every worker session opens the file itself, one file descriptor each.
+    #[default]
+    File = 0,
+    /// The file is memory-mapped read-only once and every document is opened over the mapping.
+    Mapped = 1,
+    /// The file is read into memory once and every document is opened over that buffer.
+    Loaded = 2,
+}
+
+/// A rendered page, borrowed from the C++ side for the duration of the callback.
+pub struct PageImage<'a> {
+    pub data: &'a [u8],
+    pub format: OutputFormat,
+    pub width: ImageWidth,
+    pub height: ImageHeight,
+    pub channels: ImageChannels,
+    /// Bytes per row of [PageImage::data] for [OutputFormat::Raw] and [OutputFormat::Packed].
+    pub stride: usize,
+    /// The page was found to be blank, see [ExtractorOptions::blank_ink_ratio].
+    /// [PageImage::data] is empty, but the size is that of a rendered page.
+    pub blank: bool,
+    /// The page was rendered before, its bytes come from the dedup cache or the disk cache,
+    /// see [ExtractorOptions::dedup_cache_bytes] and [ExtractorOptions::render_cache_dir].
+    pub repeated: bool,
+    /// The page is a scan handed out at its own resolution, see
+    /// [ExtractorOptions::image_passthrough]. Its size is the scan's, not that of a rendered page.
+    pub passthrough: bool,
+    /// Where rendering the page spent its time, with [ExtractorOptions::stage_stats].
+    /// `None` when timing is off, and for pages of [Extractor::iter_pages_batched].
+    pub stats: Option<PageStats>,
+}
+
+/// A stage of rendering a page, see [PageStats] and [RenderStats].
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum RenderStage {
+    /// Loading the page, or loading and recording it into a display list.
+    Load,
+    /// Hashing the page for the dedup cache, see [ExtractorOptions::dedup_cache_bytes].
+    Fingerprint,
+    /// Looking for ink on a low-resolution probe, see [ExtractorOptions::blank_ink_ratio].
+    Probe,
+    /// Rasterizing the page.
+    Draw,
+    /// Thresholding the samples to black and white, or packing them to 1 bit.
+    Threshold,
+    /// Encoding [OutputFormat::Png].
+    Encode,
+    /// Copying the rendered page into or out of the dedup cache and the disk cache.
+    Copy,
+}
+
+impl RenderStage {
+    /// Every stage, in the order of `RenderStage` in `src_cpp/main.h`.
+    pub const ALL: [RenderStage; STAGE_COUNT] = [
+        RenderStage::Load,
+        RenderStage::Fingerprint,
+        RenderStage::Probe,
+        RenderStage::Draw,
+        RenderStage::Threshold,
+        RenderStage::Encode,
+        RenderStage::Copy,
+    ];
+}
+
+/// Values of `StatsLayout` and `RenderStage::STAGE_COUNT` in `src_cpp/main.h`.
+const STAGE_COUNT: usize = 7;
+const STATS_BUCKETS: usize = 40;
+const STATS_TOTALS: usize = 3;
+
+/// Stage timings of one rendered page. Stages the page didn't go through are zero.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct PageStats {
+    pub stage_ns: [u64; STAGE_COUNT],
+    /// Bytes of the rendered pixmap.
+    pub sample_bytes: usize,
+    /// Bytes handed out in [PageImage::data].
+    pub output_bytes: usize,
+}
+
+impl PageStats {
+    pub fn stage(&self, stage: RenderStage) -> Duration {
+        Duration::from_nanos(self.stage_ns[stage as usize])
+    }
+}
+
+/// Stage timings of every page an [Extractor] rendered, see [Extractor::render_stats].
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct RenderStats {
+    pub pages: u64,
+    pub sample_bytes: u64,
+    pub output_bytes: u64,
+    /// One histogram per [RenderStage], in [RenderStage::ALL] order.
+    pub stages: Vec<StageHistogram>,
+}
+
+/// How long pages spent in one stage, as a log2 histogram: `buckets[i]` counts pages
+/// where the stage took between 2^i and 2^(i+1) nanoseconds.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct StageHistogram {
+    pub stage: RenderStage,
+    /// Pages that went through the stage.
+    pub count: u64,
+    pub total: Duration,
+    pub max: Duration,
+    pub buckets: [u64; STATS_BUCKETS],
+}
+
+impl StageHistogram {
+    pub fn mean(&self) -> Duration {
+        if self.count == 0 {
+            Duration::ZERO
+        } else {
+            // Counts past u32::MAX would wrap as a Duration divisor.
+            Duration::from_nanos((self.total.as_nanos() / self.count as u128) as u64)
+        }
+    }
+
+    /// Upper bound of the bucket holding the `p`th percentile (0.0 to 1.0), never above [StageHistogram::max].
+    pub fn percentile(&self, p: f64) -> Duration {
+        let rank = (p.clamp(0.0, 1.0) * self.count as f64).ceil() as u64;
+        let mut seen = 0;
+
+        for (bucket, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank.max(1) {
+                let bound = 1u64.checked_shl(bucket as u32 + 1).unwrap_or(u64::MAX);
+                return Duration::from_nanos(bound).min(self.max);
+            }
+        }
+
+        self.max
+    }
+}
+
+/// A horizontal band of a page rendered by [Extractor::iter_pages_banded], borrowed from the
+/// C++ side for the duration of the callback. Bands of a page arrive in order, top to bottom.
+pub struct PageBand<'a> {
+    /// The band's rows for [OutputFormat::Raw] and [OutputFormat::Packed]. For [OutputFormat::Png]
+    /// the bytes this band added to the page's PNG stream; concatenated they form the whole PNG.
+    pub data: &'a [u8],
+    pub format: OutputFormat,
+    /// Width of the page.
+    pub width: ImageWidth,
+    /// Height of the whole page, not of the band.
+    pub height: ImageHeight,
+    /// First page row covered by the band.
+    pub y: i32,
+    /// Number of rows in the band.
+    pub rows: i32,
+    /// Bytes per row of [PageBand::data] for [OutputFormat::Raw] and [OutputFormat::Packed].
+    pub stride: usize,
+}
+
+/// What MuPDF has allocated across every [Extractor] of the process, see [memory_usage].
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct MemoryUsage {
+    pub live: usize,
+    pub peak: usize,
+    /// Set by [set_memory_cap], 0 when there is no cap.
+    pub cap: usize,
+    /// Every MuPDF context alive. Shared-store sessions are counted with their base context.
+    pub contexts: Vec<ContextMemory>,
+}
+
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct ContextMemory {
+    pub live: usize,
+    pub peak: usize,
+}
+
+/// Caps what MuPDF may allocate across every [Extractor] of the process, 0 for no cap.
+/// Near and over the cap, stores are evicted instead of renders failing: the allocating
+/// context scavenges its own store and every other worker shrinks its store before its next page.
+pub fn set_memory_cap(bytes: usize) {
+    unsafe { bridge::set_memory_cap(bytes) };
+}
+
+/// Deflates every [OutputFormat::Png] page of the process at `level` (0 only stores, 9 is
+/// smallest) and writes it as 1 bit grayscale. `None`, the default, keeps MuPDF's 8 bit writer at
+/// zlib's default level. Bands of [Extractor::iter_pages_banded] always use MuPDF's writer.
+pub fn set_png_level(level: Option<u8>) -> Result<(), PageRenderError> {
+    let level = level.map_or(-1, i32::from);
+    unsafe { bridge::set_png_level(level) }.map_err(|e| PageRenderError::from(e.what()))
+}
+
+pub fn memory_usage() -> MemoryUsage {
+    let mut usage = MemoryUsage::default();
+    let mut context_live: Vec<usize> = Vec::new();
+    let mut context_peak: Vec<usize> = Vec::new();
+
+    // Contexts may come and go between calls, so ask again until they all fit.
+    loop {
+        let capacity = context_live.len();
+        let count = unsafe {
+            bridge::memory_usage(
+                &mut usage.live as *mut usize,
+                &mut usage.peak as *mut usize,
+                &mut usage.cap as *mut usize,
+                context_live.as_mut_ptr(),
+                context_peak.as_mut_ptr(),
+                capacity as i32,
+            )
+        } as usize;
+
+        if count <= capacity {
+            usage.contexts = (0..count)
+                .map(|i| ContextMemory {
+                    live: context_live[i],
+                    peak: context_peak[i],
+                })
+                .collect();
+            return usage;
+        }
+
+        context_live.resize(count, 0);
+        context_peak.resize(count, 0);
+    }
+}
+
+/// A lock MuPDF takes on behalf of every context of the process, see [lock_stats].
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum LockSlot {
+    /// `FZ_LOCK_ALLOC`, taken around every allocation and the store.
+    Alloc,
+    /// `FZ_LOCK_FREETYPE`, taken around every font operation.
+    FreeType,
+    /// `FZ_LOCK_GLYPHCACHE`, taken around glyph cache lookups.
+    GlyphCache,
+    /// Creating and cloning contexts, i.e. opening worker sessions.
+    ContextCreation,
+}
+
+impl LockSlot {
+    /// The `FZ_LOCK_*` value of the slot, `None` for [LockSlot::ContextCreation].
+    fn fz_lock(self) -> Option<i32> {
+        match self {
+            LockSlot::Alloc => Some(0),
+            LockSlot::FreeType => Some(1),
+            LockSlot::GlyphCache => Some(2),
+            LockSlot::ContextCreation => None,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct LockStats {
+    pub slot: LockSlot,
+    pub acquisitions: u64,
+    /// Acquisitions that found the lock held and had to wait.
+    pub contended: u64,
+    /// Time spent waiting across every contended acquisition.
+    pub wait: Duration,
+}
+
+/// Makes `slots` use an adaptive spin-then-park lock instead of a plain mutex, which is cheaper
+/// for short hot critical sections like [LockSlot::Alloc] and [LockSlot::FreeType]. Context
+/// creation always uses a mutex. Has to be called before the first [Extractor] is created.
+pub fn set_adaptive_locks(slots: &[LockSlot]) -> Result<(), PageRenderError> {
+    let mask = slots
+        .iter()
+        .filter_map(|slot| slot.fz_lock())
+        .fold(0, |mask, lock| mask | (1 << lock));
+
+    unsafe { bridge::set_adaptive_locks(mask) }.map_err(|e| PageRenderError::from(e.what()))
+}
+
+/// Acquisition counts and wait times of every lock MuPDF shares across contexts, since the
+/// process started or the last [reset_lock_stats].
+pub fn lock_stats() -> Vec<LockStats> {
+    const SLOTS: [LockSlot; 4] = [
+        LockSlot::Alloc,
+        LockSlot::FreeType,
+        LockSlot::GlyphCache,
+        LockSlot::ContextCreation,
+    ];
+
+    let mut acquisitions = [0u64; SLOTS.len()];
+    let mut contended = [0u64; SLOTS.len()];
+    let mut wait_ns = [0u64; SLOTS.len()];
+
+    let count = unsafe {
+        bridge::lock_stats(
+            acquisitions.as_mut_ptr(),
+            contended.as_mut_ptr(),
+            wait_ns.as_mut_ptr(),
+            SLOTS.len() as i32,
+        )
+    } as usize;
+
+    debug_assert_eq!(count, SLOTS.len(), "FZ_LOCK_MAX changed, update LockSlot");
+
+    (0..count.min(SLOTS.len()))
+        .map(|i| LockStats {
+            slot: SLOTS[i],
+            acquisitions: acquisitions[i],
+            contended: contended[i],
+            wait: Duration::from_nanos(wait_ns[i]),
+        })
+        .collect()
+}
+
+pub fn reset_lock_stats() {
+    unsafe { bridge::reset_lock_stats() };
+}
+
 impl Extractor {
     pub fn new(doc_path: impl AsRef<Path>) -> Self {
-        let mut doc_handle: *mut c_void = ptr::null_mut();
-        let mut ctx_handle: *mut c_void = ptr::null_mut();
-        let mut page_count: i32 = 0;
+        Self::with_options(doc_path, ExtractorOptions::default())
+    }
+
+    pub fn with_options(doc_path: impl AsRef<Path>, options: ExtractorOptions) -> Self {
+        Self::open(doc_path, options).unwrap()
+    }
+
+    /// [Extractor::with_options], but a document that can't be opened is an error instead of
+    /// a panic, e.g. for [Corpus] runs over files nobody checked.
+    pub fn open(
+        doc_path: impl AsRef<Path>,
+        options: ExtractorOptions,
+    ) -> Result<Self, PageRenderError> {
+        let mut source_handle: *mut c_void = ptr::null_mut();
         let_cxx_string!(cxx_str = doc_path.as_ref().to_string_lossy().to_string());
 
         debug!(
@@ -142,33 +1024,303 @@ impl Extractor {
             doc_path.as_ref().display()
         );
 
+        if options.source != SourceMode::File {
+            let mut source_size: usize = 0;
+
+            unsafe {
+                bridge::open_source(
+                    &cxx_str,
+                    options.source as i32,
+                    &mut source_handle as *mut _ as *mut PDFHandle,
+                    &mut source_size as *mut usize,
+                )
+            }
+            .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+            debug!(
+                "Opened {:?} document source: {} bytes",
+                options.source, source_size
+            );
+        }
+
         unsafe {
-            bridge::init(
-                &cxx_str,
-                &mut doc_handle as *mut _ as *mut PDFHandle,
-                &mut ctx_handle as *mut _ as *mut PDFHandle,
-                &mut page_count as *mut i32,
+            Self::open_over(
+                doc_path.as_ref(),
+                options,
+                source_handle as MemAddress,
+                None,
             )
-            .unwrap()
+        }
+    }
+
+    /// [Extractor::open] for a document that is still being downloaded, e.g. from object
+    /// storage, which `fetcher` reads in byte ranges of the `size` byte file on a thread of its
+    /// own. The document opens as soon as MuPDF can read its structure: a linearized file after
+    /// its first page arrived, any other once its trailer and cross-reference table did, which
+    /// are fetched first. Pages are fetched front to back, and a page that needs bytes that
+    /// haven't arrived is aborted with [AbortReason::Incomplete] and rendered again once they
+    /// have, so [Extractor::iter_pages] and friends work as over a file on disk. Calls for a
+    /// single page, e.g. [Extractor::page_text], hand the abort to the caller instead.
+    /// [Extractor::prescan], and with it [ExtractorOptions::inflight_bytes], waits until every
+    /// page object arrived, which for most files is most of the file.
+    ///
+    /// `doc_path` only names the document. A [ExtractorOptions::render_cache_dir] is an error,
+    /// since the disk tier is keyed by a hash of the whole file.
+    pub fn open_progressive(
+        doc_path: impl AsRef<Path>,
+        size: u64,
+        fetcher: impl RangeFetcher,
+        options: ExtractorOptions,
+    ) -> Result<Self, PageRenderError> {
+        if options.render_cache_dir.is_some() {
+            return Err(PageRenderError::Unexpected(
+                "A render cache directory needs the whole document to hash".to_string(),
+            ));
+        }
+
+        let mut source_handle: *mut c_void = ptr::null_mut();
+
+        debug!(
+            "Initializing progressive PDF with path: {}, {} bytes",
+            doc_path.as_ref().display(),
+            size
+        );
+
+        unsafe {
+            bridge::open_progressive_source(size, &mut source_handle as *mut _ as *mut PDFHandle)
+        }
+        .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+        let download = Download::start(source_handle as MemAddress, size, fetcher);
+        unsafe {
+            Self::open_over(
+                doc_path.as_ref(),
+                options,
+                source_handle as MemAddress,
+                Some(download),
+            )
+        }
+    }
+
+    /// Opens the document over `source`, 0 to read it from `doc_path`, and hands the source to
+    /// the [SessionPool] along with the `download` filling it, if any.
+    unsafe fn open_over(
+        doc_path: &Path,
+        options: ExtractorOptions,
+        source: MemAddress,
+        download: Option<Download>,
+    ) -> Result<Self, PageRenderError> {
+        let mut source_handle: *mut c_void = source as *mut c_void;
+        let mut doc_handle: *mut c_void = ptr::null_mut();
+        let mut ctx_handle: *mut c_void = ptr::null_mut();
+        let mut page_count: i32 = 0;
+        let mut seen: u64 = 0;
+        let_cxx_string!(cxx_str = doc_path.to_string_lossy().to_string());
+
+        // A progressive document fails to open until enough of it arrived, so try again
+        // whenever more did until nothing more will. Any other failure won't go away.
+        let opened = loop {
+            let opened = unsafe {
+                bridge::init(
+                    &cxx_str,
+                    &mut source_handle as *mut _ as *mut PDFHandle,
+                    &mut doc_handle as *mut _ as *mut PDFHandle,
+                    &mut ctx_handle as *mut _ as *mut PDFHandle,
+                    &mut page_count as *mut i32,
+                )
+            };
+
+            match &download {
+                Some(_)
+                    if opened
+                        .as_ref()
+                        .is_err_and(|e| e.what() == INCOMPLETE_DOCUMENT_ERROR)
+                        && wait_for_bytes(source, &mut seen) =>
+                {
+                    debug!(
+                        "Document isn't readable yet, trying again at {} bytes",
+                        seen
+                    );
+                }
+                _ => break opened,
+            }
         };
 
+        if let Err(e) = opened {
+            // Nothing else holds the source until the SessionPool owns it.
+            drop(download);
+            unsafe { bridge::close_source(&mut source_handle as *mut _ as *mut PDFHandle) };
+            return Err(PageRenderError::from(e.what()));
+        }
+
         debug!(
             "After init: doc_handle=0x{:x}, ctx_handle=0x{:x}, page_count={}",
             doc_handle as usize, ctx_handle as usize, page_count
         );
 
+        let sessions = Arc::new(SessionPool::new(
+            doc_path.to_path_buf(),
+            &options,
+            ctx_handle as MemAddress,
+            doc_handle as MemAddress,
+            source_handle as MemAddress,
+            download,
+        ));
+
         let result = Self {
-            doc_path: doc_path.as_ref().to_path_buf(),
+            doc_path: doc_path.to_path_buf(),
             doc_handle: doc_handle as *mut _ as *mut PDFHandle,
             ctx_handle: ctx_handle as *mut _ as *mut PDFHandle,
             page_count,
+            render_queue: Arc::new(RenderQueue::new(sessions.clone())),
+            sessions,
+            options,
+            page_info: None,
         };
 
         debug!(
             "Created extractor with ctx_handle: 0x{:x}",
             result.ctx_handle as usize
         );
-        result
+        Ok(result)
+    }
+
+    /// The order pages are rendered in, shared with whoever knows which pages matter most,
+    /// e.g. a classifier that wants the key page of a chunk before the pages it implies.
+    /// Requests only reorder the runs of [Extractor::iter_pages] and friends on tokio's blocking
+    /// pool; the native engine, see [ExtractorOptions::engine_workers], keeps its own page order.
+    pub fn render_queue(&self) -> Arc<RenderQueue> {
+        self.render_queue.clone()
+    }
+
+    /// Stage timings of every page rendered so far, `None` unless [ExtractorOptions::stage_stats].
+    pub fn render_stats(&self) -> Option<RenderStats> {
+        if self.sessions.render_stats == 0 {
+            return None;
+        }
+
+        let mut buckets = vec![0u64; STAGE_COUNT * STATS_BUCKETS];
+        let mut counts = [0u64; STAGE_COUNT];
+        let mut total_ns = [0u64; STAGE_COUNT];
+        let mut max_ns = [0u64; STAGE_COUNT];
+        let mut totals = [0u64; STATS_TOTALS];
+        let mut stats_handle: *mut c_void = self.sessions.render_stats as *mut c_void;
+
+        unsafe {
+            bridge::read_render_stats(
+                buckets.as_mut_ptr(),
+                counts.as_mut_ptr(),
+                total_ns.as_mut_ptr(),
+                max_ns.as_mut_ptr(),
+                totals.as_mut_ptr(),
+                &mut stats_handle as *mut _ as *mut PDFHandle,
+            )
+        }
+        .ok()?;
+
+        let stages = RenderStage::ALL
+            .iter()
+            .enumerate()
+            .map(|(i, &stage)| StageHistogram {
+                stage,
+                count: counts[i],
+                total: Duration::from_nanos(total_ns[i]),
+                max: Duration::from_nanos(max_ns[i]),
+                buckets: buckets[i * STATS_BUCKETS..(i + 1) * STATS_BUCKETS]
+                    .try_into()
+                    .unwrap(),
+            })
+            .collect();
+
+        Some(RenderStats {
+            pages: totals[0],
+            sample_bytes: totals[1],
+            output_bytes: totals[2],
+            stages,
+        })
+    }
+
+    /// Returns what is known about every page without rendering any of them, see [PageInfo].
+    /// The document is only scanned on the first call, later calls return the cached result.
+    pub fn prescan(&mut self) -> Result<Arc<[PageInfo]>, PageRenderError> {
+        if let Some(page_info) = &self.page_info {
+            return Ok(page_info.clone());
+        }
+
+        let page_info = unsafe {
+            Self::scan_pages(
+                self.page_count,
+                self.doc_handle as MemAddress,
+                self.ctx_handle as MemAddress,
+                &self.sessions,
+            )
+        }?;
+        self.page_info = Some(page_info.clone());
+        Ok(page_info)
+    }
+
+    /// The body of [Extractor::prescan], on the base context and document, which nothing else
+    /// may use until it returns.
+    unsafe fn scan_pages(
+        page_count: PageNum,
+        doc_handle: MemAddress,
+        ctx_handle: MemAddress,
+        sessions: &SessionPool,
+    ) -> Result<Arc<[PageInfo]>, PageRenderError> {
+        let pages = page_count as usize;
+        let mut bounds: Vec<f32> = vec![0.0; pages * 4];
+        let mut rotations: Vec<i32> = vec![0; pages];
+        let mut images: Vec<i32> = vec![0; pages];
+        let mut fonts: Vec<i32> = vec![0; pages];
+        let mut text: Vec<u8> = vec![0; pages];
+        let mut doc_handle: *mut c_void = doc_handle as *mut c_void;
+        let mut ctx_handle: *mut c_void = ctx_handle as *mut c_void;
+
+        debug!("Prescanning {} pages", page_count);
+
+        // Every page object has to be there, so a progressive document is scanned again as
+        // bytes arrive until it is.
+        let mut seen = sessions.received_bytes();
+        loop {
+            let scanned = unsafe {
+                bridge::prescan_document(
+                    page_count,
+                    bounds.as_mut_ptr(),
+                    rotations.as_mut_ptr(),
+                    images.as_mut_ptr(),
+                    fonts.as_mut_ptr(),
+                    text.as_mut_ptr(),
+                    &mut doc_handle as *mut _ as *mut PDFHandle,
+                    &mut ctx_handle as *mut _ as *mut PDFHandle,
+                )
+            };
+
+            match scanned {
+                Err(e)
+                    if e.what() == INCOMPLETE_DOCUMENT_ERROR && sessions.wait_for_bytes(seen) =>
+                {
+                    seen = sessions.received_bytes();
+                }
+                scanned => break scanned.map_err(|e| PageRenderError::from(e.what()))?,
+            }
+        }
+
+        let page_info: Arc<[PageInfo]> = (0..pages)
+            .map(|page| PageInfo {
+                bounds: [
+                    bounds[page * 4],
+                    bounds[page * 4 + 1],
+                    bounds[page * 4 + 2],
+                    bounds[page * 4 + 3],
+                ],
+                rotation: rotations[page],
+                image_count: images[page] as u32,
+                font_count: fonts[page] as u32,
+                has_text: text[page] != 0,
+            })
+            .collect();
+
+        Ok(page_info)
     }
 
     pub async unsafe fn iter_pages<F, State>(
@@ -176,45 +1328,362 @@ impl Extractor {
         callback: F,
         render_callback: Sender<Result<(), PageRenderError>>,
         state: Arc<Mutex<State>>,
-        mut controller: Receiver<ControlMessage>,
+        controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        F: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        if self.options.engine_workers > 0 {
+            return unsafe { self.run_engine(callback, render_callback, state, controller).await };
+        }
+
+        let format = self.options.output;
+        let job = move |page: PageNum, sessions: &SessionPool| unsafe {
+            Self::iter_page(page, format, callback, state.clone(), sessions)
+        };
+
+        let footprint = PageFootprint::Pixmap(self.options.render_profile.scale);
+        unsafe {
+            self.run_pages(job, 1, Some(footprint), render_callback, controller)
+                .await
+        };
+    }
+
+    /// Renders every page twice from one display list: first a cheap thumbnail at
+    /// [ExtractorOptions::classify_scale] for `classify`, then, only for pages `classify`
+    /// accepts (i.e. classified as Confident or Probable), the full-resolution image for `extract`.
+    /// The page's content stream is only interpreted once. A page aborted once `classify` has
+    /// seen it is reported as [PageRenderError::AbortedAfterOutput] instead of rendered again.
+    pub async unsafe fn iter_pages_tiered<C, F, State>(
+        &mut self,
+        classify: C,
+        extract: F,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        state: Arc<Mutex<State>>,
+        controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        C: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> bool
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        F: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        let format = self.options.output;
+        let classify_scale = self.options.classify_scale;
+        let job = move |page: PageNum, sessions: &SessionPool| unsafe {
+            Self::iter_page_tiered(
+                page,
+                format,
+                classify_scale,
+                classify,
+                extract,
+                state.clone(),
+                sessions,
+            )
+        };
+
+        let footprint =
+            PageFootprint::Pixmap(self.options.render_profile.scale.max(classify_scale));
+        unsafe {
+            self.run_pages(job, 1, Some(footprint), render_callback, controller)
+                .await
+        };
+    }
+
+    /// Like [Extractor::iter_pages_tiered], but `classify` only sees renders of `regions` of the
+    /// page, e.g. a [pdf_struct_traits::Classify::REGIONS], each clipped to its rectangle at its
+    /// own scale. Pages `classify` accepts are rendered at full resolution for `extract` from
+    /// the same display list. Aborts after `classify` are reported as with iter_pages_tiered.
+    pub async unsafe fn iter_pages_regions<C, F, State>(
+        &mut self,
+        regions: &'static [RegionOfInterest],
+        classify: C,
+        extract: F,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        state: Arc<Mutex<State>>,
+        controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        C: 'static
+            + Fn(PageNum, &[RegionImage], Arc<Mutex<State>>) -> bool
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        F: 'static + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> () + Send + Sync + Clone + Copy,
+        State: Send + 'static,
+    {
+        let format = self.options.output;
+        let job = move |page: PageNum, sessions: &SessionPool| unsafe {
+            Self::iter_page_regions(
+                page,
+                format,
+                regions,
+                classify,
+                extract,
+                state.clone(),
+                sessions,
+            )
+        };
+
+        let footprint = PageFootprint::Pixmap(self.options.render_profile.scale);
+        unsafe {
+            self.run_pages(job, 1, Some(footprint), render_callback, controller)
+                .await
+        };
+    }
+
+    /// Renders every page at full scale in bands of [ExtractorOptions::band_height] rows,
+    /// calling `callback` as each band completes. Meant for very large pages (e.g. A0
+    /// drawings), where a whole-page pixmap at 432 DPI runs into gigabytes. A page aborted once
+    /// some of its bands went out is reported as [PageRenderError::AbortedAfterOutput].
+    pub async unsafe fn iter_pages_banded<F, State>(
+        &mut self,
+        callback: F,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        state: Arc<Mutex<State>>,
+        controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        F: 'static
+            + Fn(PageNum, PageBand, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        let format = self.options.output;
+        let band_height = self.options.band_height;
+        let job = move |page: PageNum, sessions: &SessionPool| unsafe {
+            Self::iter_page_banded(page, format, band_height, callback, state.clone(), sessions)
+        };
+
+        let footprint = PageFootprint::Band(self.options.render_profile.scale, band_height);
+        unsafe {
+            self.run_pages(job, 1, Some(footprint), render_callback, controller)
+                .await
+        };
+    }
+
+    /// Renders every page at `scale` (1.0 = 72 DPI) in batches of [ExtractorOptions::batch_size]
+    /// pages, each batch rendered back to back in one C++ call on one session. Meant for
+    /// thumbnail-sized renders, where per-page task and FFI overhead would dominate.
+    /// Pages that fail are reported through `render_callback` without failing their batch, but a
+    /// batch with a page that is rendered again (see [AbortReason]) is rendered again as a whole.
+    pub async unsafe fn iter_pages_batched<F, State>(
+        &mut self,
+        scale: f32,
+        callback: F,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        state: Arc<Mutex<State>>,
+        controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        F: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        let format = self.options.output;
+        let batch_size = self.options.batch_size.max(1);
+        let page_count = self.page_count;
+        let errors = render_callback.clone();
+        let job = move |first: PageNum, sessions: &SessionPool| unsafe {
+            let pages: Vec<PageNum> = (first..(first + batch_size).min(page_count)).collect();
+            let session = sessions.checkout()?;
+            let batch = session.render_batch(&pages, scale, format)?;
+
+            // The task is requeued as a whole, so none of its pages may have reached `callback`.
+            for index in 0..batch.len() {
+                if let (_, Err(e @ PageRenderError::Aborted { reason, .. })) = batch.page(index) {
+                    if reason.retried() {
+                        return Err(e);
+                    }
+                }
+            }
+
+            for index in 0..batch.len() {
+                match batch.page(index) {
+                    (page, Ok(image)) => callback(page, image, state.clone()),
+                    // Blocking tasks may block on the channel, the rest of the batch waits.
+                    (_, Err(e)) => {
+                        errors.blocking_send(Err(e)).ok();
+                    }
+                }
+            }
+
+            Ok(())
+        };
+
+        let footprint = PageFootprint::Pixmap(scale);
+        unsafe {
+            self.run_pages(
+                job,
+                batch_size,
+                Some(footprint),
+                render_callback,
+                controller,
+            )
+            .await
+        };
+    }
+
+    /// Renders `pages` at `scale` (1.0 = 72 DPI) back to back on one session and hands
+    /// each result to `callback` in order. A page that fails doesn't stop the others.
+    pub unsafe fn render_pages<F>(
+        &self,
+        pages: &[PageNum],
+        scale: f32,
+        mut callback: F,
+    ) -> Result<(), PageRenderError>
+    where
+        F: FnMut(PageNum, Result<PageImage, PageRenderError>),
+    {
+        let session = unsafe { self.sessions.checkout()? };
+        let batch = unsafe { session.render_batch(pages, scale, self.options.output)? };
+
+        for index in 0..batch.len() {
+            let (page, image) = batch.page(index);
+            callback(page, image);
+        }
+
+        Ok(())
+    }
+
+    /// Renders only `regions` of `page`, each clipped to its rectangle at its own scale, and
+    /// hands them to `callback` in the same order. The page is interpreted once and nothing
+    /// outside a region is drawn, so classifying from a header band costs a fraction of a
+    /// full render.
+    pub unsafe fn render_regions<F, R>(
+        &self,
+        page: PageNum,
+        regions: &[PageRegion],
+        callback: F,
+    ) -> Result<R, PageRenderError>
+    where
+        F: FnOnce(&[RegionImage]) -> R,
+    {
+        let session = unsafe { self.sessions.checkout()? };
+        let list = unsafe { session.load_display_list(page)? };
+        let rendered = unsafe { list.render_regions(regions, self.options.output)? };
+        let images: Vec<RegionImage> = rendered
+            .iter()
+            .map(|(region, image)| image.region_image(*region))
+            .collect();
+
+        Ok(callback(&images))
+    }
+
+    /// Hands `callback` the text layer of every page, see [Extractor::page_text].
+    /// Nothing is rasterized, meant for classifying born-digital pages.
+    pub async unsafe fn iter_pages_text<F, State>(
+        &mut self,
+        callback: F,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        state: Arc<Mutex<State>>,
+        controller: Receiver<ControlMessage>,
     ) -> ()
     where
         F: 'static
-            + Fn(PageNum, &[u8], ImageWidth, ImageHeight, ImageChannels, Arc<Mutex<State>>) -> ()
+            + Fn(PageNum, PageText, Arc<Mutex<State>>) -> ()
             + Send
             + Sync
             + Clone
             + Copy,
         State: Send + 'static,
+    {
+        let job = move |page: PageNum, sessions: &SessionPool| unsafe {
+            let session = sessions.checkout()?;
+            callback(page, session.load_text(page)?, state.clone());
+            Ok(())
+        };
+
+        unsafe {
+            self.run_pages(job, 1, None, render_callback, controller)
+                .await
+        };
+    }
+
+    /// Extracts the text blocks and lines of `page` with their bounding boxes,
+    /// straight from the PDF's text layer instead of rendering the page.
+    pub unsafe fn page_text(&self, page: PageNum) -> Result<PageText, PageRenderError> {
+        let session = unsafe { self.sessions.checkout()? };
+        unsafe { session.load_text(page) }
+    }
+
+    /// Drives `job` over every page of the document, honouring [ControlMessage]s.
+    /// Every task covers `pages_per_task` pages starting at the page `job` is called with,
+    /// in the order [Extractor::render_queue] hands them out. With
+    /// [ExtractorOptions::inflight_bytes], tasks are admitted by the `footprint` of their pages.
+    async unsafe fn run_pages<J>(
+        &mut self,
+        job: J,
+        pages_per_task: i32,
+        footprint: Option<PageFootprint>,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        mut controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        J: 'static + Fn(PageNum, &SessionPool) -> Result<(), PageRenderError> + Send + Sync + Clone,
     {
         debug!("Iterating over pages {}", self.page_count);
 
         let mut pool: JoinSet<()> = JoinSet::new();
-        let mut pages_spawned = 0;
         let mut pages_completed = 0;
         let max_concurrent_pages = self.calc_max_concurrent_pages();
+        let queue = self.render_queue.clone();
+        queue.begin(self.page_count, pages_per_task);
+        let admission = self.task_admission(footprint, pages_per_task).await;
+
+        // A previous run may have been stopped.
+        self.sessions.resume_renders();
+        // A closed channel is always ready, so it's only polled until it closes.
+        let mut controller_closed = false;
 
         loop {
             select! {
                 // handle any control messages
-                msg = controller.recv() => {
+                msg = controller.recv(), if !controller_closed => {
                     match msg {
                         Some(ControlMessage::Stop) => {
                             debug!("Received stop signal, cancelling remaining tasks");
+                            self.sessions.halt_renders(AbortReason::Stopped);
                             pool.abort_all();
                             break;
                         }
                         Some(ControlMessage::Pause) => {
-                            debug!("Received pause signal, waiting...");
+                            debug!("Received pause signal, aborting pages in flight and waiting...");
+                            self.sessions.halt_renders(AbortReason::Paused);
 
                             loop {
                                 match controller.recv().await {
                                     Some(ControlMessage::Resume) => {
                                         debug!("Received resume signal, continuing...");
+                                        self.sessions.resume_renders();
                                         break;
                                     }
                                     Some(ControlMessage::Stop) => {
                                         debug!("Received stop signal while paused, halting");
+                                        self.sessions.halt_renders(AbortReason::Stopped);
                                         pool.abort_all();
                                         return;
                                     }
@@ -223,6 +1692,7 @@ impl Extractor {
                                     }
                                     None => {
                                         debug!("Control channel closed while paused");
+                                        self.sessions.halt_renders(AbortReason::Stopped);
                                         pool.abort_all();
                                         return;
                                     }
@@ -234,14 +1704,15 @@ impl Extractor {
                         }
                         None => {
                             debug!("Control channel closed, finishing remaining tasks");
+                            controller_closed = true;
                         }
                     }
                 }
 
                 // spawn new page tasks if we have capacity and more pages to process
-                _ = async {}, if pages_spawned < self.page_count && pool.len() < max_concurrent_pages => {
+                _ = async {}, if queue.has_pending() && pool.len() < max_concurrent_pages => {
                     // Try to keep the pipeline full by spawning multiple tasks at once for better I/O overlap
-                    unsafe { self.spawn_tasks(&mut pages_spawned, callback, render_callback.clone(), state.clone(), &mut pool) };
+                    unsafe { self.spawn_tasks(job.clone(), render_callback.clone(), &admission, &mut pool) };
                 }
 
                 // wait for task completion
@@ -250,7 +1721,7 @@ impl Extractor {
                 }
 
                 // all pages were spawned and completed.
-                _ = async {}, if pages_spawned >= self.page_count && pool.is_empty() => {
+                _ = async {}, if pool.is_empty() && queue.is_done() => {
                     debug!("All pages completed!");
                     break;
                 }
@@ -260,261 +1731,454 @@ impl Extractor {
         debug!("Done iterating over pages!");
     }
 
-    fn calc_max_concurrent_pages(&self) -> usize {
-        available_parallelism()
-            .map(|p| {
-                let cores = p.get();
-                // Optimize for better cache locality with smaller batches on more cores
-                match cores {
-                    1..=4 => cores * 2,           // 2-8 threads for low-core systems
-                    5..=8 => cores + 2,           // 7-10 threads for mid-range systems
-                    9..=16 => cores,              // 9-16 threads for high-core systems
-                    _ => (cores * 3 / 4).min(32), // 0.75x cores, capped at 32 for very high-core systems
-                }
-            })
-            .unwrap_or(4)
-    }
-
-    unsafe fn clone_ctx(&self) -> Result<*mut PDFHandle, String> {
-        debug!(
-            "clone_ctx called with self.ctx_handle: 0x{:x}",
-            self.ctx_handle as usize
-        );
-
-        if self.ctx_handle.is_null() {
-            return Err("Base context handle is null".to_string());
-        }
-
-        let mut ctx: *mut c_void = ptr::null_mut();
-
-        unsafe {
-            bridge::clone(
-                &self.ctx_handle as *const _ as *mut PDFHandle,
-                &mut ctx as *mut _ as *mut PDFHandle,
-            )
-            .map_err(|e| format!("Failed to clone context: {}", e.what()))?;
-        }
-
-        if ctx.is_null() {
-            return Err("Cloned context is null".to_string());
-        }
-
-        debug!("Successfully cloned context: 0x{:x}", ctx as usize);
-        Ok(ctx as *mut PDFHandle)
-    }
-
-    unsafe fn clone_doc(&self, new_ctx: *mut PDFHandle) -> Result<*mut PDFHandle, String> {
-        debug!("clone_doc called");
-
-        let mut doc: *mut c_void = ptr::null_mut();
-        let_cxx_string!(cxx_str = self.doc_path.to_string_lossy().to_string());
-
-        unsafe {
-            bridge::clone_doc(
-                &cxx_str,
-                &new_ctx as *const _ as *mut PDFHandle,
-                &mut doc as *mut _ as *mut PDFHandle,
-            )
-            .map_err(|e| format!("Failed to clone document: {}", e.what()))?;
-        }
-
-        if doc.is_null() {
-            return Err("Cloned document is null".to_string());
-        }
-
-        debug!("Successfully cloned document: 0x{:x}", doc as usize);
-        Ok(doc as *mut PDFHandle)
-    }
-
-    unsafe fn spawn_page<F, State>(
-        page: i32,
+    /// [Extractor::iter_pages] on the native render engine, see [ExtractorOptions::engine_workers].
+    /// Pages are rendered by the engine's workers and only the callbacks run on tokio's blocking
+    /// pool, at most [Extractor::calc_max_concurrent_pages] at a time.
+    async unsafe fn run_engine<F, State>(
+        &mut self,
         callback: F,
         render_callback: Sender<Result<(), PageRenderError>>,
-        thread_ctx_addr: MemAddress,
-        thread_doc_addr: MemAddress,
         state: Arc<Mutex<State>>,
-        join_set: &mut JoinSet<()>,
-    ) where
+        mut controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
         F: 'static
-            + Fn(i32, &[u8], i32, i32, i32, Arc<Mutex<State>>) -> ()
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
             + Send
             + Sync
             + Clone
             + Copy,
         State: Send + 'static,
     {
-        let render_callback_clone = render_callback.clone();
-        let callback_clone = callback.clone();
-
-        join_set.spawn(async move {
-            let result = tokio::task::spawn_blocking(move || {
-                let mut size: usize = 0;
-                let mut width: i32 = 0;
-                let mut height: i32 = 0;
-                let mut channels: i32 = 0;
-
-                unsafe {
-                    Self::iter_page(
-                        &mut size,
-                        &mut width,
-                        &mut height,
-                        &mut channels,
-                        page,
-                        callback_clone,
-                        state,
-                        thread_ctx_addr,
-                        thread_doc_addr,
-                    )
-                }
-            })
-            .await;
-
-            match result {
-                Ok(Ok(())) => {
-                    debug!("Page {} processed successfully", page);
-                }
-                Ok(Err(e)) => {
-                    render_callback_clone.send(Err(e)).await.ok();
-                }
-                Err(join_error) => {
-                    render_callback_clone
-                        .send(Err(PageRenderError::Unexpected(format!(
-                            "Task panicked: {}",
-                            join_error
-                        ))))
-                        .await
-                        .ok();
-                }
+        let max_concurrent_pages = self.calc_max_concurrent_pages();
+        // A previous run may have been stopped.
+        self.sessions.resume_renders();
+        let engine = match unsafe {
+            RenderEngine::start(self.sessions.clone(), &self.options, max_concurrent_pages as i32)
+        } {
+            Ok(engine) => Arc::new(engine),
+            Err(e) => {
+                render_callback.send(Err(e)).await.ok();
+                return;
             }
-        });
-    }
+        };
 
-    unsafe fn iter_page<F, State>(
-        size: &mut usize,
-        width: &mut i32,
-        height: &mut i32,
-        channels: &mut i32,
-        page: i32,
-        callback: F,
-        state: Arc<Mutex<State>>,
-        ctx_handle: MemAddress,
-        doc_handle: MemAddress,
-    ) -> Result<(), PageRenderError>
-    where
-        F: 'static
-            + Fn(i32, &[u8], i32, i32, i32, Arc<Mutex<State>>) -> ()
-            + Send
-            + Sync
-            + Clone
-            + Copy,
-    {
         debug!(
-            "Iterating over page {} with ctx: 0x{:x}, doc: 0x{:x}",
-            page, ctx_handle, doc_handle
+            "Started render engine with {} workers over {} pages",
+            self.options.engine_workers, engine.page_count
         );
 
-        // Validate handles
-        if ctx_handle == 0 {
-            return Err(PageRenderError::InvalidContextHandle);
-        }
-
-        if doc_handle == 0 {
-            return Err(PageRenderError::Unexpected(
-                "Document handle is null".to_string(),
-            ));
-        }
+        // One blocking thread drains the completion queue, so waiting on the engine never
+        // holds up the runtime.
+        let (pages_sender, mut pages) = tokio::sync::mpsc::channel(max_concurrent_pages);
+        let poller = engine.clone();
+        tokio::task::spawn_blocking(move || loop {
+            let page = match poller.next(ENGINE_POLL_MS) {
+                EnginePoll::Page(page, image) => (
+                    page,
+                    image.map(|image| EnginePage {
+                        image,
+                        _engine: poller.clone(),
+                    }),
+                ),
+                EnginePoll::Pending if pages_sender.is_closed() => break,
+                EnginePoll::Pending => continue,
+                EnginePoll::Done => break,
+            };
 
-        let image = unsafe {
-            // Convert MemAddress values back to PDFHandle values and create stack variables
-            let ctx_handle_value: *mut c_void = ctx_handle as *mut c_void;
-            let doc_handle_value: *mut c_void = doc_handle as *mut c_void;
+            if pages_sender.blocking_send(page).is_err() {
+                break;
+            }
+        });
 
-            debug!(
-                "Calling render_page with ctx_handle_value=0x{:x}, doc_handle_value=0x{:x}",
-                ctx_handle_value as usize, doc_handle_value as usize
-            );
+        let mut pool: JoinSet<()> = JoinSet::new();
+        let mut pages_completed = 0;
+        let mut polling = true;
+        // A closed channel is always ready, so it's only polled until it closes.
+        let mut controller_closed = false;
 
-            bridge::render_page(
-                page,
-                size as *mut usize,
-                width as *mut i32,
-                height as *mut i32,
-                channels as *mut i32,
-                &doc_handle_value as *const *mut c_void as *mut PDFHandle,
-                &ctx_handle_value as *const *mut c_void as *mut PDFHandle,
-            )
-        };
+        loop {
+            select! {
+                msg = controller.recv(), if !controller_closed => {
+                    match msg {
+                        Some(ControlMessage::Stop) => {
+                            debug!("Received stop signal, stopping render engine");
+                            engine.stop();
+                            self.sessions.halt_renders(AbortReason::Stopped);
+                            pool.abort_all();
+                            break;
+                        }
+                        Some(ControlMessage::Pause) => {
+                            debug!("Received pause signal, pausing render engine...");
+                            // Paused first, so workers wait instead of retrying their aborted pages.
+                            engine.pause(true);
+                            self.sessions.halt_renders(AbortReason::Paused);
+
+                            loop {
+                                match controller.recv().await {
+                                    Some(ControlMessage::Resume) => {
+                                        debug!("Received resume signal, resuming render engine...");
+                                        self.sessions.resume_renders();
+                                        engine.pause(false);
+                                        break;
+                                    }
+                                    Some(ControlMessage::Stop) => {
+                                        debug!("Received stop signal while paused, halting");
+                                        engine.stop();
+                                        self.sessions.halt_renders(AbortReason::Stopped);
+                                        pool.abort_all();
+                                        return;
+                                    }
+                                    Some(ControlMessage::Pause) => {
+                                        debug!("Already paused, ignoring additional pause signal");
+                                    }
+                                    None => {
+                                        debug!("Control channel closed while paused");
+                                        engine.stop();
+                                        self.sessions.halt_renders(AbortReason::Stopped);
+                                        pool.abort_all();
+                                        return;
+                                    }
+                                }
+                            }
+                        }
+                        Some(ControlMessage::Resume) => {
+                            debug!("Received resume signal while not paused, ignoring");
+                        }
+                        None => {
+                            debug!("Control channel closed, finishing remaining pages");
+                            controller_closed = true;
+                        }
+                    }
+                }
+
+                // hand finished pages to the callback while there is capacity
+                page = pages.recv(), if polling && pool.len() < max_concurrent_pages => {
+                    match page {
+                        Some((page, Ok(image))) => {
+                            let state = state.clone();
+                            let render_callback = render_callback.clone();
+
+                            pool.spawn(async move {
+                                let result = tokio::task::spawn_blocking(move || {
+                                    callback(page, image.page_image(), state)
+                                })
+                                .await;
+
+                                if let Err(join_error) = result {
+                                    render_callback
+                                        .send(Err(PageRenderError::Unexpected(format!(
+                                            "Task panicked: {}",
+                                            join_error
+                                        ))))
+                                        .await
+                                        .ok();
+                                }
+                            });
+                        }
+                        Some((_, Err(e))) => {
+                            render_callback.send(Err(e)).await.ok();
+                        }
+                        None => {
+                            debug!("Render engine is done");
+                            polling = false;
+                        }
+                    }
+                }
 
-        debug!("Attempted to render page from FFI!");
+                result = pool.join_next(), if !pool.is_empty() => {
+                    self.handle_task_completion(&mut pages_completed, result);
+                }
 
-        // Cleanup function for both context and document
-        unsafe fn cleanup_ctx_and_doc(ctx_handle: MemAddress, doc_handle: MemAddress) {
-            unsafe {
-                bridge::cleanup_pdf(doc_handle as *mut PDFHandle, ctx_handle as *mut PDFHandle)
-            };
+                _ = async {}, if !polling && pool.is_empty() => {
+                    debug!("All pages completed!");
+                    break;
+                }
+            }
         }
 
-        let image = match image {
-            Ok(i) => i,
+        debug!("Done iterating over pages!");
+    }
+
+    fn calc_max_concurrent_pages(&self) -> usize {
+        max_concurrent_pages()
+    }
+
+    /// The byte budget of a [Extractor::run_pages] run and the bytes of each of its tasks,
+    /// `None` without [ExtractorOptions::inflight_bytes] or if the bounds can't be read.
+    /// The prescan reads every page object, so it runs on the blocking pool like opening a
+    /// [Corpus] document does.
+    async fn task_admission(
+        &mut self,
+        footprint: Option<PageFootprint>,
+        pages_per_task: i32,
+    ) -> Option<(ByteBudget, Arc<[u64]>)> {
+        let budget = ByteBudget::new(self.options.inflight_bytes?);
+        let footprint = footprint?;
+        let page_info = match &self.page_info {
+            Some(page_info) => Ok(page_info.clone()),
+            None => {
+                let doc_handle = self.doc_handle as MemAddress;
+                let ctx_handle = self.ctx_handle as MemAddress;
+                let page_count = self.page_count;
+                let sessions = self.sessions.clone();
+                tokio::task::spawn_blocking(move || unsafe {
+                    Self::scan_pages(page_count, doc_handle, ctx_handle, &sessions)
+                })
+                .await
+                .unwrap_or_else(|e| {
+                    Err(PageRenderError::Unexpected(format!("Task panicked: {}", e)))
+                })
+            }
+        };
+        let page_info = match page_info {
+            Ok(page_info) => {
+                self.page_info = Some(page_info.clone());
+                page_info
+            }
             Err(e) => {
-                let error_msg = e.what().to_string();
+                debug!("Admitting pages by count only, prescan failed: {}", e);
+                return None;
+            }
+        };
 
-                #[cfg(feature = "logging")]
-                error!("Failed to render page {}: {}", page, error_msg);
+        let task_bytes = page_info
+            .chunks(pages_per_task.max(1) as usize)
+            .map(|pages| pages.iter().map(|page| footprint.bytes(page)).sum())
+            .collect();
+        Some((budget, task_bytes))
+    }
 
-                unsafe {
-                    cleanup_ctx_and_doc(ctx_handle, doc_handle);
-                    // cleanup of image happens on C++ side.
-                };
+    unsafe fn spawn_page<J>(
+        page: i32,
+        job: J,
+        render_callback: Sender<Result<(), PageRenderError>>,
+        sessions: Arc<SessionPool>,
+        queue: Arc<RenderQueue>,
+        admission: Option<(ByteBudget, u64)>,
+        join_set: &mut JoinSet<()>,
+    ) where
+        J: 'static + Fn(PageNum, &SessionPool) -> Result<(), PageRenderError> + Send + Sync + Clone,
+    {
+        let render_callback_clone = render_callback.clone();
 
-                // Check for document corruption errors that should terminate processing
-                if error_msg.contains("Document corruption detected")
-                    || error_msg.contains("corrupted and cannot be processed")
-                    || error_msg.contains("object out of range")
-                    || error_msg.contains("non-page object in page tree")
-                {
-                    #[cfg(feature = "logging")]
-                    error!(
-                        "Document corruption detected at page {}, terminating processing",
-                        page
-                    );
+        join_set.spawn(async move {
+            // Held until the callback is done with the page's image.
+            let _permit = admit(&admission).await;
+            let seen = sessions.received_bytes();
+            let waiter = sessions.clone();
+            let result = tokio::task::spawn_blocking(move || job(page, &sessions)).await;
 
-                    return Err(PageRenderError::Unexpected(format!(
-                        "Document corruption detected at page {}: {}",
-                        page, error_msg
-                    )));
+            match result {
+                Ok(Ok(())) => {
+                    debug!("Page {} processed successfully", page);
+                    queue.finish(page);
                 }
+                Ok(Err(
+                    e @ PageRenderError::Aborted {
+                        reason: AbortReason::Incomplete,
+                        ..
+                    },
+                )) => {
+                    // Bytes that arrived while the page rendered count, so it can't miss them.
+                    let arrived = tokio::task::spawn_blocking(move || waiter.wait_for_bytes(seen))
+                        .await
+                        .unwrap_or(false);
 
-                return Err(PageRenderError::Unexpected(error_msg));
+                    if arrived {
+                        debug!(
+                            "Page {} needed bytes that have arrived now, rendering it again",
+                            page
+                        );
+                        queue.requeue(page);
+                    } else {
+                        queue.finish(page);
+                        render_callback_clone.send(Err(e)).await.ok();
+                    }
+                }
+                Ok(Err(PageRenderError::Aborted {
+                    reason: reason @ (AbortReason::Paused | AbortReason::Cancelled),
+                    ..
+                })) => {
+                    debug!(
+                        "Page {} was aborted ({:?}), rendering it again",
+                        page, reason
+                    );
+                    queue.requeue(page);
+                }
+                Ok(Err(e)) => {
+                    queue.finish(page);
+                    render_callback_clone.send(Err(e)).await.ok();
+                }
+                Err(join_error) => {
+                    queue.finish(page);
+                    render_callback_clone
+                        .send(Err(PageRenderError::Unexpected(format!(
+                            "Task panicked: {}",
+                            join_error
+                        ))))
+                        .await
+                        .ok();
+                }
             }
-        };
+        });
+    }
 
-        debug!("Rendered page!");
+    unsafe fn iter_page<F, State>(
+        page: i32,
+        format: OutputFormat,
+        callback: F,
+        state: Arc<Mutex<State>>,
+        sessions: &SessionPool,
+    ) -> Result<(), PageRenderError>
+    where
+        F: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+    {
+        let session = unsafe { sessions.checkout()? };
 
-        let image_slice = unsafe { from_raw_parts(image, *size) };
+        debug!("Iterating over page {} with session: 0x{:x}", page, session.addr);
 
-        debug!("Converted page to a slice! calling callback function...");
+        // Declared after the session so the image (which belongs to the session's
+        // context) is released before the session is handed back.
+        let image = unsafe { session.render_image(page, format)? };
 
-        callback(page, image_slice, *width, *height, *channels, state);
+        debug!("Rendered page! calling callback function...");
 
-        debug!("Successfully called callback function! freeing image data.");
+        callback(page, image.page_image(), state);
 
-        unsafe { bridge::free_image_data(image) };
+        debug!("Successfully called callback function!");
 
-        debug!("Image data freed!");
         if page % 10 == 0 {
             debug!("Flushing MuPDF cache! (every 10 pages)");
+            drop(image);
+            unsafe { session.flush_cache() };
+        }
 
-            unsafe {
-                bridge::flush_cache(ctx_handle as *mut PDFHandle);
-            }
+        Ok(())
+    }
+
+    unsafe fn iter_page_tiered<C, F, State>(
+        page: i32,
+        format: OutputFormat,
+        classify_scale: f32,
+        classify: C,
+        extract: F,
+        state: Arc<Mutex<State>>,
+        sessions: &SessionPool,
+    ) -> Result<(), PageRenderError>
+    where
+        C: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> bool
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        F: 'static
+            + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+    {
+        let session = unsafe { sessions.checkout()? };
+        let list = unsafe { session.load_display_list(page)? };
+
+        let accepted = {
+            let thumbnail = unsafe { list.render(classify_scale, format)? };
+            classify(page, thumbnail.page_image(), state.clone())
+        };
+
+        if accepted {
+            debug!("Page {} accepted by classifier, rendering at full scale", page);
 
-            debug!("Flushed MuPDF cache!");
+            let image =
+                unsafe { list.render(sessions.profile.scale, format) }.map_err(after_output)?;
+            extract(page, image.page_image(), state);
         }
 
-        unsafe {
-            cleanup_ctx_and_doc(ctx_handle, doc_handle);
+        Ok(())
+    }
+
+    unsafe fn iter_page_regions<C, F, State>(
+        page: i32,
+        format: OutputFormat,
+        regions: &'static [RegionOfInterest],
+        classify: C,
+        extract: F,
+        state: Arc<Mutex<State>>,
+        sessions: &SessionPool,
+    ) -> Result<(), PageRenderError>
+    where
+        C: 'static
+            + Fn(PageNum, &[RegionImage], Arc<Mutex<State>>) -> bool
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        F: 'static + Fn(PageNum, PageImage, Arc<Mutex<State>>) -> () + Send + Sync + Clone + Copy,
+    {
+        let session = unsafe { sessions.checkout()? };
+        let list = unsafe { session.load_display_list(page)? };
+
+        let accepted = {
+            let on_page: Vec<PageRegion> = regions
+                .iter()
+                .map(|region| region.on_page(list.bounds))
+                .collect();
+            let rendered = unsafe { list.render_regions(&on_page, format)? };
+            let images: Vec<RegionImage> = rendered
+                .iter()
+                .map(|(region, image)| image.region_image(*region))
+                .collect();
+            classify(page, &images, state.clone())
         };
+
+        if accepted {
+            debug!(
+                "Page {} accepted by classifier, rendering at full scale",
+                page
+            );
+
+            let image =
+                unsafe { list.render(sessions.profile.scale, format) }.map_err(after_output)?;
+            extract(page, image.page_image(), state);
+        }
+
+        Ok(())
+    }
+
+    unsafe fn iter_page_banded<F, State>(
+        page: i32,
+        format: OutputFormat,
+        band_height: i32,
+        callback: F,
+        state: Arc<Mutex<State>>,
+        sessions: &SessionPool,
+    ) -> Result<(), PageRenderError>
+    where
+        F: 'static
+            + Fn(PageNum, PageBand, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+    {
+        let session = unsafe { sessions.checkout()? };
+        let mut bands = unsafe { session.open_bands(page, band_height, format)? };
+        let mut delivered = false;
+
+        while let Some(band) =
+            unsafe { bands.next_band() }.map_err(|e| if delivered { after_output(e) } else { e })?
+        {
+            callback(page, band, state.clone());
+            delivered = true;
+        }
+
         Ok(())
     }
 
@@ -545,22 +2209,15 @@ impl Extractor {
         }
     }
 
-    unsafe fn spawn_tasks<F, State>(
+    unsafe fn spawn_tasks<J>(
         &self,
-        pages_spawned: &mut i32,
-        callback: F,
+        job: J,
         render_callback: Sender<Result<(), PageRenderError>>,
-        state: Arc<Mutex<State>>,
+        admission: &Option<(ByteBudget, Arc<[u64]>)>,
         pool: &mut JoinSet<()>,
     ) -> ()
     where
-        F: 'static
-            + Fn(i32, &[u8], i32, i32, i32, Arc<Mutex<State>>) -> ()
-            + Send
-            + Sync
-            + Clone
-            + Copy,
-        State: Send + 'static,
+        J: 'static + Fn(PageNum, &SessionPool) -> Result<(), PageRenderError> + Send + Sync + Clone,
     {
         // Process pages in batches for better cache locality
         const BATCH_SIZE: i32 = 4;
@@ -568,81 +2225,24 @@ impl Extractor {
         let batch_count = std::cmp::min(available_slots, BATCH_SIZE as usize) as i32;
 
         for _ in 0..batch_count {
-            let page = *pages_spawned;
-            if page >= self.page_count {
+            let Some(page) = self.render_queue.next() else {
                 return;
-            }
-
-            *pages_spawned += 1;
-
-            debug!("Spawning task for page {}", page);
-
-            // First clone the context
-            let thread_ctx_addr = match unsafe { self.clone_ctx() } {
-                Ok(ctx) => {
-                    debug!("Successfully cloned context for page {}", page);
-                    ctx as MemAddress
-                }
-                Err(e) => {
-                    #[cfg(feature = "logging")]
-                    log::error!("Failed to clone context for page {}: {}", page, e);
-
-                    // Use blocking send to ensure the error is delivered
-                    let render_callback_clone = render_callback.clone();
-                    tokio::spawn(async move {
-                        render_callback_clone
-                            .send(Err(PageRenderError::Unexpected(e)))
-                            .await
-                            .ok();
-                    });
-                    continue;
-                }
-            };
-
-            // Then clone the document using the new context
-            let thread_doc_addr = match unsafe { self.clone_doc(thread_ctx_addr as *mut PDFHandle) }
-            {
-                Ok(doc) => {
-                    debug!("Successfully cloned document for page {}", page);
-                    doc as MemAddress
-                }
-                Err(e) => {
-                    #[cfg(feature = "logging")]
-                    log::error!("Failed to clone document for page {}: {}", page, e);
-
-                    // Cleanup the context we just created
-                    unsafe {
-                        bridge::cleanup_pdf(
-                            null_mut() as *mut PDFHandle,
-                            thread_ctx_addr as *mut PDFHandle,
-                        );
-                    }
-
-                    // Use blocking send to ensure the error is delivered
-                    let render_callback_clone = render_callback.clone();
-                    tokio::spawn(async move {
-                        render_callback_clone
-                            .send(Err(PageRenderError::Unexpected(e)))
-                            .await
-                            .ok();
-                    });
-                    continue;
-                }
             };
+            let task = page as usize / self.render_queue.pages_per_task();
+            let task_admission = admission
+                .as_ref()
+                .map(|(budget, task_bytes)| (budget.clone(), task_bytes[task]));
 
-            debug!(
-                "Spawning page {} with ctx_addr: 0x{:x}, doc_addr: 0x{:x}",
-                page, thread_ctx_addr, thread_doc_addr
-            );
+            debug!("Spawning task for page {}", page);
 
             unsafe {
                 Self::spawn_page(
                     page,
-                    callback,
+                    job.clone(),
                     render_callback.clone(),
-                    thread_ctx_addr,
-                    thread_doc_addr,
-                    state.clone(),
+                    self.sessions.clone(),
+                    self.render_queue.clone(),
+                    task_admission,
                     pool,
                 )
             };
@@ -650,23 +2250,1724 @@ impl Extractor {
     }
 }
 
-impl Drop for Extractor {
+/// Entries of the `abort_buf` filled for a failed render, see `AbortLayout` in `src_cpp/main.h`.
+const ABORT_FIELDS: usize = 3;
+
+/// [render_error], except that a render aborted through its cookie, as told by `abort`,
+/// becomes [PageRenderError::Aborted].
+fn abort_error(page: PageNum, e: &cxx::Exception, abort: &[u64; ABORT_FIELDS]) -> PageRenderError {
+    match AbortReason::from_raw(abort[0]) {
+        Some(reason) => PageRenderError::Aborted {
+            page,
+            reason,
+            progress: abort[1],
+            progress_max: (abort[2] != usize::MAX as u64).then_some(abort[2]),
+        },
+        None => render_error(page, e),
+    }
+}
+
+/// For a render after part of its page went to a callback, see
+/// [PageRenderError::AbortedAfterOutput].
+fn after_output(e: PageRenderError) -> PageRenderError {
+    match e {
+        PageRenderError::Aborted { page, reason, .. } if reason.retried() => {
+            PageRenderError::AbortedAfterOutput { page, reason }
+        }
+        e => e,
+    }
+}
+
+/// Maps an exception thrown while rendering `page` on the C++ side into a [PageRenderError].
+fn render_error(page: PageNum, e: &cxx::Exception) -> PageRenderError {
+    let error_msg = e.what().to_string();
+
+    #[cfg(feature = "logging")]
+    error!("Failed to render page {}: {}", page, error_msg);
+
+    // Check for document corruption errors that should terminate processing
+    if error_msg.contains("Document corruption detected")
+        || error_msg.contains("corrupted and cannot be processed")
+        || error_msg.contains("object out of range")
+        || error_msg.contains("non-page object in page tree")
+    {
+        #[cfg(feature = "logging")]
+        error!(
+            "Document corruption detected at page {}, terminating processing",
+            page
+        );
+
+        return PageRenderError::Unexpected(format!(
+            "Document corruption detected at page {}: {}",
+            page, error_msg
+        ));
+    }
+
+    PageRenderError::Unexpected(error_msg)
+}
+
+/// A page image owned by the C++ side, released when dropped.
+struct RenderedImage {
+    handle: *mut c_void,
+    data: *mut u8,
+    size: usize,
+    format: OutputFormat,
+    width: i32,
+    height: i32,
+    channels: i32,
+    stride: i32,
+    flags: i32,
+}
+
+/// Bits of [RenderedImage::flags], see `ImageFlags` in `src_cpp/main.h`.
+const IMAGE_BLANK: i32 = 1;
+const IMAGE_CACHED: i32 = 2;
+const IMAGE_PASSTHROUGH: i32 = 4;
+
+impl RenderedImage {
+    fn empty(format: OutputFormat) -> Self {
+        Self {
+            handle: ptr::null_mut(),
+            data: null_mut(),
+            size: 0,
+            format,
+            width: 0,
+            height: 0,
+            channels: 0,
+            stride: 0,
+            flags: 0,
+        }
+    }
+
+    fn page_image(&self) -> PageImage<'_> {
+        PageImage {
+            // Blank pages come back without any bytes.
+            data: if self.data.is_null() {
+                &[]
+            } else {
+                unsafe { from_raw_parts(self.data, self.size) }
+            },
+            format: self.format,
+            width: self.width,
+            height: self.height,
+            channels: self.channels,
+            stride: self.stride as usize,
+            blank: self.flags & IMAGE_BLANK != 0,
+            repeated: self.flags & IMAGE_CACHED != 0,
+            passthrough: self.flags & IMAGE_PASSTHROUGH != 0,
+            stats: self.stats(),
+        }
+    }
+
+    fn region_image(&self, region: PageRegion) -> RegionImage<'_> {
+        RegionImage {
+            region,
+            data: unsafe { from_raw_parts(self.data, self.size) },
+            width: self.width,
+            height: self.height,
+            stride: self.stride as usize,
+        }
+    }
+
+    fn stats(&self) -> Option<PageStats> {
+        if self.handle.is_null() {
+            return None;
+        }
+
+        let mut image_handle = self.handle;
+        let mut stats = PageStats::default();
+
+        let timed = unsafe {
+            bridge::page_image_stats(
+                stats.stage_ns.as_mut_ptr(),
+                &mut stats.sample_bytes as *mut usize,
+                &mut stats.output_bytes as *mut usize,
+                &mut image_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        };
+
+        matches!(timed, Ok(true)).then_some(stats)
+    }
+}
+
+impl Drop for RenderedImage {
     fn drop(&mut self) {
-        if !self.doc_handle.is_null() || !self.ctx_handle.is_null() {
-            unsafe {
-                bridge::cleanup_pdf(
-                    if self.doc_handle.is_null() {
-                        null_mut()
-                    } else {
-                        self.doc_handle
-                    },
-                    if self.ctx_handle.is_null() {
-                        null_mut()
-                    } else {
-                        self.ctx_handle
-                    },
+        unsafe { bridge::free_page_image(&mut self.handle as *mut *mut c_void as *mut PDFHandle) };
+    }
+}
+
+/// How long the completion queue poller waits for a page before checking whether anyone
+/// still listens.
+const ENGINE_POLL_MS: i32 = 50;
+
+/// Values of the status set by `next_engine_page`, see `EngineStatus` in `src_cpp/main.h`.
+const ENGINE_PAGE: i32 = 0;
+const ENGINE_DONE: i32 = 2;
+
+/// The native render engine started for [ExtractorOptions::engine_workers]. Its workers own
+/// their sessions, opened from the pool's base context, so the pool is kept alive with them.
+/// Stopped, joined and freed when dropped, which only happens once every [EnginePage] is gone.
+struct RenderEngine {
+    handle: MemAddress,
+    page_count: i32,
+    format: OutputFormat,
+    _sessions: Arc<SessionPool>,
+}
+
+enum EnginePoll {
+    Page(PageNum, Result<RenderedImage, PageRenderError>),
+    Pending,
+    Done,
+}
+
+impl RenderEngine {
+    unsafe fn start(
+        sessions: Arc<SessionPool>,
+        options: &ExtractorOptions,
+        queue_depth: i32,
+    ) -> Result<Self, PageRenderError> {
+        let mut base_ctx: *mut c_void = sessions.base_ctx as *mut c_void;
+        let mut source: *mut c_void = sessions.source as *mut c_void;
+        let mut cache_handle: *mut c_void = sessions.render_cache as *mut c_void;
+        let mut profile_handle: *mut c_void = sessions.render_profile as *mut c_void;
+        let mut stats_handle: *mut c_void = sessions.render_stats as *mut c_void;
+        let mut control_handle: *mut c_void = sessions.render_control as *mut c_void;
+        let mut engine: *mut c_void = ptr::null_mut();
+        let mut page_count: i32 = 0;
+        let_cxx_string!(cxx_str = sessions.doc_path.to_string_lossy().to_string());
+
+        unsafe {
+            bridge::start_render_engine(
+                &cxx_str,
+                options.engine_workers as i32,
+                options.pin_engine_workers,
+                sessions.share_store,
+                options.output as i32,
+                sessions.blank_ratio,
+                sessions.passthrough,
+                queue_depth,
+                options.prefetch_depth as i32,
+                &mut base_ctx as *mut _ as *mut PDFHandle,
+                &mut source as *mut _ as *mut PDFHandle,
+                &mut cache_handle as *mut _ as *mut PDFHandle,
+                &mut profile_handle as *mut _ as *mut PDFHandle,
+                if sessions.render_stats != 0 {
+                    &mut stats_handle as *mut _ as *mut PDFHandle
+                } else {
+                    ptr::null_mut()
+                },
+                &mut control_handle as *mut _ as *mut PDFHandle,
+                &mut engine as *mut _ as *mut PDFHandle,
+                &mut page_count as *mut i32,
+            )
+        }
+        .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+        Ok(Self {
+            handle: engine as MemAddress,
+            page_count,
+            format: options.output,
+            _sessions: sessions,
+        })
+    }
+
+    fn handle(&self) -> *mut c_void {
+        self.handle as *mut c_void
+    }
+
+    /// Takes the next finished page, waiting up to `timeout_ms` for one.
+    fn next(&self, timeout_ms: i32) -> EnginePoll {
+        let mut engine_handle = self.handle();
+        let mut status: i32 = 0;
+        let mut page: PageNum = 0;
+        let mut image = RenderedImage::empty(self.format);
+        let mut abort = [0u64; ABORT_FIELDS];
+
+        let result = unsafe {
+            bridge::next_engine_page(
+                timeout_ms,
+                &mut status as *mut i32,
+                &mut page as *mut i32,
+                &mut image.size as *mut usize,
+                &mut image.width as *mut i32,
+                &mut image.height as *mut i32,
+                &mut image.channels as *mut i32,
+                &mut image.stride as *mut i32,
+                &mut image.flags as *mut i32,
+                abort.as_mut_ptr(),
+                &mut engine_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut image.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        };
+
+        match result {
+            Ok(data) if status == ENGINE_PAGE => {
+                image.data = data;
+                EnginePoll::Page(page, Ok(image))
+            }
+            Ok(_) if status == ENGINE_DONE => EnginePoll::Done,
+            Ok(_) => EnginePoll::Pending,
+            Err(e) => EnginePoll::Page(page, Err(abort_error(page, &e, &abort))),
+        }
+    }
+
+    fn pause(&self, paused: bool) {
+        let mut engine_handle = self.handle();
+        unsafe {
+            bridge::pause_render_engine(paused, &mut engine_handle as *mut _ as *mut PDFHandle)
+        };
+    }
+
+    fn stop(&self) {
+        let mut engine_handle = self.handle();
+        unsafe { bridge::stop_render_engine(&mut engine_handle as *mut _ as *mut PDFHandle) };
+    }
+}
+
+impl Drop for RenderEngine {
+    fn drop(&mut self) {
+        let mut engine_handle = self.handle();
+        unsafe { bridge::free_render_engine(&mut engine_handle as *mut _ as *mut PDFHandle) };
+    }
+}
+
+/// A page finished by a [RenderEngine] worker. Unlike session images it may be dropped on any
+/// thread, the C++ side hands it back to the worker that rendered it.
+struct EnginePage {
+    // Declared first, so the image is released before the engine can be freed.
+    image: RenderedImage,
+    _engine: Arc<RenderEngine>,
+}
+
+unsafe impl Send for EnginePage {}
+
+impl EnginePage {
+    fn page_image(&self) -> PageImage<'_> {
+        self.image.page_image()
+    }
+}
+
+/// A display list recorded from one page, owned by the session's context.
+struct DisplayList<'a> {
+    handle: *mut c_void,
+    page: PageNum,
+    /// The page's bounds in points, as `[x0, y0, x1, y1]`.
+    bounds: [f32; 4],
+    session: &'a Session<'a>,
+}
+
+impl DisplayList<'_> {
+    /// Rasterizes the recorded page at `scale` (1.0 = 72 DPI) without touching the document.
+    unsafe fn render(&self, scale: f32, format: OutputFormat) -> Result<RenderedImage, PageRenderError> {
+        let mut list_handle = self.handle;
+        let mut image = RenderedImage::empty(format);
+
+        image.data = unsafe {
+            bridge::render_display_list(
+                scale,
+                format as i32,
+                &mut image.size as *mut usize,
+                &mut image.width as *mut i32,
+                &mut image.height as *mut i32,
+                &mut image.channels as *mut i32,
+                &mut image.stride as *mut i32,
+                &mut list_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut image.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.session.render_error(self.page, &e))?;
+
+        Ok(image)
+    }
+
+    /// Rasterizes only what `region` covers of the recorded page, at the region's scale.
+    unsafe fn render_region(
+        &self,
+        region: &PageRegion,
+        format: OutputFormat,
+    ) -> Result<RenderedImage, PageRenderError> {
+        let mut list_handle = self.handle;
+        let mut image = RenderedImage::empty(format);
+
+        image.data = unsafe {
+            bridge::render_display_list_region(
+                region.rect.as_ptr(),
+                region.scale,
+                format as i32,
+                &mut image.size as *mut usize,
+                &mut image.width as *mut i32,
+                &mut image.height as *mut i32,
+                &mut image.channels as *mut i32,
+                &mut image.stride as *mut i32,
+                &mut list_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut image.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.session.render_error(self.page, &e))?;
+
+        Ok(image)
+    }
+
+    /// Every region of `regions` rendered in order, with the region it was rendered for.
+    unsafe fn render_regions(
+        &self,
+        regions: &[PageRegion],
+        format: OutputFormat,
+    ) -> Result<Vec<(PageRegion, RenderedImage)>, PageRenderError> {
+        regions
+            .iter()
+            .map(|region| Ok((*region, unsafe { self.render_region(region, format)? })))
+            .collect()
+    }
+}
+
+impl Drop for DisplayList<'_> {
+    fn drop(&mut self) {
+        unsafe { bridge::free_display_list(&mut self.handle as *mut *mut c_void as *mut PDFHandle) };
+    }
+}
+
+/// A page being drawn band by band, owned by the session's context.
+struct BandRenderer<'a> {
+    handle: *mut c_void,
+    page: PageNum,
+    format: OutputFormat,
+    width: i32,
+    height: i32,
+    stride: i32,
+    session: &'a Session<'a>,
+}
+
+impl BandRenderer<'_> {
+    /// Draws the next band, or returns `None` once the whole page was handed out.
+    /// The band borrows the renderer, so it is gone before the next one is drawn.
+    unsafe fn next_band(&mut self) -> Result<Option<PageBand<'_>>, PageRenderError> {
+        let mut size: usize = 0;
+        let mut y: i32 = 0;
+        let mut rows: i32 = 0;
+
+        let data = unsafe {
+            bridge::render_next_band(
+                &mut size as *mut usize,
+                &mut y as *mut i32,
+                &mut rows as *mut i32,
+                &mut self.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.session.render_error(self.page, &e))?;
+
+        if rows == 0 {
+            return Ok(None);
+        }
+
+        Ok(Some(PageBand {
+            data: unsafe { from_raw_parts(data, size) },
+            format: self.format,
+            width: self.width,
+            height: self.height,
+            y,
+            rows,
+            stride: self.stride as usize,
+        }))
+    }
+}
+
+impl Drop for BandRenderer<'_> {
+    fn drop(&mut self) {
+        unsafe { bridge::close_band_renderer(&mut self.handle as *mut *mut c_void as *mut PDFHandle) };
+    }
+}
+
+/// Pages rendered back to back by one `render_pages` call, owned by the session's context.
+struct PageBatch<'a> {
+    handle: *mut c_void,
+    len: usize,
+    format: OutputFormat,
+    _session: &'a Session<'a>,
+}
+
+impl PageBatch<'_> {
+    fn len(&self) -> usize {
+        self.len
+    }
+
+    /// The page at `index` of the batch and its image, or why it failed to render.
+    fn page(&self, index: usize) -> (PageNum, Result<PageImage<'_>, PageRenderError>) {
+        let mut batch_handle = self.handle;
+        let mut page: PageNum = 0;
+        let mut size: usize = 0;
+        let mut width: i32 = 0;
+        let mut height: i32 = 0;
+        let mut channels: i32 = 0;
+        let mut stride: i32 = 0;
+        let mut abort = [0u64; ABORT_FIELDS];
+
+        let result = unsafe {
+            bridge::batch_page(
+                index as i32,
+                &mut page as *mut i32,
+                &mut size as *mut usize,
+                &mut width as *mut i32,
+                &mut height as *mut i32,
+                &mut channels as *mut i32,
+                &mut stride as *mut i32,
+                abort.as_mut_ptr(),
+                &mut batch_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        };
+
+        let image = result
+            .map(|data| PageImage {
+                data: unsafe { from_raw_parts(data, size) },
+                format: self.format,
+                width,
+                height,
+                channels,
+                stride: stride as usize,
+                blank: false,
+                repeated: false,
+                passthrough: false,
+                stats: None,
+            })
+            .map_err(|e| abort_error(page, &e, &abort));
+
+        (page, image)
+    }
+}
+
+impl Drop for PageBatch<'_> {
+    fn drop(&mut self) {
+        unsafe { bridge::free_page_batch(&mut self.handle as *mut *mut c_void as *mut PDFHandle) };
+    }
+}
+
+/// A worker session checked out of a [SessionPool], returned to it when dropped.
+struct Session<'a> {
+    pool: &'a SessionPool,
+    addr: MemAddress,
+}
+
+impl Session<'_> {
+    fn handle(&self) -> *mut c_void {
+        self.addr as *mut c_void
+    }
+
+    /// Maps an exception thrown while rendering `page` on this session, telling a page aborted
+    /// through its cookie from one that failed, see [abort_error].
+    fn render_error(&self, page: PageNum, e: &cxx::Exception) -> PageRenderError {
+        let mut session_handle = self.handle();
+        let mut abort = [0u64; ABORT_FIELDS];
+
+        match unsafe {
+            bridge::last_render_abort(
+                abort.as_mut_ptr(),
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        } {
+            Ok(()) => abort_error(page, e, &abort),
+            Err(_) => render_error(page, e),
+        }
+    }
+
+    unsafe fn render_image(
+        &self,
+        page: PageNum,
+        format: OutputFormat,
+    ) -> Result<RenderedImage, PageRenderError> {
+        let mut session_handle = self.handle();
+        let mut cache_handle: *mut c_void = self.pool.render_cache as *mut c_void;
+        let mut image = RenderedImage::empty(format);
+
+        image.data = unsafe {
+            bridge::render_session_image(
+                page,
+                format as i32,
+                self.pool.blank_ratio,
+                self.pool.passthrough,
+                &mut image.size as *mut usize,
+                &mut image.width as *mut i32,
+                &mut image.height as *mut i32,
+                &mut image.channels as *mut i32,
+                &mut image.stride as *mut i32,
+                &mut image.flags as *mut i32,
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut cache_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut image.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.render_error(page, &e))?;
+
+        Ok(image)
+    }
+
+    unsafe fn render_batch(
+        &self,
+        pages: &[PageNum],
+        scale: f32,
+        format: OutputFormat,
+    ) -> Result<PageBatch<'_>, PageRenderError> {
+        let mut session_handle = self.handle();
+        let mut cache_handle: *mut c_void = self.pool.render_cache as *mut c_void;
+        let mut batch = PageBatch {
+            handle: ptr::null_mut(),
+            len: pages.len(),
+            format,
+            _session: self,
+        };
+
+        unsafe {
+            bridge::render_pages(
+                pages.as_ptr(),
+                pages.len() as i32,
+                format as i32,
+                scale,
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut cache_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut batch.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        // Failing pages are kept in the batch, so this only fails for the batch as a whole.
+        .map_err(|e| self.render_error(pages.first().copied().unwrap_or(0), &e))?;
+
+        Ok(batch)
+    }
+
+    unsafe fn load_display_list(&self, page: PageNum) -> Result<DisplayList<'_>, PageRenderError> {
+        let mut session_handle = self.handle();
+        let mut list_handle: *mut c_void = ptr::null_mut();
+        let mut bounds = [0f32; 4];
+
+        unsafe {
+            bridge::load_display_list(
+                page,
+                bounds.as_mut_ptr(),
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut list_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.render_error(page, &e))?;
+
+        Ok(DisplayList {
+            handle: list_handle,
+            page,
+            bounds,
+            session: self,
+        })
+    }
+
+    unsafe fn open_bands(
+        &self,
+        page: PageNum,
+        band_height: i32,
+        format: OutputFormat,
+    ) -> Result<BandRenderer<'_>, PageRenderError> {
+        let mut session_handle = self.handle();
+        let mut bands = BandRenderer {
+            handle: ptr::null_mut(),
+            page,
+            format,
+            width: 0,
+            height: 0,
+            stride: 0,
+            session: self,
+        };
+
+        unsafe {
+            bridge::open_band_renderer(
+                page,
+                band_height,
+                format as i32,
+                &mut bands.width as *mut i32,
+                &mut bands.height as *mut i32,
+                &mut bands.stride as *mut i32,
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut bands.handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.render_error(page, &e))?;
+
+        Ok(bands)
+    }
+
+    unsafe fn load_text(&self, page: PageNum) -> Result<PageText, PageRenderError> {
+        let mut session_handle = self.handle();
+        let mut text_handle: *mut c_void = ptr::null_mut();
+        let mut size: usize = 0;
+        let mut block_count: i32 = 0;
+        let mut line_count: i32 = 0;
+
+        let data = unsafe {
+            bridge::load_page_text(
+                page,
+                &mut size as *mut usize,
+                &mut block_count as *mut i32,
+                &mut line_count as *mut i32,
+                &mut session_handle as *mut *mut c_void as *mut PDFHandle,
+                &mut text_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| self.render_error(page, &e))?;
+
+        let mut block_boxes: Vec<f32> = vec![0.0; block_count as usize * 4];
+        let mut line_boxes: Vec<f32> = vec![0.0; line_count as usize * 4];
+        let mut line_ends: Vec<i32> = vec![0; line_count as usize];
+        let mut line_blocks: Vec<i32> = vec![0; line_count as usize];
+
+        let read = unsafe {
+            bridge::read_page_text(
+                block_boxes.as_mut_ptr(),
+                line_boxes.as_mut_ptr(),
+                line_ends.as_mut_ptr(),
+                line_blocks.as_mut_ptr(),
+                &mut text_handle as *mut *mut c_void as *mut PDFHandle,
+            )
+        };
+
+        // The text is owned by the handle, so it's copied out before the handle is freed.
+        let text = String::from_utf8_lossy(unsafe { from_raw_parts(data, size) }).into_owned();
+        unsafe { bridge::free_page_text(&mut text_handle as *mut *mut c_void as *mut PDFHandle) };
+        read.map_err(|e| render_error(page, &e))?;
+
+        let rect = |boxes: &[f32], i: usize| [boxes[i * 4], boxes[i * 4 + 1], boxes[i * 4 + 2], boxes[i * 4 + 3]];
+        let mut blocks: Vec<TextBlock> = (0..block_count as usize)
+            .map(|block| TextBlock {
+                bbox: rect(&block_boxes, block),
+                lines: Vec::new(),
+            })
+            .collect();
+
+        let mut start = 0;
+        for line in 0..line_count as usize {
+            let end = line_ends[line] as usize;
+            blocks[line_blocks[line] as usize].lines.push(TextLine {
+                bbox: rect(&line_boxes, line),
+                text: text.get(start..end).unwrap_or_default().to_string(),
+            });
+            start = end;
+        }
+
+        Ok(PageText { blocks })
+    }
+
+    unsafe fn flush_cache(&self) {
+        let mut session_handle = self.handle();
+        unsafe {
+            bridge::flush_session_cache(&mut session_handle as *mut *mut c_void as *mut PDFHandle)
+        };
+    }
+}
+
+impl Drop for Session<'_> {
+    fn drop(&mut self) {
+        self.pool.checkin(self.addr);
+    }
+}
+
+/// Worker sessions opened for a single document.
+///
+/// Each session owns a context and an opened document on the C++ side and is reused
+/// for every page a worker renders. Sessions are only closed when the pool is dropped,
+/// which happens once the [Extractor] and every in-flight page task are gone.
+///
+/// The pool also owns the base context and document from `init`, since shared-store
+/// sessions are clones of the base context and must not outlive it, and the document
+/// source every document is opened over, which must outlive all of them.
+struct SessionPool {
+    doc_path: PathBuf,
+    share_store: bool,
+    base_ctx: MemAddress,
+    base_doc: MemAddress,
+    source: MemAddress,
+    /// Rendered pages shared by every session, 0 when deduplication is off.
+    render_cache: MemAddress,
+    /// What every session renders its pages with, see [ExtractorOptions::render_profile].
+    render_profile: MemAddress,
+    profile: RenderProfile,
+    /// What every session times its pages into, 0 unless [ExtractorOptions::stage_stats].
+    render_stats: MemAddress,
+    /// What aborts the renders of every session, see [SessionPool::halt_renders].
+    render_control: MemAddress,
+    /// Negative when blank pages aren't detected.
+    blank_ratio: f32,
+    /// See [ExtractorOptions::image_passthrough].
+    passthrough: bool,
+    /// What fills the source of a document opened with [Extractor::open_progressive].
+    download: Option<Download>,
+    idle: Mutex<Vec<MemAddress>>,
+}
+
+impl SessionPool {
+    fn new(
+        doc_path: PathBuf,
+        options: &ExtractorOptions,
+        base_ctx: MemAddress,
+        base_doc: MemAddress,
+        source: MemAddress,
+        download: Option<Download>,
+    ) -> Self {
+        let mut render_cache: *mut c_void = ptr::null_mut();
+        if options.dedup_cache_bytes > 0 || options.render_cache_dir.is_some() {
+            let cache_dir = options
+                .render_cache_dir
+                .as_ref()
+                .map_or(String::new(), |dir| dir.to_string_lossy().to_string());
+            let_cxx_string!(cxx_dir = cache_dir);
+            let_cxx_string!(cxx_path = doc_path.to_string_lossy().to_string());
+
+            unsafe {
+                bridge::new_render_cache(
+                    options.dedup_cache_bytes,
+                    &cxx_dir,
+                    options.render_cache_dir_bytes,
+                    &cxx_path,
+                    &mut render_cache as *mut _ as *mut PDFHandle,
+                )
+                .unwrap()
+            };
+        }
+
+        let profile = options.render_profile;
+        let mut render_profile: *mut c_void = ptr::null_mut();
+        unsafe {
+            bridge::new_render_profile(
+                profile.mode as i32,
+                profile.scale,
+                profile.threshold as i32,
+                &mut render_profile as *mut _ as *mut PDFHandle,
+            )
+            .unwrap()
+        };
+
+        let mut render_stats: *mut c_void = ptr::null_mut();
+        if options.stage_stats {
+            unsafe { bridge::new_render_stats(&mut render_stats as *mut _ as *mut PDFHandle).unwrap() };
+        }
+
+        let mut render_control: *mut c_void = ptr::null_mut();
+        let page_budget_ns = options.page_time_budget.map_or(0, |budget| {
+            budget.as_nanos().clamp(1, u64::MAX as u128) as u64
+        });
+        unsafe {
+            bridge::new_render_control(
+                page_budget_ns,
+                &mut render_control as *mut _ as *mut PDFHandle,
+            )
+            .unwrap()
+        };
+
+        Self {
+            doc_path,
+            share_store: options.share_store,
+            base_ctx,
+            base_doc,
+            source,
+            render_cache: render_cache as MemAddress,
+            render_profile: render_profile as MemAddress,
+            profile,
+            render_stats: render_stats as MemAddress,
+            render_control: render_control as MemAddress,
+            blank_ratio: options.blank_ink_ratio.unwrap_or(-1.0),
+            passthrough: options.image_passthrough,
+            download,
+            idle: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// Bytes of a progressive document received so far, see [SessionPool::wait_for_bytes].
+    fn received_bytes(&self) -> u64 {
+        let mut seen = u64::MAX;
+        if self.download.is_some() {
+            seen = 0;
+            let mut source_handle: *mut c_void = self.source as *mut c_void;
+            unsafe {
+                bridge::wait_source(
+                    0,
+                    0,
+                    &mut seen as *mut u64,
+                    &mut source_handle as *mut _ as *mut PDFHandle,
+                )
+            }
+            .unwrap();
+        }
+        seen
+    }
+
+    /// Blocks until a progressive document has received more than `seen` bytes. False if it
+    /// never will, or the document isn't progressive.
+    fn wait_for_bytes(&self, mut seen: u64) -> bool {
+        self.download.is_some() && wait_for_bytes(self.source, &mut seen)
+    }
+
+    /// Takes an idle session, or opens a new one if every session is in use.
+    unsafe fn checkout(&self) -> Result<Session<'_>, PageRenderError> {
+        if let Some(addr) = self.idle.lock().unwrap().pop() {
+            return Ok(Session { pool: self, addr });
+        }
+
+        let mut base_ctx: *mut c_void = self.base_ctx as *mut c_void;
+        let mut source: *mut c_void = self.source as *mut c_void;
+        let mut session: *mut c_void = ptr::null_mut();
+        let mut page_count: i32 = 0;
+        let_cxx_string!(cxx_str = self.doc_path.to_string_lossy().to_string());
+
+        unsafe {
+            bridge::open_session(
+                &cxx_str,
+                self.share_store,
+                &mut base_ctx as *mut _ as *mut PDFHandle,
+                &mut source as *mut _ as *mut PDFHandle,
+                &mut session as *mut _ as *mut PDFHandle,
+                &mut page_count as *mut i32,
+            )
+        }
+        .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+        let mut profile_handle: *mut c_void = self.render_profile as *mut c_void;
+        unsafe {
+            bridge::set_session_profile(
+                &mut profile_handle as *mut _ as *mut PDFHandle,
+                &mut session as *mut _ as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+        if self.render_stats != 0 {
+            let mut stats_handle: *mut c_void = self.render_stats as *mut c_void;
+            unsafe {
+                bridge::set_session_stats(
+                    &mut stats_handle as *mut _ as *mut PDFHandle,
+                    &mut session as *mut _ as *mut PDFHandle,
+                )
+            }
+            .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+        }
+
+        let mut control_handle: *mut c_void = self.render_control as *mut c_void;
+        unsafe {
+            bridge::set_session_control(
+                &mut control_handle as *mut _ as *mut PDFHandle,
+                &mut session as *mut _ as *mut PDFHandle,
+            )
+        }
+        .map_err(|e| PageRenderError::Unexpected(e.what().to_string()))?;
+
+        debug!(
+            "Opened worker session 0x{:x} ({} pages)",
+            session as usize, page_count
+        );
+        Ok(Session {
+            pool: self,
+            addr: session as MemAddress,
+        })
+    }
+
+    /// Aborts every render in flight on the pool's sessions (and the engine's), and every
+    /// render started until [SessionPool::resume_renders].
+    fn halt_renders(&self, reason: AbortReason) {
+        let mut control_handle: *mut c_void = self.render_control as *mut c_void;
+        unsafe {
+            bridge::halt_renders(
+                reason as i32,
+                &mut control_handle as *mut _ as *mut PDFHandle,
+            )
+        }
+        .unwrap();
+    }
+
+    fn resume_renders(&self) {
+        let mut control_handle: *mut c_void = self.render_control as *mut c_void;
+        unsafe { bridge::resume_renders(&mut control_handle as *mut _ as *mut PDFHandle) }.unwrap();
+    }
+
+    /// Aborts the renders in flight of `count` pages from `first`, see [AbortReason::Cancelled].
+    fn cancel_page_renders(&self, first: PageNum, count: i32) {
+        let mut control_handle: *mut c_void = self.render_control as *mut c_void;
+        unsafe {
+            bridge::cancel_page_renders(
+                first,
+                count,
+                &mut control_handle as *mut _ as *mut PDFHandle,
+            )
+        }
+        .unwrap();
+    }
+
+    fn checkin(&self, session: MemAddress) {
+        self.idle.lock().unwrap().push(session);
+    }
+
+    fn close_idle(&self) {
+        let sessions: Vec<MemAddress> = self.idle.lock().unwrap().drain(..).collect();
+
+        for session in sessions {
+            let mut handle: *mut c_void = session as *mut c_void;
+            unsafe { bridge::close_session(&mut handle as *mut _ as *mut PDFHandle) };
+        }
+    }
+}
+
+impl Drop for SessionPool {
+    fn drop(&mut self) {
+        self.close_idle();
+
+        if self.base_doc != 0 || self.base_ctx != 0 {
+            let mut doc_handle: *mut c_void = self.base_doc as *mut c_void;
+            let mut ctx_handle: *mut c_void = self.base_ctx as *mut c_void;
+
+            // cleanup_pdf expects pointers to the handles, not the handles themselves.
+            unsafe {
+                bridge::cleanup_pdf(
+                    &mut doc_handle as *mut _ as *mut PDFHandle,
+                    &mut ctx_handle as *mut _ as *mut PDFHandle,
                 );
             }
         }
+
+        if self.render_cache != 0 {
+            let mut cache_handle: *mut c_void = self.render_cache as *mut c_void;
+            unsafe { bridge::free_render_cache(&mut cache_handle as *mut _ as *mut PDFHandle) };
+        }
+
+        // Sessions copy the profile when it is set on them, nothing refers to it.
+        if self.render_profile != 0 {
+            let mut profile_handle: *mut c_void = self.render_profile as *mut c_void;
+            unsafe { bridge::free_render_profile(&mut profile_handle as *mut _ as *mut PDFHandle) };
+        }
+
+        // Every session aborted through it is closed by now.
+        if self.render_control != 0 {
+            let mut control_handle: *mut c_void = self.render_control as *mut c_void;
+            unsafe { bridge::free_render_control(&mut control_handle as *mut _ as *mut PDFHandle) };
+        }
+
+        // Every session timing into it is closed by now.
+        if self.render_stats != 0 {
+            let mut stats_handle: *mut c_void = self.render_stats as *mut c_void;
+            unsafe { bridge::free_render_stats(&mut stats_handle as *mut _ as *mut PDFHandle) };
+        }
+
+        // Stopped first, so nothing feeds the source once it's closed.
+        drop(self.download.take());
+
+        // Every document opened over the source is gone by now.
+        if self.source != 0 {
+            let mut source_handle: *mut c_void = self.source as *mut c_void;
+            unsafe { bridge::close_source(&mut source_handle as *mut _ as *mut PDFHandle) };
+        }
+    }
+}
+
+/// Reads byte ranges of a document opened with [Extractor::open_progressive], e.g. with HTTP
+/// range requests against object storage. Called from a thread of the document's own.
+pub trait RangeFetcher: Send + 'static {
+    /// Fills `buf` with the bytes of the file starting at `offset`. A failed fetch is tried
+    /// again a few times before the rest of the document is given up on.
+    fn fetch(&mut self, offset: u64, buf: &mut [u8]) -> std::io::Result<()>;
+}
+
+impl<F> RangeFetcher for F
+where
+    F: FnMut(u64, &mut [u8]) -> std::io::Result<()> + Send + 'static,
+{
+    fn fetch(&mut self, offset: u64, buf: &mut [u8]) -> std::io::Result<()> {
+        self(offset, buf)
+    }
+}
+
+/// Matches `INCOMPLETE_DOCUMENT_ERROR` in `src_cpp/main.h`.
+const INCOMPLETE_DOCUMENT_ERROR: &str = "The document hasn't arrived far enough to be read";
+
+/// Bytes a [RangeFetcher] is asked for at once.
+const DOWNLOAD_CHUNK_BYTES: u64 = 1 << 20;
+/// Times a chunk is fetched before the download is given up on.
+const FETCH_ATTEMPTS: u32 = 3;
+/// How long [wait_for_bytes] waits on the source before checking it's still expecting bytes.
+const SOURCE_POLL_MS: i32 = 50;
+
+/// Blocks until the progressive `source` has received more than `seen` bytes, and updates
+/// `seen` to how many it has. False once the source won't receive any more.
+fn wait_for_bytes(source: MemAddress, seen: &mut u64) -> bool {
+    let mut source_handle: *mut c_void = source as *mut c_void;
+    loop {
+        let mut received: u64 = 0;
+        let pending = unsafe {
+            bridge::wait_source(
+                *seen,
+                SOURCE_POLL_MS,
+                &mut received as *mut u64,
+                &mut source_handle as *mut _ as *mut PDFHandle,
+            )
+        }
+        .unwrap();
+
+        if received > *seen {
+            *seen = received;
+            return true;
+        }
+        if !pending {
+            return false;
+        }
+    }
+}
+
+/// The thread feeding a progressive source, see [Extractor::open_progressive]. Dropping it
+/// stops the download after the chunk in flight.
+struct Download {
+    stop: Arc<AtomicBool>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl Download {
+    fn start(source: MemAddress, size: u64, fetcher: impl RangeFetcher) -> Self {
+        let stop = Arc::new(AtomicBool::new(false));
+        let stopped = stop.clone();
+        let thread = std::thread::spawn(move || Self::run(source, size, fetcher, &stopped));
+
+        Self {
+            stop,
+            thread: Some(thread),
+        }
+    }
+
+    fn run(source: MemAddress, size: u64, mut fetcher: impl RangeFetcher, stop: &AtomicBool) {
+        let mut source_handle: *mut c_void = source as *mut c_void;
+        let chunks = size.div_ceil(DOWNLOAD_CHUNK_BYTES) as usize;
+        let mut fetched = vec![false; chunks];
+        let mut next = 0;
+        let mut buf = Vec::new();
+
+        while !stop.load(Ordering::Relaxed) {
+            // Whatever MuPDF was turned away at goes first, e.g. the trailer at the end of a
+            // file that isn't linearized, then the file front to back.
+            let wanted = unsafe {
+                bridge::take_source_wanted(&mut source_handle as *mut _ as *mut PDFHandle)
+            }
+            .unwrap();
+
+            let chunk = match (wanted / DOWNLOAD_CHUNK_BYTES) as usize {
+                chunk if wanted < size && !fetched[chunk] => chunk,
+                _ => {
+                    while next < chunks && fetched[next] {
+                        next += 1;
+                    }
+                    if next == chunks {
+                        break;
+                    }
+                    next
+                }
+            };
+
+            let offset = chunk as u64 * DOWNLOAD_CHUNK_BYTES;
+            buf.resize((size - offset).min(DOWNLOAD_CHUNK_BYTES) as usize, 0);
+
+            let mut attempt = 1;
+            let result = loop {
+                match fetcher.fetch(offset, &mut buf) {
+                    Err(e) if attempt < FETCH_ATTEMPTS => {
+                        debug!("Fetching bytes at {} failed ({}), trying again", offset, e);
+                        attempt += 1;
+                    }
+                    result => break result,
+                }
+            };
+
+            if let Err(e) = result {
+                #[cfg(feature = "logging")]
+                error!("Giving up on the document at byte {}: {}", offset, e);
+                unsafe { bridge::abandon_source(&mut source_handle as *mut _ as *mut PDFHandle) }
+                    .unwrap();
+                return;
+            }
+
+            unsafe {
+                bridge::feed_source(
+                    offset,
+                    buf.as_ptr(),
+                    buf.len(),
+                    &mut source_handle as *mut _ as *mut PDFHandle,
+                )
+            }
+            .unwrap();
+            fetched[chunk] = true;
+        }
+    }
+}
+
+impl Drop for Download {
+    fn drop(&mut self) {
+        self.stop.store(true, Ordering::Relaxed);
+        if let Some(thread) = self.thread.take() {
+            thread.join().ok();
+        }
+    }
+}
+
+/// Where a task of the current run stands in a [RenderQueue].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum TaskState {
+    Pending,
+    /// Spawned for a request, so cancelling every request for it aborts the render.
+    Requested,
+    /// Spawned in page order.
+    Started,
+    Done,
+}
+
+struct QueueState {
+    /// Pages every task of the current run covers, see [RenderQueue::begin].
+    pages_per_task: i32,
+    tasks: Vec<TaskState>,
+    /// No task before it is pending, so the page order walk starts here.
+    cursor: usize,
+    pending: usize,
+    remaining: usize,
+    /// Live requests by ticket. Tickets count up, so the lowest of a priority is the oldest.
+    requests: BTreeMap<u64, (PageNum, RenderPriority)>,
+    next_ticket: u64,
+}
+
+impl QueueState {
+    fn task_of(&self, page: PageNum) -> Option<usize> {
+        let task = (page / self.pages_per_task.max(1)) as usize;
+        (page >= 0 && task < self.tasks.len()).then_some(task)
+    }
+
+    fn requested(&self, task: usize) -> bool {
+        self.requests
+            .values()
+            .any(|&(page, _)| self.task_of(page) == Some(task))
+    }
+}
+
+/// The order [Extractor::iter_pages] and friends render pages in, see [RenderScheduler].
+/// Requested pages go first, the highest priority and then the oldest request first, and the
+/// rest follow in page order. Every page is still rendered once per run: a request for a page
+/// that is rendering or rendered is kept for the next run, like requests made between runs, and
+/// starting a run drops the requests for pages it doesn't have. Cancelling the last request for a page that is rendering because of it
+/// aborts the render and puts the page back in page order, except in
+/// [Extractor::iter_pages_batched] runs, whose tasks cover whole batches and run to the end.
+pub struct RenderQueue {
+    state: Mutex<QueueState>,
+    sessions: Arc<SessionPool>,
+}
+
+impl RenderQueue {
+    fn new(sessions: Arc<SessionPool>) -> Self {
+        Self {
+            state: Mutex::new(QueueState {
+                pages_per_task: 1,
+                tasks: Vec::new(),
+                cursor: 0,
+                pending: 0,
+                remaining: 0,
+                requests: BTreeMap::new(),
+                next_ticket: 0,
+            }),
+            sessions,
+        }
+    }
+
+    /// Starts a run over `page_count` pages in tasks of `pages_per_task`, keeping the requests
+    /// for its pages.
+    fn begin(&self, page_count: PageNum, pages_per_task: i32) {
+        let mut state = self.state.lock().unwrap();
+        let pages_per_task = pages_per_task.max(1);
+        let tasks = ((page_count.max(0) + pages_per_task - 1) / pages_per_task) as usize;
+
+        state
+            .requests
+            .retain(|_, &mut (page, _)| (0..page_count).contains(&page));
+        state.pages_per_task = pages_per_task;
+        state.tasks = vec![TaskState::Pending; tasks];
+        state.cursor = 0;
+        state.pending = tasks;
+        state.remaining = tasks;
+    }
+
+    /// First page of the next task to spawn, `None` when nothing is pending.
+    fn next(&self) -> Option<PageNum> {
+        let mut state = self.state.lock().unwrap();
+
+        let requested = state
+            .requests
+            .iter()
+            .filter(|&(_, &(page, _))| {
+                state
+                    .task_of(page)
+                    .is_some_and(|task| state.tasks[task] == TaskState::Pending)
+            })
+            .max_by_key(|&(&ticket, &(_, priority))| (priority, Reverse(ticket)))
+            .and_then(|(_, &(page, _))| state.task_of(page));
+
+        let task = match requested {
+            Some(task) => {
+                state.tasks[task] = TaskState::Requested;
+                task
+            }
+            None => {
+                while state.cursor < state.tasks.len()
+                    && state.tasks[state.cursor] != TaskState::Pending
+                {
+                    state.cursor += 1;
+                }
+                let task = state.cursor;
+                *state.tasks.get_mut(task)? = TaskState::Started;
+                task
+            }
+        };
+
+        state.pending -= 1;
+        Some(task as PageNum * state.pages_per_task)
+    }
+
+    /// The task starting at `page` ran to the end, whether it succeeded or not.
+    fn finish(&self, page: PageNum) {
+        let mut state = self.state.lock().unwrap();
+        let Some(task) = state.task_of(page) else {
+            return;
+        };
+
+        if state.tasks[task] != TaskState::Done {
+            state.tasks[task] = TaskState::Done;
+            state.remaining -= 1;
+        }
+        let pages_per_task = state.pages_per_task;
+        state
+            .requests
+            .retain(|_, &mut (requested, _)| requested / pages_per_task != page / pages_per_task);
+    }
+
+    /// The task starting at `page` was aborted and has to be spawned again.
+    fn requeue(&self, page: PageNum) {
+        let mut state = self.state.lock().unwrap();
+        let Some(task) = state.task_of(page) else {
+            return;
+        };
+
+        if matches!(state.tasks[task], TaskState::Requested | TaskState::Started) {
+            state.tasks[task] = TaskState::Pending;
+            state.pending += 1;
+            state.cursor = state.cursor.min(task);
+        }
+    }
+
+    fn has_pending(&self) -> bool {
+        self.state.lock().unwrap().pending > 0
+    }
+
+    fn pages_per_task(&self) -> usize {
+        self.state.lock().unwrap().pages_per_task as usize
+    }
+
+    fn is_done(&self) -> bool {
+        self.state.lock().unwrap().remaining == 0
+    }
+}
+
+impl RenderScheduler for RenderQueue {
+    fn request(&self, page: i32, priority: RenderPriority) -> RenderTicket {
+        let mut state = self.state.lock().unwrap();
+        let ticket = state.next_ticket;
+        state.next_ticket += 1;
+        state.requests.insert(ticket, (page, priority));
+
+        RenderTicket(ticket)
+    }
+
+    fn cancel(&self, ticket: RenderTicket) -> bool {
+        let mut state = self.state.lock().unwrap();
+        let Some((page, _)) = state.requests.remove(&ticket.0) else {
+            return false;
+        };
+
+        let abort = state.pages_per_task == 1
+            && state.task_of(page).is_some_and(|task| {
+                state.tasks[task] == TaskState::Requested && !state.requested(task)
+            });
+        drop(state);
+
+        // The render may finish first, in which case the page is simply done.
+        if abort {
+            debug!("Cancelling the render of page {}", page);
+            self.sessions.cancel_page_renders(page, 1);
+        }
+        true
+    }
+}
+
+impl Drop for Extractor {
+    fn drop(&mut self) {
+        // Idle sessions are closed right away. Sessions still checked out by in-flight
+        // tasks, and the base context after them, are closed when the last task
+        // releases the pool.
+        self.sessions.close_idle();
+    }
+}
+
+// The handles are only used by one thread at a time: the blocking thread that opens the
+// document, then whoever owns the Extractor. Corpus runs open documents off the runtime.
+unsafe impl Send for Extractor {}
+
+/// How many pages [Extractor::iter_pages] and [Corpus::iter_pages] render at once by default.
+fn max_concurrent_pages() -> usize {
+    available_parallelism()
+        .map(|p| {
+            let cores = p.get();
+            // Optimize for better cache locality with smaller batches on more cores
+            match cores {
+                1..=4 => cores * 2,           // 2-8 threads for low-core systems
+                5..=8 => cores + 2,           // 7-10 threads for mid-range systems
+                9..=16 => cores,              // 9-16 threads for high-core systems
+                _ => (cores * 3 / 4).min(32), // 0.75x cores, capped at 32 for very high-core systems
+            }
+        })
+        .unwrap_or(4)
+}
+
+/// What rendering a page holds in memory at its peak, see [ExtractorOptions::inflight_bytes].
+#[derive(Clone, Copy, Debug)]
+enum PageFootprint {
+    /// A gray pixmap of the whole page at this scale.
+    Pixmap(f32),
+    /// A gray band of this many rows at this scale.
+    Band(f32, i32),
+}
+
+impl PageFootprint {
+    fn bytes(self, page: &PageInfo) -> u64 {
+        let (scale, rows) = match self {
+            PageFootprint::Pixmap(scale) => (scale, None),
+            PageFootprint::Band(scale, rows) => (scale, Some(rows.max(1) as u64)),
+        };
+        let width = (page.width().abs() * scale).ceil() as u64;
+        let height = (page.height().abs() * scale).ceil() as u64;
+        width * rows.map_or(height, |rows| rows.min(height))
+    }
+}
+
+/// Admits tasks by the bytes their pages hold, see [ExtractorOptions::inflight_bytes].
+/// Counted in KiB, so budgets up to 4 TiB fit a semaphore's permits.
+#[derive(Clone)]
+struct ByteBudget {
+    permits: Arc<Semaphore>,
+    kib: u32,
+}
+
+impl ByteBudget {
+    fn new(bytes: usize) -> Self {
+        let kib = (bytes / 1024).clamp(1, u32::MAX as usize) as u32;
+        Self {
+            permits: Arc::new(Semaphore::new(kib as usize)),
+            kib,
+        }
+    }
+
+    /// Waits until `bytes` fit next to every task admitted so far. Waiters are admitted in
+    /// order, so a big page isn't starved by the small ones behind it.
+    async fn admit(&self, bytes: u64) -> OwnedSemaphorePermit {
+        let kib = bytes.div_ceil(1024).clamp(1, self.kib as u64) as u32;
+        // The semaphore is never closed.
+        self.permits.clone().acquire_many_owned(kib).await.unwrap()
+    }
+}
+
+async fn admit(admission: &Option<(ByteBudget, u64)>) -> Option<OwnedSemaphorePermit> {
+    match admission {
+        Some((budget, bytes)) => Some(budget.admit(*bytes).await),
+        None => None,
+    }
+}
+
+/// Index of a document in [Corpus::paths].
+pub type DocumentId = usize;
+
+/// Many documents rendered as one stream of pages on tokio's blocking pool, see
+/// [Corpus::iter_pages]. Pages of the next documents fill the slots the last pages of a
+/// document leave free, so short documents don't leave cores idle between them.
+pub struct Corpus {
+    pub paths: Vec<PathBuf>,
+    /// What every document is opened with. [ExtractorOptions::engine_workers] is ignored,
+    /// pages always render on the shared pool, and [ExtractorOptions::inflight_bytes] is one
+    /// budget for the pages of every document.
+    pub options: ExtractorOptions,
+    /// Pages rendering at once across every document.
+    pub max_concurrent_pages: usize,
+    /// Documents opened ahead of the ones being rendered, so opening them (reading the xref,
+    /// counting pages) overlaps rendering instead of stalling it.
+    pub open_ahead: usize,
+}
+
+/// A document of a [Corpus] run with pages still to spawn or in flight.
+struct CorpusDocument {
+    id: DocumentId,
+    extractor: Extractor,
+}
+
+/// A finished page of a [Corpus] run, as its blocking task left it.
+type CorpusPage = (
+    DocumentId,
+    PageNum,
+    Result<Result<(), PageRenderError>, JoinError>,
+);
+
+impl Corpus {
+    pub fn new(paths: impl IntoIterator<Item = impl AsRef<Path>>) -> Self {
+        Self::with_options(paths, ExtractorOptions::default())
+    }
+
+    pub fn with_options(
+        paths: impl IntoIterator<Item = impl AsRef<Path>>,
+        options: ExtractorOptions,
+    ) -> Self {
+        Self {
+            paths: paths
+                .into_iter()
+                .map(|path| path.as_ref().to_path_buf())
+                .collect(),
+            options,
+            max_concurrent_pages: max_concurrent_pages(),
+            open_ahead: 2,
+        }
+    }
+
+    /// [Extractor::iter_pages] over every document, with results tagged by the document they
+    /// belong to. Documents are opened in order and their pages spawned in order, earlier
+    /// documents first, so every document is closed as soon as its last page is done. A
+    /// document that can't be opened is reported once, as page-less, through `render_callback`.
+    pub async unsafe fn iter_pages<F, State>(
+        &self,
+        callback: F,
+        render_callback: Sender<(DocumentId, Result<(), PageRenderError>)>,
+        state: Arc<Mutex<State>>,
+        mut controller: Receiver<ControlMessage>,
+    ) -> ()
+    where
+        F: 'static
+            + Fn(DocumentId, PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        debug!("Iterating over a corpus of {} documents", self.paths.len());
+
+        let mut opening: JoinSet<(DocumentId, Result<Extractor, PageRenderError>)> = JoinSet::new();
+        let mut documents: Vec<CorpusDocument> = Vec::new();
+        let mut pool: JoinSet<CorpusPage> = JoinSet::new();
+        let mut next_document: DocumentId = 0;
+        let max_concurrent_pages = self.max_concurrent_pages.max(1);
+        // One budget across every document, see ExtractorOptions::inflight_bytes.
+        let budget = self.options.inflight_bytes.map(ByteBudget::new);
+        // A closed channel is always ready, so it's only polled until it closes.
+        let mut controller_closed = false;
+
+        loop {
+            // Keep open_ahead documents opening or waiting for their first page to be spawned.
+            let waiting = documents
+                .iter()
+                .filter(|document| document.extractor.render_queue.has_pending())
+                .count();
+            if next_document < self.paths.len() && opening.len() + waiting <= self.open_ahead {
+                let path = self.paths[next_document].clone();
+                let options = ExtractorOptions {
+                    engine_workers: 0,
+                    ..self.options.clone()
+                };
+                let id = next_document;
+                opening.spawn_blocking(move || {
+                    let mut opened = Extractor::open(path, options);
+                    if let Ok(extractor) = &mut opened
+                        && extractor.options.inflight_bytes.is_some()
+                    {
+                        // Keeps the bounds for spawn_pages, which admits by count without them.
+                        extractor.prescan().ok();
+                    }
+                    (id, opened)
+                });
+                next_document += 1;
+                continue;
+            }
+
+            select! {
+                msg = controller.recv(), if !controller_closed => {
+                    match msg {
+                        Some(ControlMessage::Stop) => {
+                            debug!("Received stop signal, cancelling remaining tasks");
+                            Self::halt_renders(&documents, AbortReason::Stopped);
+                            pool.abort_all();
+                            break;
+                        }
+                        Some(ControlMessage::Pause) => {
+                            debug!("Received pause signal, aborting pages in flight and waiting...");
+                            Self::halt_renders(&documents, AbortReason::Paused);
+
+                            loop {
+                                match controller.recv().await {
+                                    Some(ControlMessage::Resume) => {
+                                        debug!("Received resume signal, continuing...");
+                                        for document in &documents {
+                                            document.extractor.sessions.resume_renders();
+                                        }
+                                        break;
+                                    }
+                                    Some(ControlMessage::Pause) => {
+                                        debug!("Already paused, ignoring additional pause signal");
+                                    }
+                                    Some(ControlMessage::Stop) | None => {
+                                        debug!("Stopped while paused, halting");
+                                        Self::halt_renders(&documents, AbortReason::Stopped);
+                                        pool.abort_all();
+                                        return;
+                                    }
+                                }
+                            }
+                        }
+                        Some(ControlMessage::Resume) => {
+                            debug!("Received resume signal while not paused, ignoring");
+                        }
+                        None => {
+                            debug!("Control channel closed, finishing remaining tasks");
+                            controller_closed = true;
+                        }
+                    }
+                }
+
+                opened = opening.join_next(), if !opening.is_empty() => {
+                    match opened {
+                        Some(Ok((id, Ok(extractor)))) => {
+                            debug!("Opened document {} ({} pages)", id, extractor.page_count);
+                            extractor.render_queue.begin(extractor.page_count, 1);
+                            if !extractor.render_queue.is_done() {
+                                let at = documents.partition_point(|document| document.id < id);
+                                documents.insert(at, CorpusDocument { id, extractor });
+                            }
+                        }
+                        Some(Ok((id, Err(e)))) => {
+                            render_callback.send((id, Err(e))).await.ok();
+                        }
+                        Some(Err(join_error)) => {
+                            #[cfg(feature = "logging")]
+                            error!("Opening a document panicked: {}", join_error);
+                        }
+                        None => {}
+                    }
+                }
+
+                _ = async {}, if pool.len() < max_concurrent_pages && documents.iter().any(|document| document.extractor.render_queue.has_pending()) => {
+                    unsafe { Self::spawn_pages(&documents, max_concurrent_pages, &budget, callback, &state, &mut pool) };
+                }
+
+                result = pool.join_next(), if !pool.is_empty() => {
+                    if let Some(Ok((id, page, result))) = result {
+                        Self::handle_page(&mut documents, id, page, result, &render_callback).await;
+                    }
+                }
+
+                _ = async {}, if next_document >= self.paths.len() && opening.is_empty() && documents.is_empty() && pool.is_empty() => {
+                    debug!("All documents completed!");
+                    break;
+                }
+            }
+        }
+
+        debug!("Done iterating over the corpus!");
+    }
+
+    fn halt_renders(documents: &[CorpusDocument], reason: AbortReason) {
+        for document in documents {
+            document.extractor.sessions.halt_renders(reason);
+        }
+    }
+
+    /// Fills the free slots of `pool` with pages of the earliest documents that have any left.
+    unsafe fn spawn_pages<F, State>(
+        documents: &[CorpusDocument],
+        max_concurrent_pages: usize,
+        budget: &Option<ByteBudget>,
+        callback: F,
+        state: &Arc<Mutex<State>>,
+        pool: &mut JoinSet<CorpusPage>,
+    ) where
+        F: 'static
+            + Fn(DocumentId, PageNum, PageImage, Arc<Mutex<State>>) -> ()
+            + Send
+            + Sync
+            + Clone
+            + Copy,
+        State: Send + 'static,
+    {
+        for document in documents {
+            let extractor = &document.extractor;
+            let format = extractor.options.output;
+
+            while pool.len() < max_concurrent_pages {
+                let Some(page) = extractor.render_queue.next() else {
+                    break;
+                };
+
+                let id = document.id;
+                let sessions = extractor.sessions.clone();
+                let state = state.clone();
+                let footprint = PageFootprint::Pixmap(extractor.options.render_profile.scale);
+                let bytes = (extractor.page_info.as_ref())
+                    .map(|page_info| footprint.bytes(&page_info[page as usize]));
+                let admission = budget.clone().zip(bytes);
+                let tagged = move |page: PageNum, image: PageImage, state: Arc<Mutex<State>>| {
+                    callback(id, page, image, state)
+                };
+
+                debug!("Spawning task for page {} of document {}", page, id);
+                pool.spawn(async move {
+                    let _permit = admit(&admission).await;
+                    let result = tokio::task::spawn_blocking(move || unsafe {
+                        Extractor::iter_page(page, format, tagged, state, &sessions)
+                    })
+                    .await;
+                    (id, page, result)
+                });
+            }
+        }
+    }
+
+    /// Settles a finished page of document `id`, closing the document once it has none left.
+    async fn handle_page(
+        documents: &mut Vec<CorpusDocument>,
+        id: DocumentId,
+        page: PageNum,
+        result: Result<Result<(), PageRenderError>, JoinError>,
+        render_callback: &Sender<(DocumentId, Result<(), PageRenderError>)>,
+    ) {
+        let Some(at) = documents.iter().position(|document| document.id == id) else {
+            return;
+        };
+        let queue = &documents[at].extractor.render_queue;
+
+        match result {
+            Ok(Ok(())) => {
+                debug!("Page {} of document {} processed successfully", page, id);
+                queue.finish(page);
+            }
+            Ok(Err(PageRenderError::Aborted {
+                reason: AbortReason::Paused | AbortReason::Cancelled,
+                ..
+            })) => {
+                queue.requeue(page);
+            }
+            Ok(Err(e)) => {
+                queue.finish(page);
+                render_callback.send((id, Err(e))).await.ok();
+            }
+            Err(join_error) => {
+                queue.finish(page);
+                let error = PageRenderError::Unexpected(format!("Task panicked: {}", join_error));
+                render_callback.send((id, Err(error))).await.ok();
+            }
+        }
+
+        if documents[at].extractor.render_queue.is_done() {
+            debug!("Document {} completed, closing it", id);
+            documents.remove(at);
+        }
     }
 }
@@ -1,4 +1,4 @@
-// use crate::extractor::{ControlMessage, Extractor, PageRenderError};
+// use crate::extractor::{ControlMessage, Extractor, PageImage, PageRenderError};
 // use std::env;
 // use std::fs::File;
 // use std::io::Write;
@@ -28,22 +28,15 @@ pub mod extractor;
 //     let (render_sender, mut render_receiver) = channel::<Result<(), PageRenderError>>(100);
 //     let (_, controller_receiver) = channel::<ControlMessage>(10);
 
-//     fn callback(
-//         page: i32,
-//         img: &[u8],
-//         width: i32,
-//         height: i32,
-//         channels: i32,
-//         state: SafeState,
-//     ) -> () {
+//     fn callback(page: i32, img: PageImage, state: SafeState) -> () {
 //         let output = PathBuf::from(env::var("CARGO_MANIFEST_DIR").unwrap()).join("out");
 //         std::fs::create_dir_all(&output).unwrap();
 //         let mut file = File::create(output.join(format!("page_{}.png", page))).unwrap();
-//         file.write_all(img).unwrap();
+//         file.write_all(img.data).unwrap();
 
 //         println!(
 //             "Created image {} with width {} height {} and channels {}",
-//             page, width, height, channels
+//             page, img.width, img.height, img.channels
 //         );
 //     }
 
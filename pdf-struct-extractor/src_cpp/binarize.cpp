@@ -0,0 +1,275 @@
+#include "binarize.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BINARIZE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BINARIZE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC lets any translation unit use AVX2 intrinsics, GCC and Clang need
+// the function itself to be compiled for the target.
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+typedef void (*ThresholdKernel)(uint8_t *samples, size_t count, uint8_t threshold);
+typedef void (*PackKernel)(const uint8_t *src, int width, uint8_t *dst, uint8_t threshold);
+
+// Reverses the bit order of a byte. Mask instructions put pixel 0 in the least
+// significant bit, packed rows want it in the most significant one.
+static const struct BitReverseTable
+{
+    uint8_t table[256];
+
+    constexpr BitReverseTable() : table()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint8_t r = 0;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (i & (1 << bit))
+                    r |= (uint8_t)(0x80 >> bit);
+            }
+            table[i] = r;
+        }
+    }
+} bit_reverse;
+
+static void threshold_scalar(uint8_t *samples, size_t count, uint8_t threshold)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        samples[i] = samples[i] > threshold ? 255 : 0;
+    }
+}
+
+// Packs the pixels from start to the end of the row. start must be a multiple of 8.
+static void pack_row_tail(const uint8_t *src, int start, int width, uint8_t *dst, uint8_t threshold)
+{
+    for (int x = start; x < width; x += 8)
+    {
+        uint8_t byte = 0;
+        int end = width - x < 8 ? width - x : 8;
+        for (int bit = 0; bit < end; bit++)
+        {
+            if (src[x + bit] <= threshold)
+                byte |= (uint8_t)(0x80 >> bit);
+        }
+        dst[x / 8] = byte;
+    }
+}
+
+static void pack_row_scalar(const uint8_t *src, int width, uint8_t *dst, uint8_t threshold)
+{
+    pack_row_tail(src, 0, width, dst, threshold);
+}
+
+#if defined(BINARIZE_X86)
+// x86 only has signed byte compares, so both sides are biased by 0x80 to turn
+// the unsigned comparison into a signed one. The compare already yields 0xFF/0x00.
+TARGET_SSE2 static void threshold_sse2(uint8_t *samples, size_t count, uint8_t threshold)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i limit = _mm_set1_epi8((char)(threshold ^ 0x80));
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+        v = _mm_cmpgt_epi8(_mm_xor_si128(v, bias), limit);
+        _mm_storeu_si128((__m128i *)(samples + i), v);
+    }
+
+    threshold_scalar(samples + i, count - i, threshold);
+}
+
+TARGET_AVX2 static void threshold_avx2(uint8_t *samples, size_t count, uint8_t threshold)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i limit = _mm256_set1_epi8((char)(threshold ^ 0x80));
+
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(samples + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(samples + i + 32));
+        a = _mm256_cmpgt_epi8(_mm256_xor_si256(a, bias), limit);
+        b = _mm256_cmpgt_epi8(_mm256_xor_si256(b, bias), limit);
+        _mm256_storeu_si256((__m256i *)(samples + i), a);
+        _mm256_storeu_si256((__m256i *)(samples + i + 32), b);
+    }
+
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + i));
+        v = _mm256_cmpgt_epi8(_mm256_xor_si256(v, bias), limit);
+        _mm256_storeu_si256((__m256i *)(samples + i), v);
+    }
+
+    threshold_scalar(samples + i, count - i, threshold);
+}
+
+// movemask gives one bit per white pixel, inverted and bit-reversed per byte it
+// becomes the MSB-first black mask.
+TARGET_SSE2 static void pack_row_sse2(const uint8_t *src, int width, uint8_t *dst, uint8_t threshold)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i limit = _mm_set1_epi8((char)(threshold ^ 0x80));
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        unsigned black = ~(unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(v, bias), limit));
+        dst[x / 8] = bit_reverse.table[black & 0xFF];
+        dst[x / 8 + 1] = bit_reverse.table[(black >> 8) & 0xFF];
+    }
+
+    pack_row_tail(src, x, width, dst, threshold);
+}
+
+TARGET_AVX2 static void pack_row_avx2(const uint8_t *src, int width, uint8_t *dst, uint8_t threshold)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i limit = _mm256_set1_epi8((char)(threshold ^ 0x80));
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + x));
+        uint32_t black = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_xor_si256(v, bias), limit));
+        uint8_t *out = dst + x / 8;
+        out[0] = bit_reverse.table[black & 0xFF];
+        out[1] = bit_reverse.table[(black >> 8) & 0xFF];
+        out[2] = bit_reverse.table[(black >> 16) & 0xFF];
+        out[3] = bit_reverse.table[black >> 24];
+    }
+
+    pack_row_tail(src, x, width, dst, threshold);
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0).
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool cpu_has_sse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true; // Part of the x86-64 baseline.
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+#if defined(BINARIZE_NEON)
+static void threshold_neon(uint8_t *samples, size_t count, uint8_t threshold)
+{
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(samples + i);
+        vst1q_u8(samples + i, vcgtq_u8(v, limit));
+    }
+
+    threshold_scalar(samples + i, count - i, threshold);
+}
+#endif
+
+#if defined(BINARIZE_NEON)
+// NEON has no movemask, so each black lane keeps its bit weight and the lanes
+// of each 8-pixel half are summed horizontally into one byte.
+static void pack_row_neon(const uint8_t *src, int width, uint8_t *dst, uint8_t threshold)
+{
+    static const uint8_t weights_data[16] = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+    const uint8x16_t weights = vld1q_u8(weights_data);
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t black = vandq_u8(vcleq_u8(vld1q_u8(src + x), limit), weights);
+        dst[x / 8] = vaddv_u8(vget_low_u8(black));
+        dst[x / 8 + 1] = vaddv_u8(vget_high_u8(black));
+    }
+
+    pack_row_tail(src, x, width, dst, threshold);
+}
+#endif
+
+static PackKernel select_pack_kernel()
+{
+#if defined(BINARIZE_X86)
+    if (cpu_has_avx2())
+        return pack_row_avx2;
+    if (cpu_has_sse2())
+        return pack_row_sse2;
+#elif defined(BINARIZE_NEON)
+    return pack_row_neon;
+#endif
+    return pack_row_scalar;
+}
+
+static ThresholdKernel select_threshold_kernel()
+{
+#if defined(BINARIZE_X86)
+    if (cpu_has_avx2())
+        return threshold_avx2;
+    if (cpu_has_sse2())
+        return threshold_sse2;
+#elif defined(BINARIZE_NEON)
+    return threshold_neon; // NEON is mandatory on AArch64.
+#endif
+    return threshold_scalar;
+}
+
+void threshold_in_place(uint8_t *samples, size_t count, uint8_t threshold)
+{
+    static const ThresholdKernel kernel = select_threshold_kernel();
+    kernel(samples, count, threshold);
+}
+
+void pack_bits(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+               uint8_t *dst, size_t dst_stride, uint8_t threshold)
+{
+    static const PackKernel kernel = select_pack_kernel();
+
+    for (int y = 0; y < height; y++)
+    {
+        kernel(src + y * src_stride, width, dst + y * dst_stride, threshold);
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Thresholds 8-bit samples in place: every sample above threshold becomes 255 (white),
+// everything else 0 (black). Picks an AVX2, SSE2 or NEON kernel on first use depending
+// on what the CPU supports, and falls back to a scalar loop otherwise.
+void threshold_in_place(uint8_t *samples, size_t count, uint8_t threshold);
+
+// Thresholds 8-bit samples and packs them 8 pixels per byte, most significant bit first.
+// A set bit is a black pixel (sample <= threshold), matching PBM. Each row of dst starts
+// on a byte boundary dst_stride bytes apart; padding bits at the end of a row are 0.
+void pack_bits(const uint8_t *src, ptrdiff_t src_stride, int width, int height,
+               uint8_t *dst, size_t dst_stride, uint8_t threshold);
+
+// Bytes per row of a packed bitmap that is width pixels wide.
+inline size_t packed_stride(int width)
+{
+    return ((size_t)width + 7) / 8;
+}
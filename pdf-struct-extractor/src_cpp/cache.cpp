@@ -0,0 +1,310 @@
+#include "cache.h"
+#include "encode.h"
+
+#include <mupdf/fitz.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+// Start of every file of the disk tier, the image's bytes follow.
+struct DiskHeader
+{
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t channels = 0;
+    int32_t stride = 0;
+    uint32_t blank = 0;
+    uint32_t passthrough = 0;
+    uint64_t size = 0;
+};
+
+static constexpr uint32_t DISK_MAGIC = 0x43525350; // "PSRC"
+// Bumped whenever the way pages are rendered changes, so stale files are misses.
+static constexpr uint32_t DISK_VERSION = 3;
+
+// Hex MD5 of the file at path, which names the document's directory in the disk tier.
+static std::string hash_document(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error(std::format("Failed to open {} to hash it for the render cache", path));
+    }
+
+    fz_md5 md5;
+    fz_md5_init(&md5);
+
+    std::vector<char> chunk(1 << 20);
+    while (file.read(chunk.data(), (std::streamsize)chunk.size()) || file.gcount() > 0)
+    {
+        fz_md5_update(&md5, (const unsigned char *)chunk.data(), (size_t)file.gcount());
+    }
+
+    unsigned char digest[16];
+    fz_md5_final(&md5, digest);
+
+    std::string hex;
+    for (unsigned char byte : digest)
+    {
+        hex += std::format("{:02x}", byte);
+    }
+    return hex;
+}
+
+std::string render_settings_key(float scale, int threshold, int mode, int format, bool passthrough)
+{
+    // The deflate level changes a PNG's bytes, not how the page looks, so other formats share it.
+    std::string level = format == OUTPUT_PNG ? std::format("-z{}", current_png_level()) : "";
+    return std::format("s{}-t{}-m{}-f{}{}{}", std::lround(scale * 1000.0f), threshold, mode, format, level,
+                       passthrough ? "-p" : "");
+}
+
+std::shared_ptr<const CachedImage> RenderCache::find(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return nullptr;
+
+    recent.splice(recent.begin(), recent, it->second);
+    return it->second->second;
+}
+
+void RenderCache::insert(const std::string &key, std::shared_ptr<const CachedImage> image)
+{
+    size_t size = image->bytes.size();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size > budget || entries.count(key))
+        return;
+
+    while (bytes + size > budget)
+    {
+        bytes -= recent.back().second->bytes.size();
+        entries.erase(recent.back().first);
+        recent.pop_back();
+    }
+
+    recent.emplace_front(key, std::move(image));
+    entries.emplace(key, recent.begin());
+    bytes += size;
+}
+
+// Writes image where the disk tier looks for it, dropping the file if that fails.
+static bool write_disk_file(const std::filesystem::path &target, const CachedImage &image)
+{
+    DiskHeader header;
+    header.magic = DISK_MAGIC;
+    header.version = DISK_VERSION;
+    header.width = image.width;
+    header.height = image.height;
+    header.channels = image.channels;
+    header.stride = image.stride;
+    header.blank = image.blank;
+    header.passthrough = image.passthrough;
+    header.size = image.bytes.size();
+
+    // Written aside and renamed into place, so concurrent runs never read half a file.
+    std::filesystem::path partial = target;
+    partial += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    {
+        std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)image.bytes.data(), (std::streamsize)image.bytes.size());
+        if (!file)
+        {
+            file.close();
+            std::error_code ignored;
+            std::filesystem::remove(partial, ignored);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(partial, target, error);
+    if (error)
+    {
+        std::filesystem::remove(partial, error);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const CachedImage> RenderCache::load(const std::string &disk_key) const
+{
+    std::filesystem::path target = dir / disk_key;
+
+    try
+    {
+        std::error_code error;
+        uint64_t file_size = std::filesystem::file_size(target, error);
+        if (error)
+            return nullptr;
+
+        std::ifstream file(target, std::ios::binary);
+        if (!file)
+            return nullptr;
+
+        DiskHeader header;
+        if (!file.read((char *)&header, sizeof(header)) || header.magic != DISK_MAGIC ||
+            header.version != DISK_VERSION)
+            return nullptr;
+
+        // A size the file doesn't hold is a damaged file, not an image to allocate for.
+        if (header.size != file_size - sizeof(header) || header.width < 0 || header.height < 0 ||
+            header.channels < 0 || header.stride < 0)
+            return nullptr;
+
+        std::shared_ptr<CachedImage> image = std::make_shared<CachedImage>();
+        image->bytes.resize(header.size);
+        if (!file.read((char *)image->bytes.data(), (std::streamsize)header.size))
+            return nullptr;
+
+        image->width = header.width;
+        image->height = header.height;
+        image->channels = header.channels;
+        image->stride = header.stride;
+        image->blank = header.blank != 0;
+        image->passthrough = header.passthrough != 0;
+
+        // Pruning drops the files written or read longest ago first.
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now(), error);
+        return image;
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void RenderCache::store(const std::string &disk_key, const CachedImage &image)
+{
+    uint64_t size = sizeof(DiskHeader) + image.bytes.size();
+    if (disk_budget > 0 && disk_bytes.fetch_add(size) + size > disk_budget)
+    {
+        disk_bytes.fetch_sub(size);
+        return;
+    }
+
+    bool written = false;
+    try
+    {
+        written = write_disk_file(dir / disk_key, image);
+    }
+    catch (...)
+    {
+    }
+
+    if (!written && disk_budget > 0)
+        disk_bytes.fetch_sub(size);
+}
+
+// Whether name could be a document's directory in the disk tier, see hash_document. Pruning
+// leaves everything else under the cache directory alone.
+static bool is_document_dir(const std::string &name)
+{
+    return name.size() == 32 && std::all_of(name.begin(), name.end(), [](unsigned char c) {
+               return std::isdigit(c) || (c >= 'a' && c <= 'f');
+           });
+}
+
+// Drops the least recently used pages of every document under root until they fit in budget,
+// and returns the bytes the pages left hold. Files being written by other runs are left alone.
+static uint64_t prune_disk_tier(const std::filesystem::path &root, uint64_t budget)
+{
+    struct DiskFile
+    {
+        std::filesystem::file_time_type used;
+        uint64_t size;
+        std::filesystem::path path;
+    };
+    std::vector<DiskFile> files;
+    uint64_t total = 0;
+
+    std::error_code error;
+    for (const auto &doc_dir : std::filesystem::directory_iterator(root, error))
+    {
+        if (!doc_dir.is_directory(error) || !is_document_dir(doc_dir.path().filename().string()))
+            continue;
+
+        for (const auto &entry : std::filesystem::directory_iterator(doc_dir.path(), error))
+        {
+            if (!entry.is_regular_file(error) || entry.path().extension() == ".tmp")
+                continue;
+
+            uint64_t size = entry.file_size(error);
+            std::filesystem::file_time_type used = entry.last_write_time(error);
+            if (error)
+                continue;
+
+            files.push_back({used, size, entry.path()});
+            total += size;
+        }
+    }
+
+    if (total <= budget)
+        return total;
+
+    std::sort(files.begin(), files.end(), [](const DiskFile &a, const DiskFile &b) { return a.used < b.used; });
+    for (const DiskFile &file : files)
+    {
+        if (total <= budget)
+            break;
+        if (std::filesystem::remove(file.path, error))
+            total -= file.size;
+    }
+    return total;
+}
+
+void new_render_cache(size_t budget, const std::string &dir, uint64_t disk_budget, const std::string &path,
+                      PDFHandle *cache_handle)
+{
+    if (cache_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    std::filesystem::path doc_dir;
+    uint64_t disk_bytes = 0;
+    if (!dir.empty())
+    {
+        doc_dir = std::filesystem::path(dir) / hash_document(path);
+        if (disk_budget > 0)
+            disk_bytes = prune_disk_tier(dir, disk_budget);
+
+        std::error_code error;
+        std::filesystem::create_directories(doc_dir, error);
+        if (error)
+        {
+            throw std::runtime_error(std::format("Failed to create render cache directory {}: {}", doc_dir.string(), error.message()));
+        }
+    }
+
+    RenderCache *cache = new RenderCache();
+    cache->budget = budget;
+    cache->dir = doc_dir;
+    cache->disk_budget = disk_budget;
+    cache->disk_bytes = disk_bytes;
+    *cache_handle = (PDFHandle)cache;
+}
+
+void free_render_cache(PDFHandle *cache_handle)
+{
+    if (!cache_handle || !*cache_handle)
+    {
+        return;
+    }
+
+    // Images still handed out keep their entries alive through their shared_ptr.
+    delete (RenderCache *)(*cache_handle);
+    *cache_handle = nullptr;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "main.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A finished page image kept by a RenderCache.
+struct CachedImage
+{
+    std::vector<uint8_t> bytes;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int stride = 0;
+    bool blank = false;
+    // The bytes are the page's own scan, see IMAGE_PASSTHROUGH.
+    bool passthrough = false;
+};
+
+// Images of already rendered pages shared by every session of a document, in two tiers. In
+// memory, entries are keyed by the page's fingerprint and render settings, so a repeated page is
+// rendered once, and the least recently used ones are dropped past budget bytes. On disk, entries
+// are keyed by the document's content hash, the page's index and the render settings, so a later
+// run over the same document reads its pages back instead of rendering them. Opening a cache with
+// a disk budget drops the least recently used files of every document under the cache directory
+// past it, and pages aren't stored once the budget is full.
+struct RenderCache
+{
+    std::mutex mutex;
+    // Most recently used first.
+    std::list<std::pair<std::string, std::shared_ptr<const CachedImage>>> recent;
+    std::unordered_map<std::string, decltype(recent)::iterator> entries;
+    size_t bytes = 0;
+    // 0 without a memory tier.
+    size_t budget = 0;
+    // Where this document's pages go, empty without a disk tier.
+    std::filesystem::path dir;
+    // Bytes the whole cache directory may hold, 0 for no limit.
+    uint64_t disk_budget = 0;
+    // Bytes the cache directory held after pruning it, plus every page stored since.
+    std::atomic<uint64_t> disk_bytes = 0;
+
+    std::shared_ptr<const CachedImage> find(const std::string &key);
+    void insert(const std::string &key, std::shared_ptr<const CachedImage> image);
+
+    // A missing, truncated or unreadable file is a miss and a failed write is dropped, the disk
+    // tier never fails a render.
+    std::shared_ptr<const CachedImage> load(const std::string &disk_key) const;
+    void store(const std::string &disk_key, const CachedImage &image);
+};
+
+// The settings that change a rendered page's bytes, part of both tiers' keys.
+std::string render_settings_key(float scale, int threshold, int mode, int format, bool passthrough);
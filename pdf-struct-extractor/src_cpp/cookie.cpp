@@ -0,0 +1,218 @@
+#include "cookie.h"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <stdexcept>
+
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static const char *abort_message(int reason)
+{
+    switch (reason)
+    {
+    case ABORT_STOPPED:
+        return "Render aborted: stopped";
+    case ABORT_PAUSED:
+        return "Render aborted: paused";
+    case ABORT_DEADLINE:
+        return "Render aborted: page time budget exceeded";
+    case ABORT_CANCELLED:
+        return "Render aborted: cancelled";
+    case ABORT_INCOMPLETE:
+        return "Render aborted: the page's bytes haven't all arrived yet";
+    default:
+        return "Render aborted";
+    }
+}
+
+// Called with the control's mutex held, before the cookie is registered, or by the render itself.
+static void abort_cookie(RenderCookie *cookie, int reason)
+{
+    int expected = ABORT_NONE;
+    cookie->reason.compare_exchange_strong(expected, reason, std::memory_order_relaxed);
+    cookie->cookie.abort = 1;
+}
+
+void write_abort(const AbortRecord &record, uint64_t *abort_buf)
+{
+    abort_buf[ABORT_FIELD_REASON] = (uint64_t)record.reason;
+    abort_buf[ABORT_FIELD_PROGRESS] = (uint64_t)record.progress;
+    abort_buf[ABORT_FIELD_PROGRESS_MAX] = (uint64_t)record.progress_max;
+}
+
+void throw_if_aborted(fz_context *ctx, RenderCookie *cookie)
+{
+    if (cookie && cookie->cookie.incomplete)
+        abort_cookie(cookie, ABORT_INCOMPLETE);
+
+    if (cookie && cookie->cookie.abort)
+    {
+        fz_throw(ctx, FZ_ERROR_ABORT, "%s", abort_message(cookie->reason.load(std::memory_order_relaxed)));
+    }
+}
+
+void note_incomplete(fz_context *ctx, RenderCookie *cookie)
+{
+    if (cookie && fz_caught(ctx) == FZ_ERROR_TRYLATER)
+        abort_cookie(cookie, ABORT_INCOMPLETE);
+}
+
+void begin_render(RenderControl *control, RenderCookie *cookie, int page_num)
+{
+    cookie->cookie = {};
+    cookie->page_num = page_num;
+    cookie->cookie.progress_max = (size_t)-1;
+    cookie->reason.store(ABORT_NONE, std::memory_order_relaxed);
+    cookie->deadline_ns = 0;
+
+    if (!control)
+        return;
+
+    std::lock_guard<std::mutex> lock(control->mutex);
+    if (control->budget_ns > 0)
+        cookie->deadline_ns = now_ns() + control->budget_ns;
+    if (control->halted != ABORT_NONE)
+        abort_cookie(cookie, control->halted);
+
+    control->active.push_back(cookie);
+    control->changed.notify_all();
+}
+
+void end_render(RenderControl *control, RenderCookie *cookie)
+{
+    if (control)
+    {
+        std::lock_guard<std::mutex> lock(control->mutex);
+        auto it = std::find(control->active.begin(), control->active.end(), cookie);
+        if (it != control->active.end())
+        {
+            *it = control->active.back();
+            control->active.pop_back();
+        }
+    }
+
+    cookie->last.reason = cookie->cookie.abort ? cookie->reason.load(std::memory_order_relaxed) : ABORT_NONE;
+    cookie->last.progress = cookie->cookie.progress;
+    cookie->last.progress_max = cookie->cookie.progress_max;
+}
+
+// Sleeps until the earliest deadline of the active renders, aborting every render past its own.
+static void run_watchdog(RenderControl *control)
+{
+    std::unique_lock<std::mutex> lock(control->mutex);
+
+    while (!control->closing)
+    {
+        uint64_t now = now_ns();
+        uint64_t next = 0;
+
+        for (RenderCookie *cookie : control->active)
+        {
+            if (cookie->deadline_ns == 0 || cookie->cookie.abort)
+                continue;
+
+            if (cookie->deadline_ns <= now)
+                abort_cookie(cookie, ABORT_DEADLINE);
+            else if (next == 0 || cookie->deadline_ns < next)
+                next = cookie->deadline_ns;
+        }
+
+        if (next == 0)
+            control->changed.wait(lock);
+        else
+            control->changed.wait_for(lock, std::chrono::nanoseconds(next - now));
+    }
+}
+
+void new_render_control(uint64_t page_budget_ns, PDFHandle *control_handle)
+{
+    if (control_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    RenderControl *control = new RenderControl();
+    control->budget_ns = page_budget_ns;
+    if (page_budget_ns > 0)
+        control->watchdog = std::thread(run_watchdog, control);
+
+    *control_handle = (PDFHandle)control;
+}
+
+void free_render_control(PDFHandle *control_handle)
+{
+    if (!control_handle || !*control_handle)
+    {
+        return;
+    }
+
+    // Every session rendering through it is closed by now.
+    RenderControl *control = (RenderControl *)(*control_handle);
+    {
+        std::lock_guard<std::mutex> lock(control->mutex);
+        control->closing = true;
+    }
+    control->changed.notify_all();
+    if (control->watchdog.joinable())
+        control->watchdog.join();
+
+    delete control;
+    *control_handle = nullptr;
+}
+
+void halt_renders(int reason, PDFHandle *control_handle)
+{
+    if (!control_handle || !*control_handle)
+    {
+        throw std::runtime_error("Invalid render control handle");
+    }
+
+    if (reason != ABORT_STOPPED && reason != ABORT_PAUSED)
+    {
+        throw std::runtime_error(std::format("Renders can't be halted with reason {}", reason));
+    }
+
+    RenderControl *control = (RenderControl *)(*control_handle);
+    std::lock_guard<std::mutex> lock(control->mutex);
+
+    // Stopping a paused run stops it, resuming is the only way out of a stop.
+    if (control->halted != ABORT_STOPPED)
+        control->halted = reason;
+    for (RenderCookie *cookie : control->active)
+        abort_cookie(cookie, control->halted);
+}
+
+void resume_renders(PDFHandle *control_handle)
+{
+    if (!control_handle || !*control_handle)
+    {
+        throw std::runtime_error("Invalid render control handle");
+    }
+
+    RenderControl *control = (RenderControl *)(*control_handle);
+    std::lock_guard<std::mutex> lock(control->mutex);
+    control->halted = ABORT_NONE;
+}
+
+void cancel_page_renders(int first_page, int count, PDFHandle *control_handle)
+{
+    if (!control_handle || !*control_handle)
+    {
+        throw std::runtime_error("Invalid render control handle");
+    }
+
+    RenderControl *control = (RenderControl *)(*control_handle);
+    std::lock_guard<std::mutex> lock(control->mutex);
+
+    for (RenderCookie *cookie : control->active)
+    {
+        if (cookie->page_num >= first_page && cookie->page_num - first_page < count)
+            abort_cookie(cookie, ABORT_CANCELLED);
+    }
+}
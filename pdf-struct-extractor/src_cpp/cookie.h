@@ -0,0 +1,97 @@
+#pragma once
+
+#include "main.h"
+
+#include <mupdf/fitz.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How far the last render of a cookie got, and why it was aborted if it was, see last_render_abort.
+struct AbortRecord
+{
+    int reason = ABORT_NONE;
+    int progress = 0;
+    size_t progress_max = (size_t)-1;
+};
+
+// The fz_cookie of a session's in-flight render. MuPDF checks cookie.abort between content
+// stream operators and display list nodes, so setting it from any thread stops the render at
+// its next check. Renders don't throw when they're aborted, see throw_if_aborted.
+struct RenderCookie
+{
+    fz_cookie cookie = {};
+    // Page being rendered, for cancel_page_renders.
+    int page_num = -1;
+    // Steady clock nanoseconds the render is aborted at, 0 without a budget.
+    uint64_t deadline_ns = 0;
+    // Why abort was set, the first reason wins.
+    std::atomic<int> reason{ABORT_NONE};
+    // Copied from cookie when the render ends, for last_render_abort.
+    AbortRecord last;
+};
+
+// Every in-flight render of the sessions sharing it, so Stop, Pause and the per-page time budget
+// can abort them mid-page. A watchdog thread aborts renders past their deadline, it's only
+// started with a budget.
+struct RenderControl
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<RenderCookie *> active;
+    // Renders started while halted are aborted right away with this reason.
+    int halted = ABORT_NONE;
+    uint64_t budget_ns = 0;
+    bool closing = false;
+    std::thread watchdog;
+};
+
+inline fz_cookie *mupdf_cookie(RenderCookie *cookie)
+{
+    return cookie ? &cookie->cookie : nullptr;
+}
+
+// Copies record into an abort_buf of ABORT_FIELDS entries, see AbortLayout.
+void write_abort(const AbortRecord &record, uint64_t *abort_buf);
+
+// Throws FZ_ERROR_ABORT when cookie was aborted, since MuPDF just stops running the page. A page
+// MuPDF ran without some of its bytes, which a progressive source hadn't received yet, counts as
+// aborted with ABORT_INCOMPLETE. Runs inside the caller's fz_try.
+void throw_if_aborted(fz_context *ctx, RenderCookie *cookie);
+
+// Aborts cookie's render with ABORT_INCOMPLETE when what the caller's fz_catch caught is
+// FZ_ERROR_TRYLATER, e.g. from loading a page whose objects haven't arrived yet. Has to be
+// called before end_render for the reason to reach last_render_abort.
+void note_incomplete(fz_context *ctx, RenderCookie *cookie);
+
+// Resets cookie for a new render of page_num and, with a control, registers it so it can be
+// aborted. Every begin_render is matched by an end_render, see CookieScope.
+void begin_render(RenderControl *control, RenderCookie *cookie, int page_num);
+void end_render(RenderControl *control, RenderCookie *cookie);
+
+// Brackets one render with begin_render and end_render. Only used in functions without an
+// fz_try of their own, since fz_try leaves scopes with longjmp and skips destructors.
+class CookieScope
+{
+public:
+    CookieScope(RenderControl *control, RenderCookie *cookie, int page_num) : control(control), cookie(cookie)
+    {
+        begin_render(control, cookie, page_num);
+    }
+
+    ~CookieScope()
+    {
+        end_render(control, cookie);
+    }
+
+    CookieScope(const CookieScope &) = delete;
+    CookieScope &operator=(const CookieScope &) = delete;
+
+private:
+    RenderControl *control;
+    RenderCookie *cookie;
+};
@@ -0,0 +1,214 @@
+#include "encode.h"
+#include "binarize.h"
+#include "main.h"
+
+#include <array>
+#include <atomic>
+#include <format>
+#include <stdexcept>
+
+static std::atomic<int> png_level{-1};
+
+void set_png_level(int level)
+{
+    if (level < -1 || level > 9)
+    {
+        throw std::runtime_error(std::format("Invalid PNG compression level {}", level));
+    }
+
+    png_level.store(level, std::memory_order_relaxed);
+}
+
+int current_png_level()
+{
+    return png_level.load(std::memory_order_relaxed);
+}
+
+static constexpr std::array<uint32_t, 256> crc_table = []
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}();
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    uint32_t c = 0xffffffffu;
+    for (size_t i = 0; i < size; i++)
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void put_u32_at(std::vector<uint8_t> &out, size_t at, uint32_t value)
+{
+    out[at] = (uint8_t)(value >> 24);
+    out[at + 1] = (uint8_t)(value >> 16);
+    out[at + 2] = (uint8_t)(value >> 8);
+    out[at + 3] = (uint8_t)value;
+}
+
+// Opens a chunk whose data the caller appends, see end_chunk.
+static size_t begin_chunk(std::vector<uint8_t> &out, const char *type)
+{
+    size_t at = out.size();
+    put_u32(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return at;
+}
+
+static void end_chunk(std::vector<uint8_t> &out, size_t at)
+{
+    size_t length = out.size() - at - 8;
+    put_u32_at(out, at, (uint32_t)length);
+    put_u32(out, crc32(out.data() + at + 4, length + 4));
+}
+
+void write_bilevel_png(fz_context *ctx, const uint8_t *samples, ptrdiff_t src_stride, int width, int height,
+                       uint8_t threshold, int level, std::vector<uint8_t> &scanlines, std::vector<uint8_t> &out)
+{
+    // Every row is a filter byte (0, none) followed by the packed row. Filters don't pay off on
+    // 1 bit rows, deflate finds the long white runs on its own.
+    size_t stride = packed_stride(width);
+    size_t row_bytes = stride + 1;
+    size_t bound = fz_deflate_bound(ctx, row_bytes * (size_t)height);
+
+    // Signature, IHDR, IDAT around the deflated rows and IEND.
+    run_in_fz_try(ctx, [&] {
+        scanlines.resize(row_bytes * (size_t)height);
+        out.clear();
+        out.reserve(8 + 25 + 12 + bound + 12);
+    });
+    pack_bits(samples, src_stride, width, height, scanlines.data() + 1, row_bytes, threshold);
+
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = scanlines.data() + (size_t)y * row_bytes;
+        row[0] = 0;
+        // Packed bits are set for black, 1 bit grayscale PNG is 0 for black.
+        for (size_t x = 1; x < row_bytes; x++)
+            row[x] = (uint8_t)~row[x];
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.assign(signature, signature + sizeof(signature));
+
+    size_t chunk = begin_chunk(out, "IHDR");
+    put_u32(out, (uint32_t)width);
+    put_u32(out, (uint32_t)height);
+    out.insert(out.end(), {1, 0, 0, 0, 0}); // Bit depth 1, grayscale, deflate, no filter set, no interlace.
+    end_chunk(out, chunk);
+
+    chunk = begin_chunk(out, "IDAT");
+    size_t data_at = out.size();
+    size_t compressed = bound;
+    out.resize(data_at + compressed);
+    fz_deflate(ctx, out.data() + data_at, &compressed, scanlines.data(), scanlines.size(), (fz_deflate_level)level);
+    out.resize(data_at + compressed);
+    end_chunk(out, chunk);
+
+    chunk = begin_chunk(out, "IEND");
+    end_chunk(out, chunk);
+}
+
+std::string pbm_header(int width, int height)
+{
+    return std::format("P4\n{} {}\n", width, height);
+}
+
+void write_qoi(const uint8_t *samples, ptrdiff_t src_stride, int width, int height, std::vector<uint8_t> &out)
+{
+    static const uint8_t QOI_OP_INDEX = 0x00;
+    static const uint8_t QOI_OP_DIFF = 0x40;
+    static const uint8_t QOI_OP_LUMA = 0x80;
+    static const uint8_t QOI_OP_RUN = 0xc0;
+    static const uint8_t QOI_OP_RGB = 0xfe;
+
+    out.clear();
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    put_u32(out, (uint32_t)width);
+    put_u32(out, (uint32_t)height);
+    out.push_back(3); // RGB, gray is written as r = g = b.
+    out.push_back(0); // sRGB with linear alpha.
+
+    // Pixels are gray and opaque, so the index only needs the gray value, and the
+    // hash (r * 3 + g * 5 + b * 7 + a * 11) % 64 reduces to (v * 15 + 255 * 11) % 64.
+    int index[64];
+    for (int &entry : index)
+        entry = -1;
+
+    // Both sides start from opaque black.
+    uint8_t prev = 0;
+    int run = 0;
+    size_t last = (size_t)width * (size_t)height;
+    size_t n = 0;
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row = samples + (ptrdiff_t)y * src_stride;
+        for (int x = 0; x < width; x++, n++)
+        {
+            uint8_t v = row[x];
+
+            if (v == prev)
+            {
+                run++;
+                if (run == 62 || n + 1 == last)
+                {
+                    out.push_back(QOI_OP_RUN | (uint8_t)(run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                out.push_back(QOI_OP_RUN | (uint8_t)(run - 1));
+                run = 0;
+            }
+
+            int hash = (v * 15 + 255 * 11) % 64;
+            if (index[hash] == v)
+            {
+                out.push_back(QOI_OP_INDEX | (uint8_t)hash);
+            }
+            else
+            {
+                index[hash] = v;
+                int diff = (int)(int8_t)(uint8_t)(v - prev);
+
+                if (diff >= -2 && diff <= 1)
+                {
+                    out.push_back(QOI_OP_DIFF | (uint8_t)((diff + 2) << 4 | (diff + 2) << 2 | (diff + 2)));
+                }
+                else if (diff >= -32 && diff <= 31)
+                {
+                    // Red and blue differ from green by 0, which LUMA stores biased by 8.
+                    out.push_back(QOI_OP_LUMA | (uint8_t)(diff + 32));
+                    out.push_back(0x88);
+                }
+                else
+                {
+                    out.insert(out.end(), {QOI_OP_RGB, v, v, v});
+                }
+            }
+
+            prev = v;
+        }
+    }
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
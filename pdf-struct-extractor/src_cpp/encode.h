@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mupdf/fitz.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+
+// Runs C++ work that may throw, e.g. growing a vector, inside the caller's fz_try. An exception
+// unwinding through fz_try's setjmp frame would skip its fz_always and leave the context's error
+// stack pushed, so it is rethrown as a MuPDF error instead. work must not call into MuPDF.
+template <typename Work>
+void run_in_fz_try(fz_context *ctx, Work &&work)
+{
+    char message[256] = "";
+    try
+    {
+        work();
+        return;
+    }
+    catch (const std::exception &e)
+    {
+        snprintf(message, sizeof(message), "%s", e.what());
+    }
+    fz_throw(ctx, FZ_ERROR_SYSTEM, "%s", message);
+}
+
+// Deflate level set with set_png_level, -1 while PNGs go through MuPDF's own writer.
+int current_png_level();
+
+// Encodes 8-bit gray samples as a 1 bit grayscale PNG, thresholding them on the fly like
+// pack_bits, and deflates it at level (0 only stores). scanlines is scratch for the filtered
+// rows and out receives the file. Runs inside the caller's fz_try, since fz_deflate throws, and
+// both vectors are sized before anything is written so nothing else can.
+void write_bilevel_png(fz_context *ctx, const uint8_t *samples, ptrdiff_t src_stride, int width, int height,
+                       uint8_t threshold, int level, std::vector<uint8_t> &scanlines, std::vector<uint8_t> &out);
+
+// Header of a binary PBM (P4) file, which is followed by rows packed like pack_bits does.
+std::string pbm_header(int width, int height);
+
+// Encodes thresholded 8-bit gray samples as a 3 channel QOI image into out. A bilevel page is
+// nearly all QOI_OP_RUN and QOI_OP_INDEX ops, so this is a single cheap pass over the samples.
+void write_qoi(const uint8_t *samples, ptrdiff_t src_stride, int width, int height, std::vector<uint8_t> &out);
@@ -0,0 +1,739 @@
+#include "engine.h"
+#include "source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// How long a worker waiting for a free completion slot, or for its loader, sleeps before checking for a stop.
+#define SLOT_POLL_MS 10
+// Pages a worker renders between flushes of its session's store, as iter_page does.
+#define FLUSH_INTERVAL 10
+
+enum EngineState : int
+{
+    ENGINE_RUNNING = 0,
+    ENGINE_PAUSED = 1,
+    ENGINE_STOPPING = 2,
+};
+
+// A finished page waiting in the completion queue. Either image is set, or error holds why
+// the page failed.
+struct EngineResult
+{
+    int page_num = 0;
+    PDFHandle image = nullptr;
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int stride = 0;
+    int flags = 0;
+    std::string error;
+    // See AbortLayout, set along with error.
+    uint64_t abort[ABORT_FIELDS] = {};
+};
+
+// Bounded multi-producer multi-consumer queue (Vyukov), every cell carries a sequence number
+// so producers and consumers only ever contend on one atomic each. The engine never pushes
+// more results than it has slots for, so push can't fail.
+class CompletionQueue
+{
+public:
+    explicit CompletionQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        cells = std::make_unique<Cell[]>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(EngineResult &&result)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.result = std::move(result);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(EngineResult &result)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    result = std::move(cell.result);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        EngineResult result;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
+
+struct RenderEngine;
+
+struct PrefetchedPage
+{
+    int page_num = 0;
+    PreparedPage *page = nullptr;
+};
+
+// One pinned thread with its own session. range packs the pages it still has to render as
+// [next, end), next in the low 32 bits, so the owner taking a page and a thief taking the
+// upper half race on one compare-and-swap instead of a lock.
+struct alignas(64) EngineWorker
+{
+    RenderEngine *engine = nullptr;
+    int index = 0;
+    PDFHandle session = nullptr;
+    std::thread thread;
+    std::atomic<uint64_t> range{0};
+
+    // Images freed by Rust while the worker runs, dropped by the worker on its own thread.
+    std::mutex release_mutex;
+    std::vector<PDFHandle> released;
+    bool exited = false;
+    std::atomic<int> outstanding{0};
+
+    // With prefetching, the loader thread takes the worker's pages in its place and records up to
+    // prefetch_depth of them ahead on its own session, which shares the worker's store, so loading
+    // the next page overlaps drawing this one.
+    PDFHandle loader = nullptr;
+    std::thread loader_thread;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_changed;
+    std::deque<PrefetchedPage> prefetched;
+    bool loader_done = false;
+};
+
+struct RenderEngine
+{
+    std::vector<std::unique_ptr<EngineWorker>> workers;
+    int format = OUTPUT_PNG;
+    float blank_ratio = -1.0f;
+    bool passthrough = false;
+    PDFHandle cache = nullptr;
+    // What the document is read from, waited on by pages that need bytes it hasn't received yet.
+    // Null when the document is opened from its path.
+    DocumentSource *source = nullptr;
+    int prefetch_depth = 0;
+
+    CompletionQueue queue;
+    // Free cells of the queue, taken by a worker before it renders a page so results
+    // never pile up faster than they are consumed.
+    std::counting_semaphore<> slots;
+    // Results in the queue.
+    std::counting_semaphore<> ready;
+    std::atomic<int> state{ENGINE_RUNNING};
+    std::atomic<int> live_workers{0};
+
+    RenderEngine(int depth) : queue(depth), slots(depth), ready(0) {}
+};
+
+static uint64_t pack_range(uint32_t next, uint32_t end)
+{
+    return ((uint64_t)end << 32) | next;
+}
+
+// Takes the next page of the worker's own range.
+static bool take_page(EngineWorker *worker, int *page_num)
+{
+    uint64_t range = worker->range.load(std::memory_order_acquire);
+    for (;;)
+    {
+        uint32_t next = (uint32_t)range;
+        uint32_t end = (uint32_t)(range >> 32);
+        if (next >= end)
+            return false;
+
+        if (worker->range.compare_exchange_weak(range, pack_range(next + 1, end), std::memory_order_acq_rel))
+        {
+            *page_num = (int)next;
+            return true;
+        }
+    }
+}
+
+// Moves the upper half of the busiest worker's range to thief, whose own range is empty.
+// Taking the upper half leaves the victim on its sequential run and gives the thief one of its own.
+static bool steal_pages(RenderEngine *engine, EngineWorker *thief)
+{
+    for (;;)
+    {
+        EngineWorker *victim = nullptr;
+        uint64_t victim_range = 0;
+        uint32_t most = 0;
+
+        for (auto &worker : engine->workers)
+        {
+            if (worker.get() == thief)
+                continue;
+
+            uint64_t range = worker->range.load(std::memory_order_acquire);
+            uint32_t next = (uint32_t)range;
+            uint32_t end = (uint32_t)(range >> 32);
+            if (end > next && end - next > most)
+            {
+                victim = worker.get();
+                victim_range = range;
+                most = end - next;
+            }
+        }
+
+        if (!victim)
+            return false;
+
+        uint32_t next = (uint32_t)victim_range;
+        uint32_t end = (uint32_t)(victim_range >> 32);
+        uint32_t split = end - (most + 1) / 2;
+
+        if (victim->range.compare_exchange_strong(victim_range, pack_range(next, split), std::memory_order_acq_rel))
+        {
+            thief->range.store(pack_range(split, end), std::memory_order_release);
+            return true;
+        }
+    }
+}
+
+static void pin_thread(std::thread &thread, int index)
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+        return;
+
+#ifdef _WIN32
+    SetThreadAffinityMask((HANDLE)thread.native_handle(), (DWORD_PTR)1 << (index % cores % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)index;
+#endif
+}
+
+// Drops images freed since the last call. Runs on the worker's thread, the only one using its context.
+static void drop_released(EngineWorker *worker)
+{
+    std::vector<PDFHandle> released;
+    {
+        std::lock_guard<std::mutex> lock(worker->release_mutex);
+        released.swap(worker->released);
+    }
+
+    for (PDFHandle image : released)
+    {
+        drop_page_image(image);
+        worker->outstanding.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+// Release hook of every image an engine worker renders.
+static void release_engine_image(PDFHandle image, void *owner)
+{
+    EngineWorker *worker = (EngineWorker *)owner;
+    std::lock_guard<std::mutex> lock(worker->release_mutex);
+
+    // Once the worker is gone nothing else uses its context, the lock keeps concurrent frees apart.
+    if (worker->exited)
+    {
+        drop_page_image(image);
+        worker->outstanding.fetch_sub(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        worker->released.push_back(image);
+    }
+}
+
+// Waits until the engine runs or stops. Returns false once it stops.
+static bool wait_until_running(RenderEngine *engine)
+{
+    int state = engine->state.load(std::memory_order_acquire);
+    while (state == ENGINE_PAUSED)
+    {
+        engine->state.wait(state, std::memory_order_acquire);
+        state = engine->state.load(std::memory_order_acquire);
+    }
+    return state == ENGINE_RUNNING;
+}
+
+static bool is_stopping(RenderEngine *engine)
+{
+    return engine->state.load(std::memory_order_acquire) == ENGINE_STOPPING;
+}
+
+// Waits until the engine's source has received more than seen bytes, for a page that needed bytes
+// it didn't have. False when the engine stops first, or when the source won't receive any more.
+static bool wait_for_bytes(RenderEngine *engine, size_t seen)
+{
+    if (!engine->source)
+        return false;
+
+    while (wait_until_running(engine))
+    {
+        if (wait_document_source(engine->source, seen, SLOT_POLL_MS) > seen)
+            return true;
+        if (!source_pending(engine->source))
+            return false;
+    }
+    return false;
+}
+
+static bool acquire_slot(RenderEngine *engine)
+{
+    while (!engine->slots.try_acquire_for(std::chrono::milliseconds(SLOT_POLL_MS)))
+    {
+        if (is_stopping(engine))
+            return false;
+    }
+    return true;
+}
+
+// The next page a worker renders: its own next page, or once its range runs out one it stole.
+static bool next_page(EngineWorker *worker, int *page_num)
+{
+    return take_page(worker, page_num) || (steal_pages(worker->engine, worker) && take_page(worker, page_num));
+}
+
+// Prepares the worker's pages on its loader session, staying at most prefetch_depth pages ahead.
+static void run_loader(EngineWorker *worker)
+{
+    RenderEngine *engine = worker->engine;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(worker->prefetch_mutex);
+            while (worker->prefetched.size() >= (size_t)engine->prefetch_depth && !is_stopping(engine))
+                worker->prefetch_changed.wait_for(lock, std::chrono::milliseconds(SLOT_POLL_MS));
+        }
+
+        int page_num = 0;
+        if (!wait_until_running(engine) || !next_page(worker, &page_num))
+            break;
+
+        PreparedPage *page = prepare_page(page_num, engine->format, engine->passthrough, &worker->loader,
+                                          engine->cache ? &engine->cache : nullptr);
+        {
+            std::lock_guard<std::mutex> lock(worker->prefetch_mutex);
+            worker->prefetched.push_back({page_num, page});
+        }
+        worker->prefetch_changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker->prefetch_mutex);
+        worker->loader_done = true;
+    }
+    worker->prefetch_changed.notify_all();
+}
+
+// Waits for the next page the worker's loader prepared. Returns false once the loader ran out
+// of pages and everything it prepared was taken, or the engine stops.
+static bool next_prefetched(EngineWorker *worker, PrefetchedPage *next)
+{
+    {
+        std::unique_lock<std::mutex> lock(worker->prefetch_mutex);
+        while (worker->prefetched.empty())
+        {
+            if (worker->loader_done || is_stopping(worker->engine))
+                return false;
+            worker->prefetch_changed.wait_for(lock, std::chrono::milliseconds(SLOT_POLL_MS));
+        }
+
+        *next = worker->prefetched.front();
+        worker->prefetched.pop_front();
+    }
+
+    worker->prefetch_changed.notify_all();
+    return true;
+}
+
+// Renders page_num, or the page prepared for it when prefetching.
+static void render_into(EngineWorker *worker, int page_num, PreparedPage *prepared, EngineResult &result)
+{
+    RenderEngine *engine = worker->engine;
+    PDFHandle *cache = engine->cache ? &engine->cache : nullptr;
+    result.page_num = page_num;
+
+    try
+    {
+        if (prepared)
+        {
+            result.data = render_prepared_page(prepared, engine->format, engine->blank_ratio, engine->passthrough,
+                                               &result.size, &result.width, &result.height, &result.channels,
+                                               &result.stride, &result.flags, &worker->session, cache,
+                                               &result.image);
+        }
+        else
+        {
+            result.data = render_session_image(page_num, engine->format, engine->blank_ratio, engine->passthrough,
+                                               &result.size, &result.width, &result.height, &result.channels,
+                                               &result.stride, &result.flags, &worker->session, cache,
+                                               &result.image);
+        }
+        set_page_image_release(result.image, release_engine_image, worker);
+        worker->outstanding.fetch_add(1, std::memory_order_relaxed);
+    }
+    catch (const std::exception &e)
+    {
+        result.error = e.what();
+        last_render_abort(result.abort, &worker->session);
+    }
+}
+
+static void run_worker(EngineWorker *worker)
+{
+    RenderEngine *engine = worker->engine;
+    int rendered = 0;
+
+    for (;;)
+    {
+        drop_released(worker);
+
+        if (!wait_until_running(engine) || !acquire_slot(engine))
+            break;
+
+        PrefetchedPage next;
+        bool found = engine->prefetch_depth > 0 ? next_prefetched(worker, &next) : next_page(worker, &next.page_num);
+        if (!found)
+        {
+            engine->slots.release();
+            break;
+        }
+
+        size_t seen = engine->source ? source_received(engine->source) : 0;
+        EngineResult result;
+        render_into(worker, next.page_num, next.page, result);
+
+        // A page aborted by a pause is rendered again once the engine resumes, and one that needed
+        // bytes the source didn't have once more arrived, on this session since its prepared page is gone.
+        for (;;)
+        {
+            uint64_t reason = result.abort[ABORT_FIELD_REASON];
+            if (reason == ABORT_INCOMPLETE && wait_for_bytes(engine, seen))
+                seen = source_received(engine->source);
+            else if (reason != ABORT_PAUSED || !wait_until_running(engine))
+                break;
+
+            result = EngineResult();
+            render_into(worker, next.page_num, nullptr, result);
+        }
+
+        engine->queue.push(std::move(result));
+        engine->ready.release();
+
+        // Flushing while images are out would only drop what they still hold on to.
+        if (++rendered % FLUSH_INTERVAL == 0 && worker->outstanding.load(std::memory_order_relaxed) == 0)
+        {
+            flush_session_cache(&worker->session);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker->release_mutex);
+        worker->exited = true;
+    }
+    drop_released(worker);
+
+    // Results are pushed before the count drops, next_engine_page relies on it to tell when it's done.
+    engine->live_workers.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static void join_workers(RenderEngine *engine)
+{
+    engine->state.store(ENGINE_STOPPING, std::memory_order_release);
+    engine->state.notify_all();
+
+    for (auto &worker : engine->workers)
+    {
+        worker->prefetch_changed.notify_all();
+        if (worker->loader_thread.joinable())
+            worker->loader_thread.join();
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+static void destroy_engine(RenderEngine *engine)
+{
+    join_workers(engine);
+
+    EngineResult result;
+    while (engine->queue.pop(result))
+    {
+        if (result.image)
+            drop_page_image(result.image);
+    }
+
+    // Pages prepared for a stopped worker still hold on to its store, so they go before its loader.
+    for (auto &worker : engine->workers)
+    {
+        for (PrefetchedPage &next : worker->prefetched)
+            drop_prepared_page(next.page, &worker->session);
+        worker->prefetched.clear();
+
+        close_session(&worker->loader);
+        close_session(&worker->session);
+    }
+
+    delete engine;
+}
+
+void start_render_engine(const std::string &path, int workers, bool pin_threads, bool share_store, int format,
+                         float blank_ratio, bool passthrough, int queue_depth, int prefetch_depth,
+                         PDFHandle *ctx_handle, PDFHandle *source_handle, PDFHandle *cache_handle,
+                         PDFHandle *profile_handle, PDFHandle *stats_handle, PDFHandle *control_handle,
+                         PDFHandle *engine_handle, int *pages_buf)
+{
+    if (ctx_handle == nullptr || engine_handle == nullptr || pages_buf == nullptr)
+    {
+        throw std::runtime_error("Passed a nullptr when trying to start a render engine!");
+    }
+
+    if (workers <= 0 || queue_depth <= 0 || prefetch_depth < 0)
+    {
+        throw std::runtime_error(std::format("Invalid render engine size: {} workers, queue depth {}, prefetch depth {}",
+                                             workers, queue_depth, prefetch_depth));
+    }
+
+    RenderEngine *engine = new RenderEngine(queue_depth);
+    engine->format = format;
+    engine->blank_ratio = blank_ratio;
+    engine->passthrough = passthrough;
+    engine->cache = cache_handle ? *cache_handle : nullptr;
+    engine->source = source_handle ? (DocumentSource *)(*source_handle) : nullptr;
+    engine->prefetch_depth = prefetch_depth;
+
+    // Sessions are opened up front, so a document that fails to open fails here rather than on a worker.
+    int page_count = 0;
+    try
+    {
+        for (int i = 0; i < workers; i++)
+        {
+            auto worker = std::make_unique<EngineWorker>();
+            worker->engine = engine;
+            worker->index = i;
+            open_session(path, share_store, ctx_handle, source_handle, &worker->session, &page_count);
+            if (profile_handle)
+                set_session_profile(profile_handle, &worker->session);
+            if (stats_handle)
+                set_session_stats(stats_handle, &worker->session);
+            if (control_handle)
+                set_session_control(control_handle, &worker->session);
+            engine->workers.push_back(std::move(worker));
+
+            EngineWorker *added = engine->workers.back().get();
+            if (prefetch_depth > 0)
+            {
+                open_loader_session(path, source_handle, &added->session, &added->loader);
+                if (profile_handle)
+                    set_session_profile(profile_handle, &added->loader);
+                if (stats_handle)
+                    set_session_stats(stats_handle, &added->loader);
+                if (control_handle)
+                    set_session_control(control_handle, &added->loader);
+            }
+        }
+    }
+    catch (...)
+    {
+        destroy_engine(engine);
+        throw;
+    }
+
+    // Every worker starts on a contiguous run of pages, so sequential pages stay on one warm session.
+    for (int i = 0; i < workers; i++)
+    {
+        uint32_t begin = (uint32_t)((int64_t)page_count * i / workers);
+        uint32_t end = (uint32_t)((int64_t)page_count * (i + 1) / workers);
+        engine->workers[i]->range.store(pack_range(begin, end), std::memory_order_relaxed);
+    }
+
+    engine->live_workers.store(workers, std::memory_order_release);
+    for (auto &worker : engine->workers)
+    {
+        worker->thread = std::thread(run_worker, worker.get());
+        if (pin_threads)
+            pin_thread(worker->thread, worker->index);
+        // Loaders mostly wait on I/O and decompression, they're left to the scheduler.
+        if (prefetch_depth > 0)
+            worker->loader_thread = std::thread(run_loader, worker.get());
+    }
+
+    *engine_handle = (PDFHandle)engine;
+    *pages_buf = page_count;
+}
+
+uint8_t *next_engine_page(int timeout_ms, int *status_buf, int *page_buf, size_t *size_buf, int *width_buf,
+                          int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf, uint64_t *abort_buf,
+                          PDFHandle *engine_handle, PDFHandle *image_handle)
+{
+    if (!engine_handle || !*engine_handle)
+    {
+        throw std::runtime_error("Invalid render engine handle");
+    }
+
+    if (status_buf == nullptr || page_buf == nullptr || size_buf == nullptr || width_buf == nullptr ||
+        height_buf == nullptr || channels_buf == nullptr || stride_buf == nullptr || flags_buf == nullptr ||
+        abort_buf == nullptr || image_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    RenderEngine *engine = (RenderEngine *)(*engine_handle);
+
+    bool ready = engine->ready.try_acquire_for(std::chrono::milliseconds(timeout_ms < 0 ? 0 : timeout_ms));
+    if (!ready)
+    {
+        // Every worker pushes its last result before it counts itself out, so once none are
+        // left whatever is still in the queue is already counted by ready.
+        if (engine->live_workers.load(std::memory_order_acquire) == 0)
+            ready = engine->ready.try_acquire();
+
+        if (!ready)
+        {
+            *status_buf = engine->live_workers.load(std::memory_order_acquire) == 0 ? ENGINE_DONE
+                                                                                    : ENGINE_PENDING;
+            return nullptr;
+        }
+    }
+
+    EngineResult result;
+    engine->queue.pop(result);
+    engine->slots.release();
+
+    *status_buf = ENGINE_PAGE;
+    *page_buf = result.page_num;
+
+    if (!result.error.empty())
+    {
+        std::copy(result.abort, result.abort + ABORT_FIELDS, abort_buf);
+        throw std::runtime_error(result.error);
+    }
+
+    *size_buf = result.size;
+    *width_buf = result.width;
+    *height_buf = result.height;
+    *channels_buf = result.channels;
+    *stride_buf = result.stride;
+    *flags_buf = result.flags;
+    *image_handle = result.image;
+
+    return result.data;
+}
+
+void pause_render_engine(bool paused, PDFHandle *engine_handle)
+{
+    if (!engine_handle || !*engine_handle)
+    {
+        return;
+    }
+
+    RenderEngine *engine = (RenderEngine *)(*engine_handle);
+    int expected = paused ? ENGINE_RUNNING : ENGINE_PAUSED;
+
+    // A stopping engine stays stopped.
+    if (engine->state.compare_exchange_strong(expected, paused ? ENGINE_PAUSED : ENGINE_RUNNING, std::memory_order_acq_rel))
+    {
+        engine->state.notify_all();
+    }
+}
+
+void stop_render_engine(PDFHandle *engine_handle)
+{
+    if (!engine_handle || !*engine_handle)
+    {
+        return;
+    }
+
+    RenderEngine *engine = (RenderEngine *)(*engine_handle);
+    engine->state.store(ENGINE_STOPPING, std::memory_order_release);
+    engine->state.notify_all();
+}
+
+void free_render_engine(PDFHandle *engine_handle)
+{
+    if (!engine_handle || !*engine_handle)
+    {
+        return;
+    }
+
+    destroy_engine((RenderEngine *)(*engine_handle));
+    *engine_handle = nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "main.h"
+
+// Called by free_page_image instead of freeing an image that was handed a release hook,
+// with the owner it was registered with. Used by the RenderEngine, whose images belong to a
+// worker's context and must be dropped by that worker rather than by whoever frees them.
+typedef void (*PageImageRelease)(PDFHandle image, void *owner);
+
+// Routes free_page_image for image through release. Implemented in main.cpp.
+void set_page_image_release(PDFHandle image, PageImageRelease release, void *owner);
+
+// Frees image right away, ignoring any release hook. The caller must be the only
+// thread using the image's context. Implemented in main.cpp.
+void drop_page_image(PDFHandle image);
+
+// A page loaded and recorded into a display list ahead of rendering it, or found in the RenderCache.
+// Defined in main.cpp.
+struct PreparedPage;
+
+// Opens a session that prepares pages for session on another thread. It clones session's context,
+// so the two share one store and the display lists it records can be rendered by session.
+// Has to be closed before session. Implemented in main.cpp.
+void open_loader_session(const std::string &path, PDFHandle *source_handle, PDFHandle *session_handle,
+                         PDFHandle *loader_handle);
+
+// Loads page_num on the loader session: looks it up in the cache, or records it into a display list.
+// Never throws, a failure is kept and thrown by render_prepared_page. Implemented in main.cpp.
+PreparedPage *prepare_page(int page_num, int format, bool passthrough, PDFHandle *loader_handle,
+                           PDFHandle *cache_handle);
+
+// Renders a prepared page on the session its loader was opened for, like render_session_image,
+// and frees it. Implemented in main.cpp.
+uint8_t *render_prepared_page(PreparedPage *page, int format, float blank_ratio, bool passthrough, size_t *size_buf,
+                              int *width_buf, int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf,
+                              PDFHandle *session_handle, PDFHandle *cache_handle, PDFHandle *image_handle);
+
+// Frees a prepared page that won't be rendered. The caller must be the only thread using session's
+// context. Implemented in main.cpp.
+void drop_prepared_page(PreparedPage *page, PDFHandle *session_handle);
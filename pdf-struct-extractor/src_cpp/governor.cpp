@@ -0,0 +1,238 @@
+#include "governor.h"
+#include "main.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Allocations carry their size in front of them, padded to keep MuPDF's alignment.
+#define HEADER_SIZE alignof(std::max_align_t)
+// Above this share of the cap every context is asked to shrink its store.
+#define HIGH_WATER_PERCENT 85
+// How far relieve_memory_pressure shrinks a store, as a percentage of its current size.
+#define SHRINK_PERCENT 50
+
+// Usage of one context and every fz_clone_context child of it, which share its allocator.
+// Lives until the last byte it counted was freed, i.e. the context and its clones are gone.
+struct ContextUsage
+{
+    fz_alloc_context alloc;
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<bool> dropped{false};
+};
+
+static std::atomic<size_t> global_live{0};
+static std::atomic<size_t> global_peak{0};
+static std::atomic<size_t> global_cap{0};
+// Bumped whenever the process comes close to or runs into the cap.
+static std::atomic<unsigned> pressure_epoch{0};
+// Whether the process is above the high water mark since it last bumped pressure_epoch for it, so
+// one climb past the mark bumps it once instead of on every allocation until usage drops again.
+static std::atomic<bool> above_high_water{false};
+
+static std::mutex registry_mutex;
+static std::vector<ContextUsage *> registry;
+
+static size_t high_water(size_t cap)
+{
+    return cap / 100 * HIGH_WATER_PERCENT;
+}
+
+static void raise_peak(std::atomic<size_t> &peak, size_t live)
+{
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (live > current && !peak.compare_exchange_weak(current, live, std::memory_order_relaxed))
+    {
+    }
+}
+
+// Counts size more bytes against the cap, or refuses them.
+static bool reserve(ContextUsage *usage, size_t size)
+{
+    size_t cap = global_cap.load(std::memory_order_relaxed);
+    size_t live = global_live.fetch_add(size, std::memory_order_relaxed) + size;
+
+    // Running into the cap is past the high water mark too, so it's the same climb.
+    if (cap != 0 && live > high_water(cap) && !above_high_water.load(std::memory_order_relaxed) &&
+        !above_high_water.exchange(true, std::memory_order_relaxed))
+    {
+        pressure_epoch.fetch_add(1, std::memory_order_release);
+    }
+
+    if (cap != 0 && live > cap)
+    {
+        global_live.fetch_sub(size, std::memory_order_relaxed);
+        return false;
+    }
+
+    raise_peak(global_peak, live);
+    size_t context_live = usage->live.fetch_add(size, std::memory_order_relaxed) + size;
+    raise_peak(usage->peak, context_live);
+    return true;
+}
+
+static void release(ContextUsage *usage, size_t size)
+{
+    size_t live = global_live.fetch_sub(size, std::memory_order_relaxed) - size;
+    if (above_high_water.load(std::memory_order_relaxed) &&
+        live <= high_water(global_cap.load(std::memory_order_relaxed)))
+    {
+        above_high_water.store(false, std::memory_order_relaxed);
+    }
+
+    // The context struct is the first allocation and the last free, nothing touches usage after this.
+    if (usage->live.fetch_sub(size, std::memory_order_acq_rel) == size)
+    {
+        usage->dropped.store(true, std::memory_order_release);
+    }
+}
+
+static void *governed_malloc(void *user, size_t size)
+{
+    ContextUsage *usage = (ContextUsage *)user;
+    if (!reserve(usage, size))
+        return nullptr;
+
+    unsigned char *block = (unsigned char *)malloc(HEADER_SIZE + size);
+    if (!block)
+    {
+        release(usage, size);
+        return nullptr;
+    }
+
+    memcpy(block, &size, sizeof(size));
+    return block + HEADER_SIZE;
+}
+
+static void governed_free(void *user, void *ptr)
+{
+    if (!ptr)
+        return;
+
+    unsigned char *block = (unsigned char *)ptr - HEADER_SIZE;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+
+    free(block);
+    release((ContextUsage *)user, size);
+}
+
+static void *governed_realloc(void *user, void *ptr, size_t size)
+{
+    if (!ptr)
+        return governed_malloc(user, size);
+
+    ContextUsage *usage = (ContextUsage *)user;
+    unsigned char *block = (unsigned char *)ptr - HEADER_SIZE;
+    size_t old_size;
+    memcpy(&old_size, block, sizeof(old_size));
+
+    if (size > old_size && !reserve(usage, size - old_size))
+        return nullptr;
+
+    unsigned char *grown = (unsigned char *)realloc(block, HEADER_SIZE + size);
+    if (!grown)
+    {
+        if (size > old_size)
+            release(usage, size - old_size);
+        return nullptr;
+    }
+
+    if (size < old_size)
+        release(usage, old_size - size);
+
+    memcpy(grown, &size, sizeof(size));
+    return grown + HEADER_SIZE;
+}
+
+// Forgets contexts that are gone. Called with registry_mutex held.
+static void prune_registry()
+{
+    registry.erase(std::remove_if(registry.begin(), registry.end(),
+                                  [](ContextUsage *usage)
+                                  {
+                                      if (!usage->dropped.load(std::memory_order_acquire))
+                                          return false;
+                                      delete usage;
+                                      return true;
+                                  }),
+                   registry.end());
+}
+
+fz_context *new_governed_context(const fz_locks_context *locks, size_t max_store)
+{
+    ContextUsage *usage = new ContextUsage();
+    usage->alloc.user = usage;
+    usage->alloc.malloc_ = governed_malloc;
+    usage->alloc.realloc_ = governed_realloc;
+    usage->alloc.free_ = governed_free;
+
+    size_t cap = global_cap.load(std::memory_order_relaxed);
+    if (cap != 0)
+        max_store = std::min(max_store, cap);
+
+    fz_context *ctx = fz_new_context(&usage->alloc, locks, max_store);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    prune_registry();
+
+    // A context that failed to be created freed whatever it allocated, if anything.
+    if (!ctx && usage->live.load(std::memory_order_acquire) == 0)
+    {
+        delete usage;
+        return nullptr;
+    }
+
+    registry.push_back(usage);
+    return ctx;
+}
+
+bool relieve_memory_pressure(fz_context *ctx, unsigned *seen_epoch)
+{
+    unsigned epoch = pressure_epoch.load(std::memory_order_acquire);
+    if (epoch == *seen_epoch)
+        return false;
+
+    *seen_epoch = epoch;
+    fz_shrink_store(ctx, SHRINK_PERCENT);
+    return true;
+}
+
+void set_memory_cap(size_t cap_bytes)
+{
+    global_cap.store(cap_bytes, std::memory_order_relaxed);
+
+    // Contexts already over a lowered cap start shrinking right away, and the next climb past
+    // the new high water mark counts as one.
+    above_high_water.store(false, std::memory_order_relaxed);
+    pressure_epoch.fetch_add(1, std::memory_order_release);
+}
+
+int memory_usage(size_t *live_buf, size_t *peak_buf, size_t *cap_buf, size_t *context_live_buf,
+                 size_t *context_peak_buf, int capacity)
+{
+    if (live_buf)
+        *live_buf = global_live.load(std::memory_order_relaxed);
+    if (peak_buf)
+        *peak_buf = global_peak.load(std::memory_order_relaxed);
+    if (cap_buf)
+        *cap_buf = global_cap.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    prune_registry();
+
+    int count = (int)registry.size();
+    for (int i = 0; i < count && i < capacity; i++)
+    {
+        if (context_live_buf)
+            context_live_buf[i] = registry[i]->live.load(std::memory_order_relaxed);
+        if (context_peak_buf)
+            context_peak_buf[i] = registry[i]->peak.load(std::memory_order_relaxed);
+    }
+
+    return count;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <mupdf/fitz.h>
+
+#include <cstddef>
+
+// Every context is created through the memory governor, which counts what MuPDF allocates per
+// context and for the whole process against one cap (set_memory_cap in main.h). An allocation
+// that would go over the cap fails, so MuPDF scavenges the allocating context's store and retries,
+// and every other context is asked to shrink its store at its next relieve_memory_pressure call.
+
+// fz_new_context with the governor's allocator. The store is clamped to the cap when one is set.
+// Returns nullptr when the context can't be created, like fz_new_context.
+fz_context *new_governed_context(const fz_locks_context *locks, size_t max_store);
+
+// Shrinks ctx's store if the process came close to or ran into the cap since *seen_epoch, and
+// returns whether it did. Call between pages, never from inside a MuPDF call.
+bool relieve_memory_pressure(fz_context *ctx, unsigned *seen_epoch);
@@ -0,0 +1,191 @@
+#include "locks.h"
+#include "main.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+// Spins before parking in SpinParkLock. MuPDF's critical sections (allocator bookkeeping, a
+// glyph cache lookup) are a few hundred cycles, far shorter than a trip through the kernel.
+#define SPIN_LIMIT 128
+
+// A futex style mutex (Drepper's "Futexes Are Tricky", mutex 2) that spins for a while before
+// parking on std::atomic::wait. state is 0 when free, 1 when held and 2 when held with waiters.
+class SpinParkLock
+{
+public:
+    bool try_lock()
+    {
+        int expected = 0;
+        return state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock()
+    {
+        for (int i = 0; i < SPIN_LIMIT; i++)
+        {
+            if (state.load(std::memory_order_relaxed) == 0 && try_lock())
+                return;
+            cpu_relax();
+        }
+
+        while (state.exchange(2, std::memory_order_acquire) != 0)
+        {
+            state.wait(2, std::memory_order_relaxed);
+        }
+    }
+
+    void unlock()
+    {
+        if (state.exchange(0, std::memory_order_release) == 2)
+            state.notify_one();
+    }
+
+private:
+    std::atomic<int> state{0};
+};
+
+// One lock with its statistics. The counters are only written by whoever just took the lock,
+// so they share its cache line without adding contention.
+struct alignas(64) LockSlot
+{
+    std::mutex mutex;
+    SpinParkLock adaptive;
+    bool use_adaptive = false;
+
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+
+    void lock()
+    {
+        bool taken = use_adaptive ? adaptive.try_lock() : mutex.try_lock();
+
+        // Only waits are timed, an uncontended acquisition costs one extra increment.
+        if (!taken)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (use_adaptive)
+                adaptive.lock();
+            else
+                mutex.lock();
+            auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+            contended.fetch_add(1, std::memory_order_relaxed);
+            wait_ns.fetch_add((uint64_t)waited.count(), std::memory_order_relaxed);
+        }
+
+        acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        if (use_adaptive)
+            adaptive.unlock();
+        else
+            mutex.unlock();
+    }
+};
+
+static LockSlot lock_slots[LOCK_SLOT_COUNT];
+
+// Which slots use adaptive locks can't change once a context may hold one of them.
+static std::mutex lock_mode_mutex;
+static int adaptive_mask = 0;
+static bool lock_mode_fixed = false;
+
+CreationLock context_creation_lock;
+
+static void lock_mutex(void *user, int lock)
+{
+    if (lock >= 0 && lock < FZ_LOCK_MAX)
+    {
+        lock_slots[lock].lock();
+    }
+}
+
+static void unlock_mutex(void *user, int lock)
+{
+    if (lock >= 0 && lock < FZ_LOCK_MAX)
+    {
+        lock_slots[lock].unlock();
+    }
+}
+
+fz_locks_context shared_locks()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_mode_mutex);
+        if (!lock_mode_fixed)
+        {
+            for (int slot = 0; slot < FZ_LOCK_MAX; slot++)
+            {
+                lock_slots[slot].use_adaptive = (adaptive_mask & (1 << slot)) != 0;
+            }
+            lock_mode_fixed = true;
+        }
+    }
+
+    fz_locks_context locks;
+    locks.user = nullptr;
+    locks.lock = lock_mutex;
+    locks.unlock = unlock_mutex;
+    return locks;
+}
+
+void CreationLock::lock()
+{
+    lock_slots[LOCK_SLOT_CREATION].lock();
+}
+
+void CreationLock::unlock()
+{
+    lock_slots[LOCK_SLOT_CREATION].unlock();
+}
+
+void set_adaptive_locks(int slot_mask)
+{
+    std::lock_guard<std::mutex> guard(lock_mode_mutex);
+
+    if (lock_mode_fixed && slot_mask != adaptive_mask)
+    {
+        throw std::runtime_error("Lock modes can only be changed before the first document is opened");
+    }
+
+    adaptive_mask = slot_mask;
+}
+
+int lock_stats(uint64_t *acquisitions_buf, uint64_t *contended_buf, uint64_t *wait_ns_buf, int capacity)
+{
+    for (int slot = 0; slot < LOCK_SLOT_COUNT && slot < capacity; slot++)
+    {
+        if (acquisitions_buf)
+            acquisitions_buf[slot] = lock_slots[slot].acquisitions.load(std::memory_order_relaxed);
+        if (contended_buf)
+            contended_buf[slot] = lock_slots[slot].contended.load(std::memory_order_relaxed);
+        if (wait_ns_buf)
+            wait_ns_buf[slot] = lock_slots[slot].wait_ns.load(std::memory_order_relaxed);
+    }
+
+    return LOCK_SLOT_COUNT;
+}
+
+void reset_lock_stats()
+{
+    for (LockSlot &slot : lock_slots)
+    {
+        slot.acquisitions.store(0, std::memory_order_relaxed);
+        slot.contended.store(0, std::memory_order_relaxed);
+        slot.wait_ns.store(0, std::memory_order_relaxed);
+    }
+}
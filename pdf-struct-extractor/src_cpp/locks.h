@@ -0,0 +1,23 @@
+#pragma once
+
+#include <mupdf/fitz.h>
+
+// Lock statistics cover every FZ_LOCK_* slot, followed by context creation.
+#define LOCK_SLOT_CREATION FZ_LOCK_MAX
+#define LOCK_SLOT_COUNT (FZ_LOCK_MAX + 1)
+
+// The lock callbacks every context is created with: one lock per FZ_LOCK_* slot, shared by
+// every context so fz_clone_context children stay safe. Counts acquisitions, contended
+// acquisitions and time spent waiting per slot. Fixes which slots use adaptive locks
+// (set_adaptive_locks in main.h) the first time it is called.
+fz_locks_context shared_locks();
+
+// Serializes creating and cloning contexts, counted in the LOCK_SLOT_CREATION stats.
+// Meets BasicLockable, so it works with std::lock_guard.
+struct CreationLock
+{
+    void lock();
+    void unlock();
+};
+
+extern CreationLock context_creation_lock;
@@ -6,19 +6,24 @@
 #include <memory>
 #include <thread>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include "main.h"
-
-#define SCALE 6.0f // 432 DPI
-#define THRESHOLD 128.5f
-
-// Global mutexes for MuPDF locking - shared across all contexts
-static std::mutex fz_mutexes[FZ_LOCK_MAX];
-
-// Additional mutex for context creation to prevent race conditions
-static std::mutex context_creation_mutex;
-
-// Thread-local storage for frequently accessed resources
-thread_local fz_matrix cached_ctm = fz_scale(SCALE, SCALE);
+#include "binarize.h"
+#include "source.h"
+#include "prescan.h"
+#include "engine.h"
+#include "governor.h"
+#include "locks.h"
+#include "stats.h"
+#include "encode.h"
+#include "cookie.h"
+#include "cache.h"
+#include "passthrough.h"
+#include "profile.h"
+
+#define PROBE_SCALE 0.25f // 18 DPI, enough to tell ink from speckles on a blank scan
 
 // Context pool for better memory management
 struct ContextPool
@@ -72,428 +77,2702 @@ struct ContextPool
 
 static ContextPool global_context_pool;
 
-static void lock_mutex(void *user, int lock)
+// Idle pieces of each kind a PageArena keeps, the rest goes back to the heap.
+#define ARENA_IDLE_LIMIT 4
+
+// Render scratch memory a session reuses from page to page instead of going back to the heap:
+// pixmap samples (recycled between pages of the same size), PNG encode buffers and packed
+// result bytes. Whatever a page image holds comes back when it is freed. Belongs to one
+// session's context, samples are allocated with it so the memory governor sees them.
+struct PageArena
+{
+    std::mutex mutex;
+    std::vector<std::pair<size_t, unsigned char *>> idle_samples;
+    std::unordered_map<unsigned char *, size_t> lent_samples;
+    std::vector<fz_buffer *> idle_buffers;
+    std::vector<std::vector<uint8_t>> idle_bytes;
+};
+
+// Lends out size bytes of pixmap samples, reusing an idle block of the same size.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static unsigned char *take_samples(fz_context *ctx, PageArena *arena, size_t size)
 {
-    if (lock >= 0 && lock < FZ_LOCK_MAX)
+    unsigned char *samples = nullptr;
     {
-        fz_mutexes[lock].lock();
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        for (auto it = arena->idle_samples.begin(); it != arena->idle_samples.end(); ++it)
+        {
+            if (it->first == size)
+            {
+                samples = it->second;
+                arena->idle_samples.erase(it);
+                break;
+            }
+        }
     }
-}
 
-static void unlock_mutex(void *user, int lock)
-{
-    if (lock >= 0 && lock < FZ_LOCK_MAX)
+    // fz_malloc throws by longjmp (e.g. at the memory cap), so it must not run under the lock.
+    if (!samples)
+        samples = (unsigned char *)fz_malloc(ctx, size);
+
+    bool recorded = false;
+    try
+    {
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        arena->lent_samples.emplace(samples, size);
+        recorded = true;
+    }
+    catch (const std::exception &)
+    {
+    }
+
+    if (!recorded)
     {
-        fz_mutexes[lock].unlock();
+        fz_free(ctx, samples);
+        fz_throw(ctx, FZ_ERROR_SYSTEM, "Failed to keep track of pixmap samples");
     }
+    return samples;
 }
 
-void init(const std::string &path, PDFHandle *doc_handle, PDFHandle *ctx_handle, int *pages_buf)
+// Takes back samples lent out by take_samples. Returns false if they didn't come from arena.
+static bool give_samples(fz_context *ctx, PageArena *arena, unsigned char *samples)
 {
-    _setmaxstdio(8192);
+    std::lock_guard<std::mutex> lock(arena->mutex);
 
-    // Create context with larger memory allocation for big files
-    // Check file size to determine appropriate context size
-    std::ifstream file(path, std::ifstream::ate | std::ifstream::binary);
-    size_t file_size = 0;
-    if (file.is_open())
+    auto lent = arena->lent_samples.find(samples);
+    if (lent == arena->lent_samples.end())
+        return false;
+
+    // The oldest idle block is the least likely to match the pages still to come.
+    if (arena->idle_samples.size() >= ARENA_IDLE_LIMIT)
     {
-        file_size = file.tellg();
-        file.close();
+        fz_free(ctx, arena->idle_samples.front().second);
+        arena->idle_samples.erase(arena->idle_samples.begin());
     }
 
-    // Scale memory allocation based on file size
-    size_t context_memory = 256 << 20; // Default 256MB
-    if (file_size > 100 << 20)
-    {                               // Files larger than 100MB
-        context_memory = 512 << 20; // Use 512MB
-    }
-    if (file_size > 500 << 20)
-    {                                // Files larger than 500MB
-        context_memory = 1024 << 20; // Use 1GB
+    arena->idle_samples.emplace_back(lent->second, samples);
+    arena->lent_samples.erase(lent);
+    return true;
+}
+
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static fz_buffer *take_buffer(fz_context *ctx, PageArena *arena)
+{
+    {
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        if (!arena->idle_buffers.empty())
+        {
+            fz_buffer *buf = arena->idle_buffers.back();
+            arena->idle_buffers.pop_back();
+            return buf;
+        }
     }
 
-    // Create context with custom locking for multi-threading
-    fz_locks_context locks;
-    locks.user = nullptr;
-    locks.lock = lock_mutex;
-    locks.unlock = unlock_mutex;
+    return fz_new_buffer(ctx, 0);
+}
 
-    fz_context *ctx = fz_new_context(nullptr, &locks, context_memory);
-    if (!ctx)
+static void give_buffer(fz_context *ctx, PageArena *arena, fz_buffer *buf)
+{
+    std::lock_guard<std::mutex> lock(arena->mutex);
+
+    if (arena->idle_buffers.size() >= ARENA_IDLE_LIMIT)
     {
-        throw std::runtime_error("Failed to create Context!");
+        fz_drop_buffer(ctx, buf);
+        return;
     }
 
-    fz_set_aa_level(ctx, 8);
+    // Keeps its capacity, so the next page encodes without growing it again.
+    fz_clear_buffer(ctx, buf);
+    arena->idle_buffers.push_back(buf);
+}
 
-    fz_try(ctx)
+static std::vector<uint8_t> take_bytes(PageArena *arena, size_t size)
+{
+    std::vector<uint8_t> bytes;
     {
-        fz_register_document_handlers(ctx);
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        if (!arena->idle_bytes.empty())
+        {
+            bytes = std::move(arena->idle_bytes.back());
+            arena->idle_bytes.pop_back();
+        }
     }
-    fz_catch(ctx)
+
+    bytes.resize(size);
+    return bytes;
+}
+
+static void give_bytes(PageArena *arena, std::vector<uint8_t> &&bytes)
+{
+    std::lock_guard<std::mutex> lock(arena->mutex);
+    if (arena->idle_bytes.size() < ARENA_IDLE_LIMIT)
+        arena->idle_bytes.push_back(std::move(bytes));
+}
+
+// Frees everything idle. Lent out memory comes back (and stays) once its image is freed.
+static void trim_arena(fz_context *ctx, PageArena *arena)
+{
+    std::lock_guard<std::mutex> lock(arena->mutex);
+
+    for (auto &idle : arena->idle_samples)
+        fz_free(ctx, idle.second);
+    for (fz_buffer *buf : arena->idle_buffers)
+        fz_drop_buffer(ctx, buf);
+
+    arena->idle_samples.clear();
+    arena->idle_buffers.clear();
+    arena->idle_bytes.clear();
+}
+
+// A long-lived worker session: one context and one opened document that a
+// worker reuses for every page it renders, instead of reopening the PDF per page.
+struct WorkerSession
+{
+    fz_context *ctx = nullptr;
+    fz_document *doc = nullptr;
+    int page_count = 0;
+    // Set when ctx is a fz_clone_context child of the base context, sharing its
+    // store and glyph cache instead of owning its own.
+    bool shared_store = false;
+    // Last memory pressure the session shrank its store for, see relieve_memory_pressure.
+    unsigned pressure_epoch = 0;
+    PageArena arena;
+    // Where pages are timed into, see set_session_stats. Null when timing is off.
+    RenderStats *stats = nullptr;
+    // What renders on the session can be aborted through, see set_session_control.
+    RenderControl *control = nullptr;
+    RenderCookie cookie;
+    // What pages are rendered with, see set_session_profile.
+    RenderProfile profile;
+};
+
+// Gives memory back between pages when the process is close to its cap, see governor.h.
+static void relieve_session(WorkerSession *session)
+{
+    if (relieve_memory_pressure(session->ctx, &session->pressure_epoch))
+        trim_arena(session->ctx, &session->arena);
+}
+
+// A rendered page handed to Rust without copying. Exactly one of pix (raw
+// samples), buf (encoded bytes, belonging to ctx), bytes (packed bits) or
+// cached (a RenderCache entry) is used. Blank pages use none of them.
+struct PageImage
+{
+    fz_context *ctx = nullptr;
+    fz_pixmap *pix = nullptr;
+    fz_buffer *buf = nullptr;
+    std::vector<uint8_t> bytes;
+    std::shared_ptr<const CachedImage> cached;
+    // Where pix samples, buf and bytes go back to when the image is freed, if anywhere.
+    PageArena *arena = nullptr;
+    // How the page was rendered, when its session was timing.
+    PageStats stats;
+    bool timed = false;
+    // Set by set_page_image_release, see engine.h.
+    PageImageRelease release = nullptr;
+    void *owner = nullptr;
+};
+
+// Shared-store contexts are tied to the base context they were cloned from,
+// so they are dropped rather than being handed to the global pool.
+static void release_session_context(fz_context *ctx, bool shared_store)
+{
+    if (shared_store)
     {
         fz_drop_context(ctx);
-        throw std::runtime_error("Failed to register document handlers!");
+    }
+    else
+    {
+        global_context_pool.return_context(ctx);
+    }
+}
+
+// Opens the document at path, or over the shared bytes of source when one is given.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static fz_document *open_document_from(fz_context *ctx, const std::string &path, DocumentSource *source)
+{
+    if (!source)
+    {
+        return fz_open_document(ctx, path.c_str());
     }
 
+    // The stream only borrows the bytes, so no descriptor or copy is made per worker.
+    // The path is passed as the magic so the PDF handler is picked by extension.
+    fz_stream *stm = source->progressive ? open_progressive_stream(ctx, source)
+                                         : fz_open_memory(ctx, source->data, source->size);
     fz_document *doc = nullptr;
+
     fz_try(ctx)
     {
-        doc = fz_open_document(ctx, path.c_str());
+        doc = fz_open_document_with_stream(ctx, path.c_str(), stm);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_stream(ctx, stm);
     }
     fz_catch(ctx)
     {
-        fz_drop_context(ctx);
-        throw std::runtime_error("Failed to open document at path " + path);
+        fz_rethrow(ctx);
     }
 
-    if (!doc)
+    return doc;
+}
+
+// Drops a pixmap, handing its samples back to arena if they came from it.
+static void drop_pixmap(fz_context *ctx, PageArena *arena, fz_pixmap *pix)
+{
+    unsigned char *samples = fz_pixmap_samples(ctx, pix);
+    fz_drop_pixmap(ctx, pix);
+
+    if (arena && samples)
+        give_samples(ctx, arena, samples);
+}
+
+// A white gray pixmap covering bbox, over samples lent by arena when one is given.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static fz_pixmap *new_gray_pixmap(fz_context *ctx, PageArena *arena, fz_irect bbox)
+{
+    size_t size = (size_t)(bbox.x1 - bbox.x0) * (size_t)(bbox.y1 - bbox.y0);
+    fz_pixmap *pix = nullptr;
+
+    if (!arena || size == 0)
     {
-        fz_drop_context(ctx);
-        throw std::runtime_error("Document was null after being opened!");
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), bbox, nullptr, 0);
+    }
+    else
+    {
+        unsigned char *samples = take_samples(ctx, arena, size);
+        fz_try(ctx)
+        {
+            pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_gray(ctx), bbox, nullptr, 0, samples);
+        }
+        fz_catch(ctx)
+        {
+            give_samples(ctx, arena, samples);
+            fz_rethrow(ctx);
+        }
     }
 
-    int page_count = 0;
+    fz_clear_pixmap_with_value(ctx, pix, 255);
+    return pix;
+}
+
+// Renders an already validated page of an opened document into a gray pixmap, the same
+// way fz_new_pixmap_from_page does but over arena samples when an arena is given.
+// The caller owns the returned pixmap, and drops it with drop_pixmap.
+static fz_pixmap *render_gray_pixmap(fz_context *ctx, fz_document *doc, int page_num, fz_matrix ctm,
+                                     PageArena *arena = nullptr, PageStats *stats = nullptr,
+                                     RenderCookie *cookie = nullptr)
+{
+    fz_page *page = nullptr;
+    fz_pixmap *pix = nullptr;
+    fz_device *dev = nullptr;
+
+    fz_var(page);
+    fz_var(pix);
+    fz_var(dev);
+
     fz_try(ctx)
     {
-        page_count = fz_count_pages(ctx, doc);
+        uint64_t start = stage_start(stats);
+        page = fz_load_page(ctx, doc, page_num);
+        stage_end(stats, STAGE_LOAD, start);
+
+        start = stage_start(stats);
+        pix = new_gray_pixmap(ctx, arena, fz_round_rect(fz_transform_rect(fz_bound_page(ctx, page), ctm)));
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_run_page(ctx, page, dev, fz_identity, mupdf_cookie(cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, cookie);
+        stage_end(stats, STAGE_DRAW, start);
+    }
+    fz_always(ctx)
+    {
+        if (dev)
+            fz_drop_device(ctx, dev);
+        if (page)
+            fz_drop_page(ctx, page);
     }
     fz_catch(ctx)
     {
-        fz_drop_document(ctx, doc);
-        fz_drop_context(ctx);
-
-        throw std::runtime_error("Failed to count pages of document.");
+        if (pix)
+            drop_pixmap(ctx, arena, pix);
+        note_incomplete(ctx, cookie);
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
     }
 
-    *doc_handle = (PDFHandle)doc;
-    *ctx_handle = (PDFHandle)ctx;
-    *pages_buf = page_count;
-
-    // Debug output
-    // printf("[DEBUG] init() completed:\n");
-    // printf("  doc=%p -> *doc_handle=%p\n", doc, *doc_handle);
-    // printf("  ctx=%p -> *ctx_handle=%p\n", ctx, *ctx_handle);
-    // printf("  page_count=%d\n", page_count);
-    // printf("  file_size=%zuMB, context_memory=%zuMB\n", file_size >> 20, context_memory >> 20);
+    return pix;
 }
 
-uint8_t *render_page(int page_num, size_t *size_buf, int *width_buf, int *height_buf,
-                     int *channels_buf, PDFHandle *doc_handle, PDFHandle *ctx_handle)
+// fz_new_pixmap_from_display_list in gray, over arena samples when an arena is given.
+// With a clip in page space only that part of the page is drawn, into a pixmap covering just
+// the clip, and the list skips every node outside it.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static fz_pixmap *render_list_pixmap(fz_context *ctx, fz_display_list *list, fz_matrix ctm, PageArena *arena,
+                                     PageStats *stats, RenderCookie *cookie, fz_rect clip = fz_infinite_rect)
 {
-    // printf("[DEBUG] render_page() called:\n  page_num=%d\n  ctx_handle=%p\n  *ctx_handle=%p\n  doc_handle=%p\n  *doc_handle=%p\n",
-    //        page_num, ctx_handle, ctx_handle ? *ctx_handle : nullptr, doc_handle, doc_handle ? *doc_handle : nullptr);
+    uint64_t start = stage_start(stats);
+    fz_rect area = fz_intersect_rect(fz_bound_display_list(ctx, list), clip);
+    fz_pixmap *pix = new_gray_pixmap(ctx, arena, fz_round_rect(fz_transform_rect(area, ctm)));
+    fz_device *dev = nullptr;
 
-    if (!ctx_handle || !*ctx_handle)
+    fz_var(dev);
+
+    fz_try(ctx)
     {
-        // printf("[DEBUG] Invalid context handle detected!\n");
-        throw std::runtime_error("Invalid context handle");
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_run_display_list(ctx, list, dev, fz_identity, clip, mupdf_cookie(cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, cookie);
+        stage_end(stats, STAGE_DRAW, start);
     }
-
-    if (!doc_handle || !*doc_handle)
+    fz_always(ctx)
     {
-        // printf("[DEBUG] Invalid document handle detected!\n");
-        throw std::runtime_error("Invalid document handle");
+        fz_drop_device(ctx, dev);
     }
-
-    if (size_buf == nullptr || width_buf == nullptr || height_buf == nullptr || channels_buf == nullptr)
+    fz_catch(ctx)
     {
-        throw std::runtime_error("Passed nullptr for a buffer!");
+        drop_pixmap(ctx, arena, pix);
+        fz_rethrow(ctx);
     }
 
-    fz_context *ctx = (fz_context *)(*ctx_handle);
-    fz_document *doc = (fz_document *)(*doc_handle);
+    return pix;
+}
 
-    // printf("[DEBUG] Converted pointers: ctx=%p, doc=%p\n", ctx, doc);
+// Decodes a page's scan at its own resolution into a gray pixmap over arena samples, as
+// render_list_pixmap would have drawn it. The decoded pixmap may be shared through the store, so
+// it's copied rather than thresholded in place.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+static fz_pixmap *decode_scan(fz_context *ctx, fz_image *scan, PageArena *arena, PageStats *stats)
+{
+    uint64_t start = stage_start(stats);
+    fz_pixmap *decoded = fz_get_pixmap_from_image(ctx, scan, nullptr, nullptr, nullptr, nullptr);
+    fz_pixmap *gray = nullptr;
+    fz_pixmap *pix = nullptr;
 
-    // Additional safety checks for potentially corrupted documents
-    if (!ctx || !doc)
-    {
-        throw std::runtime_error("Invalid context or document handle");
-    }
+    fz_var(gray);
+    fz_var(pix);
 
-    // Validate page number with proper error handling for potentially corrupted documents
-    int total_pages = 0;
     fz_try(ctx)
     {
-        total_pages = fz_count_pages(ctx, doc);
-        // Additional check for document validity
-        if (total_pages <= 0)
+        gray = decoded;
+        if (!fz_colorspace_is_gray(ctx, fz_pixmap_colorspace(ctx, decoded)) || fz_pixmap_alpha(ctx, decoded))
         {
-            throw std::runtime_error("Document appears to be corrupted - no valid pages found");
+            gray = fz_convert_pixmap(ctx, decoded, fz_device_gray(ctx), nullptr, nullptr, fz_default_color_params, 0);
         }
 
-        // Extra validation for page access
-        if (page_num < 0 || page_num >= total_pages)
+        int width = fz_pixmap_width(ctx, gray);
+        int height = fz_pixmap_height(ctx, gray);
+        pix = new_gray_pixmap(ctx, arena, fz_make_irect(0, 0, width, height));
+
+        const unsigned char *src = fz_pixmap_samples(ctx, gray);
+        unsigned char *dst = fz_pixmap_samples(ctx, pix);
+        ptrdiff_t src_stride = fz_pixmap_stride(ctx, gray);
+        ptrdiff_t dst_stride = fz_pixmap_stride(ctx, pix);
+        for (int y = 0; y < height; y++)
         {
-            throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, total_pages));
+            memcpy(dst + y * dst_stride, src + y * src_stride, (size_t)width);
         }
+        stage_end(stats, STAGE_DRAW, start);
+    }
+    fz_always(ctx)
+    {
+        if (gray != decoded)
+            fz_drop_pixmap(ctx, gray);
+        fz_drop_pixmap(ctx, decoded);
     }
     fz_catch(ctx)
     {
-        const char *msg = fz_caught_message(ctx);
-        // Handle specific document corruption cases
-        if (msg && (strstr(msg, "object out of range") || strstr(msg, "page tree")))
-        {
-            throw std::runtime_error("Document is corrupted and cannot be processed in multi-threaded mode");
-        }
-        throw std::runtime_error(std::format("Failed to count pages or document corrupted: {}", msg ? msg : "Unknown error"));
+        if (pix)
+            drop_pixmap(ctx, arena, pix);
+        fz_rethrow(ctx);
     }
 
-    if (page_num < 0 || page_num >= total_pages)
+    return pix;
+}
+
+// Thresholds a gray pixmap in place, it has no alpha so every byte is a sample.
+static void binarize_pixmap(fz_context *ctx, fz_pixmap *pix, int threshold)
+{
+    size_t sample_count = (size_t)fz_pixmap_stride(ctx, pix) * (size_t)fz_pixmap_height(ctx, pix);
+    threshold_in_place(fz_pixmap_samples(ctx, pix), sample_count, threshold);
+}
+
+// A page's structured text, flattened so it can be copied into Rust in one go.
+// Every line's UTF-8 text is stored back to back in text, line_ends holds where
+// each one ends and line_blocks which block it belongs to.
+struct PageText
+{
+    std::string text;
+    std::vector<float> block_boxes; // x0, y0, x1, y1 per block
+    std::vector<float> line_boxes;  // x0, y0, x1, y1 per line
+    std::vector<int> line_ends;
+    std::vector<int> line_blocks;
+};
+
+static void push_rect(std::vector<float> &boxes, fz_rect rect)
+{
+    boxes.push_back(rect.x0);
+    boxes.push_back(rect.y0);
+    boxes.push_back(rect.x1);
+    boxes.push_back(rect.y1);
+}
+
+// The bytes make_mode_image packs pix into, from arena if there is one. make_mode_image owns pix
+// and image by then, so they are freed here when the bytes can't be had.
+static std::vector<uint8_t> take_image_bytes(fz_context *ctx, PageArena *arena, fz_pixmap *pix, PageImage *image,
+                                             size_t size, int page_num)
+{
+    try
     {
-        // This check is now handled above in the fz_try block
-        // But keeping this as a fallback
-        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, total_pages));
+        if (arena)
+            return take_bytes(arena, size);
+        return std::vector<uint8_t>(size);
+    }
+    catch (const std::exception &e)
+    {
+        drop_pixmap(ctx, arena, pix);
+        delete image;
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, e.what()));
     }
+}
+
+// Turns a rendered gray pixmap into a PageImage in the requested OutputFormat,
+// taking ownership of the pixmap. With an arena, the encode buffer and packed bytes
+// come from it and everything the image holds goes back to it once freed. The 1 bit
+// formats are thresholded whatever the mode, the rest only when Mode is thresholded.
+template <typename Mode>
+static uint8_t *make_mode_image(fz_context *ctx, PageArena *arena, fz_pixmap *pix, int format, int threshold,
+                                int page_num, size_t *size_buf, int *width_buf, int *height_buf,
+                                int *channels_buf, int *stride_buf, PDFHandle *image_handle, PageStats *stats)
+{
+    PageImage *image = nullptr;
+    try
+    {
+        image = new PageImage();
+    }
+    catch (const std::exception &e)
+    {
+        drop_pixmap(ctx, arena, pix);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, e.what()));
+    }
+    image->ctx = ctx;
+    image->arena = arena;
+
+    *width_buf = fz_pixmap_width(ctx, pix);
+    *height_buf = fz_pixmap_height(ctx, pix);
+    *channels_buf = fz_pixmap_components(ctx, pix);
+    *stride_buf = (int)fz_pixmap_stride(ctx, pix);
 
-    fz_page *page = nullptr;
-    fz_pixmap *gray_pix = nullptr;
-    fz_pixmap *bilevel_pix = nullptr;
-    fz_buffer *png_buffer = nullptr;
     uint8_t *data = nullptr;
+    uint64_t start = stage_start(stats);
 
-    fz_try(ctx)
+    if (stats)
+        stats->sample_bytes += (size_t)(*stride_buf) * (size_t)(*height_buf);
+
+    if (format == OUTPUT_PACKED)
     {
-        page = fz_load_page(ctx, doc, page_num);
-        if (!page)
+        // Packing thresholds on the fly, so the in-place pass would be wasted work.
+        size_t stride = packed_stride(*width_buf);
+        size_t size = stride * (size_t)(*height_buf);
+        image->bytes = take_image_bytes(ctx, arena, pix, image, size, page_num);
+        pack_bits(fz_pixmap_samples(ctx, pix), fz_pixmap_stride(ctx, pix), *width_buf, *height_buf,
+                  image->bytes.data(), stride, threshold);
+        stage_end(stats, STAGE_THRESHOLD, start);
+        drop_pixmap(ctx, arena, pix);
+
+        data = image->bytes.data();
+        *size_buf = image->bytes.size();
+        *stride_buf = (int)stride;
+    }
+    else if (format == OUTPUT_RAW)
+    {
+        // Hand out the rendered samples directly, the pixmap lives until free_page_image.
+        if constexpr (Mode::thresholded)
         {
-            throw std::runtime_error(std::format("Failed to load page {}", page_num));
+            binarize_pixmap(ctx, pix, threshold);
+            stage_end(stats, STAGE_THRESHOLD, start);
         }
-
-        // Use thread-local cached matrix instead of creating new one each time
-        gray_pix = fz_new_pixmap_from_page(ctx, page, cached_ctm, fz_device_gray(ctx), 0);
-
-        if (!gray_pix)
+        image->pix = pix;
+        data = fz_pixmap_samples(ctx, pix);
+        *size_buf = (size_t)(*stride_buf) * (size_t)(*height_buf);
+    }
+    else if (format == OUTPUT_PBM)
+    {
+        // A PBM is the packed rows behind a short header, so it's packed straight into place.
+        std::string header = pbm_header(*width_buf, *height_buf);
+        size_t stride = packed_stride(*width_buf);
+        size_t size = header.size() + stride * (size_t)(*height_buf);
+        image->bytes = take_image_bytes(ctx, arena, pix, image, size, page_num);
+        std::copy(header.begin(), header.end(), image->bytes.begin());
+        pack_bits(fz_pixmap_samples(ctx, pix), fz_pixmap_stride(ctx, pix), *width_buf, *height_buf,
+                  image->bytes.data() + header.size(), stride, threshold);
+        stage_end(stats, STAGE_THRESHOLD, start);
+        drop_pixmap(ctx, arena, pix);
+
+        data = image->bytes.data();
+        *size_buf = image->bytes.size();
+        *stride_buf = (int)stride;
+    }
+    else if (format == OUTPUT_G4 || format == OUTPUT_QOI || (Mode::thresholded && current_png_level() >= 0))
+    {
+        // Packed rows for G4, filtered scanlines for PNG.
+        std::vector<uint8_t> scratch;
+        if (arena)
+            scratch = take_bytes(arena, 0);
+        if (arena && format != OUTPUT_G4)
+            image->bytes = take_bytes(arena, 0);
+
+        int level = current_png_level();
+        int width = *width_buf;
+        int height = *height_buf;
+        size_t stride = packed_stride(width);
+
+        fz_try(ctx)
         {
-            const char *error_msg = fz_caught_message(ctx);
-            if (error_msg)
+            const uint8_t *samples = fz_pixmap_samples(ctx, pix);
+            ptrdiff_t src_stride = fz_pixmap_stride(ctx, pix);
+
+            if (format == OUTPUT_G4)
+            {
+                run_in_fz_try(ctx, [&] { scratch.resize(stride * (size_t)height); });
+                pack_bits(samples, src_stride, width, height, scratch.data(), stride, threshold);
+                stage_end(stats, STAGE_THRESHOLD, start);
+                start = stage_start(stats);
+                image->buf = fz_compress_ccitt_fax_g4(ctx, scratch.data(), width, height, (ptrdiff_t)stride);
+                *size_buf = fz_buffer_storage(ctx, image->buf, &data);
+                *stride_buf = (int)stride;
+            }
+            else if (format == OUTPUT_QOI)
             {
-                throw std::runtime_error(std::format("Failed to create pixmap: {}", error_msg));
+                if constexpr (Mode::thresholded)
+                {
+                    binarize_pixmap(ctx, pix, threshold);
+                    stage_end(stats, STAGE_THRESHOLD, start);
+                    start = stage_start(stats);
+                }
+                run_in_fz_try(ctx, [&] { write_qoi(samples, src_stride, width, height, image->bytes); });
+                data = image->bytes.data();
+                *size_buf = image->bytes.size();
+                *channels_buf = 3;
+                *stride_buf = width * 3;
             }
             else
             {
-                throw std::runtime_error("Failed to create pixmap: Unknown error");
+                // Thresholding happens while packing the scanlines, so it counts as encoding.
+                write_bilevel_png(ctx, samples, src_stride, width, height, threshold, level, scratch, image->bytes);
+                data = image->bytes.data();
+                *size_buf = image->bytes.size();
             }
+            stage_end(stats, STAGE_ENCODE, start);
         }
-
-        int width = fz_pixmap_width(ctx, gray_pix);
-        int height = fz_pixmap_height(ctx, gray_pix);
-
-        bilevel_pix = fz_new_pixmap(ctx, fz_device_gray(ctx), width, height, NULL, 0);
-        if (!bilevel_pix)
+        fz_always(ctx)
         {
-            throw std::runtime_error("Failed to create bilevel pixmap");
+            drop_pixmap(ctx, arena, pix);
         }
-
-        unsigned char *gray_samples = fz_pixmap_samples(ctx, gray_pix);
-        unsigned char *bilevel_samples = fz_pixmap_samples(ctx, bilevel_pix);
-
-        // Add prefetching hints for better cache performance
-        const int total_pixels = width * height;
-
-        for (int i = 0; i < total_pixels; i++)
+        fz_catch(ctx)
         {
-            bilevel_samples[i] = (gray_samples[i] > THRESHOLD) ? 255 : 0;
+            if (image->buf)
+                fz_drop_buffer(ctx, image->buf);
+            delete image;
+            const char *msg = fz_caught_message(ctx);
+            throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
         }
 
-        png_buffer = fz_new_buffer_from_pixmap_as_png(ctx, bilevel_pix, fz_default_color_params);
-        if (!png_buffer)
+        if (arena)
+            give_bytes(arena, std::move(scratch));
+    }
+    else
+    {
+        if constexpr (Mode::thresholded)
         {
-            throw std::runtime_error("Failed to create PNG buffer");
+            binarize_pixmap(ctx, pix, threshold);
+            stage_end(stats, STAGE_THRESHOLD, start);
+            start = stage_start(stats);
         }
+        fz_output *out = nullptr;
 
-        // Use zero-copy approach - get direct pointer to buffer data
-        size_t png_size = fz_buffer_storage(ctx, png_buffer, &data);
+        fz_var(out);
 
-        if (!data || png_size == 0)
+        fz_try(ctx)
+        {
+            if (arena)
+            {
+                // Encoding into a recycled buffer, which already has room for a page like this one.
+                image->buf = take_buffer(ctx, arena);
+                out = fz_new_output_with_buffer(ctx, image->buf);
+                fz_write_pixmap_as_png(ctx, out, pix);
+                fz_close_output(ctx, out);
+            }
+            else
+            {
+                image->buf = fz_new_buffer_from_pixmap_as_png(ctx, pix, fz_default_color_params);
+            }
+            *size_buf = fz_buffer_storage(ctx, image->buf, &data);
+            stage_end(stats, STAGE_ENCODE, start);
+        }
+        fz_always(ctx)
         {
-            throw std::runtime_error("Failed to get PNG buffer storage");
+            fz_drop_output(ctx, out);
+            drop_pixmap(ctx, arena, pix);
         }
+        fz_catch(ctx)
+        {
+            if (image->buf)
+                fz_drop_buffer(ctx, image->buf);
+            delete image;
+            const char *msg = fz_caught_message(ctx);
+            throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
+        }
+    }
 
-        // Allocate and copy only once
-        uint8_t *result_data = new uint8_t[png_size];
-        memcpy(result_data, data, png_size);
-        data = result_data;
+    if (stats)
+        stats->output_bytes += *size_buf;
 
-        int channels = fz_pixmap_components(ctx, bilevel_pix);
+    *image_handle = (PDFHandle)image;
+    return data;
+}
 
-        *size_buf = png_size;
-        *width_buf = width;
-        *height_buf = height;
-        *channels_buf = channels;
-    }
-    fz_always(ctx)
-    {
-        if (png_buffer)
-            fz_drop_buffer(ctx, png_buffer);
-        if (bilevel_pix)
-            fz_drop_pixmap(ctx, bilevel_pix);
-        if (gray_pix)
-            fz_drop_pixmap(ctx, gray_pix);
+// make_page_image with the kernels of profile's mode, picked once for the whole page.
+static uint8_t *make_page_image(fz_context *ctx, PageArena *arena, fz_pixmap *pix, int format,
+                                const RenderProfile &profile, int page_num, size_t *size_buf, int *width_buf,
+                                int *height_buf, int *channels_buf, int *stride_buf, PDFHandle *image_handle,
+                                PageStats *stats)
+{
+    return with_mode(profile.mode, [&](auto traits) {
+        return make_mode_image<decltype(traits)>(ctx, arena, pix, format, profile.threshold, page_num, size_buf,
+                                                 width_buf, height_buf, channels_buf, stride_buf, image_handle, stats);
+    });
+}
+
+// Hands the stats of a page to its image and to the RenderStats it was timed for.
+static void finish_page_stats(RenderStats *totals, PageStats *stats, PDFHandle image_handle)
+{
+    if (!stats)
+        return;
+
+    totals->record(*stats);
+
+    if (image_handle)
+    {
+        PageImage *image = (PageImage *)image_handle;
+        image->stats = *stats;
+        image->timed = true;
+    }
+}
+
+// A page recorded into a display list once, so it can be rasterized at several
+// scales without interpreting its content stream again. Belongs to ctx.
+struct PageDisplayList
+{
+    fz_context *ctx = nullptr;
+    fz_display_list *list = nullptr;
+    int page_num = 0;
+    PageArena *arena = nullptr;
+    // The session's profile, its scale aside since every render of the list passes its own.
+    RenderProfile profile;
+    // The session's RenderStats, renders of the list are timed into it when set.
+    RenderStats *stats = nullptr;
+    // The session's control and cookie, renders of the list are aborted through them.
+    RenderControl *control = nullptr;
+    RenderCookie *cookie = nullptr;
+};
+
+static bool is_valid_format(int format)
+{
+    return format >= OUTPUT_PNG && format <= OUTPUT_QOI;
+}
+
+// Records an already validated page into a display list, optionally returning
+// the page bounds. The caller owns the returned list.
+static fz_display_list *record_page(fz_context *ctx, fz_document *doc, int page_num, fz_rect *bounds,
+                                    PageStats *stats = nullptr, RenderCookie *cookie = nullptr)
+{
+    fz_page *page = nullptr;
+    fz_display_list *list = nullptr;
+    fz_device *dev = nullptr;
+    uint64_t start = stage_start(stats);
+
+    fz_var(page);
+    fz_var(list);
+    fz_var(dev);
+
+    fz_try(ctx)
+    {
+        page = fz_load_page(ctx, doc, page_num);
+        fz_rect page_bounds = fz_bound_page(ctx, page);
+        if (bounds)
+            *bounds = page_bounds;
+
+        // fz_new_display_list_from_page, with a cookie to abort the interpretation.
+        list = fz_new_display_list(ctx, page_bounds);
+        dev = fz_new_list_device(ctx, list);
+        fz_run_page(ctx, page, dev, fz_identity, mupdf_cookie(cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, cookie);
+        stage_end(stats, STAGE_LOAD, start);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
         if (page)
             fz_drop_page(ctx, page);
     }
     fz_catch(ctx)
     {
-        if (data)
-        {
-            delete[] data;
-            data = nullptr;
-        }
+        fz_drop_display_list(ctx, list);
+        note_incomplete(ctx, cookie);
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
+    }
+
+    return list;
+}
+
+// A page drawn in horizontal bands of band_height rows, so peak pixel memory is
+// width * band_height no matter how large the page is. Belongs to ctx.
+struct BandRenderer
+{
+    fz_context *ctx = nullptr;
+    fz_display_list *list = nullptr;
+    fz_matrix ctm;
+    fz_irect bbox;
+    int format = OUTPUT_PNG;
+    // The session's threshold, and whether OUTPUT_RAW and OUTPUT_PNG bands are thresholded with it.
+    int threshold = 0;
+    bool thresholded = true;
+    int band_height = 0;
+    int next_y = 0;
+    int page_num = 0;
+    // Samples for the band being drawn, reused for every band.
+    std::vector<uint8_t> samples;
+    // Packed rows of the band for OUTPUT_PACKED.
+    std::vector<uint8_t> bytes;
+    // PNG stream for OUTPUT_PNG, drained after every band.
+    fz_buffer *buf = nullptr;
+    fz_output *out = nullptr;
+    fz_band_writer *writer = nullptr;
+    // The session's control and cookie, every band is aborted through them.
+    RenderControl *control = nullptr;
+    RenderCookie *cookie = nullptr;
+};
+
+static void drop_band_renderer(BandRenderer *bands)
+{
+    fz_context *ctx = bands->ctx;
+
+    fz_drop_band_writer(ctx, bands->writer);
+    fz_drop_output(ctx, bands->out);
+    fz_drop_buffer(ctx, bands->buf);
+    fz_drop_display_list(ctx, bands->list);
+    delete bands;
+}
+
+// Whether a recorded page draws nothing, or so little that at most blank_ratio of a low-resolution
+// probe's pixels are threshold or darker. Runs inside the caller's fz_try.
+static bool is_blank_page(fz_context *ctx, fz_display_list *list, float blank_ratio, int threshold,
+                          RenderCookie *cookie)
+{
+    if (fz_display_list_is_empty(ctx, list))
+    {
+        return true;
+    }
+
+    // fz_new_pixmap_from_display_list, with a cookie since a low resolution doesn't make
+    // drawing every path of a pathological page any cheaper.
+    fz_matrix ctm = fz_scale(PROBE_SCALE, PROBE_SCALE);
+    fz_pixmap *probe = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx),
+                                               fz_round_rect(fz_transform_rect(fz_bound_display_list(ctx, list), ctm)),
+                                               nullptr, 0);
+    fz_device *dev = nullptr;
+
+    fz_var(dev);
+
+    fz_try(ctx)
+    {
+        fz_clear_pixmap_with_value(ctx, probe, 255);
+        dev = fz_new_draw_device(ctx, ctm, probe);
+        fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, mupdf_cookie(cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, cookie);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_pixmap(ctx, probe);
+        fz_rethrow(ctx);
+    }
+
+    unsigned char *samples = fz_pixmap_samples(ctx, probe);
+    size_t count = (size_t)fz_pixmap_stride(ctx, probe) * (size_t)fz_pixmap_height(ctx, probe);
+    size_t ink = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ink += samples[i] <= threshold;
+    }
+    fz_drop_pixmap(ctx, probe);
+
+    return (double)ink <= (double)count * blank_ratio;
+}
+
+// Fills in the size of a blank page as if it was rendered with ctm, without any bytes.
+static uint8_t *make_blank_image(int format, fz_rect bounds, fz_matrix ctm, size_t *size_buf, int *width_buf,
+                                 int *height_buf, int *channels_buf, int *stride_buf, PDFHandle *image_handle)
+{
+    fz_irect bbox = fz_round_rect(fz_transform_rect(bounds, ctm));
+
+    *width_buf = bbox.x1 - bbox.x0;
+    *height_buf = bbox.y1 - bbox.y0;
+    bool packed = format == OUTPUT_PACKED || format == OUTPUT_PBM || format == OUTPUT_G4;
+    *channels_buf = format == OUTPUT_QOI ? 3 : 1;
+    *stride_buf = packed ? (int)packed_stride(*width_buf) : *width_buf * *channels_buf;
+    *size_buf = 0;
+    *image_handle = (PDFHandle)new PageImage();
+
+    return nullptr;
+}
+
+static uint8_t *share_cached_image(std::shared_ptr<const CachedImage> cached, size_t *size_buf, int *width_buf,
+                                   int *height_buf, int *channels_buf, int *stride_buf, PDFHandle *image_handle)
+{
+    PageImage *image = new PageImage();
+    image->cached = cached;
+
+    *width_buf = cached->width;
+    *height_buf = cached->height;
+    *channels_buf = cached->channels;
+    *stride_buf = cached->stride;
+    *size_buf = cached->bytes.size();
+    *image_handle = (PDFHandle)image;
+
+    return cached->blank ? nullptr : (uint8_t *)cached->bytes.data();
+}
+
+// Hands out a scan's own G4 stream, see original_g4_stream, taking over the kept buffer. It never
+// goes to an arena, the image still holds it.
+static uint8_t *share_scan_stream(fz_context *ctx, fz_buffer *stream, int width, int height, size_t *size_buf,
+                                  int *width_buf, int *height_buf, int *channels_buf, int *stride_buf,
+                                  PDFHandle *image_handle, PageStats *stats)
+{
+    PageImage *image = new PageImage();
+    image->ctx = ctx;
+    image->buf = stream;
+
+    uint8_t *data = nullptr;
+    *size_buf = fz_buffer_storage(ctx, stream, &data);
+    *width_buf = width;
+    *height_buf = height;
+    *channels_buf = 1;
+    *stride_buf = (int)packed_stride(width);
+    *image_handle = (PDFHandle)image;
+
+    if (stats)
+        stats->output_bytes += *size_buf;
+
+    return data;
+}
+
+// One page of a PageBatch. Either image is set, or error holds why the page failed.
+struct BatchPage
+{
+    int page_num = 0;
+    PDFHandle image = nullptr;
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int stride = 0;
+    std::string error;
+    // How far the page got, when it was aborted.
+    AbortRecord abort;
+};
+
+// Pages rendered back to back by render_pages, kept until free_page_batch.
+struct PageBatch
+{
+    std::vector<BatchPage> pages;
+};
+
+// Renders an already validated page of an opened document into a PNG buffer.
+// Shared by render_page and the worker session path, which validates against
+// its cached page count instead of calling fz_count_pages for every page.
+static uint8_t *render_loaded_page(fz_context *ctx, fz_document *doc, int page_num, const RenderProfile &profile,
+                                   size_t *size_buf, int *width_buf, int *height_buf, int *channels_buf)
+{
+    fz_pixmap *bilevel_pix = render_gray_pixmap(ctx, doc, page_num, profile.ctm());
+    if (mode_thresholded(profile.mode))
+        binarize_pixmap(ctx, bilevel_pix, profile.threshold);
+    fz_buffer *png_buffer = nullptr;
+    uint8_t *data = nullptr;
+
+    fz_var(png_buffer);
+    fz_var(data);
+
+    fz_try(ctx)
+    {
+        png_buffer = fz_new_buffer_from_pixmap_as_png(ctx, bilevel_pix, fz_default_color_params);
+
+        unsigned char *storage = nullptr;
+        size_t png_size = fz_buffer_storage(ctx, png_buffer, &storage);
+
+        if (!storage || png_size == 0)
+        {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to get PNG buffer storage");
+        }
+
+        // Allocate and copy only once
+        data = new uint8_t[png_size];
+        memcpy(data, storage, png_size);
+
+        *size_buf = png_size;
+        *width_buf = fz_pixmap_width(ctx, bilevel_pix);
+        *height_buf = fz_pixmap_height(ctx, bilevel_pix);
+        *channels_buf = fz_pixmap_components(ctx, bilevel_pix);
+    }
+    fz_always(ctx)
+    {
+        if (png_buffer)
+            fz_drop_buffer(ctx, png_buffer);
+        fz_drop_pixmap(ctx, bilevel_pix);
+    }
+    fz_catch(ctx)
+    {
+        if (data)
+        {
+            delete[] data;
+            data = nullptr;
+        }
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
+    }
+
+    return data;
+}
+
+void open_source(const std::string &path, int mode, PDFHandle *source_handle, size_t *size_buf)
+{
+    if (source_handle == nullptr || size_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    if (mode != SOURCE_MAPPED && mode != SOURCE_LOADED)
+    {
+        throw std::runtime_error(std::format("Unknown document source mode {}", mode));
+    }
+
+    DocumentSource *source = open_document_source(path, mode == SOURCE_MAPPED);
+
+    *source_handle = (PDFHandle)source;
+    *size_buf = source->size;
+}
+
+void close_source(PDFHandle *source_handle)
+{
+    if (!source_handle || !*source_handle)
+    {
+        return;
+    }
+
+    close_document_source((DocumentSource *)(*source_handle));
+    *source_handle = nullptr;
+}
+
+void open_progressive_source(uint64_t size, PDFHandle *source_handle)
+{
+    if (source_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    *source_handle = (PDFHandle)new_progressive_source((size_t)size);
+}
+
+void feed_source(uint64_t offset, const uint8_t *data, size_t size, PDFHandle *source_handle)
+{
+    if (!source_handle || !*source_handle)
+    {
+        throw std::runtime_error("Invalid source handle");
+    }
+
+    if (data == nullptr && size > 0)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    feed_document_source((DocumentSource *)(*source_handle), (size_t)offset, data, size);
+}
+
+bool wait_source(uint64_t seen, int timeout_ms, uint64_t *received_buf, PDFHandle *source_handle)
+{
+    if (!source_handle || !*source_handle)
+    {
+        throw std::runtime_error("Invalid source handle");
+    }
+
+    if (received_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    DocumentSource *source = (DocumentSource *)(*source_handle);
+    *received_buf = wait_document_source(source, (size_t)seen, timeout_ms);
+    return source_pending(source);
+}
+
+uint64_t take_source_wanted(PDFHandle *source_handle)
+{
+    if (!source_handle || !*source_handle)
+    {
+        throw std::runtime_error("Invalid source handle");
+    }
+
+    size_t wanted = take_wanted_offset((DocumentSource *)(*source_handle));
+    return wanted == SIZE_MAX ? UINT64_MAX : (uint64_t)wanted;
+}
+
+void abandon_source(PDFHandle *source_handle)
+{
+    if (!source_handle || !*source_handle)
+    {
+        throw std::runtime_error("Invalid source handle");
+    }
+
+    abandon_document_source((DocumentSource *)(*source_handle));
+}
+
+void init(const std::string &path, PDFHandle *source_handle, PDFHandle *doc_handle, PDFHandle *ctx_handle, int *pages_buf)
+{
+    DocumentSource *source = source_handle ? (DocumentSource *)(*source_handle) : nullptr;
+
+    // Create context with larger memory allocation for big files
+    // Check file size to determine appropriate context size
+    size_t file_size = 0;
+    if (source)
+    {
+        file_size = source->size;
+    }
+    else
+    {
+        // Every worker opens its own descriptor when reading from the path.
+        _setmaxstdio(8192);
+
+        std::ifstream file(path, std::ifstream::ate | std::ifstream::binary);
+        if (file.is_open())
+        {
+            file_size = file.tellg();
+            file.close();
+        }
+    }
+
+    // Scale memory allocation based on file size
+    size_t context_memory = 256 << 20; // Default 256MB
+    if (file_size > 100 << 20)
+    {                               // Files larger than 100MB
+        context_memory = 512 << 20; // Use 512MB
+    }
+    if (file_size > 500 << 20)
+    {                                // Files larger than 500MB
+        context_memory = 1024 << 20; // Use 1GB
+    }
+
+    // Create context with custom locking for multi-threading
+    fz_locks_context locks = shared_locks();
+
+    fz_context *ctx = new_governed_context(&locks, context_memory);
+    if (!ctx)
+    {
+        throw std::runtime_error("Failed to create Context!");
+    }
+
+    fz_set_aa_level(ctx, 8);
+
+    fz_try(ctx)
+    {
+        fz_register_document_handlers(ctx);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_context(ctx);
+        throw std::runtime_error("Failed to register document handlers!");
+    }
+
+    fz_document *doc = nullptr;
+    fz_try(ctx)
+    {
+        doc = open_document_from(ctx, path, source);
+    }
+    fz_catch(ctx)
+    {
+        bool incomplete = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+        fz_drop_context(ctx);
+        if (incomplete)
+            throw std::runtime_error(INCOMPLETE_DOCUMENT_ERROR);
+        throw std::runtime_error("Failed to open document at path " + path);
+    }
+
+    if (!doc)
+    {
+        fz_drop_context(ctx);
+        throw std::runtime_error("Document was null after being opened!");
+    }
+
+    int page_count = 0;
+    fz_try(ctx)
+    {
+        page_count = fz_count_pages(ctx, doc);
+    }
+    fz_catch(ctx)
+    {
+        bool incomplete = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+        fz_drop_document(ctx, doc);
+        fz_drop_context(ctx);
+
+        if (incomplete)
+            throw std::runtime_error(INCOMPLETE_DOCUMENT_ERROR);
+        throw std::runtime_error("Failed to count pages of document.");
+    }
+
+    *doc_handle = (PDFHandle)doc;
+    *ctx_handle = (PDFHandle)ctx;
+    *pages_buf = page_count;
+
+    // Debug output
+    // printf("[DEBUG] init() completed:\n");
+    // printf("  doc=%p -> *doc_handle=%p\n", doc, *doc_handle);
+    // printf("  ctx=%p -> *ctx_handle=%p\n", ctx, *ctx_handle);
+    // printf("  page_count=%d\n", page_count);
+    // printf("  file_size=%zuMB, context_memory=%zuMB\n", file_size >> 20, context_memory >> 20);
+}
+
+uint8_t *render_page(int page_num, size_t *size_buf, int *width_buf, int *height_buf,
+                     int *channels_buf, PDFHandle *doc_handle, PDFHandle *ctx_handle)
+{
+    // printf("[DEBUG] render_page() called:\n  page_num=%d\n  ctx_handle=%p\n  *ctx_handle=%p\n  doc_handle=%p\n  *doc_handle=%p\n",
+    //        page_num, ctx_handle, ctx_handle ? *ctx_handle : nullptr, doc_handle, doc_handle ? *doc_handle : nullptr);
+
+    if (!ctx_handle || !*ctx_handle)
+    {
+        // printf("[DEBUG] Invalid context handle detected!\n");
+        throw std::runtime_error("Invalid context handle");
+    }
+
+    if (!doc_handle || !*doc_handle)
+    {
+        // printf("[DEBUG] Invalid document handle detected!\n");
+        throw std::runtime_error("Invalid document handle");
+    }
+
+    if (size_buf == nullptr || width_buf == nullptr || height_buf == nullptr || channels_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    fz_context *ctx = (fz_context *)(*ctx_handle);
+    fz_document *doc = (fz_document *)(*doc_handle);
+
+    // printf("[DEBUG] Converted pointers: ctx=%p, doc=%p\n", ctx, doc);
+
+    // Additional safety checks for potentially corrupted documents
+    if (!ctx || !doc)
+    {
+        throw std::runtime_error("Invalid context or document handle");
+    }
+
+    // Validate page number with proper error handling for potentially corrupted documents
+    int total_pages = 0;
+    fz_try(ctx)
+    {
+        total_pages = fz_count_pages(ctx, doc);
+        // Additional check for document validity
+        if (total_pages <= 0)
+        {
+            throw std::runtime_error("Document appears to be corrupted - no valid pages found");
+        }
+
+        // Extra validation for page access
+        if (page_num < 0 || page_num >= total_pages)
+        {
+            throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, total_pages));
+        }
+    }
+    fz_catch(ctx)
+    {
+        const char *msg = fz_caught_message(ctx);
+        // Handle specific document corruption cases
+        if (msg && (strstr(msg, "object out of range") || strstr(msg, "page tree")))
+        {
+            throw std::runtime_error("Document is corrupted and cannot be processed in multi-threaded mode");
+        }
+        throw std::runtime_error(std::format("Failed to count pages or document corrupted: {}", msg ? msg : "Unknown error"));
+    }
+
+    if (page_num < 0 || page_num >= total_pages)
+    {
+        // This check is now handled above in the fz_try block
+        // But keeping this as a fallback
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, total_pages));
+    }
+
+    return render_loaded_page(ctx, doc, page_num, RenderProfile(), size_buf, width_buf, height_buf, channels_buf);
+}
+
+void free_image_data(uint8_t *data)
+{
+    delete[] data;
+}
+
+void cleanup_pdf(PDFHandle *doc_handle, PDFHandle *ctx_handle)
+{
+    printf("[DEBUG] cleanup_pdf() called with doc_handle=%p, ctx_handle=%p\n",
+           doc_handle ? *doc_handle : nullptr, ctx_handle ? *ctx_handle : nullptr);
+
+    // Clean up document first if it exists
+    if (doc_handle && *doc_handle)
+    {
+        fz_context *ctx = (fz_context *)(*ctx_handle);
+        fz_document *doc = (fz_document *)(*doc_handle);
+
+        if (ctx && doc)
+        {
+            fz_try(ctx)
+            {
+                fz_drop_document(ctx, doc);
+            }
+            fz_catch(ctx)
+            {
+                printf("[DEBUG] Error while dropping document: %s\n", fz_caught_message(ctx));
+            }
+        }
+        *doc_handle = nullptr;
+        printf("[DEBUG] Document handle cleaned up\n");
+    }
+
+    // Return context to pool instead of dropping it immediately
+    if (ctx_handle && *ctx_handle)
+    {
+        fz_context *ctx = (fz_context *)(*ctx_handle);
+
+        if (ctx)
+        {
+            // Return to pool instead of dropping
+            global_context_pool.return_context(ctx);
+            printf("[DEBUG] Context returned to pool\n");
+        }
+        *ctx_handle = nullptr;
+        printf("[DEBUG] Context handle cleaned up\n");
+    }
+}
+
+void flush_cache(PDFHandle *ctx_handle)
+{
+    if (ctx_handle && *ctx_handle)
+    {
+        fz_context *ctx = (fz_context *)(*ctx_handle);
+
+        fz_empty_store(ctx);
+
+        fz_shrink_store(ctx, 0);
+    }
+}
+
+void clone(PDFHandle *current_ctx, PDFHandle *new_ctx)
+{
+    if (current_ctx == nullptr || new_ctx == nullptr)
+    {
+        throw std::runtime_error("Passed a nullptr when trying to clone context!");
+    }
+
+    printf("[DEBUG] clone() called:\n  current_ctx=%p\n  *current_ctx=%p\n", current_ctx, *current_ctx);
+
+    // Try to get a context from the pool first
+    fz_context *pooled_context = global_context_pool.get_context();
+
+    if (pooled_context)
+    {
+        printf("[DEBUG] clone() using pooled context: %p\n", pooled_context);
+        *new_ctx = (PDFHandle)pooled_context;
+        return;
+    }
+
+    // Protect context creation with mutex to prevent race conditions
+    std::lock_guard<CreationLock> lock(context_creation_lock);
+
+    // Create a completely new context with the same locking mechanism
+    // instead of cloning to avoid shared resource issues
+    fz_locks_context locks = shared_locks();
+
+    fz_context *new_context = new_governed_context(&locks, 256 << 20);
+    if (new_context == nullptr)
+    {
+        throw std::runtime_error("Failed to create new context!");
+    }
+
+    fz_set_aa_level(new_context, 8);
+
+    fz_try(new_context)
+    {
+        fz_register_document_handlers(new_context);
+    }
+    fz_catch(new_context)
+    {
+        fz_drop_context(new_context);
+        throw std::runtime_error("Failed to register document handlers in new context!");
+    }
+
+    printf("[DEBUG] clone() completed: new_context=%p -> *new_ctx=%p\n", new_context, new_context);
+    *new_ctx = (PDFHandle)new_context;
+}
+
+void clone_doc(const std::string &path, PDFHandle *ctx_handle, PDFHandle *new_doc)
+{
+    if (ctx_handle == nullptr || new_doc == nullptr)
+    {
+        throw std::runtime_error("Passed a nullptr when trying to clone document!");
+    }
+
+    fz_context *ctx = (fz_context *)(*ctx_handle);
+
+    // Open the document fresh for this thread
+    fz_document *doc = nullptr;
+    fz_try(ctx)
+    {
+        doc = fz_open_document(ctx, path.c_str());
+        if (!doc)
+        {
+            throw std::runtime_error("Failed to open document for cloning");
+        }
+
+        // Validate the document immediately
+        int test_pages = fz_count_pages(ctx, doc);
+        if (test_pages <= 0)
+        {
+            fz_drop_document(ctx, doc);
+            throw std::runtime_error("Document has no valid pages");
+        }
+    }
+    fz_catch(ctx)
+    {
+        if (doc)
+        {
+            fz_drop_document(ctx, doc);
+        }
+        throw std::runtime_error(std::format("Failed to clone document: {}", fz_caught_message(ctx)));
+    }
+
+    *new_doc = (PDFHandle)doc;
+}
+
+void clone_shared(PDFHandle *current_ctx, PDFHandle *new_ctx)
+{
+    if (current_ctx == nullptr || new_ctx == nullptr || *current_ctx == nullptr)
+    {
+        throw std::runtime_error("Passed a nullptr when trying to clone context!");
+    }
+
+    fz_context *base = (fz_context *)(*current_ctx);
+
+    // fz_clone_context shares the store, glyph cache, colorspaces and document
+    // handlers with the base context. That sharing is only safe because every
+    // context is created with the same shared_locks().
+    fz_context *shared_context = nullptr;
+    {
+        std::lock_guard<CreationLock> lock(context_creation_lock);
+        shared_context = fz_clone_context(base);
+    }
+
+    if (shared_context == nullptr)
+    {
+        throw std::runtime_error("Failed to clone shared context!");
+    }
+
+    *new_ctx = (PDFHandle)shared_context;
+}
+
+void open_session(const std::string &path, bool share_store, PDFHandle *ctx_handle, PDFHandle *source_handle,
+                  PDFHandle *session_handle, int *pages_buf)
+{
+    if (ctx_handle == nullptr || session_handle == nullptr || pages_buf == nullptr)
+    {
+        throw std::runtime_error("Passed a nullptr when trying to open a worker session!");
+    }
+
+    DocumentSource *source = source_handle ? (DocumentSource *)(*source_handle) : nullptr;
+
+    PDFHandle session_ctx = nullptr;
+    if (share_store)
+    {
+        clone_shared(ctx_handle, &session_ctx);
+    }
+    else
+    {
+        clone(ctx_handle, &session_ctx);
+    }
+    fz_context *ctx = (fz_context *)session_ctx;
+
+    fz_document *doc = nullptr;
+    int page_count = 0;
+    fz_try(ctx)
+    {
+        doc = open_document_from(ctx, path, source);
+        page_count = fz_count_pages(ctx, doc);
+    }
+    fz_catch(ctx)
+    {
+        if (doc)
+        {
+            fz_drop_document(ctx, doc);
+        }
+        std::string msg = fz_caught_message(ctx);
+        release_session_context(ctx, share_store);
+        throw std::runtime_error(std::format("Failed to open worker session: {}", msg));
+    }
+
+    if (page_count <= 0)
+    {
+        fz_drop_document(ctx, doc);
+        release_session_context(ctx, share_store);
+        throw std::runtime_error("Document has no valid pages");
+    }
+
+    WorkerSession *session = nullptr;
+    try
+    {
+        session = new WorkerSession();
+    }
+    catch (const std::exception &e)
+    {
+        fz_drop_document(ctx, doc);
+        release_session_context(ctx, share_store);
+        throw std::runtime_error(std::format("Failed to open worker session: {}", e.what()));
+    }
+    session->ctx = ctx;
+    session->doc = doc;
+    session->page_count = page_count;
+    session->shared_store = share_store;
+    fz_set_aa_level(ctx, mode_aa_level(session->profile.mode));
+
+    *session_handle = (PDFHandle)session;
+    *pages_buf = page_count;
+}
+
+uint8_t *render_session_page(int page_num, size_t *size_buf, int *width_buf, int *height_buf,
+                             int *channels_buf, PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if (size_buf == nullptr || width_buf == nullptr || height_buf == nullptr || channels_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+
+    // The page count was cached when the session was opened.
+    if (page_num < 0 || page_num >= session->page_count)
+    {
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, session->page_count));
+    }
+
+    return render_loaded_page(session->ctx, session->doc, page_num, session->profile, size_buf, width_buf, height_buf,
+                              channels_buf);
+}
+
+// A page loaded ahead of rendering it, see prepare_page. Either cached is set, the page
+// was recorded into list, or error holds why preparing it failed.
+struct PreparedPage
+{
+    int page_num = 0;
+    // Keys of the page in the cache's memory and disk tiers, see find_cached_page.
+    std::string key;
+    std::string disk_key;
+    std::shared_ptr<const CachedImage> cached;
+    fz_display_list *list = nullptr;
+    fz_rect bounds;
+    PageStats stats;
+    std::string error;
+    // How far preparing got, when it was aborted.
+    AbortRecord abort;
+};
+
+// Looks a page rendered at scale with the session's profile up in both tiers of the cache, setting its keys so a miss can be
+// kept once it's rendered, see store_cached_page. Fingerprinting only reads the page object and its
+// raw streams, so a repeated page costs a hash instead of a render, and a page found on disk costs
+// a file read.
+static std::shared_ptr<const CachedImage> find_cached_page(WorkerSession *session, RenderCache *cache, int page_num,
+                                                           float scale, int format, bool passthrough,
+                                                           std::string &key, std::string &disk_key,
+                                                           PageStats *stats)
+{
+    if (!cache)
+        return nullptr;
+
+    std::string settings =
+        render_settings_key(scale, session->profile.threshold, session->profile.mode, format, passthrough);
+    std::shared_ptr<const CachedImage> cached;
+
+    if (cache->budget > 0)
+    {
+        unsigned char digest[16];
+        uint64_t start = stage_start(stats);
+        bool fingerprinted = fingerprint_page(session->ctx, session->doc, page_num, digest);
+        stage_end(stats, STAGE_FINGERPRINT, start);
+
+        if (fingerprinted)
+        {
+            key.assign((const char *)digest, sizeof(digest));
+            key += settings;
+            cached = cache->find(key);
+        }
+    }
+
+    if (!cache->dir.empty())
+    {
+        disk_key = std::format("{}-{}", page_num, settings);
+
+        if (!cached)
+        {
+            uint64_t start = stage_start(stats);
+            cached = cache->load(disk_key);
+            stage_end(stats, STAGE_COPY, start);
+
+            if (cached && !key.empty())
+                cache->insert(key, cached);
+        }
+    }
+
+    return cached;
+}
+
+// Keeps a page that missed the cache in the tiers find_cached_page set its keys for. The image's
+// bytes move into the entry and the image shares the entry from then on, like a cache hit, so the
+// page is held once. Pixmap samples and MuPDF buffers can't be taken over, so they are copied and
+// dropped. Returns where the image's bytes are now.
+static uint8_t *store_cached_page(RenderCache *cache, const std::string &key, const std::string &disk_key,
+                                  uint8_t *data, size_t size, int width, int height, int channels, int stride,
+                                  bool blank, bool passthrough, PDFHandle image_handle, PageStats *stats)
+{
+    if (key.empty() && disk_key.empty())
+        return data;
+
+    uint64_t start = stage_start(stats);
+    PageImage *image = (PageImage *)image_handle;
+    std::shared_ptr<CachedImage> cached = std::make_shared<CachedImage>();
+    if (!image->bytes.empty())
+        cached->bytes = std::move(image->bytes);
+    else if (data)
+        cached->bytes.assign(data, data + size);
+    image->bytes = std::vector<uint8_t>();
+
+    if (image->pix)
+        drop_pixmap(image->ctx, image->arena, image->pix);
+    if (image->buf && image->arena)
+        give_buffer(image->ctx, image->arena, image->buf);
+    else if (image->buf)
+        fz_drop_buffer(image->ctx, image->buf);
+    image->pix = nullptr;
+    image->buf = nullptr;
+    image->cached = cached;
+
+    cached->width = width;
+    cached->height = height;
+    cached->channels = channels;
+    cached->stride = stride;
+    cached->blank = blank;
+    cached->passthrough = passthrough;
+
+    if (!key.empty())
+        cache->insert(key, cached);
+    if (!disk_key.empty())
+        cache->store(disk_key, *cached);
+    stage_end(stats, STAGE_COPY, start);
+
+    return blank ? nullptr : cached->bytes.data();
+}
+
+// Renders a page found in the cache or recorded into a display list, on any session sharing the
+// store of the one that prepared it. With passthrough, a page that only draws a scan is handed out
+// at the scan's own resolution instead, see find_page_image. Drops the page's list.
+static uint8_t *render_prepared(WorkerSession *session, RenderCache *cache, PreparedPage &page, int format,
+                                float blank_ratio, bool passthrough, size_t *size_buf, int *width_buf,
+                                int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf,
+                                PDFHandle *image_handle, PageStats *stats)
+{
+    fz_context *ctx = session->ctx;
+
+    if (page.cached)
+    {
+        *flags_buf = IMAGE_CACHED | (page.cached->blank ? IMAGE_BLANK : 0) |
+                     (page.cached->passthrough ? IMAGE_PASSTHROUGH : 0);
+        return share_cached_image(page.cached, size_buf, width_buf, height_buf, channels_buf, stride_buf,
+                                  image_handle);
+    }
+
+    fz_display_list *list = page.list;
+    fz_image *scan = nullptr;
+    fz_buffer *stream = nullptr;
+    fz_pixmap *pix = nullptr;
+    bool blank = false;
+    page.list = nullptr;
+
+    fz_var(scan);
+    fz_var(stream);
+    fz_var(pix);
+    fz_var(blank);
+
+    fz_try(ctx)
+    {
+        if (blank_ratio >= 0.0f)
+        {
+            uint64_t probe_start = stage_start(stats);
+            blank = is_blank_page(ctx, list, blank_ratio, session->profile.threshold, &session->cookie);
+            stage_end(stats, STAGE_PROBE, probe_start);
+        }
+        if (!blank && passthrough)
+        {
+            uint64_t probe_start = stage_start(stats);
+            scan = find_page_image(ctx, list, page.bounds, &session->cookie);
+            stage_end(stats, STAGE_PROBE, probe_start);
+        }
+
+        if (scan && format == OUTPUT_G4)
+            stream = original_g4_stream(ctx, scan);
+        if (scan && !stream)
+            pix = decode_scan(ctx, scan, &session->arena, stats);
+        else if (!blank && !scan)
+            pix = render_list_pixmap(ctx, list, session->profile.ctm(), &session->arena, stats, &session->cookie);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_image(ctx, scan);
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page.page_num, msg ? msg : "Unknown error"));
+    }
+
+    bool scanned = scan != nullptr;
+    uint8_t *data = nullptr;
+    if (blank)
+    {
+        *flags_buf = IMAGE_BLANK;
+        data = make_blank_image(format, page.bounds, session->profile.ctm(), size_buf, width_buf, height_buf,
+                                channels_buf, stride_buf, image_handle);
+    }
+    else if (stream)
+    {
+        *flags_buf = IMAGE_PASSTHROUGH;
+        data = share_scan_stream(ctx, stream, scan->w, scan->h, size_buf, width_buf, height_buf, channels_buf,
+                                 stride_buf, image_handle, stats);
+    }
+    else
+    {
+        *flags_buf = scanned ? IMAGE_PASSTHROUGH : 0;
+        data = make_page_image(ctx, &session->arena, pix, format, session->profile, page.page_num, size_buf,
+                               width_buf, height_buf, channels_buf, stride_buf, image_handle, stats);
+    }
+    fz_drop_image(ctx, scan);
+
+    return store_cached_page(cache, page.key, page.disk_key, data, *size_buf, *width_buf, *height_buf,
+                             *channels_buf, *stride_buf, blank, scanned, *image_handle, stats);
+}
+
+// The body of render_session_image once its arguments are checked, timing each stage into stats if given.
+static uint8_t *render_checked_image(WorkerSession *session, RenderCache *cache, int page_num, int format,
+                                     float blank_ratio, bool passthrough, size_t *size_buf, int *width_buf, int *height_buf,
+                                     int *channels_buf, int *stride_buf, int *flags_buf, PDFHandle *image_handle,
+                                     PageStats *stats)
+{
+    fz_context *ctx = session->ctx;
+    *flags_buf = 0;
+
+    PreparedPage page;
+    page.page_num = page_num;
+    page.cached =
+        find_cached_page(session, cache, page_num, session->profile.scale, format, passthrough, page.key,
+                         page.disk_key, stats);
+
+    if (!page.cached && blank_ratio < 0.0f && !passthrough && page.key.empty() && page.disk_key.empty())
+    {
+        fz_pixmap *pix = render_gray_pixmap(ctx, session->doc, page_num, session->profile.ctm(), &session->arena,
+                                            stats, &session->cookie);
+
+        return make_page_image(ctx, &session->arena, pix, format, session->profile, page_num, size_buf, width_buf,
+                               height_buf, channels_buf, stride_buf, image_handle, stats);
+    }
+
+    // Record the page once, so probing it for ink, looking for its scan and rendering it share one
+    // interpretation.
+    if (!page.cached)
+        page.list = record_page(ctx, session->doc, page_num, &page.bounds, stats, &session->cookie);
+
+    return render_prepared(session, cache, page, format, blank_ratio, passthrough, size_buf, width_buf, height_buf,
+                           channels_buf, stride_buf, flags_buf, image_handle, stats);
+}
+
+uint8_t *render_session_image(int page_num, int format, float blank_ratio, bool passthrough, size_t *size_buf,
+                              int *width_buf, int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf,
+                              PDFHandle *session_handle, PDFHandle *cache_handle, PDFHandle *image_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if (size_buf == nullptr || width_buf == nullptr || height_buf == nullptr || channels_buf == nullptr ||
+        stride_buf == nullptr || flags_buf == nullptr || image_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    if (!is_valid_format(format))
+    {
+        throw std::runtime_error(std::format("Unknown output format {}", format));
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    RenderCache *cache = cache_handle ? (RenderCache *)(*cache_handle) : nullptr;
+    relieve_session(session);
+
+    if (page_num < 0 || page_num >= session->page_count)
+    {
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, session->page_count));
+    }
+
+    PageStats page_stats;
+    PageStats *stats = session->stats ? &page_stats : nullptr;
+    CookieScope scope(session->control, &session->cookie, page_num);
+
+    uint8_t *data = render_checked_image(session, cache, page_num, format, blank_ratio, passthrough, size_buf,
+                                         width_buf, height_buf, channels_buf, stride_buf, flags_buf, image_handle,
+                                         stats);
+    finish_page_stats(session->stats, stats, *image_handle);
+    return data;
+}
+
+void open_loader_session(const std::string &path, PDFHandle *source_handle, PDFHandle *session_handle,
+                         PDFHandle *loader_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    PDFHandle ctx_handle = ((WorkerSession *)(*session_handle))->ctx;
+    int page_count = 0;
+    open_session(path, true, &ctx_handle, source_handle, loader_handle, &page_count);
+}
+
+PreparedPage *prepare_page(int page_num, int format, bool passthrough, PDFHandle *loader_handle,
+                           PDFHandle *cache_handle)
+{
+    WorkerSession *loader = (WorkerSession *)(*loader_handle);
+    RenderCache *cache = cache_handle ? (RenderCache *)(*cache_handle) : nullptr;
+    PageStats *stats = nullptr;
+
+    PreparedPage *page = new PreparedPage();
+    page->page_num = page_num;
+    if (loader->stats)
+        stats = &page->stats;
+
+    try
+    {
+        relieve_session(loader);
+
+        if (page_num < 0 || page_num >= loader->page_count)
+        {
+            throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, loader->page_count));
+        }
+
+        CookieScope scope(loader->control, &loader->cookie, page_num);
+        page->cached = find_cached_page(loader, cache, page_num, loader->profile.scale, format, passthrough,
+                                        page->key, page->disk_key, stats);
+        if (!page->cached)
+            page->list = record_page(loader->ctx, loader->doc, page_num, &page->bounds, stats, &loader->cookie);
+    }
+    catch (const std::exception &e)
+    {
+        page->error = e.what();
+        page->abort = loader->cookie.last;
+    }
+
+    return page;
+}
+
+uint8_t *render_prepared_page(PreparedPage *page, int format, float blank_ratio, bool passthrough, size_t *size_buf,
+                              int *width_buf, int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf,
+                              PDFHandle *session_handle, PDFHandle *cache_handle, PDFHandle *image_handle)
+{
+    // Only errors leave a page without its list, and render_prepared takes the list over first thing.
+    std::unique_ptr<PreparedPage> owned(page);
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    RenderCache *cache = cache_handle ? (RenderCache *)(*cache_handle) : nullptr;
+    relieve_session(session);
+    *flags_buf = 0;
+
+    if (!page->error.empty())
+    {
+        // Reported as if the page failed on this session, see last_render_abort.
+        session->cookie.last = page->abort;
+        throw std::runtime_error(page->error);
+    }
+
+    PageStats *stats = session->stats ? &page->stats : nullptr;
+    CookieScope scope(session->control, &session->cookie, page->page_num);
+    uint8_t *data = render_prepared(session, cache, *page, format, blank_ratio, passthrough, size_buf, width_buf,
+                                    height_buf, channels_buf, stride_buf, flags_buf, image_handle, stats);
+    finish_page_stats(session->stats, stats, *image_handle);
+    return data;
+}
+
+void drop_prepared_page(PreparedPage *page, PDFHandle *session_handle)
+{
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+
+    if (page->list)
+        fz_drop_display_list(session->ctx, page->list);
+    delete page;
+}
+
+void set_session_stats(PDFHandle *stats_handle, PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    session->stats = stats_handle ? (RenderStats *)(*stats_handle) : nullptr;
+}
+
+bool page_image_stats(uint64_t *stage_ns_buf, size_t *sample_bytes_buf, size_t *output_bytes_buf,
+                      PDFHandle *image_handle)
+{
+    if (!image_handle || !*image_handle)
+    {
+        throw std::runtime_error("Invalid image handle");
+    }
+
+    if (stage_ns_buf == nullptr || sample_bytes_buf == nullptr || output_bytes_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    const PageImage *image = (const PageImage *)(*image_handle);
+    if (!image->timed)
+    {
+        return false;
+    }
+
+    std::copy(image->stats.stage_ns, image->stats.stage_ns + STAGE_COUNT, stage_ns_buf);
+    *sample_bytes_buf = image->stats.sample_bytes;
+    *output_bytes_buf = image->stats.output_bytes;
+    return true;
+}
+
+void set_session_control(PDFHandle *control_handle, PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    session->control = control_handle ? (RenderControl *)(*control_handle) : nullptr;
+}
+
+void new_render_profile(int mode, float scale, int threshold, PDFHandle *profile_handle)
+{
+    if (profile_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    if (mode != MODE_BILEVEL && mode != MODE_GRAY)
+    {
+        throw std::runtime_error(std::format("Unknown render mode {}", mode));
+    }
+
+    if (!(scale > 0.0f) || threshold < 0 || threshold > 255)
+    {
+        throw std::runtime_error(std::format("Invalid render profile: scale {}, threshold {}", scale, threshold));
+    }
+
+    RenderProfile *profile = new RenderProfile();
+    profile->mode = mode;
+    profile->scale = scale;
+    profile->threshold = threshold;
+    *profile_handle = (PDFHandle)profile;
+}
+
+void free_render_profile(PDFHandle *profile_handle)
+{
+    if (!profile_handle || !*profile_handle)
+    {
+        return;
+    }
+
+    delete (RenderProfile *)(*profile_handle);
+    *profile_handle = nullptr;
+}
+
+void set_session_profile(PDFHandle *profile_handle, PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    session->profile = profile_handle && *profile_handle ? *(RenderProfile *)(*profile_handle) : RenderProfile();
+    fz_set_aa_level(session->ctx, mode_aa_level(session->profile.mode));
+}
+
+void last_render_abort(uint64_t *abort_buf, PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if (abort_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    write_abort(((WorkerSession *)(*session_handle))->cookie.last, abort_buf);
+}
+
+void free_page_image(PDFHandle *image_handle)
+{
+    if (!image_handle || !*image_handle)
+    {
+        return;
+    }
+
+    PageImage *image = (PageImage *)(*image_handle);
+
+    if (image->release)
+    {
+        image->release(image, image->owner);
+    }
+    else
+    {
+        drop_page_image(image);
+    }
+
+    *image_handle = nullptr;
+}
+
+void set_page_image_release(PDFHandle image, PageImageRelease release, void *owner)
+{
+    ((PageImage *)image)->release = release;
+    ((PageImage *)image)->owner = owner;
+}
+
+void drop_page_image(PDFHandle handle)
+{
+    PageImage *image = (PageImage *)handle;
+
+    if (image->pix)
+        drop_pixmap(image->ctx, image->arena, image->pix);
+    if (image->buf && image->arena)
+        give_buffer(image->ctx, image->arena, image->buf);
+    else if (image->buf)
+        fz_drop_buffer(image->ctx, image->buf);
+    if (image->arena && image->bytes.capacity() > 0)
+        give_bytes(image->arena, std::move(image->bytes));
+
+    delete image;
+}
+
+void render_pages(const int *pages, int count, int format, float scale, PDFHandle *session_handle,
+                  PDFHandle *cache_handle, PDFHandle *batch_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if ((pages == nullptr && count > 0) || batch_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    if (!is_valid_format(format))
+    {
+        throw std::runtime_error(std::format("Unknown output format {}", format));
+    }
+
+    if (!(scale > 0.0f))
+    {
+        throw std::runtime_error(std::format("Invalid render scale {}", scale));
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    RenderCache *cache = cache_handle ? (RenderCache *)(*cache_handle) : nullptr;
+    fz_context *ctx = session->ctx;
+    fz_matrix ctm = fz_scale(scale, scale);
+
+    PageBatch *batch = new PageBatch();
+    batch->pages.resize(count < 0 ? 0 : count);
+
+    // A failing page doesn't fail the batch, its error is handed out with it instead.
+    for (size_t i = 0; i < batch->pages.size(); i++)
+    {
+        BatchPage &page = batch->pages[i];
+        page.page_num = pages[i];
+        relieve_session(session);
+
+        try
+        {
+            if (page.page_num < 0 || page.page_num >= session->page_count)
+            {
+                throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page.page_num, session->page_count));
+            }
+
+            PageStats page_stats;
+            PageStats *stats = session->stats ? &page_stats : nullptr;
+            CookieScope scope(session->control, &session->cookie, page.page_num);
+
+            std::string key, disk_key;
+            std::shared_ptr<const CachedImage> cached =
+                find_cached_page(session, cache, page.page_num, scale, format, false, key, disk_key, stats);
+
+            if (cached)
+            {
+                page.data = share_cached_image(cached, &page.size, &page.width, &page.height, &page.channels,
+                                               &page.stride, &page.image);
+            }
+            else
+            {
+                fz_pixmap *pix = render_gray_pixmap(ctx, session->doc, page.page_num, ctm, &session->arena, stats,
+                                                    &session->cookie);
+                page.data = make_page_image(ctx, &session->arena, pix, format, session->profile, page.page_num, &page.size,
+                                            &page.width, &page.height, &page.channels, &page.stride, &page.image, stats);
+                page.data = store_cached_page(cache, key, disk_key, page.data, page.size, page.width, page.height,
+                                              page.channels, page.stride, false, false, page.image, stats);
+            }
+            finish_page_stats(session->stats, stats, page.image);
+        }
+        catch (const std::exception &e)
+        {
+            page.error = e.what();
+            page.abort = session->cookie.last;
+        }
+    }
+
+    *batch_handle = (PDFHandle)batch;
+}
+
+uint8_t *batch_page(int index, int *page_buf, size_t *size_buf, int *width_buf, int *height_buf, int *channels_buf,
+                    int *stride_buf, uint64_t *abort_buf, PDFHandle *batch_handle)
+{
+    if (!batch_handle || !*batch_handle)
+    {
+        throw std::runtime_error("Invalid batch handle");
+    }
+
+    if (page_buf == nullptr || size_buf == nullptr || width_buf == nullptr || height_buf == nullptr ||
+        channels_buf == nullptr || stride_buf == nullptr || abort_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    PageBatch *batch = (PageBatch *)(*batch_handle);
+
+    if (index < 0 || (size_t)index >= batch->pages.size())
+    {
+        throw std::runtime_error(std::format("Attempted to access batch entry {} but batch only has {} pages!", index, batch->pages.size()));
+    }
+
+    const BatchPage &page = batch->pages[index];
+    *page_buf = page.page_num;
+
+    if (!page.error.empty())
+    {
+        write_abort(page.abort, abort_buf);
+        throw std::runtime_error(page.error);
+    }
+
+    *size_buf = page.size;
+    *width_buf = page.width;
+    *height_buf = page.height;
+    *channels_buf = page.channels;
+    *stride_buf = page.stride;
+
+    return page.data;
+}
+
+void free_page_batch(PDFHandle *batch_handle)
+{
+    if (!batch_handle || !*batch_handle)
+    {
+        return;
+    }
+
+    PageBatch *batch = (PageBatch *)(*batch_handle);
+    for (BatchPage &page : batch->pages)
+    {
+        free_page_image(&page.image);
+    }
+
+    delete batch;
+    *batch_handle = nullptr;
+}
+
+void load_display_list(int page_num, float *bounds_buf, PDFHandle *session_handle, PDFHandle *list_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if (bounds_buf == nullptr || list_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    fz_context *ctx = session->ctx;
+    relieve_session(session);
+
+    if (page_num < 0 || page_num >= session->page_count)
+    {
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, session->page_count));
+    }
+
+    fz_display_list *list = nullptr;
+    fz_rect bounds = fz_empty_rect;
+    {
+        CookieScope scope(session->control, &session->cookie, page_num);
+        list = record_page(ctx, session->doc, page_num, &bounds, nullptr, &session->cookie);
+    }
+
+    bounds_buf[0] = bounds.x0;
+    bounds_buf[1] = bounds.y0;
+    bounds_buf[2] = bounds.x1;
+    bounds_buf[3] = bounds.y1;
+
+    PageDisplayList *page_list = new PageDisplayList();
+    page_list->ctx = ctx;
+    page_list->list = list;
+    page_list->page_num = page_num;
+    page_list->arena = &session->arena;
+    page_list->profile = session->profile;
+    page_list->stats = session->stats;
+    page_list->control = session->control;
+    page_list->cookie = &session->cookie;
+
+    *list_handle = (PDFHandle)page_list;
+}
+
+// The body of render_display_list and render_display_list_region once their arguments are checked.
+static uint8_t *render_list_image(PageDisplayList *page_list, float scale, fz_rect clip, int format,
+                                  size_t *size_buf, int *width_buf, int *height_buf, int *channels_buf,
+                                  int *stride_buf, PDFHandle *image_handle)
+{
+    fz_context *ctx = page_list->ctx;
+
+    // The list was recorded by load_display_list, so only the replay and what follows is timed here.
+    PageStats page_stats;
+    PageStats *stats = page_list->stats ? &page_stats : nullptr;
+
+    fz_pixmap *pix = nullptr;
+    begin_render(page_list->control, page_list->cookie, page_list->page_num);
+    fz_try(ctx)
+    {
+        pix = render_list_pixmap(ctx, page_list->list, fz_scale(scale, scale), page_list->arena, stats,
+                                 page_list->cookie, clip);
+    }
+    fz_always(ctx)
+    {
+        end_render(page_list->control, page_list->cookie);
+    }
+    fz_catch(ctx)
+    {
         const char *msg = fz_caught_message(ctx);
-        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_list->page_num, msg ? msg : "Unknown error"));
     }
 
+    uint8_t *data = make_page_image(ctx, page_list->arena, pix, format, page_list->profile, page_list->page_num, size_buf,
+                                    width_buf, height_buf, channels_buf, stride_buf, image_handle, stats);
+    finish_page_stats(page_list->stats, stats, *image_handle);
     return data;
 }
 
-void free_image_data(uint8_t *data)
+uint8_t *render_display_list(float scale, int format, size_t *size_buf, int *width_buf, int *height_buf,
+                             int *channels_buf, int *stride_buf, PDFHandle *list_handle, PDFHandle *image_handle)
 {
-    delete[] data;
+    if (!list_handle || !*list_handle)
+    {
+        throw std::runtime_error("Invalid display list handle");
+    }
+
+    if (size_buf == nullptr || width_buf == nullptr || height_buf == nullptr || channels_buf == nullptr ||
+        stride_buf == nullptr || image_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    if (!is_valid_format(format))
+    {
+        throw std::runtime_error(std::format("Unknown output format {}", format));
+    }
+
+    if (!(scale > 0.0f))
+    {
+        throw std::runtime_error(std::format("Invalid render scale {}", scale));
+    }
+
+    return render_list_image((PageDisplayList *)(*list_handle), scale, fz_infinite_rect, format, size_buf, width_buf,
+                             height_buf, channels_buf, stride_buf, image_handle);
 }
 
-void cleanup_pdf(PDFHandle *doc_handle, PDFHandle *ctx_handle)
+uint8_t *render_display_list_region(const float *rect_buf, float scale, int format, size_t *size_buf,
+                                    int *width_buf, int *height_buf, int *channels_buf, int *stride_buf,
+                                    PDFHandle *list_handle, PDFHandle *image_handle)
 {
-    printf("[DEBUG] cleanup_pdf() called with doc_handle=%p, ctx_handle=%p\n",
-           doc_handle ? *doc_handle : nullptr, ctx_handle ? *ctx_handle : nullptr);
+    if (!list_handle || !*list_handle)
+    {
+        throw std::runtime_error("Invalid display list handle");
+    }
 
-    // Clean up document first if it exists
-    if (doc_handle && *doc_handle)
+    if (rect_buf == nullptr || size_buf == nullptr || width_buf == nullptr || height_buf == nullptr ||
+        channels_buf == nullptr || stride_buf == nullptr || image_handle == nullptr)
     {
-        fz_context *ctx = (fz_context *)(*ctx_handle);
-        fz_document *doc = (fz_document *)(*doc_handle);
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
 
-        if (ctx && doc)
-        {
-            fz_try(ctx)
-            {
-                fz_drop_document(ctx, doc);
-            }
-            fz_catch(ctx)
-            {
-                printf("[DEBUG] Error while dropping document: %s\n", fz_caught_message(ctx));
-            }
-        }
-        *doc_handle = nullptr;
-        printf("[DEBUG] Document handle cleaned up\n");
+    if (!is_valid_format(format))
+    {
+        throw std::runtime_error(std::format("Unknown output format {}", format));
     }
 
-    // Return context to pool instead of dropping it immediately
-    if (ctx_handle && *ctx_handle)
+    if (!(scale > 0.0f))
     {
-        fz_context *ctx = (fz_context *)(*ctx_handle);
+        throw std::runtime_error(std::format("Invalid render scale {}", scale));
+    }
 
-        if (ctx)
-        {
-            // Return to pool instead of dropping
-            global_context_pool.return_context(ctx);
-            printf("[DEBUG] Context returned to pool\n");
-        }
-        *ctx_handle = nullptr;
-        printf("[DEBUG] Context handle cleaned up\n");
+    PageDisplayList *page_list = (PageDisplayList *)(*list_handle);
+    fz_rect clip = fz_make_rect(rect_buf[0], rect_buf[1], rect_buf[2], rect_buf[3]);
+    fz_rect area = fz_intersect_rect(fz_bound_display_list(page_list->ctx, page_list->list), clip);
+
+    if (fz_is_empty_irect(fz_round_rect(fz_transform_rect(area, fz_scale(scale, scale)))))
+    {
+        throw std::runtime_error(std::format("Region [{}, {}, {}, {}] doesn't cover any of page {}", clip.x0, clip.y0,
+                                             clip.x1, clip.y1, page_list->page_num));
     }
+
+    return render_list_image(page_list, scale, clip, format, size_buf, width_buf, height_buf, channels_buf,
+                             stride_buf, image_handle);
 }
 
-void flush_cache(PDFHandle *ctx_handle)
+void free_display_list(PDFHandle *list_handle)
 {
-    if (ctx_handle && *ctx_handle)
+    if (!list_handle || !*list_handle)
     {
-        fz_context *ctx = (fz_context *)(*ctx_handle);
-
-        fz_empty_store(ctx);
-
-        fz_shrink_store(ctx, 0);
+        return;
     }
+
+    PageDisplayList *page_list = (PageDisplayList *)(*list_handle);
+    fz_drop_display_list(page_list->ctx, page_list->list);
+    delete page_list;
+    *list_handle = nullptr;
 }
 
-void clone(PDFHandle *current_ctx, PDFHandle *new_ctx)
+void open_band_renderer(int page_num, int band_height, int format, int *width_buf, int *height_buf, int *stride_buf,
+                        PDFHandle *session_handle, PDFHandle *band_handle)
 {
-    if (current_ctx == nullptr || new_ctx == nullptr)
+    if (!session_handle || !*session_handle)
     {
-        throw std::runtime_error("Passed a nullptr when trying to clone context!");
+        throw std::runtime_error("Invalid session handle");
     }
 
-    printf("[DEBUG] clone() called:\n  current_ctx=%p\n  *current_ctx=%p\n", current_ctx, *current_ctx);
+    if (width_buf == nullptr || height_buf == nullptr || stride_buf == nullptr || band_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
 
-    // Try to get a context from the pool first
-    fz_context *pooled_context = global_context_pool.get_context();
+    if (!is_valid_format(format))
+    {
+        throw std::runtime_error(std::format("Unknown output format {}", format));
+    }
 
-    if (pooled_context)
+    // Whole-file encodings can't be handed out one band at a time.
+    if (format != OUTPUT_PNG && format != OUTPUT_RAW && format != OUTPUT_PACKED)
     {
-        printf("[DEBUG] clone() using pooled context: %p\n", pooled_context);
-        *new_ctx = (PDFHandle)pooled_context;
-        return;
+        throw std::runtime_error(std::format("Output format {} can't be rendered in bands", format));
     }
 
-    // Protect context creation with mutex to prevent race conditions
-    std::lock_guard<std::mutex> lock(context_creation_mutex);
+    if (band_height <= 0)
+    {
+        throw std::runtime_error(std::format("Invalid band height {}", band_height));
+    }
 
-    // Create a completely new context with the same locking mechanism
-    // instead of cloning to avoid shared resource issues
-    fz_locks_context locks;
-    locks.user = nullptr;
-    locks.lock = lock_mutex;
-    locks.unlock = unlock_mutex;
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    fz_context *ctx = session->ctx;
+    relieve_session(session);
 
-    fz_context *new_context = fz_new_context(nullptr, &locks, 256 << 20);
-    if (new_context == nullptr)
+    if (page_num < 0 || page_num >= session->page_count)
     {
-        throw std::runtime_error("Failed to create new context!");
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, session->page_count));
     }
 
-    fz_set_aa_level(new_context, 8);
+    fz_rect bounds;
+    fz_display_list *list = nullptr;
+    {
+        CookieScope scope(session->control, &session->cookie, page_num);
+        list = record_page(ctx, session->doc, page_num, &bounds, nullptr, &session->cookie);
+    }
 
-    fz_try(new_context)
+    BandRenderer *bands = nullptr;
+    try
     {
-        fz_register_document_handlers(new_context);
+        bands = new BandRenderer();
     }
-    fz_catch(new_context)
+    catch (const std::exception &e)
     {
-        fz_drop_context(new_context);
-        throw std::runtime_error("Failed to register document handlers in new context!");
+        fz_drop_display_list(ctx, list);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, e.what()));
+    }
+    bands->ctx = ctx;
+    bands->list = list;
+    bands->control = session->control;
+    bands->cookie = &session->cookie;
+    bands->ctm = session->profile.ctm();
+    bands->bbox = fz_round_rect(fz_transform_rect(bounds, bands->ctm));
+    bands->format = format;
+    bands->threshold = session->profile.threshold;
+    bands->thresholded = mode_thresholded(session->profile.mode);
+    bands->band_height = band_height;
+    bands->next_y = bands->bbox.y0;
+    bands->page_num = page_num;
+
+    int width = bands->bbox.x1 - bands->bbox.x0;
+    int height = bands->bbox.y1 - bands->bbox.y0;
+    // The renderer owns the list from here on, dropping it drops everything it holds so far.
+    try
+    {
+        bands->samples.resize((size_t)width * (size_t)band_height);
+        if (format == OUTPUT_PACKED)
+            bands->bytes.resize(packed_stride(width) * (size_t)band_height);
+    }
+    catch (const std::exception &e)
+    {
+        drop_band_renderer(bands);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, e.what()));
     }
 
-    printf("[DEBUG] clone() completed: new_context=%p -> *new_ctx=%p\n", new_context, new_context);
-    *new_ctx = (PDFHandle)new_context;
+    if (format == OUTPUT_PNG)
+    {
+        fz_try(ctx)
+        {
+            bands->buf = fz_new_buffer(ctx, (size_t)width * (size_t)band_height / 8 + 1024);
+            bands->out = fz_new_output_with_buffer(ctx, bands->buf);
+            bands->writer = fz_new_png_band_writer(ctx, bands->out);
+            int dpi = (int)(72 * session->profile.scale);
+            fz_write_header(ctx, bands->writer, width, height, 1, 0, dpi, dpi, page_num, fz_device_gray(ctx), nullptr);
+        }
+        fz_catch(ctx)
+        {
+            drop_band_renderer(bands);
+            const char *msg = fz_caught_message(ctx);
+            throw std::runtime_error(std::format("Failed to render page {}: {}", page_num, msg ? msg : "Unknown error"));
+        }
+    }
+
+    *width_buf = width;
+    *height_buf = height;
+    *stride_buf = format == OUTPUT_PACKED ? (int)packed_stride(width) : format == OUTPUT_RAW ? width : 0;
+    *band_handle = (PDFHandle)bands;
 }
 
-void clone_doc(const std::string &path, PDFHandle *ctx_handle, PDFHandle *new_doc)
+uint8_t *render_next_band(size_t *size_buf, int *y_buf, int *rows_buf, PDFHandle *band_handle)
 {
-    if (ctx_handle == nullptr || new_doc == nullptr)
+    if (!band_handle || !*band_handle)
     {
-        throw std::runtime_error("Passed a nullptr when trying to clone document!");
+        throw std::runtime_error("Invalid band handle");
     }
 
-    fz_context *ctx = (fz_context *)(*ctx_handle);
+    if (size_buf == nullptr || y_buf == nullptr || rows_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
 
-    // Open the document fresh for this thread
-    fz_document *doc = nullptr;
+    BandRenderer *bands = (BandRenderer *)(*band_handle);
+    fz_context *ctx = bands->ctx;
+
+    *y_buf = bands->next_y - bands->bbox.y0;
+    *rows_buf = 0;
+    *size_buf = 0;
+
+    if (bands->next_y >= bands->bbox.y1)
+    {
+        return nullptr;
+    }
+
+    int width = bands->bbox.x1 - bands->bbox.x0;
+    int rows = std::min(bands->band_height, bands->bbox.y1 - bands->next_y);
+    bool last = bands->next_y + rows >= bands->bbox.y1;
+    fz_irect band_box = fz_make_irect(bands->bbox.x0, bands->next_y, bands->bbox.x1, bands->next_y + rows);
+
+    fz_pixmap *pix = nullptr;
+    fz_device *dev = nullptr;
+    uint8_t *data = nullptr;
+
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(data);
+
+    begin_render(bands->control, bands->cookie, bands->page_num);
     fz_try(ctx)
     {
-        doc = fz_open_document(ctx, path.c_str());
-        if (!doc)
+        // The pixmap only wraps the reused band samples, so nothing page-sized is allocated.
+        pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_gray(ctx), band_box, nullptr, 0, bands->samples.data());
+        fz_clear_pixmap_with_value(ctx, pix, 255);
+
+        // The scissor rect skips display list nodes outside the band entirely.
+        dev = fz_new_draw_device_with_bbox(ctx, fz_identity, pix, &band_box);
+        fz_run_display_list(ctx, bands->list, dev, bands->ctm, fz_rect_from_irect(band_box), mupdf_cookie(bands->cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, bands->cookie);
+
+        if (bands->format == OUTPUT_PACKED)
         {
-            throw std::runtime_error("Failed to open document for cloning");
+            size_t stride = packed_stride(width);
+            pack_bits(bands->samples.data(), width, width, rows, bands->bytes.data(), stride, bands->threshold);
+            data = bands->bytes.data();
+            *size_buf = stride * (size_t)rows;
+        }
+        else if (bands->format == OUTPUT_RAW)
+        {
+            if (bands->thresholded)
+                threshold_in_place(bands->samples.data(), (size_t)width * (size_t)rows, bands->threshold);
+            data = bands->samples.data();
+            *size_buf = (size_t)width * (size_t)rows;
+        }
+        else
+        {
+            if (bands->thresholded)
+                threshold_in_place(bands->samples.data(), (size_t)width * (size_t)rows, bands->threshold);
+
+            // Hand out only what this band added to the PNG stream, the first band
+            // also carries the header written on open.
+            if (bands->next_y != bands->bbox.y0)
+                fz_clear_buffer(ctx, bands->buf);
+            fz_write_band(ctx, bands->writer, width, rows, bands->samples.data());
+            if (last)
+            {
+                fz_close_band_writer(ctx, bands->writer);
+                fz_close_output(ctx, bands->out);
+            }
+            *size_buf = fz_buffer_storage(ctx, bands->buf, &data);
         }
+    }
+    fz_always(ctx)
+    {
+        end_render(bands->control, bands->cookie);
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx)
+    {
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to render page {}: {}", bands->page_num, msg ? msg : "Unknown error"));
+    }
 
-        // Validate the document immediately
-        int test_pages = fz_count_pages(ctx, doc);
-        if (test_pages <= 0)
+    bands->next_y += rows;
+    *rows_buf = rows;
+    return data;
+}
+
+void close_band_renderer(PDFHandle *band_handle)
+{
+    if (!band_handle || !*band_handle)
+    {
+        return;
+    }
+
+    drop_band_renderer((BandRenderer *)(*band_handle));
+    *band_handle = nullptr;
+}
+
+uint8_t *load_page_text(int page_num, size_t *size_buf, int *block_count_buf, int *line_count_buf,
+                        PDFHandle *session_handle, PDFHandle *text_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        throw std::runtime_error("Invalid session handle");
+    }
+
+    if (size_buf == nullptr || block_count_buf == nullptr || line_count_buf == nullptr || text_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+    fz_context *ctx = session->ctx;
+    relieve_session(session);
+
+    if (page_num < 0 || page_num >= session->page_count)
+    {
+        throw std::runtime_error(std::format("Attempted to access page {} but document only has {} pages!", page_num, session->page_count));
+    }
+
+    fz_page *page = nullptr;
+    fz_stext_page *stext = nullptr;
+    fz_device *dev = nullptr;
+    PageText *page_text = new PageText();
+
+    fz_var(page);
+    fz_var(stext);
+    fz_var(dev);
+
+    // Run through the session's cookie like a render, so text extraction can be stopped and
+    // paused, and a page that isn't all there yet is ABORT_INCOMPLETE instead of a failure.
+    begin_render(session->control, &session->cookie, page_num);
+    fz_try(ctx)
+    {
+        page = fz_load_page(ctx, session->doc, page_num);
+
+        // Default options leave image blocks out, only text is extracted.
+        fz_stext_options options = {};
+        stext = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+        dev = fz_new_stext_device(ctx, stext, &options);
+        fz_run_page(ctx, page, dev, fz_identity, mupdf_cookie(&session->cookie));
+        fz_close_device(ctx, dev);
+        throw_if_aborted(ctx, &session->cookie);
+
+        char utf8[8];
+        for (fz_stext_block *block = stext->first_block; block; block = block->next)
         {
-            fz_drop_document(ctx, doc);
-            throw std::runtime_error("Document has no valid pages");
+            if (block->type != FZ_STEXT_BLOCK_TEXT)
+                continue;
+
+            int block_index = (int)(page_text->block_boxes.size() / 4);
+            push_rect(page_text->block_boxes, block->bbox);
+
+            for (fz_stext_line *line = block->u.t.first_line; line; line = line->next)
+            {
+                for (fz_stext_char *ch = line->first_char; ch; ch = ch->next)
+                {
+                    page_text->text.append(utf8, fz_runetochar(utf8, ch->c));
+                }
+
+                push_rect(page_text->line_boxes, line->bbox);
+                page_text->line_ends.push_back((int)page_text->text.size());
+                page_text->line_blocks.push_back(block_index);
+            }
         }
     }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        fz_drop_stext_page(ctx, stext);
+        if (page)
+            fz_drop_page(ctx, page);
+    }
     fz_catch(ctx)
     {
-        if (doc)
+        delete page_text;
+        note_incomplete(ctx, &session->cookie);
+        end_render(session->control, &session->cookie);
+        const char *msg = fz_caught_message(ctx);
+        throw std::runtime_error(std::format("Failed to extract text of page {}: {}", page_num, msg ? msg : "Unknown error"));
+    }
+    end_render(session->control, &session->cookie);
+
+    *size_buf = page_text->text.size();
+    *block_count_buf = (int)(page_text->block_boxes.size() / 4);
+    *line_count_buf = (int)page_text->line_ends.size();
+    *text_handle = (PDFHandle)page_text;
+
+    return (uint8_t *)page_text->text.data();
+}
+
+void read_page_text(float *block_boxes_buf, float *line_boxes_buf, int *line_ends_buf, int *line_blocks_buf,
+                    PDFHandle *text_handle)
+{
+    if (!text_handle || !*text_handle)
+    {
+        throw std::runtime_error("Invalid text handle");
+    }
+
+    if (block_boxes_buf == nullptr || line_boxes_buf == nullptr || line_ends_buf == nullptr || line_blocks_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    PageText *page_text = (PageText *)(*text_handle);
+
+    std::copy(page_text->block_boxes.begin(), page_text->block_boxes.end(), block_boxes_buf);
+    std::copy(page_text->line_boxes.begin(), page_text->line_boxes.end(), line_boxes_buf);
+    std::copy(page_text->line_ends.begin(), page_text->line_ends.end(), line_ends_buf);
+    std::copy(page_text->line_blocks.begin(), page_text->line_blocks.end(), line_blocks_buf);
+}
+
+void free_page_text(PDFHandle *text_handle)
+{
+    if (!text_handle || !*text_handle)
+    {
+        return;
+    }
+
+    delete (PageText *)(*text_handle);
+    *text_handle = nullptr;
+}
+
+void flush_session_cache(PDFHandle *session_handle)
+{
+    if (session_handle && *session_handle)
+    {
+        WorkerSession *session = (WorkerSession *)(*session_handle);
+        trim_arena(session->ctx, &session->arena);
+
+        // A shared store is bounded by the base context's budget, and emptying it
+        // would throw away warm fonts and glyphs for every other worker.
+        if (!session->shared_store)
         {
-            fz_drop_document(ctx, doc);
+            flush_cache((PDFHandle *)&session->ctx);
         }
-        throw std::runtime_error(std::format("Failed to clone document: {}", fz_caught_message(ctx)));
     }
+}
 
-    *new_doc = (PDFHandle)doc;
-}
\ No newline at end of file
+void close_session(PDFHandle *session_handle)
+{
+    if (!session_handle || !*session_handle)
+    {
+        return;
+    }
+
+    WorkerSession *session = (WorkerSession *)(*session_handle);
+
+    if (session->doc)
+    {
+        fz_try(session->ctx)
+        {
+            fz_drop_document(session->ctx, session->doc);
+        }
+        fz_catch(session->ctx)
+        {
+            // Closing runs from Drop with nobody to report to, and the session goes away either way.
+        }
+    }
+
+    trim_arena(session->ctx, &session->arena);
+    release_session_context(session->ctx, session->shared_store);
+    delete session;
+    *session_handle = nullptr;
+}
@@ -5,15 +5,318 @@
 
 typedef void *PDFHandle;
 
+// Output formats understood by render_session_image.
+enum OutputFormat : int
+{
+    OUTPUT_PNG = 0, // PNG encoded bytes.
+    OUTPUT_RAW = 1,    // Rendered samples, stride_buf bytes per row.
+    OUTPUT_PACKED = 2, // 1 bit per pixel, MSB first, set bits are black, stride_buf bytes per row.
+    OUTPUT_PBM = 3,    // Binary PBM (P4) file: OUTPUT_PACKED rows behind a "P4\n<width> <height>\n" header.
+    OUTPUT_G4 = 4,     // Bare CCITT Group 4 stream of the bilevel page, i.e. /K -1 /Columns width /BlackIs1 true.
+    OUTPUT_QOI = 5,    // QOI file of the bilevel page, 3 channels.
+};
+
+// Bits of flags_buf set by render_session_image.
+enum ImageFlags : int
+{
+    IMAGE_BLANK = 1,       // The page draws (next to) nothing. No bytes are returned, only its size.
+    IMAGE_CACHED = 2,      // The page was rendered before, the bytes come from the RenderCache.
+    IMAGE_PASSTHROUGH = 4, // The page is a scan, its image is handed out at its own resolution.
+};
+
+// How a session's pages are drawn and turned into samples, see new_render_profile.
+enum RenderMode : int
+{
+    MODE_BILEVEL = 0, // Drawn without anti-aliasing and thresholded to black and white in every format.
+    MODE_GRAY = 1,    // Drawn anti-aliased. OUTPUT_RAW, OUTPUT_PNG and OUTPUT_QOI keep the gray samples.
+};
+
+// What next_engine_page handed out.
+enum EngineStatus : int
+{
+    ENGINE_PAGE = 0,    // A finished page, or its error.
+    ENGINE_PENDING = 1, // Nothing finished within the timeout.
+    ENGINE_DONE = 2,    // Every worker is done and every page was handed out.
+};
+
+// Why a render was aborted, see new_render_control.
+enum AbortReason : int
+{
+    ABORT_NONE = 0,
+    ABORT_STOPPED = 1,    // halt_renders, the run was stopped.
+    ABORT_PAUSED = 2,     // halt_renders, the run was paused. The page is rendered again on resume.
+    ABORT_DEADLINE = 3,   // The render took longer than the control's page budget.
+    ABORT_CANCELLED = 4,  // cancel_page_renders, nothing wants the page right now.
+    ABORT_INCOMPLETE = 5, // The page needs bytes a progressive source hasn't received yet.
+};
+
+// Layout of the abort_buf filled for a failed render.
+enum AbortLayout : int
+{
+    ABORT_FIELD_REASON = 0,       // An AbortReason, ABORT_NONE when the render wasn't aborted.
+    ABORT_FIELD_PROGRESS = 1,     // fz_cookie progress when the render stopped.
+    ABORT_FIELD_PROGRESS_MAX = 2, // fz_cookie progress_max, SIZE_MAX when MuPDF didn't know it.
+    ABORT_FIELDS = 3,
+};
+
+// What init and prescan_document throw when they needed bytes a progressive source hasn't received
+// yet (FZ_ERROR_TRYLATER), so they can be tried again once more arrived. Anything else they throw
+// won't go away with more bytes.
+inline constexpr const char INCOMPLETE_DOCUMENT_ERROR[] = "The document hasn't arrived far enough to be read";
+
+// Stages of rendering a page, timed with set_session_stats.
+enum RenderStage : int
+{
+    STAGE_LOAD = 0,        // fz_load_page, or loading and recording the page into a display list.
+    STAGE_FINGERPRINT = 1, // Hashing the page for the RenderCache.
+    STAGE_PROBE = 2,       // Looking for ink on a low-res probe of the page.
+    STAGE_DRAW = 3,        // Rasterizing the page into a pixmap.
+    STAGE_THRESHOLD = 4,   // Thresholding or packing the samples.
+    STAGE_ENCODE = 5,      // PNG encoding.
+    STAGE_COPY = 6,        // Copying the result, e.g. into or out of the RenderCache.
+    STAGE_COUNT = 7,
+};
+
+// Layout of the buffers read_render_stats fills.
+enum StatsLayout : int
+{
+    STATS_BUCKETS = 40, // Log2 nanosecond buckets per stage, the last one is open ended.
+    STATS_TOTALS = 3,   // Pages, pixmap sample bytes and output bytes.
+};
+
+// Where documents are read from, see open_source.
+enum SourceMode : int
+{
+    SOURCE_FILE = 0,   // Every document opens the path itself.
+    SOURCE_MAPPED = 1, // The file is memory-mapped read-only once.
+    SOURCE_LOADED = 2, // The file is read into memory once.
+};
+
 // All arguments for the following functions that are a pointer to any type
 // Are just "buffers" for data. Since CXX is unbelievably annoying with structs and
 // other complex types, it's easier to just expect buffers.
 
-void init(const std::string &path, PDFHandle *doc_handle, PDFHandle *ctx_handle, int *pages_buf);
+// Caps what MuPDF may allocate across every context of the process, 0 for no cap. Going over
+// it makes MuPDF evict from the allocating context's store and asks every other worker to shrink
+// its store between pages, rather than failing renders; see governor.h.
+void set_memory_cap(size_t cap_bytes);
+// Live, peak and cap bytes for the whole process, and live and peak bytes for every context
+// (counting its fz_clone_context children) for up to capacity contexts. Returns how many
+// contexts there are, which may be more than capacity.
+int memory_usage(size_t *live_buf, size_t *peak_buf, size_t *cap_buf, size_t *context_live_buf,
+                 size_t *context_peak_buf, int capacity);
+
+// Deflate level (0 stores, 1 to 9 as zlib) of every OUTPUT_PNG page of the process, which are then
+// written as 1 bit grayscale. -1, the default, keeps MuPDF's 8 bit PNG writer at its default level.
+// Banded PNGs, and pages of MODE_GRAY sessions, always use MuPDF's writer.
+void set_png_level(int level);
+
+// Bit (1 << FZ_LOCK_*) per MuPDF lock slot that uses an adaptive spin-then-park lock instead of
+// std::mutex, meant for hot slots like FZ_LOCK_ALLOC and FZ_LOCK_FREETYPE. Can only be changed
+// before the first document is opened, throws after.
+void set_adaptive_locks(int slot_mask);
+// Per lock slot, every FZ_LOCK_* followed by context creation: how often it was taken, how often
+// that meant waiting, and the nanoseconds spent waiting, for up to capacity slots. Returns the
+// number of slots.
+int lock_stats(uint64_t *acquisitions_buf, uint64_t *contended_buf, uint64_t *wait_ns_buf, int capacity);
+void reset_lock_stats();
+
+// Reads the file at path once (SOURCE_MAPPED or SOURCE_LOADED), so init and every worker session
+// can open their document over the same read-only bytes instead of each opening the file.
+// Close it only after every document opened from it was dropped.
+void open_source(const std::string &path, int mode, PDFHandle *source_handle, size_t *size_buf);
+void close_source(PDFHandle *source_handle);
+
+// A source for a file of size bytes that is still arriving, e.g. downloaded from object storage in
+// byte ranges, filled through feed_source. init and sessions open documents over it like over any
+// source. MuPDF reads what has arrived, and a render that needs bytes that haven't fails with
+// ABORT_INCOMPLETE, see last_render_abort, to be rendered again once more arrived. Linearized files
+// open as soon as their first page is in, and their pages arrive in order.
+void open_progressive_source(uint64_t size, PDFHandle *source_handle);
+// Copies size bytes of the file at offset into the source. Ranges may arrive in any order and overlap.
+void feed_source(uint64_t offset, const uint8_t *data, size_t size, PDFHandle *source_handle);
+// Waits up to timeout_ms for the source to have more than seen bytes, and sets received_buf to how
+// many it has. Returns whether the source still expects bytes.
+bool wait_source(uint64_t seen, int timeout_ms, uint64_t *received_buf, PDFHandle *source_handle);
+// The lowest offset a read of the source was turned away at since the last call, UINT64_MAX for
+// none. Where fetching should go on.
+uint64_t take_source_wanted(PDFHandle *source_handle);
+// The rest of the file won't arrive, so reads of what's missing fail for good instead of with
+// ABORT_INCOMPLETE.
+void abandon_source(PDFHandle *source_handle);
+
+// source_handle may point to a null handle, in which case the document is opened from path.
+void init(const std::string &path, PDFHandle *source_handle, PDFHandle *doc_handle, PDFHandle *ctx_handle, int *pages_buf);
 uint8_t *render_page(int page_num, size_t *size_buf, int *width_buf, int *height_buf,
                      int *channels_buf, PDFHandle *doc_handle, PDFHandle *ctx_handle);
 void free_image_data(uint8_t *data);
 void cleanup_pdf(PDFHandle *doc_handle, PDFHandle *ctx_handle);
 void flush_cache(PDFHandle *ctx_handle);
 void clone(PDFHandle *current_ctx, PDFHandle *new_ctx);
-void clone_doc(const std::string &path, PDFHandle *ctx_handle, PDFHandle *new_doc);
\ No newline at end of file
+void clone_doc(const std::string &path, PDFHandle *ctx_handle, PDFHandle *new_doc);
+
+// Reads what can be known about every page without rendering it: bounds (4 floats per page,
+// x0 y0 x1 y1 in points), /Rotate, the number of image and font resources, and whether the
+// page's content (or a form it uses) starts a text object. Each buffer holds page_count entries.
+// Only walks the page objects and content bytes, nothing is interpreted or rasterized.
+void prescan_document(int page_count, float *bounds_buf, int *rotation_buf, int *images_buf, int *fonts_buf,
+                      uint8_t *text_buf, PDFHandle *doc_handle, PDFHandle *ctx_handle);
+// Clones the base context with fz_clone_context, so the new context shares the base
+// context's store, glyph cache and memory budget. Release it with fz_drop_context semantics
+// (close_session), never through the context pool.
+void clone_shared(PDFHandle *current_ctx, PDFHandle *new_ctx);
+
+// Worker sessions keep one context and one opened document alive for every page a worker
+// renders. The page count is cached on open, so rendering skips fz_count_pages entirely.
+// With share_store set, the session context is a clone of ctx_handle sharing its store.
+// With a source, the document is opened over its shared bytes instead of from path.
+void open_session(const std::string &path, bool share_store, PDFHandle *ctx_handle, PDFHandle *source_handle,
+                  PDFHandle *session_handle, int *pages_buf);
+uint8_t *render_session_page(int page_num, size_t *size_buf, int *width_buf, int *height_buf,
+                             int *channels_buf, PDFHandle *session_handle);
+// Renders a page in the given OutputFormat without copying. The returned bytes are owned by
+// *image_handle and stay valid until free_page_image, which must be called before the
+// session is used by another thread.
+// With blank_ratio >= 0, pages with an empty display list, or where at most blank_ratio of a
+// low-res probe is ink, are reported as IMAGE_BLANK instead of rendered. With a cache_handle
+// (may point to a null handle), pages are looked up first and hits come from the cache.
+// With passthrough, a page that only draws one upright image covering it, plus invisible OCR text at
+// most, is handed out at the image's own resolution as IMAGE_PASSTHROUGH instead of rendered. For
+// OUTPUT_G4 the image's CCITT G4 stream is handed out as is when it already is one.
+uint8_t *render_session_image(int page_num, int format, float blank_ratio, bool passthrough, size_t *size_buf,
+                              int *width_buf, int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf,
+                              PDFHandle *session_handle, PDFHandle *cache_handle, PDFHandle *image_handle);
+void free_page_image(PDFHandle *image_handle);
+
+// Renders count pages back to back on one session at the given scale (1.0 = 72 DPI), so
+// per-page setup and FFI round trips are paid once per batch. batch_page hands out entry
+// index and throws that page's error if it failed, without failing the rest of the batch,
+// filling abort_buf as last_render_abort does.
+// Pages are looked up in cache_handle (may point to a null handle) first.
+// Every image stays alive until free_page_batch, which must be called before the session
+// is used by another thread.
+void render_pages(const int *pages, int count, int format, float scale, PDFHandle *session_handle,
+                  PDFHandle *cache_handle, PDFHandle *batch_handle);
+uint8_t *batch_page(int index, int *page_buf, size_t *size_buf, int *width_buf, int *height_buf, int *channels_buf,
+                    int *stride_buf, uint64_t *abort_buf, PDFHandle *batch_handle);
+void free_page_batch(PDFHandle *batch_handle);
+
+// A cache of rendered pages shared by every session of the document at path, holding at most
+// budget bytes in memory and, unless dir is empty, the pages it sees in a directory under dir
+// named after the document's MD5, with at most disk_budget bytes under dir (0 for no limit).
+// Either tier may be left out, see cache.h.
+void new_render_cache(size_t budget, const std::string &dir, uint64_t disk_budget, const std::string &path,
+                      PDFHandle *cache_handle);
+void free_render_cache(PDFHandle *cache_handle);
+
+// Stage timings and byte counts of every page rendered by the sessions timing into it, see
+// set_session_stats. read_render_stats copies out per stage histograms (buckets_buf holds
+// STATS_BUCKETS counts for each of the STAGE_COUNT stages, bucket i counting pages where a stage
+// took [2^i, 2^(i+1)) ns), how many pages went through each stage and the total and slowest
+// time they spent there, followed by STATS_TOTALS totals in totals_buf.
+void new_render_stats(PDFHandle *stats_handle);
+void read_render_stats(uint64_t *buckets_buf, uint64_t *counts_buf, uint64_t *total_ns_buf, uint64_t *max_ns_buf,
+                       uint64_t *totals_buf, PDFHandle *stats_handle);
+void free_render_stats(PDFHandle *stats_handle);
+// Times every page the session renders into stats_handle, which must outlive the session.
+// With a null handle the session stops timing, so timing costs nothing unless asked for.
+void set_session_stats(PDFHandle *stats_handle, PDFHandle *session_handle);
+// Copies the STAGE_COUNT stage timings of a timed image into stage_ns_buf. Returns false,
+// leaving the buffers alone, when the image's session wasn't timing.
+bool page_image_stats(uint64_t *stage_ns_buf, size_t *sample_bytes_buf, size_t *output_bytes_buf,
+                      PDFHandle *image_handle);
+
+// Aborts renders in flight on the sessions sharing it through their fz_cookie, so a stopped or
+// paused run doesn't wait for a page that takes minutes to draw. With a page_budget_ns above 0
+// a watchdog thread also aborts every page (every call, for bands) that takes longer than that.
+// Implemented in cookie.cpp.
+void new_render_control(uint64_t page_budget_ns, PDFHandle *control_handle);
+void free_render_control(PDFHandle *control_handle);
+// Aborts every render in flight with reason (ABORT_STOPPED or ABORT_PAUSED), and every
+// render started until resume_renders. A stop isn't turned back into a pause.
+void halt_renders(int reason, PDFHandle *control_handle);
+void resume_renders(PDFHandle *control_handle);
+// Aborts the renders in flight of count pages from first_page with ABORT_CANCELLED. Unlike
+// halt_renders, later renders of those pages go ahead.
+void cancel_page_renders(int first_page, int count, PDFHandle *control_handle);
+// Makes the session's renders abortable through control_handle, which must outlive the session.
+void set_session_control(PDFHandle *control_handle, PDFHandle *session_handle);
+// The scale (1.0 is 72 DPI), threshold (0 to 255) and RenderMode pages are rendered with. Sessions
+// start out at 432 DPI in MODE_BILEVEL with a threshold of 128. Scale and threshold are plain
+// values, while the mode picks which instantiation of the drawing and encoding kernels a page takes.
+void new_render_profile(int mode, float scale, int threshold, PDFHandle *profile_handle);
+void free_render_profile(PDFHandle *profile_handle);
+// Renders the session's pages with a copy of profile_handle's profile, or the default one with a
+// null handle. Also sets the anti-aliasing of the session's context to the one of the profile's mode.
+void set_session_profile(PDFHandle *profile_handle, PDFHandle *session_handle);
+// Fills ABORT_FIELDS entries of abort_buf, see AbortLayout, for the last render on the session.
+// Meant for after a render threw, to tell an aborted page from a broken one and how far it got.
+void last_render_abort(uint64_t *abort_buf, PDFHandle *session_handle);
+
+// A native render engine: a fixed set of worker threads (pinned to cores with pin_threads), each
+// owning one session for its whole life. Every worker starts on a contiguous run of pages and
+// idle workers steal the upper half of the busiest worker's run. Finished pages go into a lock-free
+// completion queue of queue_depth entries that next_engine_page polls, waiting up to timeout_ms;
+// workers wait for a free entry before rendering, so results never outrun their consumer.
+// With a prefetch_depth above 0 every worker also gets a loader thread that loads and records up to
+// that many of its pages ahead, so the worker only draws. Workers render with profile_handle's
+// profile, time their pages into stats_handle and can be aborted through control_handle when they
+// point to a handle, see set_session_profile, set_session_stats and set_session_control. A page aborted by a pause is rendered again once the engine resumes, and
+// one aborted with ABORT_INCOMPLETE once its progressive source has received more.
+// Images are handed out as by render_session_image, but free_page_image may be called from any
+// thread: the image goes back to its worker, which drops it before its next page. Every image must
+// be freed before free_render_engine, which stops and joins the workers and closes their sessions.
+void start_render_engine(const std::string &path, int workers, bool pin_threads, bool share_store, int format,
+                         float blank_ratio, bool passthrough, int queue_depth, int prefetch_depth,
+                         PDFHandle *ctx_handle, PDFHandle *source_handle, PDFHandle *cache_handle,
+                         PDFHandle *profile_handle, PDFHandle *stats_handle, PDFHandle *control_handle,
+                         PDFHandle *engine_handle, int *pages_buf);
+// Sets status_buf to an EngineStatus. For a failed page, page_buf and abort_buf (see AbortLayout)
+// are set and its error is thrown.
+uint8_t *next_engine_page(int timeout_ms, int *status_buf, int *page_buf, size_t *size_buf, int *width_buf,
+                          int *height_buf, int *channels_buf, int *stride_buf, int *flags_buf, uint64_t *abort_buf,
+                          PDFHandle *engine_handle, PDFHandle *image_handle);
+// Paused workers finish the page they are on and wait, unless it's aborted through their control.
+void pause_render_engine(bool paused, PDFHandle *engine_handle);
+// Workers finish the page they are on and exit. Pages already queued can still be taken.
+void stop_render_engine(PDFHandle *engine_handle);
+void free_render_engine(PDFHandle *engine_handle);
+
+// Records a page into a display list once, so it can be rasterized at several scales (e.g. a
+// low-DPI thumbnail to classify, then the full-resolution image to extract) without interpreting
+// the content stream again. The list belongs to the session and must be freed before the session
+// is used by another thread. bounds_buf gets the page's bounds in points as x0, y0, x1, y1.
+void load_display_list(int page_num, float *bounds_buf, PDFHandle *session_handle, PDFHandle *list_handle);
+uint8_t *render_display_list(float scale, int format, size_t *size_buf, int *width_buf, int *height_buf,
+                             int *channels_buf, int *stride_buf, PDFHandle *list_handle, PDFHandle *image_handle);
+// Renders only the part of the page inside rect_buf (x0, y0, x1, y1 in points) at scale through a
+// clipped draw device, skipping every node of the list outside it, e.g. the header band a
+// classifier looks at. Throws if the rect doesn't cover any of the page.
+uint8_t *render_display_list_region(const float *rect_buf, float scale, int format, size_t *size_buf,
+                                    int *width_buf, int *height_buf, int *channels_buf, int *stride_buf,
+                                    PDFHandle *list_handle, PDFHandle *image_handle);
+void free_display_list(PDFHandle *list_handle);
+
+// Draws a page at the session's scale in horizontal bands of band_height rows, so peak pixel memory
+// is bounded by the band rather than the page. Each render_next_band call draws, thresholds (unless
+// the session is in MODE_GRAY and the format keeps gray samples) and returns the next band in the
+// given OutputFormat: its rows for OUTPUT_RAW/OUTPUT_PACKED, or the bytes it added to the page's
+// PNG stream for OUTPUT_PNG. The bytes stay valid until the next call. Returns nullptr with
+// rows_buf set to 0 once the page is done. The renderer belongs to the session and must be closed
+// before the session is used by another thread.
+void open_band_renderer(int page_num, int band_height, int format, int *width_buf, int *height_buf, int *stride_buf,
+                        PDFHandle *session_handle, PDFHandle *band_handle);
+uint8_t *render_next_band(size_t *size_buf, int *y_buf, int *rows_buf, PDFHandle *band_handle);
+void close_band_renderer(PDFHandle *band_handle);
+
+// Extracts a page's text layer with fz_new_stext_page_from_page, without rasterizing anything.
+// Returns every line's UTF-8 text back to back, owned by *text_handle. read_page_text then copies
+// out block_count_buf block boxes and line_count_buf line boxes (4 floats each, in points), the
+// end offset of each line's text and the block each line belongs to.
+uint8_t *load_page_text(int page_num, size_t *size_buf, int *block_count_buf, int *line_count_buf,
+                        PDFHandle *session_handle, PDFHandle *text_handle);
+void read_page_text(float *block_boxes_buf, float *line_boxes_buf, int *line_ends_buf, int *line_blocks_buf,
+                    PDFHandle *text_handle);
+void free_page_text(PDFHandle *text_handle);
+void flush_session_cache(PDFHandle *session_handle);
+void close_session(PDFHandle *session_handle);
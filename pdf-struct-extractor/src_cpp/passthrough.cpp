@@ -0,0 +1,132 @@
+#include "passthrough.h"
+
+#include <cmath>
+
+// How far, in points, the image's edges may be off the page's and still count as covering it.
+static constexpr float COVER_SLACK = 1.0f;
+
+// Device find_page_image runs a page's display list through. fz_new_derived_device zeroes it.
+struct ScanDevice
+{
+    fz_device super;
+    fz_image *image;
+    fz_matrix ctm;
+    bool rejected;
+};
+
+// Anything but the scan itself, whatever callback it's set as.
+template <typename... Args>
+static void reject_content(fz_context *, fz_device *dev, Args...)
+{
+    ((ScanDevice *)dev)->rejected = true;
+}
+
+static void scan_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, fz_matrix ctm, float alpha,
+                            fz_color_params)
+{
+    ScanDevice *scan = (ScanDevice *)dev;
+
+    if (scan->image || alpha < 1.0f || image->mask || image->use_colorkey)
+    {
+        scan->rejected = true;
+        return;
+    }
+
+    scan->image = fz_keep_image(ctx, image);
+    scan->ctm = ctm;
+}
+
+static void scan_ignore_text(fz_context *, fz_device *, const fz_text *, fz_matrix)
+{
+}
+
+static void drop_scan_device(fz_context *ctx, fz_device *dev)
+{
+    fz_drop_image(ctx, ((ScanDevice *)dev)->image);
+}
+
+static bool covers_page(fz_matrix ctm, fz_rect bounds)
+{
+    if (ctm.b != 0.0f || ctm.c != 0.0f || ctm.a <= 0.0f || ctm.d <= 0.0f)
+        return false;
+
+    fz_rect rect = fz_transform_rect(fz_unit_rect, ctm);
+    return std::fabs(rect.x0 - bounds.x0) <= COVER_SLACK && std::fabs(rect.y0 - bounds.y0) <= COVER_SLACK &&
+           std::fabs(rect.x1 - bounds.x1) <= COVER_SLACK && std::fabs(rect.y1 - bounds.y1) <= COVER_SLACK;
+}
+
+fz_image *find_page_image(fz_context *ctx, fz_display_list *list, fz_rect bounds, RenderCookie *cookie)
+{
+    ScanDevice *dev = fz_new_derived_device(ctx, ScanDevice);
+    fz_image *image = nullptr;
+
+    dev->super.drop_device = drop_scan_device;
+    dev->super.fill_image = scan_fill_image;
+    dev->super.ignore_text = scan_ignore_text;
+    dev->super.fill_path = reject_content;
+    dev->super.stroke_path = reject_content;
+    dev->super.clip_path = reject_content;
+    dev->super.clip_stroke_path = reject_content;
+    dev->super.fill_text = reject_content;
+    dev->super.stroke_text = reject_content;
+    dev->super.clip_text = reject_content;
+    dev->super.clip_stroke_text = reject_content;
+    dev->super.fill_shade = reject_content;
+    dev->super.fill_image_mask = reject_content;
+    dev->super.clip_image_mask = reject_content;
+    dev->super.begin_mask = reject_content;
+    dev->super.begin_group = reject_content;
+
+    fz_var(image);
+
+    fz_try(ctx)
+    {
+        fz_run_display_list(ctx, list, &dev->super, fz_identity, fz_infinite_rect, mupdf_cookie(cookie));
+        fz_close_device(ctx, &dev->super);
+        throw_if_aborted(ctx, cookie);
+
+        if (dev->image && !dev->rejected && covers_page(dev->ctm, bounds))
+        {
+            image = dev->image;
+            dev->image = nullptr;
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, &dev->super);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+
+    return image;
+}
+
+fz_buffer *original_g4_stream(fz_context *ctx, fz_image *image)
+{
+    if (image->bpc != 1 || image->n != 1 || image->imagemask || image->mask || image->use_colorkey ||
+        !image->colorspace || !fz_colorspace_is_gray(ctx, image->colorspace))
+    {
+        return nullptr;
+    }
+
+    fz_compressed_buffer *compressed = fz_compressed_image_buffer(ctx, image);
+    if (!compressed || !compressed->buffer || compressed->params.type != FZ_IMAGE_FAX)
+        return nullptr;
+
+    const auto &fax = compressed->params.u.fax;
+    if (fax.k >= 0 || fax.columns != image->w || (fax.rows != 0 && fax.rows != image->h) ||
+        fax.encoded_byte_align || fax.end_of_line)
+    {
+        return nullptr;
+    }
+
+    // The stream codes runs as black or white whatever BlackIs1 says, BlackIs1 and the image's
+    // Decode array only decide which of the two shows up black on the page.
+    bool inverted = image->decode[0] > image->decode[1];
+    if ((fax.black_is_1 != 0) != inverted)
+        return nullptr;
+
+    return fz_keep_buffer(ctx, compressed->buffer);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "cookie.h"
+
+#include <mupdf/fitz.h>
+
+// The one image a scanned page draws, kept, or nullptr when list draws anything else: another
+// image, paths, visible text, clips, masks or groups. Invisible text, as OCR layers are drawn, is
+// fine. The image has to be upright and cover bounds, so it is the whole page at its own resolution.
+// Runs inside the caller's fz_try, errors are thrown with fz_throw semantics.
+fz_image *find_page_image(fz_context *ctx, fz_display_list *list, fz_rect bounds, RenderCookie *cookie);
+
+// The image's own CCITT Group 4 stream, kept, when it can be handed out as an OUTPUT_G4 stream
+// without decoding it: opaque bilevel gray, image width columns, unaligned rows and black where
+// the stream codes black. nullptr otherwise.
+fz_buffer *original_g4_stream(fz_context *ctx, fz_image *image);
@@ -0,0 +1,381 @@
+#include <mupdf/fitz.h>
+#include <mupdf/pdf.h>
+#include <stdexcept>
+#include <format>
+#include <cstring>
+#include "main.h"
+#include "prescan.h"
+
+// What a page's resources say about it, gathered without running its content stream.
+struct PageResources
+{
+    int images = 0;
+    int fonts = 0;
+    bool has_text = false;
+};
+
+static bool is_pdf_delimiter(unsigned char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0' ||
+           c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' ||
+           c == '{' || c == '}' || c == '/' || c == '%';
+}
+
+// Looks for a BT (begin text object) operator, which every text-showing operator
+// has to be wrapped in, without tokenizing the whole stream.
+static bool has_text_operator(const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (data[i] == 'B' && data[i + 1] == 'T' &&
+            (i == 0 || is_pdf_delimiter(data[i - 1])) &&
+            (i + 2 == len || is_pdf_delimiter(data[i + 2])))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool stream_has_text(fz_context *ctx, pdf_obj *stream)
+{
+    if (!pdf_is_stream(ctx, stream))
+    {
+        return false;
+    }
+
+    fz_buffer *buf = pdf_load_stream(ctx, stream);
+    bool found = false;
+
+    fz_try(ctx)
+    {
+        unsigned char *data = nullptr;
+        size_t len = fz_buffer_storage(ctx, buf, &data);
+        found = has_text_operator(data, len);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_buffer(ctx, buf);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+
+    return found;
+}
+
+static bool contents_have_text(fz_context *ctx, pdf_obj *contents)
+{
+    if (pdf_is_array(ctx, contents))
+    {
+        int count = pdf_array_len(ctx, contents);
+        for (int i = 0; i < count; i++)
+        {
+            if (stream_has_text(ctx, pdf_array_get(ctx, contents, i)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return stream_has_text(ctx, contents);
+}
+
+// Counts the images and fonts a resource dictionary makes available, descending into
+// form XObjects. Marking guards against forms that (indirectly) reference themselves.
+static void scan_resources(fz_context *ctx, pdf_obj *resources, PageResources *out)
+{
+    if (!pdf_is_dict(ctx, resources) || pdf_mark_obj(ctx, resources))
+    {
+        return;
+    }
+
+    fz_try(ctx)
+    {
+        pdf_obj *fonts = pdf_dict_get(ctx, resources, PDF_NAME(Font));
+        if (pdf_is_dict(ctx, fonts))
+        {
+            out->fonts += pdf_dict_len(ctx, fonts);
+        }
+
+        pdf_obj *xobjects = pdf_dict_get(ctx, resources, PDF_NAME(XObject));
+        int count = pdf_is_dict(ctx, xobjects) ? pdf_dict_len(ctx, xobjects) : 0;
+        for (int i = 0; i < count; i++)
+        {
+            pdf_obj *xobject = pdf_dict_get_val(ctx, xobjects, i);
+            pdf_obj *subtype = pdf_dict_get(ctx, xobject, PDF_NAME(Subtype));
+
+            if (pdf_name_eq(ctx, subtype, PDF_NAME(Image)))
+            {
+                out->images++;
+            }
+            else if (pdf_name_eq(ctx, subtype, PDF_NAME(Form)))
+            {
+                if (!out->has_text)
+                {
+                    out->has_text = stream_has_text(ctx, xobject);
+                }
+                scan_resources(ctx, pdf_dict_get(ctx, xobject, PDF_NAME(Resources)), out);
+            }
+        }
+    }
+    fz_always(ctx)
+    {
+        pdf_unmark_obj(ctx, resources);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+void prescan_document(int page_count, float *bounds_buf, int *rotation_buf, int *images_buf, int *fonts_buf,
+                      uint8_t *text_buf, PDFHandle *doc_handle, PDFHandle *ctx_handle)
+{
+    if (!ctx_handle || !*ctx_handle || !doc_handle || !*doc_handle)
+    {
+        throw std::runtime_error("Invalid context handle");
+    }
+
+    if (bounds_buf == nullptr || rotation_buf == nullptr || images_buf == nullptr || fonts_buf == nullptr ||
+        text_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    fz_context *ctx = (fz_context *)(*ctx_handle);
+    fz_document *doc = (fz_document *)(*doc_handle);
+    pdf_document *pdf = pdf_document_from_fz_document(ctx, doc);
+
+    for (int page_num = 0; page_num < page_count; page_num++)
+    {
+        fz_page *page = nullptr;
+        PageResources resources;
+        fz_rect bounds = fz_empty_rect;
+        int rotation = 0;
+
+        fz_var(page);
+
+        fz_try(ctx)
+        {
+            page = fz_load_page(ctx, doc, page_num);
+            bounds = fz_bound_page(ctx, page);
+
+            // Other formats don't carry any of this, they only get their bounds.
+            pdf_page *ppage = pdf ? pdf_page_from_fz_page(ctx, page) : nullptr;
+            if (ppage)
+            {
+                pdf_obj *page_obj = pdf_lookup_page_obj(ctx, pdf, page_num);
+                rotation = pdf_to_int(ctx, pdf_dict_get_inheritable(ctx, page_obj, PDF_NAME(Rotate)));
+                // Snapped to a quarter turn like MuPDF does when it loads the page.
+                rotation = ((rotation % 360) + 360) % 360;
+                rotation = 90 * ((rotation + 45) / 90) % 360;
+
+                resources.has_text = contents_have_text(ctx, pdf_page_contents(ctx, ppage));
+                scan_resources(ctx, pdf_page_resources(ctx, ppage), &resources);
+            }
+        }
+        fz_always(ctx)
+        {
+            if (page)
+                fz_drop_page(ctx, page);
+        }
+        fz_catch(ctx)
+        {
+            if (fz_caught(ctx) == FZ_ERROR_TRYLATER)
+                throw std::runtime_error(INCOMPLETE_DOCUMENT_ERROR);
+
+            const char *msg = fz_caught_message(ctx);
+            throw std::runtime_error(std::format("Failed to prescan page {}: {}", page_num, msg ? msg : "Unknown error"));
+        }
+
+        bounds_buf[page_num * 4 + 0] = bounds.x0;
+        bounds_buf[page_num * 4 + 1] = bounds.y0;
+        bounds_buf[page_num * 4 + 2] = bounds.x1;
+        bounds_buf[page_num * 4 + 3] = bounds.y1;
+        rotation_buf[page_num] = rotation;
+        images_buf[page_num] = resources.images;
+        fonts_buf[page_num] = resources.fonts;
+        text_buf[page_num] = resources.has_text ? 1 : 0;
+    }
+}
+
+static void hash_int(fz_md5 *md5, int value)
+{
+    fz_md5_update(md5, (const unsigned char *)&value, sizeof(value));
+}
+
+static void hash_string(fz_md5 *md5, const char *value)
+{
+    fz_md5_update(md5, (const unsigned char *)value, strlen(value) + 1);
+}
+
+// Hashes a resource object by what it refers to: indirect objects by their number,
+// since two pages using the same font or image share the object, direct ones by value.
+static void hash_resource(fz_context *ctx, fz_md5 *md5, pdf_obj *obj, int depth)
+{
+    if (pdf_is_indirect(ctx, obj))
+    {
+        hash_string(md5, "R");
+        hash_int(md5, pdf_to_num(ctx, obj));
+    }
+    else if (pdf_is_name(ctx, obj))
+    {
+        hash_string(md5, "/");
+        hash_string(md5, pdf_to_name(ctx, obj));
+    }
+    else if (pdf_is_number(ctx, obj))
+    {
+        float value = pdf_to_real(ctx, obj);
+        fz_md5_update(md5, (const unsigned char *)&value, sizeof(value));
+    }
+    else if (pdf_is_string(ctx, obj))
+    {
+        size_t len = pdf_to_str_len(ctx, obj);
+        hash_string(md5, "(");
+        hash_int(md5, (int)len);
+        fz_md5_update(md5, (const unsigned char *)pdf_to_str_buf(ctx, obj), len);
+    }
+    else if (pdf_is_bool(ctx, obj))
+    {
+        hash_string(md5, pdf_to_bool(ctx, obj) ? "true" : "false");
+    }
+    else if (depth > 0 && pdf_is_array(ctx, obj))
+    {
+        int count = pdf_array_len(ctx, obj);
+        hash_string(md5, "[");
+        for (int i = 0; i < count; i++)
+        {
+            hash_resource(ctx, md5, pdf_array_get(ctx, obj, i), depth - 1);
+        }
+    }
+    else if (depth > 0 && pdf_is_dict(ctx, obj))
+    {
+        int count = pdf_dict_len(ctx, obj);
+        hash_string(md5, "<<");
+        for (int i = 0; i < count; i++)
+        {
+            hash_resource(ctx, md5, pdf_dict_get_key(ctx, obj, i), depth - 1);
+            hash_resource(ctx, md5, pdf_dict_get_val(ctx, obj, i), depth - 1);
+        }
+    }
+}
+
+// Hashes an annotation by the entries that decide how it's drawn. Its appearance streams are
+// indirect, so they hash by number like resources do, and the field values an appearance is
+// generated from are looked up through the field's parents. The links back to the page, the
+// field and other annotations differ on every page without changing how it looks.
+static void hash_annot(fz_context *ctx, fz_md5 *md5, pdf_obj *annot)
+{
+    int count = pdf_dict_len(ctx, annot);
+    hash_string(md5, "annot");
+    for (int i = 0; i < count; i++)
+    {
+        pdf_obj *key = pdf_dict_get_key(ctx, annot, i);
+        if (pdf_name_eq(ctx, key, PDF_NAME(P)) || pdf_name_eq(ctx, key, PDF_NAME(Parent)) ||
+            pdf_name_eq(ctx, key, PDF_NAME(Popup)) || pdf_name_eq(ctx, key, PDF_NAME(IRT)) ||
+            pdf_name_eq(ctx, key, PDF_NAME(NM)) || pdf_name_eq(ctx, key, PDF_NAME(M)))
+        {
+            continue;
+        }
+
+        hash_resource(ctx, md5, key, 0);
+        hash_resource(ctx, md5, pdf_dict_get_val(ctx, annot, i), 2);
+    }
+
+    hash_resource(ctx, md5, pdf_dict_get_inheritable(ctx, annot, PDF_NAME(FT)), 0);
+    hash_resource(ctx, md5, pdf_dict_get_inheritable(ctx, annot, PDF_NAME(Ff)), 0);
+    hash_resource(ctx, md5, pdf_dict_get_inheritable(ctx, annot, PDF_NAME(V)), 1);
+    hash_resource(ctx, md5, pdf_dict_get_inheritable(ctx, annot, PDF_NAME(DA)), 0);
+}
+
+static void hash_stream(fz_context *ctx, fz_md5 *md5, pdf_obj *stream)
+{
+    if (!pdf_is_stream(ctx, stream))
+    {
+        return;
+    }
+
+    // Raw bytes are enough to tell pages apart and skip decompressing the stream.
+    fz_buffer *buf = pdf_load_raw_stream(ctx, stream);
+
+    fz_try(ctx)
+    {
+        unsigned char *data = nullptr;
+        size_t len = fz_buffer_storage(ctx, buf, &data);
+        hash_int(md5, (int)len);
+        fz_md5_update(md5, data, len);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_buffer(ctx, buf);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+bool fingerprint_page(fz_context *ctx, fz_document *doc, int page_num, unsigned char digest[16])
+{
+    pdf_document *pdf = pdf_document_from_fz_document(ctx, doc);
+    if (!pdf)
+    {
+        return false;
+    }
+
+    bool hashed = false;
+    fz_md5 md5;
+    fz_md5_init(&md5);
+
+    fz_try(ctx)
+    {
+        pdf_obj *page_obj = pdf_lookup_page_obj(ctx, pdf, page_num);
+
+        // Everything that decides what the page looks like: its boxes, rotation, scale,
+        // transparency group, content, the resources the content draws with and the
+        // annotations drawn over it.
+        hash_resource(ctx, &md5, pdf_dict_get_inheritable(ctx, page_obj, PDF_NAME(MediaBox)), 1);
+        hash_resource(ctx, &md5, pdf_dict_get_inheritable(ctx, page_obj, PDF_NAME(CropBox)), 1);
+        hash_int(&md5, pdf_to_int(ctx, pdf_dict_get_inheritable(ctx, page_obj, PDF_NAME(Rotate))));
+        hash_resource(ctx, &md5, pdf_dict_get(ctx, page_obj, PDF_NAME(UserUnit)), 0);
+        hash_resource(ctx, &md5, pdf_dict_get(ctx, page_obj, PDF_NAME(Group)), 2);
+
+        pdf_obj *contents = pdf_dict_get(ctx, page_obj, PDF_NAME(Contents));
+        if (pdf_is_array(ctx, contents))
+        {
+            int count = pdf_array_len(ctx, contents);
+            for (int i = 0; i < count; i++)
+            {
+                hash_stream(ctx, &md5, pdf_array_get(ctx, contents, i));
+            }
+        }
+        else
+        {
+            hash_stream(ctx, &md5, contents);
+        }
+
+        hash_resource(ctx, &md5, pdf_dict_get_inheritable(ctx, page_obj, PDF_NAME(Resources)), 3);
+
+        pdf_obj *annots = pdf_dict_get(ctx, page_obj, PDF_NAME(Annots));
+        int annot_count = pdf_array_len(ctx, annots);
+        for (int i = 0; i < annot_count; i++)
+        {
+            hash_annot(ctx, &md5, pdf_array_get(ctx, annots, i));
+        }
+        hashed = true;
+    }
+    fz_catch(ctx)
+    {
+        // A page that can't be fingerprinted is simply rendered.
+        hashed = false;
+    }
+
+    if (hashed)
+    {
+        fz_md5_final(&md5, digest);
+    }
+    return hashed;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <mupdf/fitz.h>
+
+// Hashes everything about a PDF page that decides how it renders: its boxes, rotation, user unit,
+// transparency group, raw content streams, the objects its resources refer to and its annotations
+// with their appearance states and field values. Pages with the same digest render to the same
+// image. Returns false, without throwing, when the page can't be fingerprinted.
+bool fingerprint_page(fz_context *ctx, fz_document *doc, int page_num, unsigned char digest[16]);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "main.h"
+
+#include <mupdf/fitz.h>
+
+// What a session renders pages with, see new_render_profile. The default is what pages were
+// always rendered with: black and white at 432 DPI.
+struct RenderProfile
+{
+    int mode = MODE_BILEVEL;
+    float scale = 6.0f;  // 432 DPI
+    int threshold = 128; // Gray samples above this become white, everything else black
+
+    fz_matrix ctm() const
+    {
+        return fz_scale(scale, scale);
+    }
+};
+
+// What each RenderMode does, fixed at compile time so the kernels that differ by mode are
+// instantiated once per mode instead of checking it for every pixel, see with_mode.
+template <int Mode>
+struct ModeTraits;
+
+template <>
+struct ModeTraits<MODE_BILEVEL>
+{
+    // Every edge is thresholded right after it's drawn, so anti-aliasing it is wasted work.
+    static constexpr int aa_level = 0;
+    static constexpr bool thresholded = true;
+};
+
+template <>
+struct ModeTraits<MODE_GRAY>
+{
+    static constexpr int aa_level = 8;
+    static constexpr bool thresholded = false;
+};
+
+// Calls kernel with the ModeTraits of mode, which picks the instantiation once per call.
+template <typename Kernel>
+auto with_mode(int mode, Kernel &&kernel)
+{
+    if (mode == MODE_GRAY)
+        return kernel(ModeTraits<MODE_GRAY>{});
+    return kernel(ModeTraits<MODE_BILEVEL>{});
+}
+
+inline int mode_aa_level(int mode)
+{
+    return with_mode(mode, [](auto traits) { return decltype(traits)::aa_level; });
+}
+
+inline bool mode_thresholded(int mode)
+{
+    return with_mode(mode, [](auto traits) { return decltype(traits)::thresholded; });
+}
@@ -0,0 +1,364 @@
+#include "source.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// Paths come from Rust as UTF-8, the ANSI file APIs would mangle anything outside the code page.
+static std::wstring widen(const std::string &path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    if (length <= 0)
+    {
+        throw std::runtime_error("Failed to open document at path " + path);
+    }
+
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, wide.data(), length);
+    return wide;
+}
+
+static void map_file(const std::string &path, DocumentSource *source)
+{
+    HANDLE file = CreateFileW(widen(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Failed to open document at path " + path);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        throw std::runtime_error(std::format("Failed to map document at path {}: empty or unreadable file", path));
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error(std::format("Failed to map document at path {}: error {}", path, GetLastError()));
+    }
+
+    source->data = (const unsigned char *)view;
+    source->size = (size_t)size.QuadPart;
+    source->file = file;
+    source->mapping = mapping;
+    source->mapped = true;
+}
+
+static void unmap_file(DocumentSource *source)
+{
+    UnmapViewOfFile(source->data);
+    CloseHandle((HANDLE)source->mapping);
+    CloseHandle((HANDLE)source->file);
+}
+#else
+static void map_file(const std::string &path, DocumentSource *source)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open document at path " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error(std::format("Failed to map document at path {}: empty or unreadable file", path));
+    }
+
+    void *view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file alive, the descriptor isn't needed anymore.
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        throw std::runtime_error(std::format("Failed to map document at path {}", path));
+    }
+
+    // Objects are looked up all over the file through the xref, not read front to back.
+    madvise(view, (size_t)info.st_size, MADV_RANDOM);
+
+    source->data = (const unsigned char *)view;
+    source->size = (size_t)info.st_size;
+    source->mapped = true;
+}
+
+static void unmap_file(DocumentSource *source)
+{
+    munmap((void *)source->data, source->size);
+}
+#endif
+
+static void load_file(const std::string &path, DocumentSource *source)
+{
+    std::ifstream file(path, std::ifstream::ate | std::ifstream::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Failed to open document at path " + path);
+    }
+
+    std::streamoff size = file.tellg();
+    if (size <= 0)
+    {
+        throw std::runtime_error(std::format("Failed to load document at path {}: empty or unreadable file", path));
+    }
+
+    source->bytes.resize((size_t)size);
+    file.seekg(0);
+    if (!file.read((char *)source->bytes.data(), size))
+    {
+        throw std::runtime_error(std::format("Failed to load document at path {}", path));
+    }
+
+    source->data = source->bytes.data();
+    source->size = source->bytes.size();
+}
+
+// Sources are only handed out once they are set up, a throw on the way frees them. map_file sets
+// mapped last, so a source freed this way never has a mapping to undo.
+DocumentSource *open_document_source(const std::string &path, bool map)
+{
+    std::unique_ptr<DocumentSource> source = std::make_unique<DocumentSource>();
+
+    if (map)
+    {
+        map_file(path, source.get());
+    }
+    else
+    {
+        load_file(path, source.get());
+    }
+
+    return source.release();
+}
+
+DocumentSource *new_progressive_source(size_t size)
+{
+    if (size == 0)
+    {
+        throw std::runtime_error("Can't open a progressive document source of 0 bytes");
+    }
+
+    std::unique_ptr<DocumentSource> source = std::make_unique<DocumentSource>();
+    source->bytes.resize(size);
+    source->data = source->bytes.data();
+    source->size = size;
+    source->progressive = true;
+    return source.release();
+}
+
+void close_document_source(DocumentSource *source)
+{
+    if (!source)
+    {
+        return;
+    }
+
+    if (source->mapped)
+    {
+        unmap_file(source);
+    }
+
+    delete source;
+}
+
+// Bytes received from offset on without a gap. Called with the source's mutex held.
+static size_t received_run(const DocumentSource *source, size_t offset)
+{
+    auto it = source->received.upper_bound(offset);
+    if (it == source->received.begin())
+        return 0;
+
+    --it;
+    return it->second > offset ? it->second - offset : 0;
+}
+
+// Marks [start, end) received, merging it with every range it touches. Called with the source's mutex held.
+static void mark_received(DocumentSource *source, size_t start, size_t end)
+{
+    auto it = source->received.upper_bound(start);
+    if (it != source->received.begin() && std::prev(it)->second >= start)
+        --it;
+
+    while (it != source->received.end() && it->first <= end)
+    {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        source->received_bytes -= it->second - it->first;
+        it = source->received.erase(it);
+    }
+
+    source->received.emplace(start, end);
+    source->received_bytes += end - start;
+}
+
+void feed_document_source(DocumentSource *source, size_t offset, const unsigned char *data, size_t size)
+{
+    if (!source->progressive)
+    {
+        throw std::runtime_error("Only progressive document sources can be fed");
+    }
+
+    if (offset > source->size || size > source->size - offset)
+    {
+        throw std::runtime_error(std::format("Bytes {} to {} are past the end of the {} byte document", offset,
+                                             offset + size, source->size));
+    }
+
+    if (size == 0)
+        return;
+
+    size_t end = offset + size;
+    {
+        std::lock_guard<std::mutex> lock(source->mutex);
+
+        // Only the gaps are written, since received bytes are read without the lock.
+        size_t pos = offset;
+        while (pos < end)
+        {
+            size_t run = received_run(source, pos);
+            if (run > 0)
+            {
+                pos = std::min(end, pos + run);
+                continue;
+            }
+
+            auto next = source->received.upper_bound(pos);
+            size_t gap_end = next == source->received.end() ? end : std::min(end, next->first);
+            std::memcpy(source->bytes.data() + pos, data + (pos - offset), gap_end - pos);
+            pos = gap_end;
+        }
+
+        mark_received(source, offset, end);
+    }
+    source->fed.notify_all();
+}
+
+size_t wait_document_source(DocumentSource *source, size_t seen, int timeout_ms)
+{
+    if (!source->progressive)
+        return source->size;
+
+    std::unique_lock<std::mutex> lock(source->mutex);
+    source->fed.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+        return source->received_bytes > seen || source->received_bytes == source->size || source->abandoned;
+    });
+    return source->received_bytes;
+}
+
+size_t source_received(DocumentSource *source)
+{
+    if (!source->progressive)
+        return source->size;
+
+    std::lock_guard<std::mutex> lock(source->mutex);
+    return source->received_bytes;
+}
+
+size_t take_wanted_offset(DocumentSource *source)
+{
+    std::lock_guard<std::mutex> lock(source->mutex);
+    size_t wanted = source->wanted;
+    source->wanted = SIZE_MAX;
+    return wanted;
+}
+
+bool source_pending(DocumentSource *source)
+{
+    if (!source->progressive)
+        return false;
+
+    std::lock_guard<std::mutex> lock(source->mutex);
+    return source->received_bytes < source->size && !source->abandoned;
+}
+
+void abandon_document_source(DocumentSource *source)
+{
+    {
+        std::lock_guard<std::mutex> lock(source->mutex);
+        source->abandoned = true;
+    }
+    source->fed.notify_all();
+}
+
+// Hands out the received run at the stream's position, which is where the last one ended.
+static int next_progressive(fz_context *ctx, fz_stream *stm, size_t)
+{
+    DocumentSource *source = (DocumentSource *)stm->state;
+    size_t offset = (size_t)stm->pos;
+    if (offset >= source->size)
+        return EOF;
+
+    size_t run = 0;
+    bool abandoned = false;
+    {
+        std::lock_guard<std::mutex> lock(source->mutex);
+        run = received_run(source, offset);
+        if (run == 0)
+        {
+            source->wanted = std::min(source->wanted, offset);
+            abandoned = source->abandoned;
+        }
+    }
+
+    // Thrown once the lock is released, fz_throw leaves with longjmp.
+    if (run == 0 && abandoned)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "The document stopped arriving before byte %zu", offset);
+    if (run == 0)
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "Byte %zu of the document hasn't arrived yet", offset);
+
+    stm->rp = (unsigned char *)source->data + offset;
+    stm->wp = stm->rp + run;
+    stm->pos += (int64_t)run;
+    return *stm->rp++;
+}
+
+// Only moves the position, so seeking to the end of a file that hasn't arrived works.
+static void seek_progressive(fz_context *, fz_stream *stm, int64_t offset, int whence)
+{
+    DocumentSource *source = (DocumentSource *)stm->state;
+    if (whence == SEEK_END)
+        offset += (int64_t)source->size;
+    else if (whence == SEEK_CUR)
+        offset += stm->pos - (stm->wp - stm->rp);
+
+    offset = std::clamp<int64_t>(offset, 0, (int64_t)source->size);
+    stm->rp = stm->wp = (unsigned char *)source->data + offset;
+    stm->pos = offset;
+}
+
+// The source outlives every document opened over it, the stream only borrows it.
+static void drop_progressive(fz_context *, void *)
+{
+}
+
+fz_stream *open_progressive_stream(fz_context *ctx, DocumentSource *source)
+{
+    fz_stream *stm = fz_new_stream(ctx, source, next_progressive, drop_progressive);
+    stm->seek = seek_progressive;
+    stm->progressive = 1;
+    return stm;
+}
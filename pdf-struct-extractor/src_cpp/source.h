@@ -0,0 +1,66 @@
+#pragma once
+
+#include <mupdf/fitz.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Read-only bytes of a PDF file, read from disk once and shared by every document
+// opened over them with fz_open_memory. Must outlive all of those documents.
+//
+// A progressive source starts out empty and is filled by feed_document_source as the
+// file arrives, in any order. bytes is sized for the whole file up front and never moves,
+// so a range marked received is read without locking.
+struct DocumentSource
+{
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    // File contents when loaded into memory instead of mapped.
+    std::vector<unsigned char> bytes;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#endif
+    bool mapped = false;
+
+    bool progressive = false;
+    std::mutex mutex;
+    std::condition_variable fed;
+    // Start to end of every received range, disjoint and merged when they touch.
+    std::map<size_t, size_t> received;
+    size_t received_bytes = 0;
+    // Lowest offset a reader was turned away at since it was last taken, SIZE_MAX for none.
+    size_t wanted = SIZE_MAX;
+    // Set once the rest of the file won't come, readers then fail instead of waiting.
+    bool abandoned = false;
+};
+
+// Maps the file read-only (map = true) or reads it whole into memory.
+// Throws std::runtime_error when the file can't be opened or read.
+DocumentSource *open_document_source(const std::string &path, bool map);
+// An empty progressive source for a file of size bytes.
+DocumentSource *new_progressive_source(size_t size);
+void close_document_source(DocumentSource *source);
+
+// Copies size bytes of the file at offset into a progressive source and wakes its waiters.
+void feed_document_source(DocumentSource *source, size_t offset, const unsigned char *data, size_t size);
+// Blocks until a progressive source has received more than seen bytes, won't receive any more,
+// or timeout_ms passed. Returns how many bytes it has received.
+size_t wait_document_source(DocumentSource *source, size_t seen, int timeout_ms);
+// Bytes a progressive source has received, the whole size for any other source.
+size_t source_received(DocumentSource *source);
+// Takes the lowest offset a reader was turned away at since the last call, SIZE_MAX for none.
+size_t take_wanted_offset(DocumentSource *source);
+// Whether a progressive source still expects bytes: it is neither complete nor abandoned.
+bool source_pending(DocumentSource *source);
+void abandon_document_source(DocumentSource *source);
+
+// A stream over a progressive source flagged as progressive, so MuPDF reads linearized files
+// front to back. Reading bytes the source hasn't received yet throws FZ_ERROR_TRYLATER and
+// records the offset for take_wanted_offset. Runs inside the caller's fz_try.
+fz_stream *open_progressive_stream(fz_context *ctx, DocumentSource *source);
@@ -0,0 +1,89 @@
+#include "stats.h"
+
+#include <bit>
+#include <stdexcept>
+
+static int bucket_of(uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : (int)std::bit_width(ns) - 1;
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+void RenderStats::record(const PageStats &page)
+{
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        if (!(page.stages & (1 << stage)))
+            continue;
+
+        Stage &histogram = stages[stage];
+        uint64_t ns = page.stage_ns[stage];
+
+        histogram.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        histogram.count.fetch_add(1, std::memory_order_relaxed);
+        histogram.total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t max = histogram.max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !histogram.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    pages.fetch_add(1, std::memory_order_relaxed);
+    sample_bytes.fetch_add(page.sample_bytes, std::memory_order_relaxed);
+    output_bytes.fetch_add(page.output_bytes, std::memory_order_relaxed);
+}
+
+void new_render_stats(PDFHandle *stats_handle)
+{
+    if (stats_handle == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    *stats_handle = (PDFHandle) new RenderStats();
+}
+
+void read_render_stats(uint64_t *buckets_buf, uint64_t *counts_buf, uint64_t *total_ns_buf, uint64_t *max_ns_buf,
+                       uint64_t *totals_buf, PDFHandle *stats_handle)
+{
+    if (!stats_handle || !*stats_handle)
+    {
+        throw std::runtime_error("Invalid render stats handle");
+    }
+
+    if (buckets_buf == nullptr || counts_buf == nullptr || total_ns_buf == nullptr || max_ns_buf == nullptr ||
+        totals_buf == nullptr)
+    {
+        throw std::runtime_error("Passed nullptr for a buffer!");
+    }
+
+    RenderStats *stats = (RenderStats *)(*stats_handle);
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        const RenderStats::Stage &histogram = stats->stages[stage];
+        for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+        {
+            buckets_buf[stage * STATS_BUCKETS + bucket] = histogram.buckets[bucket].load(std::memory_order_relaxed);
+        }
+        counts_buf[stage] = histogram.count.load(std::memory_order_relaxed);
+        total_ns_buf[stage] = histogram.total_ns.load(std::memory_order_relaxed);
+        max_ns_buf[stage] = histogram.max_ns.load(std::memory_order_relaxed);
+    }
+
+    totals_buf[0] = stats->pages.load(std::memory_order_relaxed);
+    totals_buf[1] = stats->sample_bytes.load(std::memory_order_relaxed);
+    totals_buf[2] = stats->output_bytes.load(std::memory_order_relaxed);
+}
+
+void free_render_stats(PDFHandle *stats_handle)
+{
+    if (!stats_handle || !*stats_handle)
+    {
+        return;
+    }
+
+    delete (RenderStats *)(*stats_handle);
+    *stats_handle = nullptr;
+}
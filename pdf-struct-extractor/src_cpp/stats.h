@@ -0,0 +1,61 @@
+#pragma once
+
+#include "main.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Where the time of one rendered page went, see RenderStage in main.h.
+struct PageStats
+{
+    uint64_t stage_ns[STAGE_COUNT] = {};
+    // Bit (1 << stage) per stage the page went through.
+    int stages = 0;
+    size_t sample_bytes = 0;
+    size_t output_bytes = 0;
+};
+
+// Starts timing a stage, for stage_end. Free when stats is null, i.e. collection is off.
+// Plain values rather than a scope guard, since stages run inside fz_try, which leaves
+// scopes with longjmp and skips destructors.
+inline uint64_t stage_start(const PageStats *stats)
+{
+    if (!stats)
+        return 0;
+
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+inline void stage_end(PageStats *stats, int stage, uint64_t start)
+{
+    if (!stats)
+        return;
+
+    stats->stage_ns[stage] += stage_start(stats) - start;
+    stats->stages |= 1 << stage;
+}
+
+// Stage timings of every page rendered by the sessions of one document, as log2 histograms:
+// bucket i counts pages where the stage took [2^i, 2^(i+1)) nanoseconds. Lock-free, every
+// session records into it concurrently.
+struct RenderStats
+{
+    struct Stage
+    {
+        std::atomic<uint64_t> buckets[STATS_BUCKETS] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+    };
+
+    Stage stages[STAGE_COUNT];
+    std::atomic<uint64_t> pages{0};
+    std::atomic<uint64_t> sample_bytes{0};
+    std::atomic<uint64_t> output_bytes{0};
+
+    void record(const PageStats &page);
+};
@@ -99,9 +99,135 @@ where
 pub trait Classify {
     type SharedData: Send + Sync;
 
+    /// What the classifier hands to this type. Types whose key pages are born-digital
+    /// (e.g. a "CHAPTER {num}" heading) can set [ClassifyInput::Text] to be classified
+    /// through [Classify::classify_text] from the page's text layer, which skips rendering.
+    const INPUT: ClassifyInput = ClassifyInput::Image;
+
+    /// The parts of a page [Classify::classify_regions] looks at, e.g. the header band a
+    /// "CHAPTER {num}" heading sits in. Only rendered when [Classify::INPUT] is
+    /// [ClassifyInput::Regions], so classifying a page touches a few percent of its pixels.
+    const REGIONS: &'static [RegionOfInterest] = &[];
+
     fn classify<E>(img: &[u8]) -> ClassificationResult<Self::SharedData, E>
     where
         E: Debug + Display + Error;
+
+    /// Classifies a page from its text layer. Only called when [Classify::INPUT]
+    /// is [ClassifyInput::Text].
+    fn classify_text<E>(_text: &PageText) -> ClassificationResult<Self::SharedData, E>
+    where
+        E: Debug + Display + Error,
+    {
+        panic!(
+            "{} requested text input but doesn't implement Classify::classify_text!",
+            std::any::type_name::<Self>()
+        )
+    }
+
+    /// Classifies a page from renders of its [Classify::REGIONS], in the same order.
+    /// Only called when [Classify::INPUT] is [ClassifyInput::Regions].
+    fn classify_regions<E>(_regions: &[RegionImage]) -> ClassificationResult<Self::SharedData, E>
+    where
+        E: Debug + Display + Error,
+    {
+        panic!(
+            "{} requested region input but doesn't implement Classify::classify_regions!",
+            std::any::type_name::<Self>()
+        )
+    }
+}
+
+/// What [Classify] wants to see of a page.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum ClassifyInput {
+    /// A rendered image of the page, see [Classify::classify].
+    #[default]
+    Image,
+    /// The page's text layer, see [Classify::classify_text].
+    Text,
+    /// Renders of the page's [Classify::REGIONS] only, see [Classify::classify_regions].
+    Regions,
+}
+
+/// A part of a page to render, relative to the page so one declaration fits every page size.
+/// `rect` is `[x0, y0, x1, y1]` in fractions of the page's width and height from its top left
+/// corner, rendered at `scale` (1.0 = 72 DPI).
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct RegionOfInterest {
+    pub rect: [f32; 4],
+    pub scale: f32,
+}
+
+impl RegionOfInterest {
+    pub const fn new(rect: [f32; 4], scale: f32) -> Self {
+        Self { rect, scale }
+    }
+
+    /// The region on a page with these bounds, see [PageInfo::bounds].
+    pub fn on_page(&self, bounds: [f32; 4]) -> PageRegion {
+        let width = bounds[2] - bounds[0];
+        let height = bounds[3] - bounds[1];
+
+        PageRegion {
+            rect: [
+                bounds[0] + self.rect[0] * width,
+                bounds[1] + self.rect[1] * height,
+                bounds[0] + self.rect[2] * width,
+                bounds[1] + self.rect[3] * height,
+            ],
+            scale: self.scale,
+        }
+    }
+}
+
+/// A clip rectangle of a page in points (1/72 inch) as `[x0, y0, x1, y1]`, rendered at `scale`
+/// (1.0 = 72 DPI). Only what the rectangle covers is drawn.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct PageRegion {
+    pub rect: [f32; 4],
+    pub scale: f32,
+}
+
+/// A rendered [PageRegion], see [Classify::classify_regions].
+/// `data` is in the renderer's output format, `stride` bytes per row for raw formats.
+#[derive(Clone, Copy, Debug)]
+pub struct RegionImage<'a> {
+    pub region: PageRegion,
+    pub data: &'a [u8],
+    pub width: i32,
+    pub height: i32,
+    pub stride: usize,
+}
+
+/// The text layer of a page, as structured by the PDF renderer.
+/// Bounding boxes are in points (1/72 inch) as `[x0, y0, x1, y1]`.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct PageText {
+    pub blocks: Vec<TextBlock>,
+}
+
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct TextBlock {
+    pub bbox: [f32; 4],
+    pub lines: Vec<TextLine>,
+}
+
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct TextLine {
+    pub bbox: [f32; 4],
+    pub text: String,
+}
+
+impl PageText {
+    /// Every line of the page, in reading order.
+    pub fn lines(&self) -> impl Iterator<Item = &TextLine> {
+        self.blocks.iter().flat_map(|block| block.lines.iter())
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.blocks.is_empty()
+    }
 }
 
 /// Trait that defines how to construct a page into Self
@@ -149,6 +275,61 @@ impl Extract for () {
     }
 }
 
+/// What a prescan of the document knows about a page before it is rendered.
+/// Cheap enough to gather for every page up front, so work can be planned
+/// (e.g. skipping pages without a text layer) without rasterizing anything.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct PageInfo {
+    /// Page bounds in points (1/72 inch) as `[x0, y0, x1, y1]`, with the page's rotation applied.
+    pub bounds: [f32; 4],
+    /// The page's `/Rotate`, one of 0, 90, 180 or 270.
+    pub rotation: i32,
+    /// Image XObjects available to the page, including those of forms it uses.
+    pub image_count: u32,
+    /// Font resources available to the page, including those of forms it uses.
+    pub font_count: u32,
+    /// Whether the page has a text layer, i.e. its content starts at least one text object.
+    pub has_text: bool,
+}
+
+impl PageInfo {
+    pub fn width(&self) -> f32 {
+        self.bounds[2] - self.bounds[0]
+    }
+
+    pub fn height(&self) -> f32 {
+        self.bounds[3] - self.bounds[1]
+    }
+}
+
+/// How urgently the classifier wants a page, see [RenderScheduler].
+/// Requested pages are rendered before every page nobody asked for, highest priority first.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum RenderPriority {
+    /// Pages inferred from a [Pattern], rendered ahead in case the inference holds.
+    Speculative,
+    /// Pages that decide the document's structure, e.g. the next key candidate.
+    Key,
+}
+
+/// A request made through [RenderScheduler::request], to cancel it with.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct RenderTicket(pub u64);
+
+/// Lets the classifier pull pages out of document order: render the next key candidate now,
+/// prefetch the pages a pattern infers after it, and drop that prefetch once the inference is
+/// proven wrong. Every page is still rendered once, pages nobody asked for go in page order.
+pub trait RenderScheduler: Send + Sync {
+    /// Asks for `page` to be rendered at `priority`. A page that was already rendered, or is
+    /// being rendered, isn't rendered again in the same run, the request waits for the next.
+    fn request(&self, page: i32, priority: RenderPriority) -> RenderTicket;
+
+    /// Withdraws a request. Once nothing wants its page any more a page that hasn't started is
+    /// put back in page order, and one already rendering is aborted and put back. Returns false
+    /// when the request was already served or withdrawn.
+    fn cancel(&self, ticket: RenderTicket) -> bool;
+}
+
 #[derive(Clone, PartialEq, Eq)]
 pub struct TypeInformation {
     pub id: TypeId,